@@ -120,7 +120,8 @@ Awh::Awh(FILE                 *fplog,
          const gmx_multisim_t *multiSimRecord,
          const AwhParams      &awhParams,
          const std::string    &biasInitFilename,
-         pull_t               *pull_work) :
+         pull_t               *pull_work,
+         bool                  shareFullGrid) :
     seed_(awhParams.seed),
     nstout_(awhParams.nstOut),
     commRecord_(commRecord),
@@ -169,8 +170,9 @@ Awh::Awh(FILE                 *fplog,
         }
 
         /* Construct the bias and couple it to the system. */
-        Bias::ThisRankWillDoIO thisRankWillDoIO = (MASTER(commRecord_) ? Bias::ThisRankWillDoIO::Yes : Bias::ThisRankWillDoIO::No);
-        biasCoupledToSystem_.emplace_back(Bias(k, awhParams, awhParams.awhBiasParams[k], dimParams, beta, inputRecord.delta_t, numSharingSimulations, biasInitFilename, thisRankWillDoIO),
+        Bias::ThisRankWillDoIO   thisRankWillDoIO = (MASTER(commRecord_) ? Bias::ThisRankWillDoIO::Yes : Bias::ThisRankWillDoIO::No);
+        BiasState::ShareFullGrid shareMode        = (shareFullGrid ? BiasState::ShareFullGrid::yes : BiasState::ShareFullGrid::no);
+        biasCoupledToSystem_.emplace_back(Bias(k, awhParams, awhParams.awhBiasParams[k], dimParams, beta, inputRecord.delta_t, numSharingSimulations, biasInitFilename, thisRankWillDoIO, BiasParams::DisableUpdateSkips::no, shareMode),
                                           pullCoordIndex);
 
         biasCoupledToSystem_.back().bias.printInitializationToLog(fplog);
@@ -122,6 +122,7 @@ class Awh
          * \param[in]     awhParams         AWH input parameters, consistent with the relevant parts of \p inputRecord (as set up by grompp).
          * \param[in]     biasInitFilename  Name of file to read PMF and target from.
          * \param[in,out] pull_work         Pointer to a pull struct which AWH will couple to, has to be initialized, is assumed not to change during the lifetime of the Awh object.
+         * \param[in]     shareFullGrid     If to sum the data of all points when sharing biases between simulations, only used as a reference for testing.
          */
         Awh(FILE                 *fplog,
             const t_inputrec     &inputRecord,
@@ -129,7 +130,8 @@ class Awh
             const gmx_multisim_t *multiSimRecord,
             const AwhParams      &awhParams,
             const std::string    &biasInitFilename,
-            pull_t               *pull_work);
+            pull_t               *pull_work,
+            bool                  shareFullGrid = false);
 
         /*! \brief Destructor. */
         ~Awh();
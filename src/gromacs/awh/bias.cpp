@@ -263,11 +263,12 @@ Bias::Bias(int                             biasIndexInCollection,
            int                             numSharingSimulations,
            const std::string              &biasInitFilename,
            ThisRankWillDoIO                thisRankWillDoIO,
-           BiasParams::DisableUpdateSkips  disableUpdateSkips) :
+           BiasParams::DisableUpdateSkips  disableUpdateSkips,
+           BiasState::ShareFullGrid        shareFullGrid) :
     dimParams_(dimParamsInit),
     grid_(dimParamsInit, awhBiasParams.dimParams),
     params_(awhParams, awhBiasParams, dimParams_, beta, mdTimeStep, disableUpdateSkips, numSharingSimulations, grid_.axis(), biasIndexInCollection),
-    state_(awhBiasParams, params_.initialHistogramSize, dimParams_, grid_),
+    state_(awhBiasParams, params_.initialHistogramSize, dimParams_, grid_, shareFullGrid),
     thisRankDoesIO_(thisRankWillDoIO == ThisRankWillDoIO::Yes),
     biasForce_(ndim()),
     alignedTempWorkSpace_(),
@@ -162,6 +162,7 @@ class Bias
          * \param[in] biasInitFilename       Name of file to read PMF and target from.
          * \param[in] thisRankWillDoIO       Tells whether this MPI rank will do I/O (checkpointing, AWH output), normally (only) the master rank does I/O.
          * \param[in] disableUpdateSkips     If to disable update skips, useful for testing.
+         * \param[in] shareFullGrid          If to sum the data of all points when sharing, useful for testing.
          */
         Bias(int                             biasIndexInCollection,
              const AwhParams                &awhParams,
@@ -172,7 +173,8 @@ class Bias
              int                             numSharingSimulations,
              const std::string              &biasInitFilename,
              ThisRankWillDoIO                thisRankWillDoIO,
-             BiasParams::DisableUpdateSkips  disableUpdateSkips = BiasParams::DisableUpdateSkips::no);
+             BiasParams::DisableUpdateSkips  disableUpdateSkips = BiasParams::DisableUpdateSkips::no,
+             BiasState::ShareFullGrid        shareFullGrid = BiasState::ShareFullGrid::no);
 
         /*! \brief
          * Print information about initialization to log file.
@@ -59,6 +59,7 @@
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/math/utilities.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdtypes/awh-history.h"
 #include "gromacs/mdtypes/awh-params.h"
 #include "gromacs/mdtypes/commrec.h"
@@ -76,6 +77,33 @@
 namespace gmx
 {
 
+namespace
+{
+
+/*! \brief The minimum number of points for which a loop over points is threaded.
+ *
+ * Most loops over points do one or a few exp() or log() calls per point,
+ * so for fewer points the OpenMP overhead is larger than the gain.
+ */
+constexpr int c_minNumPointsForThreading = 1000;
+
+/*! \brief
+ * Returns the number of OpenMP threads to use for a loop over points.
+ *
+ * \param[in] numPoints  The number of points in the loop.
+ */
+int numThreadsForPointLoop(size_t numPoints)
+{
+    if (numPoints < c_minNumPointsForThreading)
+    {
+        return 1;
+    }
+    /* The gmx_omp_nthreads module might not be initialized, so max(1,) */
+    return std::max(1, gmx_omp_nthreads_get(emntDefault));
+}
+
+}   // namespace
+
 void BiasState::getPmf(gmx::ArrayRef<float> pmf) const
 {
     GMX_ASSERT(pmf.size() == points_.size(), "pmf should have the size of the bias grid");
@@ -104,18 +132,6 @@ void sumOverSimulations(gmx::ArrayRef<int>    arrayRef,
     gmx_sumi_sim(arrayRef.size(), arrayRef.data(), multiSimComm);
 }
 
-/*! \brief
- * Sum an array over all simulations on the master rank of each simulation.
- *
- * \param[in,out] arrayRef      The data to sum.
- * \param[in]     multiSimComm  Struct for multi-simulation communication.
- */
-void sumOverSimulations(gmx::ArrayRef<double> arrayRef,
-                        const gmx_multisim_t *multiSimComm)
-{
-    gmx_sumd_sim(arrayRef.size(), arrayRef.data(), multiSimComm);
-}
-
 /*! \brief
  * Sum an array over all simulations on all ranks of each simulation.
  *
@@ -141,43 +157,49 @@ void sumOverSimulations(gmx::ArrayRef<T>      arrayRef,
 }
 
 /*! \brief
- * Sum PMF over multiple simulations, when requested.
+ * Start a non-blocking sum of an array over all simulations.
+ *
+ * The sum is only performed on the master rank of each simulation.
+ * The data should not be accessed until finishSumOverSimulations()
+ * has returned.
  *
- * \param[in,out] pointState         The state of the points in the bias.
- * \param[in]     numSharedUpdate    The number of biases sharing the histogram.
- * \param[in]     commRecord         Struct for intra-simulation communication.
- * \param[in]     multiSimComm       Struct for multi-simulation communication.
+ * \param[in,out] arrayRef      The data to sum.
+ * \param[in]     commRecord    Struct for intra-simulation communication.
+ * \param[in]     multiSimComm  Struct for multi-simulation communication.
+ * \param[out]    request       The request to pass to finishSumOverSimulations().
  */
-void sumPmf(gmx::ArrayRef<PointState>  pointState,
-            int                        numSharedUpdate,
-            const t_commrec           *commRecord,
-            const gmx_multisim_t      *multiSimComm)
+void startSumOverSimulations(gmx::ArrayRef<double>  arrayRef,
+                             const t_commrec       *commRecord,
+                             const gmx_multisim_t  *multiSimComm,
+                             gmx_sumd_request_t    *request)
 {
-    if (numSharedUpdate == 1)
+    if (MASTER(commRecord))
     {
-        return;
+        gmx_sumd_sim_start(arrayRef.size(), arrayRef.data(), multiSimComm, request);
     }
-    GMX_ASSERT(multiSimComm != nullptr && numSharedUpdate % multiSimComm->nsim == 0, "numSharedUpdate should be a multiple of multiSimComm->nsim");
-    GMX_ASSERT(numSharedUpdate == multiSimComm->nsim, "Sharing within a simulation is not implemented (yet)");
-
-    std::vector<double> buffer(pointState.size());
+}
 
-    /* Need to temporarily exponentiate the log weights to sum over simulations */
-    for (size_t i = 0; i < buffer.size(); i++)
+/*! \brief
+ * Finish a sum started with startSumOverSimulations().
+ *
+ * This assumes the data is identical on all ranks within each simulation.
+ * On return, all ranks of each simulation have the sum.
+ *
+ * \param[in,out] arrayRef      The data to sum.
+ * \param[in]     commRecord    Struct for intra-simulation communication.
+ * \param[in,out] request       The request returned by startSumOverSimulations().
+ */
+void finishSumOverSimulations(gmx::ArrayRef<double>  arrayRef,
+                              const t_commrec       *commRecord,
+                              gmx_sumd_request_t    *request)
+{
+    if (MASTER(commRecord))
     {
-        buffer[i] = pointState[i].inTargetRegion() ? std::exp(-pointState[i].logPmfSum()) : 0;
+        gmx_sumd_sim_wait(request);
     }
-
-    sumOverSimulations(gmx::ArrayRef<double>(buffer), commRecord, multiSimComm);
-
-    /* Take log again to get (non-normalized) PMF */
-    double normFac = 1.0/numSharedUpdate;
-    for (size_t i = 0; i < pointState.size(); i++)
+    if (commRecord->nnodes > 1)
     {
-        if (pointState[i].inTargetRegion())
-        {
-            pointState[i].setLogPmfSum(-std::log(buffer[i]*normFac));
-        }
+        gmx_bcast(arrayRef.size()*sizeof(double), arrayRef.data(), commRecord);
     }
 }
 
@@ -256,26 +278,35 @@ void BiasState::calcConvolvedPmf(const std::vector<DimParams>  &dimParams,
     std::vector<float> pmf(numPoints);
     getPmf(pmf);
 
+    /* The convolution of each point only reads the PMF of its neighbors,
+     * so we can process the points in parallel.
+     */
+    const int numThreads = numThreadsForPointLoop(numPoints);
+#pragma omp parallel for num_threads(numThreads) schedule(static)
     for (size_t m = 0; m < numPoints; m++)
     {
-        double           freeEnergyWeights = 0;
-        const GridPoint &point             = grid.point(m);
-        for (auto &neighbor : point.neighbor)
+        try
         {
-            /* The negative PMF is a positive bias. */
-            double biasNeighbor = -pmf[neighbor];
-
-            /* Add the convolved PMF weights for the neighbors of this point.
-               Note that this function only adds point within the target > 0 region.
-               Sum weights, take the logarithm last to get the free energy. */
-            double logWeight   = biasedLogWeightFromPoint(dimParams, points_, grid,
-                                                          neighbor, biasNeighbor,
-                                                          point.coordValue);
-            freeEnergyWeights += std::exp(logWeight);
-        }
+            double           freeEnergyWeights = 0;
+            const GridPoint &point             = grid.point(m);
+            for (auto &neighbor : point.neighbor)
+            {
+                /* The negative PMF is a positive bias. */
+                double biasNeighbor = -pmf[neighbor];
+
+                /* Add the convolved PMF weights for the neighbors of this point.
+                   Note that this function only adds point within the target > 0 region.
+                   Sum weights, take the logarithm last to get the free energy. */
+                double logWeight   = biasedLogWeightFromPoint(dimParams, points_, grid,
+                                                              neighbor, biasNeighbor,
+                                                              point.coordValue);
+                freeEnergyWeights += std::exp(logWeight);
+            }
 
-        GMX_RELEASE_ASSERT(freeEnergyWeights > 0, "Attempting to do log(<= 0) in AWH convolved PMF calculation.");
-        (*convolvedPmf)[m] = -std::log(static_cast<float>(freeEnergyWeights));
+            GMX_RELEASE_ASSERT(freeEnergyWeights > 0, "Attempting to do log(<= 0) in AWH convolved PMF calculation.");
+            (*convolvedPmf)[m] = -std::log(static_cast<float>(freeEnergyWeights));
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
     }
 }
 
@@ -300,18 +331,31 @@ void updateTargetDistribution(gmx::ArrayRef<PointState>  pointState,
         freeEnergyCutoff = freeEnergyMinimumValue(pointState) + params.freeEnergyCutoffInKT;
     }
 
+    const int numPoints  = pointState.size();
+    const int numThreads = numThreadsForPointLoop(numPoints);
+
+    /* Update the targets in parallel, but sum them in a fixed order
+     * to get results independent of the number of threads.
+     */
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
+    {
+        pointState[m].updateTargetWeight(params, freeEnergyCutoff);
+    }
+
     double sumTarget = 0;
-    for (PointState &ps : pointState)
+    for (const PointState &ps : pointState)
     {
-        sumTarget += ps.updateTargetWeight(params, freeEnergyCutoff);
+        sumTarget += ps.target();
     }
     GMX_RELEASE_ASSERT(sumTarget > 0, "We should have a non-zero distribution");
 
     /* Normalize to 1 */
     double invSum = 1.0/sumTarget;
-    for (PointState &ps : pointState)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
     {
-        ps.scaleTarget(invSum);
+        pointState[m].scaleTarget(invSum);
     }
 }
 
@@ -577,9 +621,16 @@ void BiasState::doSkippedUpdatesForAllPoints(const BiasParams &params)
 
     getSkippedUpdateHistogramScaleFactors(params, &weightHistScaling, &logPmfsumScaling);
 
-    for (auto &pointState : points_)
+    const int         numPoints  = points_.size();
+    const int         numThreads = numThreadsForPointLoop(numPoints);
+    const gmx_int64_t numUpdates = histogramSize_.numUpdates();
+
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
     {
-        bool didUpdate = pointState.performPreviouslySkippedUpdates(params, histogramSize_.numUpdates(), weightHistScaling, logPmfsumScaling);
+        PointState &pointState = points_[m];
+
+        bool        didUpdate  = pointState.performPreviouslySkippedUpdates(params, numUpdates, weightHistScaling, logPmfsumScaling);
 
         /* Update the bias for this point only if there were skipped updates in the past to avoid calculating the log unneccessarily */
         if (didUpdate)
@@ -614,7 +665,56 @@ namespace
 {
 
 /*! \brief
- * Merge update lists from multiple sharing simulations.
+ * Generate an update list of points sampled since the last update.
+ *
+ * \param[in] grid              The AWH bias.
+ * \param[in] points            The point state.
+ * \param[in] originUpdatelist  The origin of the rectangular region that has been sampled since last update.
+ * \param[in] endUpdatelist     The end of the rectangular that has been sampled since last update.
+ * \param[in,out] updateList    Local update list to set (assumed >= npoints long).
+ */
+void makeLocalUpdateList(const Grid                    &grid,
+                         const std::vector<PointState> &points,
+                         const awh_ivec                 originUpdatelist,
+                         const awh_ivec                 endUpdatelist,
+                         std::vector<int>              *updateList)
+{
+    awh_ivec origin;
+    awh_ivec numPoints;
+
+    /* Define the update search grid */
+    for (int d = 0; d < grid.numDimensions(); d++)
+    {
+        origin[d]    = originUpdatelist[d];
+        numPoints[d] = endUpdatelist[d] - originUpdatelist[d] + 1;
+
+        /* Because the end_updatelist is unwrapped it can be > (npoints - 1) so that numPoints can be > npoints in grid.
+           This helps for calculating the distance/number of points but should be removed and fixed when the way of
+           updating origin/end updatelist is changed (see sampleProbabilityWeights). */
+        numPoints[d] = std::min(grid.axis(d).numPoints(), numPoints[d]);
+    }
+
+    /* Make the update list */
+    updateList->clear();
+    int  pointIndex  = -1;
+    bool pointExists = true;
+    while (pointExists)
+    {
+        pointExists = advancePointInSubgrid(grid, origin, numPoints, &pointIndex);
+
+        if (pointExists && points[pointIndex].inTargetRegion())
+        {
+            updateList->push_back(pointIndex);
+        }
+    }
+}
+
+/*! \brief
+ * Merge update lists from multiple sharing simulations by summing flags for all points.
+ *
+ * This communicates data for the whole grid. makeSharedUpdateList()
+ * gives the same list with much less communication, this function
+ * is only used as a reference, see BiasState::ShareFullGrid.
  *
  * \param[in,out] updateList    Update list for this simulation (assumed >= npoints long).
  * \param[in]     numPoints     Total number of points.
@@ -628,8 +728,7 @@ void mergeSharedUpdateLists(std::vector<int>     *updateList,
 {
     std::vector<int> numUpdatesOfPoint;
 
-    /* Flag the update points of this sim.
-       TODO: we can probably avoid allocating this array and just use the input array. */
+    /* Flag the update points of this sim */
     numUpdatesOfPoint.resize(numPoints, 0);
     for (auto &pointIndex : *updateList)
     {
@@ -651,48 +750,57 @@ void mergeSharedUpdateLists(std::vector<int>     *updateList,
 }
 
 /*! \brief
- * Generate an update list of points sampled since the last update.
+ * Generate the update list of points sampled by any of the sharing simulations.
+ *
+ * Instead of exchanging flags for all points, only the corners of
+ * the rectangular update region of each simulation are exchanged.
+ * The update list is the union of the update lists of these regions.
  *
  * \param[in] grid              The AWH bias.
  * \param[in] points            The point state.
  * \param[in] originUpdatelist  The origin of the rectangular region that has been sampled since last update.
  * \param[in] endUpdatelist     The end of the rectangular that has been sampled since last update.
- * \param[in,out] updateList    Local update list to set (assumed >= npoints long).
+ * \param[in] commRecord        Struct for intra-simulation communication.
+ * \param[in] multiSimComm      Struct for multi-simulation communication.
+ * \param[in,out] updateList    Update list to set.
  */
-void makeLocalUpdateList(const Grid                    &grid,
-                         const std::vector<PointState> &points,
-                         const awh_ivec                 originUpdatelist,
-                         const awh_ivec                 endUpdatelist,
-                         std::vector<int>              *updateList)
+void makeSharedUpdateList(const Grid                    &grid,
+                          const std::vector<PointState> &points,
+                          const awh_ivec                 originUpdatelist,
+                          const awh_ivec                 endUpdatelist,
+                          const t_commrec               *commRecord,
+                          const gmx_multisim_t          *multiSimComm,
+                          std::vector<int>              *updateList)
 {
-    awh_ivec origin;
-    awh_ivec numPoints;
+    const int        numDim = grid.numDimensions();
+    const int        numSim = multiSimComm->nsim;
 
-    /* Define the update search grid */
-    for (int d = 0; d < grid.numDimensions(); d++)
+    /* Collect the origin and end of the update regions of all simulations */
+    std::vector<int> regions(numSim*2*numDim, 0);
+    int             *origin = &regions[(multiSimComm->sim*2    )*numDim];
+    int             *end    = &regions[(multiSimComm->sim*2 + 1)*numDim];
+    for (int d = 0; d < numDim; d++)
     {
-        origin[d]    = originUpdatelist[d];
-        numPoints[d] = endUpdatelist[d] - originUpdatelist[d] + 1;
-
-        /* Because the end_updatelist is unwrapped it can be > (npoints - 1) so that numPoints can be > npoints in grid.
-           This helps for calculating the distance/number of points but should be removed and fixed when the way of
-           updating origin/end updatelist is changed (see sampleProbabilityWeights). */
-        numPoints[d] = std::min(grid.axis(d).numPoints(), numPoints[d]);
+        origin[d] = originUpdatelist[d];
+        end[d]    = endUpdatelist[d];
     }
+    sumOverSimulations(gmx::ArrayRef<int>(regions), commRecord, multiSimComm);
 
-    /* Make the update list */
+    /* Merge the lists of all regions, regions of different simulations
+     * will often overlap, so we need to remove duplicates.
+     */
     updateList->clear();
-    int  pointIndex  = -1;
-    bool pointExists = true;
-    while (pointExists)
+    std::vector<int> regionUpdateList;
+    for (int sim = 0; sim < numSim; sim++)
     {
-        pointExists = advancePointInSubgrid(grid, origin, numPoints, &pointIndex);
-
-        if (pointExists && points[pointIndex].inTargetRegion())
-        {
-            updateList->push_back(pointIndex);
-        }
+        makeLocalUpdateList(grid, points,
+                            &regions[(sim*2    )*numDim],
+                            &regions[(sim*2 + 1)*numDim],
+                            &regionUpdateList);
+        updateList->insert(updateList->end(), regionUpdateList.begin(), regionUpdateList.end());
     }
+    std::sort(updateList->begin(), updateList->end());
+    updateList->erase(std::unique(updateList->begin(), updateList->end()), updateList->end());
 }
 
 }   // namespace
@@ -712,69 +820,75 @@ namespace
 {
 
 /*! \brief
- * Add partial histograms (accumulating between updates) to accumulating histograms.
+ * Start summing the partial histograms and the PMF over the sharing simulations.
+ *
+ * Only the data for the points in the update list, i.e. the points that
+ * have been sampled by any of the simulations since the last update,
+ * is summed. The PMF of all other points is identical in all simulations.
+ * The sum is non-blocking, the data should not be accessed until
+ * finishSumSharedHistogramsAndPmf() has returned.
  *
- * \param[in,out] pointState         The state of the points in the bias.
- * \param[in,out] weightSumCovering  The weights for checking covering.
- * \param[in]     numSharedUpdate    The number of biases sharing the histrogram.
- * \param[in]     commRecord         Struct for intra-simulation communication.
- * \param[in]     multiSimComm       Struct for multi-simulation communication.
- * \param[in]     localUpdateList    List of points with data.
+ * \param[in]  pointState  The state of the points in the bias.
+ * \param[in]  updateList  List of points sampled by any simulation.
+ * \param[in]  commRecord    Struct for intra-simulation communication.
+ * \param[in]  multiSimComm  Struct for multi-simulation communication.
+ * \param[out] buffer      Buffer for the communication.
+ * \param[out] request     The request of the non-blocking sum.
  */
-void sumHistograms(gmx::ArrayRef<PointState>  pointState,
-                   gmx::ArrayRef<double>      weightSumCovering,
-                   int                        numSharedUpdate,
-                   const t_commrec           *commRecord,
-                   const gmx_multisim_t      *multiSimComm,
-                   const std::vector<int>    &localUpdateList)
+void startSumSharedHistogramsAndPmf(gmx::ArrayRef<const PointState>  pointState,
+                                    const std::vector<int>          &updateList,
+                                    const t_commrec                 *commRecord,
+                                    const gmx_multisim_t            *multiSimComm,
+                                    std::vector<double>             *buffer,
+                                    gmx_sumd_request_t              *request)
 {
-    /* The covering checking histograms are added before summing over simulations, so that the weights from different
-       simulations are kept distinguishable. */
-    for (int globalIndex : localUpdateList)
-    {
-        weightSumCovering[globalIndex] +=
-            pointState[globalIndex].weightSumIteration();
-    }
+    const size_t numPoints = updateList.size();
 
-    /* Sum histograms over multiple simulations if needed. */
-    if (numSharedUpdate > 1)
+    /* Collect the weights, counts and PMF in a single buffer,
+     * so we need only one reduction.
+     */
+    buffer->resize(3*numPoints);
+    for (size_t localIndex = 0; localIndex < numPoints; localIndex++)
     {
-        GMX_ASSERT(numSharedUpdate == multiSimComm->nsim, "Sharing within a simulation is not implemented (yet)");
+        const PointState &ps = pointState[updateList[localIndex]];
 
-        /* Collect the weights and counts in linear arrays to be able to use gmx_sumd_sim. */
-        std::vector<double> weightSum;
-        std::vector<double> coordVisits;
-
-        weightSum.resize(localUpdateList.size());
-        coordVisits.resize(localUpdateList.size());
-
-        for (size_t localIndex = 0; localIndex < localUpdateList.size(); localIndex++)
-        {
-            const PointState &ps = pointState[localUpdateList[localIndex]];
-
-            weightSum[localIndex]   = ps.weightSumIteration();
-            coordVisits[localIndex] = ps.numVisitsIteration();
-        }
-
-        sumOverSimulations(gmx::ArrayRef<double>(weightSum), commRecord, multiSimComm);
-        sumOverSimulations(gmx::ArrayRef<double>(coordVisits), commRecord, multiSimComm);
+        (*buffer)[3*localIndex    ] = ps.weightSumIteration();
+        (*buffer)[3*localIndex + 1] = ps.numVisitsIteration();
+        /* Need to temporarily exponentiate the log weights to sum over simulations */
+        (*buffer)[3*localIndex + 2] = std::exp(-ps.logPmfSum());
+    }
 
-        /* Transfer back the result */
-        for (size_t localIndex = 0; localIndex < localUpdateList.size(); localIndex++)
-        {
-            PointState &ps = pointState[localUpdateList[localIndex]];
+    startSumOverSimulations(gmx::ArrayRef<double>(*buffer), commRecord, multiSimComm, request);
+}
 
-            ps.setPartialWeightAndCount(weightSum[localIndex],
-                                        coordVisits[localIndex]);
-        }
-    }
+/*! \brief
+ * Finish summing the partial histograms and the PMF over the sharing simulations.
+ *
+ * \param[in,out] pointState       The state of the points in the bias.
+ * \param[in]     updateList       List of points sampled by any simulation.
+ * \param[in]     numSharedUpdate  The number of biases sharing the histrogram.
+ * \param[in]     commRecord       Struct for intra-simulation communication.
+ * \param[in,out] buffer           The buffer passed to startSumSharedHistogramsAndPmf().
+ * \param[in,out] request          The request of the non-blocking sum.
+ */
+void finishSumSharedHistogramsAndPmf(gmx::ArrayRef<PointState>  pointState,
+                                     const std::vector<int>    &updateList,
+                                     int                        numSharedUpdate,
+                                     const t_commrec           *commRecord,
+                                     std::vector<double>       *buffer,
+                                     gmx_sumd_request_t        *request)
+{
+    finishSumOverSimulations(gmx::ArrayRef<double>(*buffer), commRecord, request);
 
-    /* Now add the partial counts and weights to the accumulating histograms.
-       Note: we still need to use the weights for the update so we wait
-       with resetting them until the end of the update. */
-    for (int globalIndex : localUpdateList)
+    /* Transfer back the result, take log again to get the (non-normalized) PMF */
+    double normFac = 1.0/numSharedUpdate;
+    for (size_t localIndex = 0; localIndex < updateList.size(); localIndex++)
     {
-        pointState[globalIndex].addPartialWeightAndCount();
+        PointState &ps = pointState[updateList[localIndex]];
+
+        ps.setPartialWeightAndCount((*buffer)[3*localIndex],
+                                    (*buffer)[3*localIndex + 1]);
+        ps.setLogPmfSum(-std::log((*buffer)[3*localIndex + 2]*normFac));
     }
 }
 
@@ -997,11 +1111,14 @@ bool BiasState::isSamplingRegionCovered(const BiasParams             &params,
  */
 static void normalizeFreeEnergyAndPmfSum(std::vector<PointState> *pointState)
 {
-    double minF = freeEnergyMinimumValue(*pointState);
+    double    minF       = freeEnergyMinimumValue(*pointState);
 
-    for (PointState &ps : *pointState)
+    const int numPoints  = pointState->size();
+    const int numThreads = numThreadsForPointLoop(numPoints);
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
     {
-        ps.normalizeFreeEnergyAndPmfSum(minF);
+        (*pointState)[m].normalizeFreeEnergyAndPmfSum(minF);
     }
 }
 
@@ -1023,23 +1140,67 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
 
     /* Make a list of all local points, i.e. those that could have been touched since
        the last update. These are the points needed for summing histograms below
-       (non-local points only add zeros). For local updates, this will also be the
+       (non-local points only add zeros). With sharing, these are the points touched
+       by any of the sharing simulations. For local updates, this will also be the
        final update list. */
-    makeLocalUpdateList(grid, points_, originUpdatelist_, endUpdatelist_,
-                        updateList);
-    if (params.numSharedUpdate > 1)
+    if (params.numSharedUpdate > 1 && !shareFullGrid_)
+    {
+        makeSharedUpdateList(grid, points_, originUpdatelist_, endUpdatelist_,
+                             commRecord, multiSimComm, updateList);
+    }
+    else if (params.numSharedUpdate > 1)
     {
+        makeLocalUpdateList(grid, points_, originUpdatelist_, endUpdatelist_,
+                            updateList);
         mergeSharedUpdateLists(updateList, points_.size(), commRecord, multiSimComm);
     }
+    else
+    {
+        makeLocalUpdateList(grid, points_, originUpdatelist_, endUpdatelist_,
+                            updateList);
+    }
 
     /* Reset the range for the next update */
     resetLocalUpdateRange(grid);
 
-    /* Add samples to histograms for all local points and sync simulations if needed */
-    sumHistograms(points_, weightSumCovering_,
-                  params.numSharedUpdate, commRecord, multiSimComm, *updateList);
+    /* The covering checking histograms are added before summing over simulations, so that the weights from different
+       simulations are kept distinguishable. */
+    for (int globalIndex : *updateList)
+    {
+        weightSumCovering_[globalIndex] +=
+            points_[globalIndex].weightSumIteration();
+    }
 
-    sumPmf(points_, params.numSharedUpdate, commRecord, multiSimComm);
+    /* Start summing the histograms over the sharing simulations.
+     * We overlap this communication with the checks below, which do not
+     * depend on the sampled histograms of this update.
+     */
+    std::vector<double> sharedBuffer;
+    gmx_sumd_request_t  sharedRequest;
+    std::vector<int>    fullGridList;
+    std::vector<int>   *sharedList = updateList;
+    if (params.numSharedUpdate > 1)
+    {
+        GMX_ASSERT(params.numSharedUpdate == multiSimComm->nsim, "Sharing within a simulation is not implemented (yet)");
+
+        if (shareFullGrid_)
+        {
+            /* Sum the data of all points, points that have not been
+             * sampled by any simulation only add zero weights.
+             */
+            for (size_t m = 0; m < points_.size(); m++)
+            {
+                if (points_[m].inTargetRegion())
+                {
+                    fullGridList.push_back(m);
+                }
+            }
+            sharedList = &fullGridList;
+        }
+
+        startSumSharedHistogramsAndPmf(points_, *sharedList, commRecord, multiSimComm,
+                                       &sharedBuffer, &sharedRequest);
+    }
 
     /* Renormalize the free energy if values are too large. */
     bool needToNormalizeFreeEnergy = false;
@@ -1057,11 +1218,6 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
         }
     }
 
-    /* Update target distribution? */
-    bool needToUpdateTargetDistribution =
-        (params.eTarget != eawhtargetCONSTANT &&
-         params.isUpdateTargetStep(step));
-
     /* In the initial stage, the histogram grows dynamically as a function of the number of coverings. */
     bool detectedCovering = false;
     if (inInitialStage())
@@ -1071,6 +1227,25 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
                                                     commRecord, multiSimComm));
     }
 
+    if (params.numSharedUpdate > 1)
+    {
+        finishSumSharedHistogramsAndPmf(points_, *sharedList, params.numSharedUpdate, commRecord,
+                                        &sharedBuffer, &sharedRequest);
+    }
+
+    /* Now add the partial counts and weights to the accumulating histograms.
+       Note: we still need to use the weights for the update so we wait
+       with resetting them until the end of the update. */
+    for (int globalIndex : *updateList)
+    {
+        points_[globalIndex].addPartialWeightAndCount();
+    }
+
+    /* Update target distribution? */
+    bool needToUpdateTargetDistribution =
+        (params.eTarget != eawhtargetCONSTANT &&
+         params.isUpdateTargetStep(step));
+
     /* The weighthistogram size after this update. */
     double newHistogramSize = histogramSize_.newHistogramSize(params, t, detectedCovering, points_, weightSumCovering_, fplog);
 
@@ -1111,19 +1286,26 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
     setHistogramUpdateScaleFactors(params, newHistogramSize, histogramSize_.histogramSize(),
                                    &weightHistScalingNew, &logPmfsumScalingNew);
 
-    /* Update free energy and reference weight histogram for points in the update list. */
-    for (int pointIndex : *updateList)
+    /* Update free energy and reference weight histogram for points in the update list.
+     * The point updates are independent, so we can do them in parallel.
+     */
+    const int         numPointsToUpdate = updateList->size();
+    const int         numThreads        = numThreadsForPointLoop(numPointsToUpdate);
+    const gmx_int64_t numUpdates        = histogramSize_.numUpdates();
+    const int        *updateIndices     = updateList->data();
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < numPointsToUpdate; i++)
     {
-        PointState *pointStateToUpdate = &points_[pointIndex];
+        PointState *pointStateToUpdate = &points_[updateIndices[i]];
 
         /* Do updates from previous update steps that were skipped because this point was at that time non-local. */
         if (params.skipUpdates())
         {
-            pointStateToUpdate->performPreviouslySkippedUpdates(params, histogramSize_.numUpdates(), weightHistScalingSkipped, logPmfsumScalingSkipped);
+            pointStateToUpdate->performPreviouslySkippedUpdates(params, numUpdates, weightHistScalingSkipped, logPmfsumScalingSkipped);
         }
 
         /* Now do an update with new sampling data. */
-        pointStateToUpdate->updateWithNewSampling(params, histogramSize_.numUpdates(), weightHistScalingNew, logPmfsumScalingNew);
+        pointStateToUpdate->updateWithNewSampling(params, numUpdates, weightHistScalingNew, logPmfsumScalingNew);
     }
 
     /* Only update the histogram size after we are done with the local point updates */
@@ -1142,9 +1324,10 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
 
     /* Update the bias. The bias is updated separately and last since it simply a function of
        the free energy and the target distribution and we want to avoid doing extra work. */
-    for (int pointIndex : *updateList)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < numPointsToUpdate; i++)
     {
-        points_[pointIndex].updateBias();
+        points_[updateIndices[i]].updateBias();
     }
 
     /* Increase the update counter. */
@@ -1169,30 +1352,42 @@ double BiasState::updateProbabilityWeightsAndConvolvedBias(const std::vector<Dim
     const int     weightSize = ((neighbors.size() + packSize - 1)/packSize)*packSize;
     weight->resize(weightSize);
 
+    /* With large neighborhoods, e.g. with 3D grids, we compute
+     * the weights in parallel. The weights are summed afterwards,
+     * in the same order independently of the number of threads.
+     */
+    const int             numPacks   = weightSize/packSize;
+    const int             numThreads = numThreadsForPointLoop(neighbors.size());
     double * gmx_restrict weightData = weight->data();
-    PackType              weightSumPack(0.0);
-    for (size_t i = 0; i < neighbors.size(); i += packSize)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int p = 0; p < numPacks; p++)
     {
+        const size_t i = p*packSize;
         for (size_t n = i; n < i + packSize; n++)
         {
             if (n < neighbors.size())
             {
                 const int neighbor = neighbors[n];
-                (*weight)[n] = biasedLogWeightFromPoint(dimParams, points_, grid,
-                                                        neighbor, points_[neighbor].bias(),
-                                                        coordState_.coordValue());
+                weightData[n]      = biasedLogWeightFromPoint(dimParams, points_, grid,
+                                                              neighbor, points_[neighbor].bias(),
+                                                              coordState_.coordValue());
             }
             else
             {
                 /* Pad with values that don't affect the result */
-                (*weight)[n] = c_largeNegativeExponent;
+                weightData[n] = c_largeNegativeExponent;
             }
         }
         PackType weightPack = load<PackType>(weightData + i);
         weightPack          = gmx::exp(weightPack);
-        weightSumPack       = weightSumPack + weightPack;
         store(weightData + i, weightPack);
     }
+    PackType weightSumPack(0.0);
+    for (int i = 0; i < weightSize; i += packSize)
+    {
+        weightSumPack = weightSumPack + load<PackType>(weightData + i);
+    }
+
     /* Sum of probability weights */
     double weightSum    = reduce(weightSumPack);
     GMX_RELEASE_ASSERT(weightSum > 0, "zero probability weight when updating AWH probability weights.");
@@ -1678,11 +1873,13 @@ void BiasState::initGridPointState(const AwhBiasParams           &awhBiasParams,
 BiasState::BiasState(const AwhBiasParams          &awhBiasParams,
                      double                        histogramSizeInitial,
                      const std::vector<DimParams> &dimParams,
-                     const Grid                   &grid) :
+                     const Grid                   &grid,
+                     ShareFullGrid                 shareFullGrid) :
     coordState_(awhBiasParams, dimParams, grid),
     points_(grid.numPoints()),
     weightSumCovering_(grid.numPoints()),
-    histogramSize_(awhBiasParams, histogramSizeInitial)
+    histogramSize_(awhBiasParams, histogramSizeInitial),
+    shareFullGrid_(shareFullGrid == ShareFullGrid::yes)
 {
     /* The minimum and maximum multidimensional point indices that are affected by the next update */
     for (size_t d = 0; d < dimParams.size(); d++)
@@ -93,6 +93,14 @@ class PointState;
 class BiasState
 {
     public:
+        /*! \brief Switch to sum the data of all points when sharing, used as a reference for testing.
+         */
+        enum class ShareFullGrid
+        {
+            no,  /**< Only sum the data of the points sampled by any of the sharing simulations */
+            yes  /**< Sum the data of all points */
+        };
+
         /*! \brief Constructor.
          *
          * Constructs the global state and the point states on a provided
@@ -104,11 +112,13 @@ class BiasState
          *                                  entries and grow by a floating-point scaling factor.
          * \param[in] dimParams             The dimension parameters.
          * \param[in] grid                  The bias grid.
+         * \param[in] shareFullGrid         If to sum the data of all points when sharing, useful for testing.
          */
         BiasState(const AwhBiasParams          &awhBiasParams,
                   double                        histogramSizeInitial,
                   const std::vector<DimParams> &dimParams,
-                  const Grid                   &grid);
+                  const Grid                   &grid,
+                  ShareFullGrid                 shareFullGrid = ShareFullGrid::no);
 
         /*! \brief
          * Restore the bias state from history.
@@ -535,6 +545,9 @@ class BiasState
         /* Track the part of the grid sampled since the last update. */
         awh_ivec            originUpdatelist_;  /**< The origin of the rectangular region that has been sampled since last update. */
         awh_ivec            endUpdatelist_;     /**< The end of the rectangular region that has been sampled since last update. */
+
+        /* Only used as a reference for testing */
+        bool                shareFullGrid_;     /**< Whether sharing sums the data of all points instead of only the sampled ones */
 };
 
 //! Linewidth used for warning output
@@ -82,49 +82,6 @@ static gmx_bool  bACFinit = FALSE;
 /*! \brief Data structure for storing command line variables. */
 static t_acf     acf;
 
-enum {
-    enNorm, enCos, enSin
-};
-
-/*! \brief Routine to compute ACF using FFT. */
-static void low_do_four_core(int nframes, real c1[], real cfour[],
-                             int nCos)
-{
-    int  i = 0;
-    std::vector<std::vector<real> > data;
-    data.resize(1);
-    data[0].resize(nframes, 0);
-    switch (nCos)
-    {
-        case enNorm:
-            for (i = 0; (i < nframes); i++)
-            {
-                data[0][i] = c1[i];
-            }
-            break;
-        case enCos:
-            for (i = 0; (i < nframes); i++)
-            {
-                data[0][i] = cos(c1[i]);
-            }
-            break;
-        case enSin:
-            for (i = 0; (i < nframes); i++)
-            {
-                data[0][i] = sin(c1[i]);
-            }
-            break;
-        default:
-            gmx_fatal(FARGS, "nCos = %d, %s %d", nCos, __FILE__, __LINE__);
-    }
-
-    many_auto_correl(&data);
-    for (i = 0; (i < nframes); i++)
-    {
-        cfour[i] = data[0][i];
-    }
-}
-
 /*! \brief Routine to comput ACF without FFT. */
 static void do_ac_core(int nframes, int nout,
                        real corr[], real c1[], int nrestart,
@@ -323,210 +280,263 @@ static void norm_and_scale_vectors(int nframes, real c1[], real scale)
     }
 }
 
-/*! \brief Debugging */
-static void dump_tmp(char *s, int n, real c[])
+/*! \brief Number of items whose ACFs are computed together using FFT. */
+static const int c_fourBatch = 256;
+
+/*! \brief
+ * Store the product of components m1, m2 and m3 of the vectors of nb items
+ * in ctmp, where a component < 0 is left out.
+ */
+static void four_product(int nb, int nframes, real **c1, real **ctmp,
+                         int m1, int m2, int m3)
 {
-    FILE *fp;
-    int   i;
+    int i, j;
 
-    fp = gmx_ffopen(s, "w");
-    for (i = 0; (i < n); i++)
+    for (i = 0; (i < nb); i++)
     {
-        fprintf(fp, "%10d  %10g\n", i, c[i]);
+        for (j = 0; (j < nframes); j++)
+        {
+            ctmp[i][j] = c1[i][DIM*j+m1];
+            if (m2 >= 0)
+            {
+                ctmp[i][j] *= c1[i][DIM*j+m2];
+            }
+            if (m3 >= 0)
+            {
+                ctmp[i][j] *= c1[i][DIM*j+m3];
+            }
+        }
     }
-    gmx_ffclose(fp);
 }
 
-/*! \brief High level ACF routine. */
-static void do_four_core(unsigned long mode, int nframes,
-                         real c1[], real csum[], real ctmp[])
+/*! \brief Add fac times the ACF of each of the nb series in ctmp to csum. */
+static void four_term(gmx_many_correl_t mc, int nb, int nframes,
+                      real **ctmp, real **csum, real fac)
 {
-    real   *cfour;
-    char    buf[32];
-    real    fac;
-    int     j, m, m1;
+    std::vector<int> ndata(nb, nframes);
+    int              i, j;
 
-    snew(cfour, nframes);
-
-    if (MODE(eacNormal))
-    {
-        /********************************************
-         *  N O R M A L
-         ********************************************/
-        low_do_four_core(nframes, c1, csum, enNorm);
-    }
-    else if (MODE(eacCos))
+    many_correl_auto(mc, nb, ndata.data(), ctmp);
+    for (i = 0; (i < nb); i++)
     {
-        /***************************************************
-         * C O S I N E
-         ***************************************************/
-        /* Copy the data to temp array. Since we need it twice
-         * we can't overwrite original.
-         */
         for (j = 0; (j < nframes); j++)
         {
-            ctmp[j] = c1[j];
+            csum[i][j] += fac*ctmp[i][j];
         }
+    }
+}
 
-        /* Cosine term of AC function */
-        low_do_four_core(nframes, ctmp, cfour, enCos);
-        for (j = 0; (j < nframes); j++)
-        {
-            c1[j]  = cfour[j];
-        }
+/*! \brief
+ * High level ACF routine using FFT.
+ *
+ * Each ACF is written as a sum of terms that are plain autocorrelations
+ * of some function of the input. Each term is computed for a batch of
+ * items at once, so that the FFT plans and work arrays are reused.
+ */
+static void do_four_core(unsigned long mode, int nframes, int nitem,
+                         real **c1, gmx_bool bVerbose)
+{
+    gmx_many_correl_t mc;
+    real            **csum, **ctmp;
+    int               i, i0, j, m, m1, m2, m3, nb;
 
-        /* Sine term of AC function */
-        low_do_four_core(nframes, ctmp, cfour, enSin);
-        for (j = 0; (j < nframes); j++)
+    mc = init_many_correl(0);
+    snew(csum, c_fourBatch);
+    snew(ctmp, c_fourBatch);
+    for (i = 0; (i < std::min(nitem, c_fourBatch)); i++)
+    {
+        snew(csum[i], nframes);
+        snew(ctmp[i], nframes);
+    }
+
+    for (i0 = 0; (i0 < nitem); i0 += c_fourBatch)
+    {
+        real **c = c1 + i0;
+
+        nb = std::min(c_fourBatch, nitem - i0);
+        if (bVerbose)
         {
-            c1[j]  += cfour[j];
-            csum[j] = c1[j];
+            fprintf(stderr, "\rThingie %d", i0+nb);
+            fflush(stderr);
         }
-    }
-    else if (MODE(eacP2))
-    {
-        /***************************************************
-         * Legendre polynomials
-         ***************************************************/
-        /* First normalize the vectors */
-        norm_and_scale_vectors(nframes, c1, 1.0);
-
-        /* For P2 thingies we have to do six FFT based correls
-         * First for XX^2, then for YY^2, then for ZZ^2
-         * Then we have to do XY, YZ and XZ (counting these twice)
-         * After that we sum them and normalise
-         * P2(x) = (3 * cos^2 (x) - 1)/2
-         * for unit vectors u and v we compute the cosine as the inner product
-         * cos(u,v) = uX vX + uY vY + uZ vZ
-         *
-         *        oo
-         *        /
-         * C(t) = |  (3 cos^2(u(t'),u(t'+t)) - 1)/2 dt'
-         *        /
-         *        0
-         *
-         * For ACF we need:
-         * P2(u(0),u(t)) = [3 * (uX(0) uX(t) +
-         *                       uY(0) uY(t) +
-         *                       uZ(0) uZ(t))^2 - 1]/2
-         *               = [3 * ((uX(0) uX(t))^2 +
-         *                       (uY(0) uY(t))^2 +
-         *                       (uZ(0) uZ(t))^2 +
-         *                 2(uX(0) uY(0) uX(t) uY(t)) +
-         *                 2(uX(0) uZ(0) uX(t) uZ(t)) +
-         *                 2(uY(0) uZ(0) uY(t) uZ(t))) - 1]/2
-         *
-         *               = [(3/2) * (<uX^2> + <uY^2> + <uZ^2> +
-         *                         2<uXuY> + 2<uXuZ> + 2<uYuZ>) - 0.5]
-         *
-         */
-
-        /* Because of normalization the number of -0.5 to subtract
-         * depends on the number of data points!
-         */
-        for (j = 0; (j < nframes); j++)
+        for (i = 0; (i < nb); i++)
         {
-            csum[j]  = -0.5*(nframes-j);
+            for (j = 0; (j < nframes); j++)
+            {
+                csum[i][j] = 0;
+            }
         }
 
-        /***** DIAGONAL ELEMENTS ************/
-        for (m = 0; (m < DIM); m++)
+        if (MODE(eacNormal))
         {
-            /* Copy the vector data in a linear array */
-            for (j = 0; (j < nframes); j++)
+            /********************************************
+             *  N O R M A L
+             ********************************************/
+            for (i = 0; (i < nb); i++)
             {
-                ctmp[j]  = gmx::square(c1[DIM*j+m]);
+                for (j = 0; (j < nframes); j++)
+                {
+                    ctmp[i][j] = c[i][j];
+                }
             }
-            if (debug)
+            four_term(mc, nb, nframes, ctmp, csum, 1.0);
+        }
+        else if (MODE(eacCos))
+        {
+            /***************************************************
+             * C O S I N E
+             ***************************************************/
+            /* cos(a-b) = cos(a) cos(b) + sin(a) sin(b) */
+            for (i = 0; (i < nb); i++)
+            {
+                for (j = 0; (j < nframes); j++)
+                {
+                    ctmp[i][j] = std::cos(c[i][j]);
+                }
+            }
+            four_term(mc, nb, nframes, ctmp, csum, 1.0);
+            for (i = 0; (i < nb); i++)
             {
-                sprintf(buf, "c1diag%d.xvg", m);
-                dump_tmp(buf, nframes, ctmp);
+                for (j = 0; (j < nframes); j++)
+                {
+                    ctmp[i][j] = std::sin(c[i][j]);
+                }
             }
+            four_term(mc, nb, nframes, ctmp, csum, 1.0);
+        }
+        else if (MODE(eacP2))
+        {
+            /***************************************************
+             * Legendre polynomials
+             ***************************************************/
+            /* For P2 thingies we have to do six FFT based correls
+             * First for XX^2, then for YY^2, then for ZZ^2
+             * Then we have to do XY, YZ and XZ (counting these twice)
+             * After that we sum them and normalise
+             * P2(x) = (3 * cos^2 (x) - 1)/2
+             * for unit vectors u and v we compute the cosine as the inner product
+             * cos(u,v) = uX vX + uY vY + uZ vZ
+             *
+             *        oo
+             *        /
+             * C(t) = |  (3 cos^2(u(t'),u(t'+t)) - 1)/2 dt'
+             *        /
+             *        0
+             *
+             * For ACF we need:
+             * P2(u(0),u(t)) = [3 * (uX(0) uX(t) +
+             *                       uY(0) uY(t) +
+             *                       uZ(0) uZ(t))^2 - 1]/2
+             *               = [3 * ((uX(0) uX(t))^2 +
+             *                       (uY(0) uY(t))^2 +
+             *                       (uZ(0) uZ(t))^2 +
+             *                 2(uX(0) uY(0) uX(t) uY(t)) +
+             *                 2(uX(0) uZ(0) uX(t) uZ(t)) +
+             *                 2(uY(0) uZ(0) uY(t) uZ(t))) - 1]/2
+             *
+             *               = [(3/2) * (<uX^2> + <uY^2> + <uZ^2> +
+             *                         2<uXuY> + 2<uXuZ> + 2<uYuZ>) - 0.5]
+             *
+             */
+            for (i = 0; (i < nb); i++)
+            {
+                /* First normalize the vectors */
+                norm_and_scale_vectors(nframes, c[i], 1.0);
 
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
+                /* Because of normalization the number of -0.5 to subtract
+                 * depends on the number of data points!
+                 */
+                for (j = 0; (j < nframes); j++)
+                {
+                    csum[i][j]  = -0.5*(nframes-j);
+                }
+            }
 
-            if (debug)
+            /***** DIAGONAL ELEMENTS ************/
+            for (m = 0; (m < DIM); m++)
             {
-                sprintf(buf, "c1dfout%d.xvg", m);
-                dump_tmp(buf, nframes, cfour);
+                four_product(nb, nframes, c, ctmp, m, m, -1);
+                four_term(mc, nb, nframes, ctmp, csum, 1.5);
             }
-            fac = 1.5;
-            for (j = 0; (j < nframes); j++)
+            /******* OFF-DIAGONAL ELEMENTS **********/
+            for (m = 0; (m < DIM); m++)
             {
-                csum[j] += fac*(cfour[j]);
+                four_product(nb, nframes, c, ctmp, m, (m+1) % DIM, -1);
+                four_term(mc, nb, nframes, ctmp, csum, 3.0);
             }
         }
-        /******* OFF-DIAGONAL ELEMENTS **********/
-        for (m = 0; (m < DIM); m++)
+        else if (MODE(eacP3))
         {
-            /* Copy the vector data in a linear array */
-            m1 = (m+1) % DIM;
-            for (j = 0; (j < nframes); j++)
+            /* P3(x) = (5 x^3 - 3 x)/2 with x = u(0).u(t) for unit vectors.
+             * x^3 expands into the ten distinct cubic monomials of the
+             * components, counted with their number of permutations.
+             */
+            for (i = 0; (i < nb); i++)
             {
-                ctmp[j] = c1[DIM*j+m]*c1[DIM*j+m1];
+                norm_and_scale_vectors(nframes, c[i], 1.0);
             }
-
-            if (debug)
+            for (m1 = 0; (m1 < DIM); m1++)
             {
-                sprintf(buf, "c1off%d.xvg", m);
-                dump_tmp(buf, nframes, ctmp);
+                for (m2 = m1; (m2 < DIM); m2++)
+                {
+                    for (m3 = m2; (m3 < DIM); m3++)
+                    {
+                        int nperm = (m1 == m3) ? 1 : ((m1 == m2 || m2 == m3) ? 3 : 6);
+
+                        four_product(nb, nframes, c, ctmp, m1, m2, m3);
+                        four_term(mc, nb, nframes, ctmp, csum, 2.5*nperm);
+                    }
+                }
+                four_product(nb, nframes, c, ctmp, m1, -1, -1);
+                four_term(mc, nb, nframes, ctmp, csum, -1.5);
             }
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
-            if (debug)
+        }
+        else if (MODE(eacP1) || MODE(eacVector))
+        {
+            /***************************************************
+             * V E C T O R & P1
+             ***************************************************/
+            if (MODE(eacP1))
             {
-                sprintf(buf, "c1ofout%d.xvg", m);
-                dump_tmp(buf, nframes, cfour);
+                /* First normalize the vectors */
+                for (i = 0; (i < nb); i++)
+                {
+                    norm_and_scale_vectors(nframes, c[i], 1.0);
+                }
             }
-            fac = 3.0;
-            for (j = 0; (j < nframes); j++)
+
+            /* For vector thingies we have to do three FFT based correls
+             * First for XX, then for YY, then for ZZ
+             * After that we sum them and normalise
+             */
+            for (m = 0; (m < DIM); m++)
             {
-                csum[j] += fac*cfour[j];
+                four_product(nb, nframes, c, ctmp, m, -1, -1);
+                four_term(mc, nb, nframes, ctmp, csum, 1.0);
             }
         }
-    }
-    else if (MODE(eacP1) || MODE(eacVector))
-    {
-        /***************************************************
-         * V E C T O R & P1
-         ***************************************************/
-        if (MODE(eacP1))
+        else
         {
-            /* First normalize the vectors */
-            norm_and_scale_vectors(nframes, c1, 1.0);
+            gmx_fatal(FARGS, "\nUnknown mode in do_autocorr (%lu)", mode);
         }
 
-        /* For vector thingies we have to do three FFT based correls
-         * First for XX, then for YY, then for ZZ
-         * After that we sum them and normalise
-         */
-        for (j = 0; (j < nframes); j++)
-        {
-            csum[j] = 0.0;
-        }
-        for (m = 0; (m < DIM); m++)
+        for (i = 0; (i < nb); i++)
         {
-            /* Copy the vector data in a linear array */
             for (j = 0; (j < nframes); j++)
             {
-                ctmp[j] = c1[DIM*j+m];
-            }
-            low_do_four_core(nframes, ctmp, cfour, enNorm);
-            for (j = 0; (j < nframes); j++)
-            {
-                csum[j] += cfour[j];
+                c[i][j] = csum[i][j]/(real)(nframes-j);
             }
         }
     }
-    else
-    {
-        gmx_fatal(FARGS, "\nUnknown mode in do_autocorr (%d)", mode);
-    }
 
-    sfree(cfour);
-    for (j = 0; (j < nframes); j++)
+    for (i = 0; (i < std::min(nitem, c_fourBatch)); i++)
     {
-        c1[j] = csum[j]/(real)(nframes-j);
+        sfree(csum[i]);
+        sfree(ctmp[i]);
     }
+    sfree(csum);
+    sfree(ctmp);
+    done_many_correl(mc);
 }
 
 void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *title,
@@ -538,7 +548,6 @@ void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *t
 {
     FILE       *fp, *gp = nullptr;
     int         i;
-    real       *csum;
     real       *ctmp, *fit;
     real        sum, Ct2av, Ctav;
     gmx_bool    bFour = acf.bFour;
@@ -559,7 +568,7 @@ void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *t
         gmx_fatal(FARGS, "Incompatible options bCos && bVector (%s, %d)",
                   __FILE__, __LINE__);
     }
-    if ((MODE(eacP3) || MODE(eacRcross)) && bFour)
+    if ((MODE(eacRcross) || MODE(eacIden)) && bFour)
     {
         if (bVerbose)
         {
@@ -582,37 +591,32 @@ void low_do_autocorr(const char *fn, const gmx_output_env_t *oenv, const char *t
                gmx::boolToString(bNormalize));
         printf("mode = %lu, dt = %g, nrestart = %d\n", mode, dt, nrestart);
     }
-    /* Allocate temp arrays */
-    snew(csum, nframes);
-    snew(ctmp, nframes);
-
     /* Loop over items (e.g. molecules or dihedrals)
      * In this loop the actual correlation functions are computed, but without
      * normalizing them.
      */
-    for (int i = 0; i < nitem; i++)
+    if (bFour)
     {
-        if (bVerbose && (((i % 100) == 0) || (i == nitem-1)))
-        {
-            fprintf(stderr, "\rThingie %d", i+1);
-            fflush(stderr);
-        }
-
-        if (bFour)
-        {
-            do_four_core(mode, nframes, c1[i], csum, ctmp);
-        }
-        else
+        do_four_core(mode, nframes, nitem, c1, bVerbose);
+    }
+    else
+    {
+        snew(ctmp, nframes);
+        for (int i = 0; i < nitem; i++)
         {
+            if (bVerbose && (((i % 100) == 0) || (i == nitem-1)))
+            {
+                fprintf(stderr, "\rThingie %d", i+1);
+                fflush(stderr);
+            }
             do_ac_core(nframes, nout, ctmp, c1[i], nrestart, mode);
         }
+        sfree(ctmp);
     }
     if (bVerbose)
     {
         fprintf(stderr, "\n");
     }
-    sfree(ctmp);
-    sfree(csum);
 
     if (fn)
     {
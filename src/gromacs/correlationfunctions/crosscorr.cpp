@@ -113,6 +113,7 @@ static void cross_corr_low(int n, real f[], real g[], real corr[], gmx_fft_t fft
     {
         complexConjugatMult(&in1[i], &in2[i]);
         in1[i].re /= size;
+        in1[i].im /= size;
     }
     gmx_fft_1d(fft, GMX_FFT_BACKWARD, in1, in1);
 
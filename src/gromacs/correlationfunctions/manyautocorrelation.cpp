@@ -44,11 +44,183 @@
 #include "manyautocorrelation.h"
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "gromacs/fft/fft.h"
+#include "gromacs/math/gmxcomplex.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/gmxomp.h"
 
+/*! \brief Plans and work arrays of one thread */
+struct t_correl_thread
+{
+    //! FFT plans for each transform length used so far
+    std::vector<std::pair<int, gmx_fft_t> >                plan;
+    //! Real-space work array
+    std::vector<real, gmx::AlignedAllocator<real> >         buf;
+    //! Transforms of the first and second series
+    std::vector<t_complex, gmx::AlignedAllocator<t_complex> > fk, gk;
+};
+
+/*! \brief Opaque setup for computing many correlation functions */
+struct gmx_many_correl
+{
+    //! Number of threads
+    int                          nthreads;
+    //! Plans and work arrays of each thread
+    std::vector<t_correl_thread> thread;
+};
+
+/*! \brief
+ * Return the transform length to use for a series of n points.
+ *
+ * The length is at least 2n-1 to avoid wrap-around of the correlation,
+ * and at least 2 since not all FFT libraries support length 1.
+ * It is restricted to 2^k, 3*2^k and 5*2^k so that the transforms are
+ * fast and only a few plans are needed for series of varying length.
+ */
+static int correlFftSize(int n)
+{
+    int m    = std::max(2*n - 1, 2);
+    int size = 1;
+
+    while (size < m)
+    {
+        size *= 2;
+    }
+    for (int f = 3; f <= 5; f += 2)
+    {
+        int s = f;
+        while (s < m)
+        {
+            s *= 2;
+        }
+        size = std::min(size, s);
+    }
+    return size;
+}
+
+/*! \brief Return the plan of a thread for transforms of length \p nfft */
+static gmx_fft_t correlPlan(t_correl_thread *th, int nfft)
+{
+    for (const auto &p : th->plan)
+    {
+        if (p.first == nfft)
+        {
+            return p.second;
+        }
+    }
+    gmx_fft_t fft;
+    gmx_fft_init_1d_real(&fft, nfft, GMX_FFT_FLAG_CONSERVATIVE);
+    th->plan.emplace_back(nfft, fft);
+    if (th->buf.size() < static_cast<size_t>(nfft))
+    {
+        th->buf.resize(nfft);
+        th->fk.resize(nfft/2 + 1);
+        th->gk.resize(nfft/2 + 1);
+    }
+
+    return fft;
+}
+
+/*! \brief
+ * Correlate one series f, or the pair f and g, see many_correl_cross().
+ */
+static void correlOne(t_correl_thread *th, int n, real f[], real g[])
+{
+    if (n <= 0)
+    {
+        return;
+    }
+    int        nfft = correlFftSize(n);
+    gmx_fft_t  fft  = correlPlan(th, nfft);
+    int        nk   = nfft/2 + 1;
+    real      *buf  = th->buf.data();
+    t_complex *fk   = th->fk.data();
+    t_complex *gk   = th->gk.data();
+    /* Normalization of the inverse transform */
+    real       norm = 1.0/nfft;
+
+    std::copy(f, f + n, buf);
+    std::fill(buf + n, buf + nfft, 0);
+    gmx_fft_1d_real(fft, GMX_FFT_REAL_TO_COMPLEX, buf, fk);
+    if (g != nullptr)
+    {
+        std::copy(g, g + n, buf);
+        std::fill(buf + n, buf + nfft, 0);
+        gmx_fft_1d_real(fft, GMX_FFT_REAL_TO_COMPLEX, buf, gk);
+        for (int k = 0; k < nk; k++)
+        {
+            real re = fk[k].re*gk[k].re + fk[k].im*gk[k].im;
+            real im = fk[k].im*gk[k].re - fk[k].re*gk[k].im;
+            gk[k].re = re*norm;
+            gk[k].im = im*norm;
+        }
+        gmx_fft_1d_real(fft, GMX_FFT_COMPLEX_TO_REAL, gk, buf);
+        std::copy(buf, buf + n, g);
+    }
+    for (int k = 0; k < nk; k++)
+    {
+        fk[k].re = (fk[k].re*fk[k].re + fk[k].im*fk[k].im)*norm;
+        fk[k].im = 0;
+    }
+    gmx_fft_1d_real(fft, GMX_FFT_COMPLEX_TO_REAL, fk, buf);
+    std::copy(buf, buf + n, f);
+}
+
+gmx_many_correl_t init_many_correl(int nthreads)
+{
+    gmx_many_correl_t mc = new gmx_many_correl;
+
+    mc->nthreads = gmx_omp_get_max_threads();
+    if (nthreads > 0)
+    {
+        mc->nthreads = std::min(nthreads, mc->nthreads);
+    }
+    mc->thread.resize(mc->nthreads);
+
+    return mc;
+}
+
+void done_many_correl(gmx_many_correl_t mc)
+{
+    for (auto &th : mc->thread)
+    {
+        for (auto &p : th.plan)
+        {
+            gmx_fft_destroy(p.second);
+        }
+    }
+    delete mc;
+}
+
+/*! \brief Distribute the series over the threads of the setup */
+static void many_correl(gmx_many_correl_t mc, int nfunc, const int ndata[], real *f[], real *g[])
+{
+#pragma omp parallel for num_threads(mc->nthreads) schedule(dynamic)
+    for (int i = 0; i < nfunc; i++)
+    {
+        try
+        {
+            correlOne(&mc->thread[gmx_omp_get_thread_num()], ndata[i], f[i],
+                      g != nullptr ? g[i] : nullptr);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
+void many_correl_auto(gmx_many_correl_t mc, int nfunc, const int ndata[], real *c[])
+{
+    many_correl(mc, nfunc, ndata, c, nullptr);
+}
+
+void many_correl_cross(gmx_many_correl_t mc, int nfunc, const int ndata[], real *f[], real *g[])
+{
+    many_correl(mc, nfunc, ndata, f, g);
+}
+
 int many_auto_correl(std::vector<std::vector<real> > *c)
 {
     size_t nfunc = (*c).size();
@@ -74,57 +246,15 @@ int many_auto_correl(std::vector<std::vector<real> > *c)
         }
     }
 #endif
-    // Add buffer size to the arrays.
-    size_t nfft = (3*ndata/2) + 1;
-    // Pad arrays with zeros
-    for (auto &i : *c)
-    {
-        i.resize(nfft, 0);
-    }
-    #pragma omp parallel
-    {
-        try
-        {
-            gmx_fft_t         fft1;
-            std::vector<real> in, out;
-
-            int               nthreads  = gmx_omp_get_max_threads();
-            int               thread_id = gmx_omp_get_thread_num();
-            int               i0        = (thread_id*nfunc)/nthreads;
-            int               i1        = std::min(nfunc, ((thread_id+1)*nfunc)/nthreads);
-
-            gmx_fft_init_1d(&fft1, nfft, GMX_FFT_FLAG_CONSERVATIVE);
-            /* Allocate temporary arrays */
-            in.resize(2*nfft, 0);
-            out.resize(2*nfft, 0);
-            for (int i = i0; (i < i1); i++)
-            {
-                for (size_t j = 0; j < ndata; j++)
-                {
-                    in[2*j+0] = (*c)[i][j];
-                    in[2*j+1] = 0;
-                }
-                gmx_fft_1d(fft1, GMX_FFT_BACKWARD, (void *)in.data(), (void *)out.data());
-                for (size_t j = 0; j < nfft; j++)
-                {
-                    in[2*j+0] = (out[2*j+0]*out[2*j+0] + out[2*j+1]*out[2*j+1])/nfft;
-                    in[2*j+1] = 0;
-                }
-                gmx_fft_1d(fft1, GMX_FFT_FORWARD, (void *)in.data(), (void *)out.data());
-                for (size_t j = 0; (j < nfft); j++)
-                {
-                    (*c)[i][j] = out[2*j+0];
-                }
-            }
-            /* Free the memory */
-            gmx_fft_destroy(fft1);
-        }
-        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
-    }
+    std::vector<int>    n(nfunc, static_cast<int>(ndata));
+    std::vector<real *> ptr;
     for (auto &i : *c)
     {
-        i.resize(ndata);
+        ptr.push_back(i.data());
     }
+    gmx_many_correl_t   mc = init_many_correl(0);
+    many_correl_auto(mc, static_cast<int>(nfunc), n.data(), ptr.data());
+    done_many_correl(mc);
 
     return 0;
 }
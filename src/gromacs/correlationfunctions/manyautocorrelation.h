@@ -50,17 +50,70 @@
 #include "gromacs/utility/real.h"
 
 /*! \brief
- * Perform many autocorrelation calculations.
+ * Opaque setup for computing many correlation functions, see
+ * init_many_correl().
+ */
+typedef struct gmx_many_correl *gmx_many_correl_t;
+
+/*! \brief
+ * Set up for computing many correlation functions.
+ *
+ * The correlation functions are computed with real-to-complex FFTs.
+ * The setup keeps the FFT plans and aligned work arrays of each thread,
+ * so that they can be reused by all calls made with it.
+ *
+ * \param[in] nthreads Number of OpenMP threads to use, <= 0 means all
+ * \return the setup
+ */
+gmx_many_correl_t init_many_correl(int nthreads);
+
+/*! \brief
+ * Free a setup made with init_many_correl().
  *
- * This routine performs many autocorrelation function calculations using FFTs.
- * The GROMACS FFT library wrapper is employed. On return the c vector contain
- * a symmetric function that is useful for further FFT:ing, for instance in order to
- * compute spectra.
+ * \param[in] mc The setup
+ */
+void done_many_correl(gmx_many_correl_t mc);
+
+/*! \brief
+ * Compute a batch of autocorrelation functions.
+ *
+ * On return c[i][j] holds the sum over k of c[i][k]*c[i][k+j] for all
+ * lags 0 <= j < ndata[i]. The sums are not normalized. The series are
+ * zero padded internally, so there is no wrap-around at large lags.
+ * The series may differ in length and are distributed over the threads.
+ *
+ * \param[in]    mc    The setup
+ * \param[in]    nfunc Number of series
+ * \param[in]    ndata Length of each series
+ * \param[inout] c     The series, replaced by their autocorrelation
+ */
+void many_correl_auto(gmx_many_correl_t mc, int nfunc, const int ndata[], real *c[]);
+
+/*! \brief
+ * Compute a batch of auto- and cross-correlation functions.
+ *
+ * On return f[i][j] holds the sum over k of f[i][k]*f[i][k+j], as for
+ * many_correl_auto(), and g[i][j] the sum over k of f[i][k+j]*g[i][k],
+ * for all lags 0 <= j < ndata[i]. Computing both together saves a
+ * transform per series.
+ *
+ * \param[in]    mc    The setup
+ * \param[in]    nfunc Number of series
+ * \param[in]    ndata Length of each pair of series
+ * \param[inout] f     First series, replaced by their autocorrelation
+ * \param[inout] g     Second series, replaced by the cross-correlation
+ */
+void many_correl_cross(gmx_many_correl_t mc, int nfunc, const int ndata[], real *f[], real *g[]);
+
+/*! \brief
+ * Perform many autocorrelation calculations.
  *
- * The vectors c[i] should all have the same length, but this is not checked for.
+ * This routine performs many autocorrelation function calculations using FFTs,
+ * see many_correl_auto(). On return c[i][j] holds the unnormalized
+ * autocorrelation of c[i] at lag j.
  *
- * The c arrays will be extend and filled with zero beyond ndata before
- * computing the correlation.
+ * The vectors c[i] should all have the same length, but this is only
+ * checked in debug builds.
  *
  * The functions uses OpenMP parallellization.
  *
@@ -46,6 +46,7 @@
 #include <cmath>
 
 #include <memory>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -81,6 +82,93 @@ TEST_F (ManyAutocorrelationTest, DifferentLength)
 }
 #endif
 
+//! Direct evaluation of sum_k f[k+j] g[k]
+static real directCorrelation(const std::vector<real> &f, const std::vector<real> &g, size_t j)
+{
+    double sum = 0;
+    for (size_t k = 0; k + j < f.size(); k++)
+    {
+        sum += f[k+j]*g[k];
+    }
+    return sum;
+}
+
+TEST_F (ManyAutocorrelationTest, MatchesDirectSum)
+{
+    std::vector<std::vector<real> > c(3);
+    for (size_t i = 0; i < c.size(); i++)
+    {
+        for (int j = 0; j < 37; j++)
+        {
+            c[i].push_back(std::sin(0.3*j*(i+1)) + 0.1*j);
+        }
+    }
+    std::vector<std::vector<real> > ref = c;
+    many_auto_correl(&c);
+    for (size_t i = 0; i < c.size(); i++)
+    {
+        ASSERT_EQ(ref[i].size(), c[i].size());
+        for (size_t j = 0; j < c[i].size(); j++)
+        {
+            EXPECT_REAL_EQ_TOL(directCorrelation(ref[i], ref[i], j), c[i][j],
+                               gmx::test::absoluteTolerance(1e-4*c[i][0]));
+        }
+    }
+}
+
+TEST_F (ManyAutocorrelationTest, BatchOfDifferentLengths)
+{
+    const int                       nfunc = 6;
+    const int                       ndata[nfunc] = { 1, 2, 7, 100, 257, 1000 };
+    std::vector<std::vector<real> > f(nfunc), g(nfunc);
+    std::vector<real *>             fptr, gptr;
+
+    for (int i = 0; i < nfunc; i++)
+    {
+        for (int j = 0; j < ndata[i]; j++)
+        {
+            f[i].push_back(std::cos(0.1*j + i));
+            g[i].push_back(1 + std::sin(0.7*j*i));
+        }
+    }
+    std::vector<std::vector<real> > fref = f, gref = g;
+    for (int i = 0; i < nfunc; i++)
+    {
+        fptr.push_back(f[i].data());
+        gptr.push_back(g[i].data());
+    }
+
+    gmx_many_correl_t mc = init_many_correl(0);
+    many_correl_cross(mc, nfunc, ndata, fptr.data(), gptr.data());
+    for (int i = 0; i < nfunc; i++)
+    {
+        for (int j = 0; j < ndata[i]; j++)
+        {
+            EXPECT_REAL_EQ_TOL(directCorrelation(fref[i], fref[i], j), f[i][j],
+                               gmx::test::absoluteTolerance(1e-4*ndata[i]));
+            EXPECT_REAL_EQ_TOL(directCorrelation(fref[i], gref[i], j), g[i][j],
+                               gmx::test::absoluteTolerance(1e-4*ndata[i]));
+        }
+    }
+
+    /* The same setup is reused for a second batch */
+    f = fref;
+    for (int i = 0; i < nfunc; i++)
+    {
+        fptr[i] = f[i].data();
+    }
+    many_correl_auto(mc, nfunc, ndata, fptr.data());
+    for (int i = 0; i < nfunc; i++)
+    {
+        for (int j = 0; j < ndata[i]; j++)
+        {
+            EXPECT_REAL_EQ_TOL(directCorrelation(fref[i], fref[i], j), f[i][j],
+                               gmx::test::absoluteTolerance(1e-4*ndata[i]));
+        }
+    }
+    done_many_correl(mc);
+}
+
 }
 
 }
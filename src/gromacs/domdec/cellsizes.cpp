@@ -543,6 +543,72 @@ static void dd_cell_sizes_dlb_root_enforce_limits(gmx_domdec_t *dd,
 }
 
 
+/*! \brief Sets cell sizes along a row that balance a cost model fitted to the measured loads
+ *
+ * The measured load of each cell is assumed to be spread uniformly over
+ * the cell, which gives a piecewise linear cumulative cost along the row.
+ * The boundaries are placed where the cumulative cost reaches multiples
+ * of the average load. For a static inhomogeneous system, such as
+ * an interface, this balances the load in one step instead of
+ * converging geometrically as the relaxation scheme does.
+ *
+ * \param[in]  ncd        The number of cells in the row
+ * \param[in]  cell_f     The current cell boundaries as fractions, size ncd+1
+ * \param[in]  load       The load of the first cell, entries are \p loadStride apart
+ * \param[in]  loadStride The stride between the loads of consecutive cells
+ * \param[out] cell_size  The new cell sizes as fractions, size ncd
+ */
+static void cellSizesFromCostModel(int ncd, const real *cell_f,
+                                   const float *load, int loadStride,
+                                   real *cell_size)
+{
+    double loadSum = 0;
+    for (int i = 0; i < ncd; i++)
+    {
+        loadSum += load[i*loadStride];
+    }
+    if (loadSum <= 0)
+    {
+        for (int i = 0; i < ncd; i++)
+        {
+            cell_size[i] = cell_f[i+1] - cell_f[i];
+        }
+        return;
+    }
+
+    /* Avoid a zero cost density, which would make boundaries degenerate */
+    const double loadMin  = 1e-3*loadSum/ncd;
+    auto         cellLoad = [&](int i)
+        {
+            return std::max(static_cast<double>(load[i*loadStride]), loadMin);
+        };
+
+    double loadTotal = 0;
+    for (int i = 0; i < ncd; i++)
+    {
+        loadTotal += cellLoad(i);
+    }
+
+    /* Walk along the row, placing boundary b where the cumulative cost is b/ncd */
+    double boundaryPrev = 0;
+    double cumulative   = 0;
+    int    cell         = 0;
+    for (int b = 1; b < ncd; b++)
+    {
+        double target = loadTotal*b/ncd;
+        while (cell < ncd - 1 && cumulative + cellLoad(cell) < target)
+        {
+            cumulative += cellLoad(cell);
+            cell++;
+        }
+        double boundary = cell_f[cell] + (target - cumulative)/cellLoad(cell)*(cell_f[cell+1] - cell_f[cell]);
+
+        cell_size[b-1] = boundary - boundaryPrev;
+        boundaryPrev   = boundary;
+    }
+    cell_size[ncd-1] = 1 - boundaryPrev;
+}
+
 static void set_dd_cell_sizes_dlb_root(gmx_domdec_t *dd,
                                        int d, int dim, domdec_root_t *root,
                                        const gmx_ddbox_t *ddbox,
@@ -582,6 +648,32 @@ static void set_dd_cell_sizes_dlb_root(gmx_domdec_t *dd,
             cell_size[i] = 1.0/ncd;
         }
     }
+    else if (dd_load_count(comm) > 0 && comm->bDlbCostModel)
+    {
+        /* Solve for the boundaries that balance the cost model directly */
+        cellSizesFromCostModel(ncd, root->cell_f,
+                               comm->load[d].load + 2, comm->load[d].nload,
+                               cell_size);
+        change_max = 0;
+        for (i = 0; i < ncd; i++)
+        {
+            change     = cell_size[i]/(root->cell_f[i+1] - root->cell_f[i]) - 1;
+            change_max = std::max(change_max, std::max(change, -change));
+        }
+        /* Limit the amount of scaling, but apply the same
+         * fraction of the model change to all cells in the row.
+         */
+        sc = 1;
+        if (change_max > change_limit)
+        {
+            sc = change_limit/change_max;
+        }
+        for (i = 0; i < ncd; i++)
+        {
+            real size_old = root->cell_f[i+1] - root->cell_f[i];
+            cell_size[i]  = size_old + sc*(cell_size[i] - size_old);
+        }
+    }
     else if (dd_load_count(comm) > 0)
     {
         load_aver  = comm->load[d].sum_m/ncd;
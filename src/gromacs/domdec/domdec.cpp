@@ -53,6 +53,7 @@
 #include "gromacs/domdec/dlbtiming.h"
 #include "gromacs/domdec/domdec_network.h"
 #include "gromacs/domdec/ga2la.h"
+#include "gromacs/domdec/haloexchange.h"
 #include "gromacs/ewald/pme.h"
 #include "gromacs/fileio/gmxfio.h"
 #include "gromacs/fileio/pdbio.h"
@@ -339,244 +340,6 @@ void dd_get_constraint_range(const gmx_domdec_t *dd, int *at_start, int *at_end)
     *at_end   = dd->comm->nat[ddnatCON];
 }
 
-void dd_move_x(gmx_domdec_t *dd, matrix box, rvec x[], gmx_wallcycle *wcycle)
-{
-    wallcycle_start(wcycle, ewcMOVEX);
-
-    int                    nzone, nat_tot, n, d, p, i, j, at0, at1, zone;
-    int                   *index, *cgindex;
-    gmx_domdec_comm_t     *comm;
-    gmx_domdec_comm_dim_t *cd;
-    gmx_domdec_ind_t      *ind;
-    rvec                   shift = {0, 0, 0}, *buf, *rbuf;
-    gmx_bool               bPBC, bScrew;
-
-    comm = dd->comm;
-
-    cgindex = dd->cgindex;
-
-    buf = comm->vbuf.v;
-
-    nzone   = 1;
-    nat_tot = dd->nat_home;
-    for (d = 0; d < dd->ndim; d++)
-    {
-        bPBC   = (dd->ci[dd->dim[d]] == 0);
-        bScrew = (bPBC && dd->bScrewPBC && dd->dim[d] == XX);
-        if (bPBC)
-        {
-            copy_rvec(box[dd->dim[d]], shift);
-        }
-        cd = &comm->cd[d];
-        for (p = 0; p < cd->np; p++)
-        {
-            ind   = &cd->ind[p];
-            index = ind->index;
-            n     = 0;
-            if (!bPBC)
-            {
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        copy_rvec(x[j], buf[n]);
-                        n++;
-                    }
-                }
-            }
-            else if (!bScrew)
-            {
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        /* We need to shift the coordinates */
-                        rvec_add(x[j], shift, buf[n]);
-                        n++;
-                    }
-                }
-            }
-            else
-            {
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        /* Shift x */
-                        buf[n][XX] = x[j][XX] + shift[XX];
-                        /* Rotate y and z.
-                         * This operation requires a special shift force
-                         * treatment, which is performed in calc_vir.
-                         */
-                        buf[n][YY] = box[YY][YY] - x[j][YY];
-                        buf[n][ZZ] = box[ZZ][ZZ] - x[j][ZZ];
-                        n++;
-                    }
-                }
-            }
-
-            if (cd->bInPlace)
-            {
-                rbuf = x + nat_tot;
-            }
-            else
-            {
-                rbuf = comm->vbuf2.v;
-            }
-            /* Send and receive the coordinates */
-            dd_sendrecv_rvec(dd, d, dddirBackward,
-                             buf,  ind->nsend[nzone+1],
-                             rbuf, ind->nrecv[nzone+1]);
-            if (!cd->bInPlace)
-            {
-                j = 0;
-                for (zone = 0; zone < nzone; zone++)
-                {
-                    for (i = ind->cell2at0[zone]; i < ind->cell2at1[zone]; i++)
-                    {
-                        copy_rvec(rbuf[j], x[i]);
-                        j++;
-                    }
-                }
-            }
-            nat_tot += ind->nrecv[nzone+1];
-        }
-        nzone += nzone;
-    }
-
-    wallcycle_stop(wcycle, ewcMOVEX);
-}
-
-void dd_move_f(gmx_domdec_t *dd, rvec f[], rvec *fshift, gmx_wallcycle *wcycle)
-{
-    wallcycle_start(wcycle, ewcMOVEF);
-
-    int                    nzone, nat_tot, n, d, p, i, j, at0, at1, zone;
-    int                   *index, *cgindex;
-    gmx_domdec_comm_t     *comm;
-    gmx_domdec_comm_dim_t *cd;
-    gmx_domdec_ind_t      *ind;
-    rvec                  *buf, *sbuf;
-    ivec                   vis;
-    int                    is;
-    gmx_bool               bShiftForcesNeedPbc, bScrew;
-
-    comm = dd->comm;
-
-    cgindex = dd->cgindex;
-
-    buf = comm->vbuf.v;
-
-    nzone   = comm->zones.n/2;
-    nat_tot = dd->nat_tot;
-    for (d = dd->ndim-1; d >= 0; d--)
-    {
-        /* Only forces in domains near the PBC boundaries need to
-           consider PBC in the treatment of fshift */
-        bShiftForcesNeedPbc   = (dd->ci[dd->dim[d]] == 0);
-        bScrew                = (bShiftForcesNeedPbc && dd->bScrewPBC && dd->dim[d] == XX);
-        if (fshift == nullptr && !bScrew)
-        {
-            bShiftForcesNeedPbc = FALSE;
-        }
-        /* Determine which shift vector we need */
-        clear_ivec(vis);
-        vis[dd->dim[d]] = 1;
-        is              = IVEC2IS(vis);
-
-        cd = &comm->cd[d];
-        for (p = cd->np-1; p >= 0; p--)
-        {
-            ind      = &cd->ind[p];
-            nat_tot -= ind->nrecv[nzone+1];
-            if (cd->bInPlace)
-            {
-                sbuf = f + nat_tot;
-            }
-            else
-            {
-                sbuf = comm->vbuf2.v;
-                j    = 0;
-                for (zone = 0; zone < nzone; zone++)
-                {
-                    for (i = ind->cell2at0[zone]; i < ind->cell2at1[zone]; i++)
-                    {
-                        copy_rvec(f[i], sbuf[j]);
-                        j++;
-                    }
-                }
-            }
-            /* Communicate the forces */
-            dd_sendrecv_rvec(dd, d, dddirForward,
-                             sbuf, ind->nrecv[nzone+1],
-                             buf,  ind->nsend[nzone+1]);
-            index = ind->index;
-            /* Add the received forces */
-            n = 0;
-            if (!bShiftForcesNeedPbc)
-            {
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        rvec_inc(f[j], buf[n]);
-                        n++;
-                    }
-                }
-            }
-            else if (!bScrew)
-            {
-                /* fshift should always be defined if this function is
-                 * called when bShiftForcesNeedPbc is true */
-                assert(NULL != fshift);
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        rvec_inc(f[j], buf[n]);
-                        /* Add this force to the shift force */
-                        rvec_inc(fshift[is], buf[n]);
-                        n++;
-                    }
-                }
-            }
-            else
-            {
-                for (i = 0; i < ind->nsend[nzone]; i++)
-                {
-                    at0 = cgindex[index[i]];
-                    at1 = cgindex[index[i]+1];
-                    for (j = at0; j < at1; j++)
-                    {
-                        /* Rotate the force */
-                        f[j][XX] += buf[n][XX];
-                        f[j][YY] -= buf[n][YY];
-                        f[j][ZZ] -= buf[n][ZZ];
-                        if (fshift)
-                        {
-                            /* Add this force to the shift force */
-                            rvec_inc(fshift[is], buf[n]);
-                        }
-                        n++;
-                    }
-                }
-            }
-        }
-        nzone /= 2;
-    }
-    wallcycle_stop(wcycle, ewcMOVEF);
-}
-
 void dd_atom_spread_real(gmx_domdec_t *dd, real v[])
 {
     int                    nzone, nat_tot, n, d, p, i, j, at0, at1, zone;
@@ -3528,6 +3291,8 @@ static gmx_domdec_comm_t *init_dd_comm()
     /* This should be replaced by a unique pointer */
     comm->balanceRegion = ddBalanceRegionAllocate();
 
+    comm->haloExchange = dd_halo_exchange_allocate();
+
     return comm;
 }
 
@@ -4376,6 +4141,7 @@ static void set_dd_envvar_options(FILE *fplog, gmx_domdec_t *dd, int rank_mysim)
 
     dd->bSendRecv2      = dd_getenv(fplog, "GMX_DD_USE_SENDRECV2", 0);
     comm->dlb_scale_lim = dd_getenv(fplog, "GMX_DLB_MAX_BOX_SCALING", 10);
+    comm->bDlbCostModel = dd_getenv(fplog, "GMX_DLB_COST_MODEL", 0);
     comm->eFlop         = dd_getenv(fplog, "GMX_DLB_BASED_ON_FLOPS", 0);
     int recload         = dd_getenv(fplog, "GMX_DD_RECORD_LOAD", 1);
     comm->nstDDDump     = dd_getenv(fplog, "GMX_DD_NST_DUMP", 0);
@@ -4387,6 +4153,11 @@ static void set_dd_envvar_options(FILE *fplog, gmx_domdec_t *dd, int rank_mysim)
         fprintf(fplog, "Will use two sequential MPI_Sendrecv calls instead of two simultaneous non-blocking MPI_Irecv and MPI_Isend pairs for constraint and vsite communication\n");
     }
 
+    if (comm->bDlbCostModel && fplog)
+    {
+        fprintf(fplog, "Will set the DLB cell boundaries from a cost model of the measured cell loads\n");
+    }
+
     if (comm->eFlop)
     {
         if (fplog)
@@ -4473,6 +4244,15 @@ gmx_domdec_t *init_domain_decomposition(FILE *fplog, t_commrec *cr,
     return dd;
 }
 
+void done_domdec(gmx_domdec_t *dd)
+{
+    /* The halo exchange holds MPI requests, which need to be freed
+     * before MPI is finalized. The rest of dd is not freed yet.
+     */
+    dd_halo_exchange_free(dd->comm->haloExchange);
+    dd->comm->haloExchange = nullptr;
+}
+
 static gmx_bool test_dd_cutoff(t_commrec *cr,
                                t_state *state, const t_inputrec *ir,
                                real cutoff_req)
@@ -5641,6 +5421,9 @@ static void setup_dd_communication(gmx_domdec_t *dd,
                       nullptr, comm->bLocalCG);
     }
 
+    /* Store the atom indices and buffers for the coordinate and force halo exchange */
+    dd_halo_exchange_setup(dd);
+
     if (debug)
     {
         fprintf(debug, "Finished setting up DD communication, zones:");
@@ -6224,6 +6007,10 @@ static void dd_sort_state(gmx_domdec_t *dd, rvec *cgcm, t_forcerec *fr, t_state
     {
         order_vec_atom(dd->ncg_home, cgindex, cgsort, as_rvec_array(state->cg_p.data()), vbuf);
     }
+    for (auto &emVec : state->em_vecs)
+    {
+        order_vec_atom(dd->ncg_home, cgindex, cgsort, as_rvec_array(emVec.data()), vbuf);
+    }
 
     if (fr->cutoff_scheme == ecutsGROUP)
     {
@@ -208,6 +208,9 @@ gmx_domdec_t *init_domain_decomposition(FILE                *fplog,
                                         const matrix         box,
                                         const rvec          *xGlobal);
 
+/*! \brief Frees the halo exchange setup of \p dd, should be called before MPI is finalized */
+void done_domdec(gmx_domdec_t *dd);
+
 /*! \brief Initialize data structures for bonded interactions */
 void dd_init_bondeds(FILE              *fplog,
                      gmx_domdec_t      *dd,
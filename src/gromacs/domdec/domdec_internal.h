@@ -55,6 +55,7 @@ struct t_commrec;
 /*! \cond INTERNAL */
 
 struct BalanceRegion;
+struct HaloExchange;
 
 typedef struct
 {
@@ -301,6 +302,8 @@ struct gmx_domdec_comm_t
     gmx_domdec_comm_dim_t cd[DIM];
     /** The maximum number of cells to communicate with in one dimension */
     int                   maxpulse;
+    /** The atom indices, buffers and requests for the coordinate and force halo exchange */
+    HaloExchange         *haloExchange;
 
     /** Which cg distribution is stored on the master node,
      *  stored as DD partitioning call count.
@@ -358,6 +361,7 @@ struct gmx_domdec_comm_t
 
     /* Information for managing the dynamic load balancing */
     int            dlb_scale_lim;      /**< Maximum DLB scaling per load balancing step in percent */
+    gmx_bool       bDlbCostModel;      /**< Set cell boundaries by balancing a cost model fitted to the measured loads */
 
     BalanceRegion *balanceRegion;      /**< Struct for timing the force load balancing region */
 
@@ -53,6 +53,7 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include "gromacs/domdec/domdec.h"
 #include "gromacs/domdec/domdec_network.h"
@@ -111,6 +112,25 @@ typedef struct {
     int        excl_count;       /**< The total exclusion count for \p excl */
 } thread_work_t;
 
+/*! \brief The bonded interactions assigned to the local atoms, for incremental updates
+ *
+ * Interactions are linked to their first atom in the reverse topology.
+ * For each local atom we store the offsets in the reverse ilist of
+ * the entries that were assigned to this domain. Without distance checks,
+ * whether an entry is assigned only depends on the zones of its atoms.
+ * So as long as these did not change, the entries can be added again
+ * with only a global to local index conversion.
+ */
+struct local_assignment_t
+{
+    std::vector<int>                 atomGlobal;  /**< The global index of each local atom */
+    std::vector<int>                 atomCell;    /**< The ga2la cell of each local atom */
+    std::vector<int>                 entryThread; /**< The thread that stored the entries of each local atom */
+    std::vector<int>                 entryStart;  /**< The start of the entries of each local atom in \p entries */
+    std::vector<int>                 entryEnd;    /**< The end of the entries of each local atom in \p entries */
+    std::vector < std::vector<int> > entries;     /**< Per thread, the reverse ilist offsets of the assigned entries, intermolecular ones stored as -1 - offset */
+};
+
 /*! \brief Struct for the reverse topology: links bonded interactions to atomsx */
 struct gmx_reverse_top_t
 {
@@ -133,6 +153,15 @@ struct gmx_reverse_top_t
     /* Work data structures for multi-threading */
     int            nthread;           /**< The number of threads to be used */
     thread_work_t *th_work;           /**< Thread work array for local topology generation */
+
+    /* Data for incremental updates of the local bonded interactions */
+    reverse_ilist_t   *ril_mt_owner;       /**< For each moltype atom, the atoms with entries in ril_mt involving it */
+    reverse_ilist_t    ril_intermol_owner; /**< For each atom, the atoms with entries in ril_intermol involving it */
+    local_assignment_t assignment[2];      /**< The previous and the current bonded assignment */
+    int                assignmentCur;      /**< The index of the current assignment in \p assignment */
+    gmx_bool           bAssignmentValid;   /**< Can the current assignment be updated incrementally? */
+    std::vector<int>   prevAtomIndex;      /**< For each local atom, its index in the previous assignment, -1 when it needs to be reassigned */
+    std::vector<int>   changedAtoms;       /**< Work buffer for the global indices of atoms that changed zone */
     //! @endcond
 };
 
@@ -659,6 +688,55 @@ static void destroy_reverse_ilist(reverse_ilist_t *ril)
     sfree(ril->il);
 }
 
+/*! \brief Make the list of owner atoms, i.e. the atoms an interaction is linked to in \p ril, for each atom of \p ril
+ *
+ * Only interactions whose assignment depends on the zones of the other
+ * atoms are considered: settles, vsites and single-atom interactions
+ * are assigned based on the zone of the owner only.
+ */
+static void make_reverse_owners(const reverse_ilist_t *ril, int numAtoms,
+                                reverse_ilist_t *owner)
+{
+    std::vector < std::vector<int> > ownersOfAtom(numAtoms);
+
+    for (int o = 0; o < numAtoms; o++)
+    {
+        int j = ril->index[o];
+        while (j < ril->index[o + 1])
+        {
+            int ftype = ril->il[j];
+            int nral  = NRAL(ftype);
+            if (ftype != F_SETTLE && nral >= 2 &&
+                !(interaction_function[ftype].flags & IF_VSITE))
+            {
+                for (int k = 2; k <= nral; k++)
+                {
+                    int a = ril->il[j + 1 + k];
+                    if (ownersOfAtom[a].empty() || ownersOfAtom[a].back() != o)
+                    {
+                        ownersOfAtom[a].push_back(o);
+                    }
+                }
+            }
+            j += 2 + nral_rt(ftype);
+        }
+    }
+
+    snew(owner->index, numAtoms + 1);
+    owner->index[0] = 0;
+    for (int a = 0; a < numAtoms; a++)
+    {
+        owner->index[a + 1] = owner->index[a] + ownersOfAtom[a].size();
+    }
+    snew(owner->il, owner->index[numAtoms]);
+    for (int a = 0; a < numAtoms; a++)
+    {
+        std::copy(ownersOfAtom[a].begin(), ownersOfAtom[a].end(),
+                  owner->il + owner->index[a]);
+    }
+    owner->numAtomsInMolecule = numAtoms;
+}
+
 /*! \brief Generate the reverse topology */
 static gmx_reverse_top_t *make_reverse_top(const gmx_mtop_t *mtop, gmx_bool bFE,
                                            const int * const * const * vsite_pbc_molt,
@@ -669,7 +747,8 @@ static gmx_reverse_top_t *make_reverse_top(const gmx_mtop_t *mtop, gmx_bool bFE,
     int               *nint_mt;
     int                thread;
 
-    snew(rt, 1);
+    /* Value initialization, so all plain members are zero as with snew */
+    rt = new gmx_reverse_top_t();
 
     /* Should we include constraints (for SHAKE) in rt? */
     rt->bConstr = bConstr;
@@ -697,6 +776,12 @@ static gmx_reverse_top_t *make_reverse_top(const gmx_mtop_t *mtop, gmx_bool bFE,
 
         rt->ril_mt_tot_size += rt->ril_mt[mt].index[molt.atoms.nr];
     }
+    snew(rt->ril_mt_owner, mtop->moltype.size());
+    for (size_t mt = 0; mt < mtop->moltype.size(); mt++)
+    {
+        make_reverse_owners(&rt->ril_mt[mt], mtop->moltype[mt].atoms.nr,
+                            &rt->ril_mt_owner[mt]);
+    }
     if (debug)
     {
         fprintf(debug, "The total size of the atom to interaction index is %d integers\n", rt->ril_mt_tot_size);
@@ -726,6 +811,8 @@ static gmx_reverse_top_t *make_reverse_top(const gmx_mtop_t *mtop, gmx_bool bFE,
                                nullptr,
                                rt->bConstr, rt->bSettle, rt->bBCheck, FALSE,
                                &rt->ril_intermol);
+        make_reverse_owners(&rt->ril_intermol, mtop->natoms,
+                            &rt->ril_intermol_owner);
     }
 
     if (bFE && gmx_mtop_bondeds_free_energy(mtop))
@@ -754,6 +841,10 @@ static gmx_reverse_top_t *make_reverse_top(const gmx_mtop_t *mtop, gmx_bool bFE,
 
     rt->nthread = gmx_omp_nthreads_get(emntDomdec);
     snew(rt->th_work, rt->nthread);
+    for (local_assignment_t &assignment : rt->assignment)
+    {
+        assignment.entries.resize(rt->nthread);
+    }
     if (vsite_pbc_molt != nullptr)
     {
         for (thread = 0; thread < rt->nthread; thread++)
@@ -1277,6 +1368,9 @@ static void combine_idef(t_idef *dest, const thread_work_t *src, int nsrc,
 }
 
 /*! \brief Check and when available assign bonded interactions for local atom i
+ *
+ * The reverse ilist offsets of the assigned entries are appended
+ * to \p assigned, negated for intermolecular interactions.
  */
 static inline void
 check_assign_interactions_atom(int i, int i_gl,
@@ -1298,6 +1392,7 @@ check_assign_interactions_atom(int i, int i_gl,
                                int **vsite_pbc, int *vsite_pbc_nalloc,
                                int iz,
                                gmx_bool bBCheck,
+                               std::vector<int> *assigned,
                                int *nbonded_local)
 {
     int j;
@@ -1309,7 +1404,9 @@ check_assign_interactions_atom(int i, int i_gl,
         const t_iatom *iatoms;
         int            nral;
         t_iatom        tiatoms[1 + MAXATOMLIST];
+        int            entry;
 
+        entry  = (bInterMolInteractions ? -1 - j : j);
         ftype  = rtil[j++];
         iatoms = rtil + j;
         nral   = NRAL(ftype);
@@ -1329,6 +1426,7 @@ check_assign_interactions_atom(int i, int i_gl,
                 tiatoms[3] = i + iatoms[3] - iatoms[1];
                 add_ifunc(nral, tiatoms, &idef->il[ftype]);
                 (*nbonded_local)++;
+                assigned->push_back(entry);
             }
             j += 1 + nral;
         }
@@ -1341,6 +1439,7 @@ check_assign_interactions_atom(int i, int i_gl,
                 add_vsite(dd->ga2la, index, rtil, ftype, nral,
                           TRUE, i, i_gl, i_mol,
                           iatoms, idef, vsite_pbc, vsite_pbc_nalloc);
+                assigned->push_back(entry);
             }
             j += 1 + nral + 2;
         }
@@ -1514,16 +1613,116 @@ check_assign_interactions_atom(int i, int i_gl,
                 {
                     (*nbonded_local)++;
                 }
+                assigned->push_back(entry);
             }
             j += 1 + nral;
         }
     }
 }
 
+/*! \brief Add the bonded interactions of local atom i that were assigned at the previous partitioning
+ *
+ * The entries \p entry to \p entryEnd are reverse ilist offsets as stored
+ * by check_assign_interactions_atom. The zones of all atoms involved
+ * did not change, so the interactions are still assigned to us and
+ * we only need to convert the atom indices. The entries are appended
+ * to \p assigned.
+ */
+static inline void
+add_assigned_interactions_atom(int i, int i_gl,
+                               int mol, int i_mol,
+                               int numAtomsInMolecule,
+                               const reverse_ilist_t *ril_mt,
+                               const reverse_ilist_t *ril_intermol,
+                               const int *entry, const int *entryEnd,
+                               const gmx_domdec_t *dd,
+                               const gmx_molblock_t *molb,
+                               const t_iparams *ip_in,
+                               t_idef *idef,
+                               int **vsite_pbc, int *vsite_pbc_nalloc,
+                               gmx_bool bBCheck,
+                               std::vector<int> *assigned,
+                               int *nbonded_local)
+{
+    for (; entry < entryEnd; entry++)
+    {
+        gmx_bool       bInterMol;
+        const int     *index, *rtil;
+        int            j, ftype, nral, k;
+        const t_iatom *iatoms;
+        t_iatom        tiatoms[1 + MAXATOMLIST];
+
+        bInterMol = (*entry < 0);
+        index     = (bInterMol ? ril_intermol->index : ril_mt->index);
+        rtil      = (bInterMol ? ril_intermol->il : ril_mt->il);
+        j         = (bInterMol ? -1 - *entry : *entry);
+        ftype     = rtil[j];
+        iatoms    = rtil + j + 1;
+        nral      = NRAL(ftype);
+
+        if (ftype == F_SETTLE)
+        {
+            tiatoms[0] = iatoms[0];
+            tiatoms[1] = i;
+            tiatoms[2] = i + iatoms[2] - iatoms[1];
+            tiatoms[3] = i + iatoms[3] - iatoms[1];
+            add_ifunc(nral, tiatoms, &idef->il[ftype]);
+            (*nbonded_local)++;
+        }
+        else if (interaction_function[ftype].flags & IF_VSITE)
+        {
+            add_vsite(dd->ga2la, index, rtil, ftype, nral,
+                      TRUE, i, i_gl, i_mol,
+                      iatoms, idef, vsite_pbc, vsite_pbc_nalloc);
+        }
+        else
+        {
+            tiatoms[0] = iatoms[0];
+            tiatoms[1] = i;
+            if (ftype == F_POSRES)
+            {
+                add_posres(mol, i_mol, numAtomsInMolecule,
+                           molb, tiatoms, ip_in, idef);
+            }
+            else if (ftype == F_FBPOSRES)
+            {
+                add_fbposres(mol, i_mol, numAtomsInMolecule,
+                             molb, tiatoms, ip_in, idef);
+            }
+            for (k = 2; k <= nral; k++)
+            {
+                int k_gl, kz;
+
+                if (!bInterMol)
+                {
+                    k_gl = i_gl + iatoms[k] - i_mol;
+                }
+                else
+                {
+                    k_gl = iatoms[k];
+                }
+                if (!ga2la_get(dd->ga2la, k_gl, &tiatoms[k], &kz))
+                {
+                    gmx_incons("An atom of an incrementally assigned bonded interaction is not local");
+                }
+            }
+            add_ifunc(nral, tiatoms, &idef->il[ftype]);
+            if (bBCheck ||
+                !(interaction_function[ftype].flags & IF_LIMZERO))
+            {
+                (*nbonded_local)++;
+            }
+        }
+        assigned->push_back(*entry);
+    }
+}
+
 /*! \brief This function looks up and assigns bonded interactions for zone iz.
  *
  * With thread parallelizing each thread acts on a different atom range:
- * at_start to at_end.
+ * at_start to at_end. The assigned entries are stored in \p cur.
+ * When \p prev is not nullptr, atoms with a valid prevAtomIndex
+ * get the interactions that were assigned to them in \p prev.
  */
 static int make_bondeds_zone(gmx_domdec_t *dd,
                              const gmx_domdec_zones_t *zones,
@@ -1536,13 +1735,17 @@ static int make_bondeds_zone(gmx_domdec_t *dd,
                              int **vsite_pbc,
                              int *vsite_pbc_nalloc,
                              int izone,
-                             int at_start, int at_end)
+                             int at_start, int at_end,
+                             const local_assignment_t *prev,
+                             local_assignment_t *cur,
+                             int thread)
 {
     int                i, i_gl, mb, mt, mol, i_mol;
     int               *index, *rtil;
     gmx_bool           bBCheck;
     gmx_reverse_top_t *rt;
     int                nbonded_local;
+    std::vector<int>  *assigned;
 
     rt = dd->reverse_top;
 
@@ -1550,11 +1753,53 @@ static int make_bondeds_zone(gmx_domdec_t *dd,
 
     nbonded_local = 0;
 
+    assigned = &cur->entries[thread];
+
     for (i = at_start; i < at_end; i++)
     {
+        int la, cell = -1;
+
         /* Get the global atom number */
         i_gl = dd->gatindex[i];
+
+        cur->atomGlobal[i]  = i_gl;
+        cur->entryThread[i] = thread;
+        cur->entryStart[i]  = assigned->size();
+
+        if (prev != nullptr && rt->prevAtomIndex[i] >= 0)
+        {
+            int                     p       = rt->prevAtomIndex[i];
+            const std::vector<int> &entries = prev->entries[prev->entryThread[p]];
+
+            /* The zone did not change */
+            cur->atomCell[i] = prev->atomCell[p];
+
+            if (prev->entryEnd[p] > prev->entryStart[p])
+            {
+                global_atomnr_to_moltype_ind(rt, i_gl, &mb, &mt, &mol, &i_mol);
+
+                add_assigned_interactions_atom(i, i_gl, mol, i_mol,
+                                               rt->ril_mt[mt].numAtomsInMolecule,
+                                               &rt->ril_mt[mt], &rt->ril_intermol,
+                                               entries.data() + prev->entryStart[p],
+                                               entries.data() + prev->entryEnd[p],
+                                               dd, &molb[mb], ip_in,
+                                               idef, vsite_pbc, vsite_pbc_nalloc,
+                                               bBCheck,
+                                               assigned,
+                                               &nbonded_local);
+            }
+            cur->entryEnd[i] = assigned->size();
+
+            continue;
+        }
+
         global_atomnr_to_moltype_ind(rt, i_gl, &mb, &mt, &mol, &i_mol);
+
+        /* Store the zone, with the pulse flag, for the next update */
+        ga2la_get(dd->ga2la, i_gl, &la, &cell);
+        cur->atomCell[i] = cell;
+
         /* Check all intramolecular interactions assigned to this atom */
         index = rt->ril_mt[mt].index;
         rtil  = rt->ril_mt[mt].il;
@@ -1573,6 +1818,7 @@ static int make_bondeds_zone(gmx_domdec_t *dd,
                                        idef, vsite_pbc, vsite_pbc_nalloc,
                                        izone,
                                        bBCheck,
+                                       assigned,
                                        &nbonded_local);
 
 
@@ -1596,8 +1842,11 @@ static int make_bondeds_zone(gmx_domdec_t *dd,
                                            idef, vsite_pbc, vsite_pbc_nalloc,
                                            izone,
                                            bBCheck,
+                                           assigned,
                                            &nbonded_local);
         }
+
+        cur->entryEnd[i] = assigned->size();
     }
 
     return nbonded_local;
@@ -1905,7 +2154,97 @@ static void clear_idef(t_idef *idef)
     }
 }
 
-/*! \brief Generate and store all required local bonded interactions in \p idef and local exclusions in \p lexcls */
+/*! \brief Invalidates the previous assignment of local atom \p a_gl, when local */
+static inline void clear_prev_atom_index(const gmx_domdec_t *dd,
+                                         std::vector<int> *prevAtomIndex,
+                                         int a_gl)
+{
+    int a, cell;
+
+    if (ga2la_get(dd->ga2la, a_gl, &a, &cell) &&
+        a < static_cast<int>(prevAtomIndex->size()))
+    {
+        (*prevAtomIndex)[a] = -1;
+    }
+}
+
+/*! \brief Determines which local atoms can keep their previously assigned bonded interactions
+ *
+ * Sets rt->prevAtomIndex for the \p numAtoms local atoms in the bonded
+ * zones. An atom needs to be reassigned when it is new or changed zone,
+ * or when an atom in one of its reverse ilist entries did.
+ */
+static void set_prev_atom_indices(const gmx_domdec_t       *dd,
+                                  gmx_reverse_top_t        *rt,
+                                  const local_assignment_t *prev,
+                                  int                       numAtoms)
+{
+    std::vector<int> &prevAtomIndex = rt->prevAtomIndex;
+    std::vector<int> &changed       = rt->changedAtoms;
+
+    prevAtomIndex.assign(numAtoms, -1);
+    changed.clear();
+
+    /* Match the previous local atoms with the current ones */
+    for (size_t p = 0; p < prev->atomGlobal.size(); p++)
+    {
+        int a, cell;
+
+        if (ga2la_get(dd->ga2la, prev->atomGlobal[p], &a, &cell) &&
+            a < numAtoms && cell == prev->atomCell[p])
+        {
+            prevAtomIndex[a] = p;
+        }
+        else
+        {
+            changed.push_back(prev->atomGlobal[p]);
+        }
+    }
+    for (int a = 0; a < numAtoms; a++)
+    {
+        if (prevAtomIndex[a] < 0)
+        {
+            changed.push_back(dd->gatindex[a]);
+        }
+    }
+
+    /* The atoms owning interactions that involve atoms that changed
+     * need to be reassigned.
+     */
+    for (int a_gl : changed)
+    {
+        int                    mb, mt, mol, a_mol;
+        const reverse_ilist_t *owner;
+
+        global_atomnr_to_moltype_ind(rt, a_gl, &mb, &mt, &mol, &a_mol);
+        owner = &rt->ril_mt_owner[mt];
+        for (int j = owner->index[a_mol]; j < owner->index[a_mol + 1]; j++)
+        {
+            clear_prev_atom_index(dd, &prevAtomIndex, a_gl + owner->il[j] - a_mol);
+        }
+        if (rt->bIntermolecularInteractions)
+        {
+            owner = &rt->ril_intermol_owner;
+            for (int j = owner->index[a_gl]; j < owner->index[a_gl + 1]; j++)
+            {
+                clear_prev_atom_index(dd, &prevAtomIndex, owner->il[j]);
+            }
+        }
+    }
+
+    if (debug)
+    {
+        int numReassigned = std::count(prevAtomIndex.begin(), prevAtomIndex.end(), -1);
+        fprintf(debug, "Incremental bonded assignment: %zu atoms changed zone, reassigning %d of %d atoms\n",
+                changed.size(), numReassigned, numAtoms);
+    }
+}
+
+/*! \brief Generate and store all required local bonded interactions in \p idef and local exclusions in \p lexcls
+ *
+ * With \p bIncremental, the previous bonded assignment is updated
+ * instead of assigning the interactions of all atoms from scratch.
+ */
 static int make_local_bondeds_excls(gmx_domdec_t *dd,
                                     gmx_domdec_zones_t *zones,
                                     const gmx_mtop_t *mtop,
@@ -1914,14 +2253,17 @@ static int make_local_bondeds_excls(gmx_domdec_t *dd,
                                     real rc,
                                     int *la2lc, t_pbc *pbc_null, rvec *cg_cm,
                                     t_idef *idef, gmx_vsite_t *vsite,
-                                    t_blocka *lexcls, int *excl_count)
+                                    t_blocka *lexcls, int *excl_count,
+                                    gmx_bool bIncremental)
 {
-    int                nzone_bondeds, nzone_excl;
-    int                izone, cg0, cg1;
-    real               rc2;
-    int                nbonded_local;
-    int                thread;
-    gmx_reverse_top_t *rt;
+    int                 nzone_bondeds, nzone_excl;
+    int                 izone, cg0, cg1;
+    real                rc2;
+    int                 nbonded_local;
+    int                 thread;
+    gmx_reverse_top_t  *rt;
+    int                 numAtomsBondeds;
+    local_assignment_t *prev, *cur;
 
     if (dd->reverse_top->bInterCGInteractions)
     {
@@ -1952,6 +2294,26 @@ static int make_local_bondeds_excls(gmx_domdec_t *dd,
 
     rc2 = rc*rc;
 
+    /* Set up the storage of the assignment, the previous one is kept */
+    numAtomsBondeds = dd->cgindex[zones->cg_range[nzone_bondeds]];
+    prev            = nullptr;
+    if (bIncremental)
+    {
+        prev = &rt->assignment[rt->assignmentCur];
+        set_prev_atom_indices(dd, rt, prev, numAtomsBondeds);
+    }
+    rt->assignmentCur = 1 - rt->assignmentCur;
+    cur               = &rt->assignment[rt->assignmentCur];
+    cur->atomGlobal.resize(numAtomsBondeds);
+    cur->atomCell.resize(numAtomsBondeds);
+    cur->entryThread.resize(numAtomsBondeds);
+    cur->entryStart.resize(numAtomsBondeds);
+    cur->entryEnd.resize(numAtomsBondeds);
+    for (std::vector<int> &entries : cur->entries)
+    {
+        entries.clear();
+    }
+
     /* Clear the counts */
     clear_idef(idef);
     nbonded_local = 0;
@@ -2016,7 +2378,8 @@ static int make_local_bondeds_excls(gmx_domdec_t *dd,
                                       idef_t,
                                       vsite_pbc, vsite_pbc_nalloc,
                                       izone,
-                                      dd->cgindex[cg0t], dd->cgindex[cg1t]);
+                                      dd->cgindex[cg0t], dd->cgindex[cg1t],
+                                      prev, cur, thread);
 
                 if (izone < nzone_excl)
                 {
@@ -2104,6 +2467,57 @@ void dd_make_local_cgs(gmx_domdec_t *dd, t_block *lcgs)
     lcgs->index = dd->cgindex;
 }
 
+/*! \brief Checks that the incrementally updated bonded interactions in \p idef match a full assignment
+ *
+ * Rebuilds the local bondeds from scratch into \p idef and compares them
+ * with the incremental result, the interactions should be identical
+ * and in the same order.
+ */
+static void check_incremental_bondeds(gmx_domdec_t *dd,
+                                      gmx_domdec_zones_t *zones,
+                                      const gmx_mtop_t *mtop,
+                                      const int *cginfo,
+                                      real rc,
+                                      rvec *cg_cm,
+                                      t_idef *idef, gmx_vsite_t *vsite,
+                                      t_blocka *lexcls,
+                                      int nbonded_incremental)
+{
+    std::vector < std::vector<t_iatom> > iatoms(F_NRE);
+    ivec rcheck;
+    int  nbonded, nexcl, ftype;
+
+    for (ftype = 0; ftype < F_NRE; ftype++)
+    {
+        iatoms[ftype].assign(idef->il[ftype].iatoms,
+                             idef->il[ftype].iatoms + idef->il[ftype].nr);
+    }
+
+    clear_ivec(rcheck);
+    nbonded = make_local_bondeds_excls(dd, zones, mtop, cginfo,
+                                       FALSE, rcheck, FALSE, rc,
+                                       dd->la2lc, nullptr, cg_cm,
+                                       idef, vsite, lexcls, &nexcl,
+                                       FALSE);
+
+    for (ftype = 0; ftype < F_NRE; ftype++)
+    {
+        const t_ilist *il = &idef->il[ftype];
+        if (static_cast<size_t>(il->nr) != iatoms[ftype].size() ||
+            !std::equal(il->iatoms, il->iatoms + il->nr, iatoms[ftype].begin()))
+        {
+            gmx_fatal(FARGS, "The incremental update of the local %s interactions on rank %d gave %zu entries which do not match the %d entries of a full assignment",
+                      interaction_function[ftype].longname, dd->rank,
+                      iatoms[ftype].size(), il->nr);
+        }
+    }
+    if (nbonded != nbonded_incremental)
+    {
+        gmx_fatal(FARGS, "The incremental update of the local topology on rank %d gave %d bonded interactions instead of %d",
+                  dd->rank, nbonded_incremental, nbonded);
+    }
+}
+
 void dd_make_local_top(gmx_domdec_t *dd, gmx_domdec_zones_t *zones,
                        int npbcdim, matrix box,
                        rvec cellsize_min, ivec npulse,
@@ -2179,13 +2593,30 @@ void dd_make_local_top(gmx_domdec_t *dd, gmx_domdec_zones_t *zones,
         }
     }
 
+    gmx_reverse_top_t *rt = dd->reverse_top;
+
+    /* Without distance checks, the assignment only depends on which atoms
+     * are present in which zone. Then we only need to reassign
+     * the interactions of atoms for which this changed.
+     */
+    gmx_bool bIncremental = (rt->bAssignmentValid && !(bRCheckMB || bRCheck2B));
+
     dd->nbonded_local =
         make_local_bondeds_excls(dd, zones, mtop, fr->cginfo,
                                  bRCheckMB, rcheck, bRCheck2B, rc,
                                  dd->la2lc,
                                  pbc_null, cgcm_or_x,
                                  &ltop->idef, vsite,
-                                 &ltop->excls, &nexcl);
+                                 &ltop->excls, &nexcl,
+                                 bIncremental);
+
+    if (bIncremental && dd->comm->DD_debug > 0)
+    {
+        check_incremental_bondeds(dd, zones, mtop, fr->cginfo, rc,
+                                  cgcm_or_x, &ltop->idef, vsite,
+                                  &ltop->excls, dd->nbonded_local);
+    }
+    rt->bAssignmentValid = !(bRCheckMB || bRCheck2B);
 
     /* The ilist is not sorted yet,
      * we can only do this when we have the charge arrays.
@@ -232,7 +232,18 @@ static inline void ga2la_del(gmx_ga2la_t *ga2la, int a_gl)
             if (ind_prev >= 0)
             {
                 ga2la->lal[ind_prev].next = ga2la->lal[ind].next;
-
+            }
+            else if (ga2la->lal[ind].next >= 0)
+            {
+                /* We delete the head of a list, move the next element
+                 * into the head position, so the list stays reachable.
+                 */
+                int ind_next    = ga2la->lal[ind].next;
+                ga2la->lal[ind] = ga2la->lal[ind_next];
+                ind             = ind_next;
+            }
+            if (ind >= ga2la->mod)
+            {
                 /* This index is a linked entry, so we free an entry.
                  * Check if we are creating the first empty space.
                  */
@@ -0,0 +1,572 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+/*! \internal \file
+ *
+ * \brief This file defines the halo exchange of coordinates and forces
+ * between domain decomposition cells.
+ *
+ * \author Berk Hess <hess@kth.se>
+ * \ingroup module_domdec
+ */
+
+#include "gmxpre.h"
+
+#include "haloexchange.h"
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "gromacs/domdec/domdec.h"
+#include "gromacs/domdec/domdec_network.h"
+#include "gromacs/domdec/domdec_struct.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
+#include "gromacs/pbcutil/ishift.h"
+#include "gromacs/timing/wallcycle.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxmpi.h"
+
+#include "domdec_internal.h"
+
+/*! \brief The minimum number of atoms per thread for thread-parallel packing and unpacking */
+static constexpr int c_haloMinAtomsPerThread = 512;
+
+/*! \brief The first MPI tag used for the halo pulses
+ *
+ * Each pulse uses its own pair of tags, so receives can be posted
+ * for all pulses at once without matching any other DD message.
+ */
+static constexpr int c_haloTagOffset = 16;
+
+/*! \internal \brief Atom indices, buffers and MPI requests for one grid pulse */
+struct HaloPulse
+{
+    std::vector<int>       atomIndex;             /**< Local indices of the atoms to send */
+    int                    numAtomsRecv  = 0;     /**< The number of atoms to receive */
+    bool                   inPlace       = false; /**< Whether the received atoms are contiguous in the local atom range */
+    int                    atomStartRecv = 0;     /**< The first local atom index of the received atoms, used in place */
+    std::vector<gmx::RVec> sendBuffer;            /**< Coordinate send and force receive buffer, size atomIndex.size() */
+    std::vector<gmx::RVec> recvBuffer;            /**< Coordinate receive and force send buffer, size numAtomsRecv, empty in place */
+    int                    tag = 0;               /**< MPI tag for coordinates, tag + 1 is used for forces */
+#if GMX_LIB_MPI
+    MPI_Request            xSendRequest   = MPI_REQUEST_NULL; /**< Persistent coordinate send request */
+    MPI_Request            xRecvRequest   = MPI_REQUEST_NULL; /**< Persistent coordinate receive request, not used in place */
+    MPI_Request            fSendRequest   = MPI_REQUEST_NULL; /**< Persistent force send request, not used in place */
+    MPI_Request            fRecvRequest   = MPI_REQUEST_NULL; /**< Persistent force receive request */
+    MPI_Request            inPlaceRequest = MPI_REQUEST_NULL; /**< In place coordinate receive or force send request */
+#endif
+};
+
+/*! \internal \brief Setup for the halo exchange, indexed by DD dimension index and pulse */
+struct HaloExchange
+{
+    std::array<std::vector<HaloPulse>, DIM> pulses;                          /**< The pulses per DD dimension index */
+    int                                     numThreads             = 1;     /**< The number of OpenMP threads to use */
+    bool                                    usePersistentRequests = false; /**< Whether persistent MPI requests are set up */
+};
+
+HaloExchange *dd_halo_exchange_allocate()
+{
+    return new HaloExchange;
+}
+
+/*! \brief Frees the persistent requests of all pulses */
+static void freePersistentRequests(HaloExchange *halo)
+{
+#if GMX_LIB_MPI
+    for (auto &dimPulses : halo->pulses)
+    {
+        for (HaloPulse &pulse : dimPulses)
+        {
+            for (MPI_Request *request : { &pulse.xSendRequest, &pulse.xRecvRequest,
+                                          &pulse.fSendRequest, &pulse.fRecvRequest })
+            {
+                if (*request != MPI_REQUEST_NULL)
+                {
+                    MPI_Request_free(request);
+                }
+            }
+        }
+    }
+#endif
+    halo->usePersistentRequests = false;
+}
+
+void dd_halo_exchange_free(HaloExchange *halo)
+{
+    if (halo != nullptr)
+    {
+        freePersistentRequests(halo);
+        delete halo;
+    }
+}
+
+/*! \brief Creates persistent requests bound to the pulse buffers
+ *
+ * Coordinates are sent backward and forces forward, as with
+ * dd_sendrecv_rvec using dddirBackward and dddirForward, respectively.
+ * Requests are only created for non-empty messages; the counts
+ * of the sending and receiving ranks always match. Pulses that
+ * receive in place communicate directly with the coordinate and force
+ * arrays passed to dd_move_x and dd_move_f, so for those the coordinate
+ * receive and force send are started per call instead.
+ */
+static void initPersistentRequests(const gmx_domdec_t gmx_unused *dd,
+                                   HaloExchange gmx_unused       *halo)
+{
+#if GMX_LIB_MPI
+    for (int d = 0; d < dd->ndim; d++)
+    {
+        const int rankForward  = dd->neighbor[d][0];
+        const int rankBackward = dd->neighbor[d][1];
+
+        for (HaloPulse &pulse : halo->pulses[d])
+        {
+            const int numBytesSend = pulse.sendBuffer.size()*sizeof(rvec);
+            const int numBytesRecv = pulse.numAtomsRecv*sizeof(rvec);
+
+            if (numBytesSend > 0)
+            {
+                MPI_Send_init(pulse.sendBuffer.data(), numBytesSend, MPI_BYTE,
+                              rankBackward, pulse.tag, dd->mpi_comm_all,
+                              &pulse.xSendRequest);
+                MPI_Recv_init(pulse.sendBuffer.data(), numBytesSend, MPI_BYTE,
+                              rankBackward, pulse.tag + 1, dd->mpi_comm_all,
+                              &pulse.fRecvRequest);
+            }
+            if (numBytesRecv > 0 && !pulse.inPlace)
+            {
+                MPI_Recv_init(pulse.recvBuffer.data(), numBytesRecv, MPI_BYTE,
+                              rankForward, pulse.tag, dd->mpi_comm_all,
+                              &pulse.xRecvRequest);
+                MPI_Send_init(pulse.recvBuffer.data(), numBytesRecv, MPI_BYTE,
+                              rankForward, pulse.tag + 1, dd->mpi_comm_all,
+                              &pulse.fSendRequest);
+            }
+        }
+    }
+    halo->usePersistentRequests = true;
+#endif
+}
+
+void dd_halo_exchange_setup(gmx_domdec_t *dd)
+{
+    gmx_domdec_comm_t *comm = dd->comm;
+    HaloExchange      *halo = comm->haloExchange;
+
+    /* The buffers can be reallocated below, so the requests need to go */
+    freePersistentRequests(halo);
+
+    halo->numThreads = gmx_omp_nthreads_get(emntDomdec);
+
+    const int *cgindex = dd->cgindex;
+    int        nzone   = 1;
+    int        nat_tot = dd->nat_home;
+    int        tag     = c_haloTagOffset;
+    for (int d = 0; d < dd->ndim; d++)
+    {
+        const gmx_domdec_comm_dim_t &cd = comm->cd[d];
+
+        halo->pulses[d].resize(cd.np);
+        for (int p = 0; p < cd.np; p++)
+        {
+            const gmx_domdec_ind_t &ind   = cd.ind[p];
+            HaloPulse              &pulse = halo->pulses[d][p];
+
+            /* Convert the charge group indices to atom indices */
+            pulse.atomIndex.resize(ind.nsend[nzone + 1]);
+            int n = 0;
+            for (int i = 0; i < ind.nsend[nzone]; i++)
+            {
+                for (int a = cgindex[ind.index[i]]; a < cgindex[ind.index[i] + 1]; a++)
+                {
+                    pulse.atomIndex[n++] = a;
+                }
+            }
+            GMX_ASSERT(n == ind.nsend[nzone + 1], "The atom count should match the charge group atom counts");
+
+            pulse.numAtomsRecv  = ind.nrecv[nzone + 1];
+            pulse.inPlace       = cd.bInPlace;
+            pulse.atomStartRecv = nat_tot;
+            pulse.sendBuffer.resize(pulse.atomIndex.size());
+            pulse.recvBuffer.resize(pulse.inPlace ? 0 : pulse.numAtomsRecv);
+            pulse.tag           = tag;
+            tag                += 2;
+            nat_tot            += pulse.numAtomsRecv;
+        }
+        nzone += nzone;
+    }
+
+    initPersistentRequests(dd, halo);
+}
+
+/*! \brief Returns the number of threads to use for packing or unpacking \p numAtoms atoms */
+static int numThreadsForAtoms(const HaloExchange *halo,
+                              int                 numAtoms)
+{
+    return std::max(1, std::min(halo->numThreads, numAtoms/c_haloMinAtomsPerThread));
+}
+
+/*! \brief Starts the coordinate or force receives of all pulses
+ *
+ * Coordinates of pulses that receive in place are received directly
+ * into \p x, starting at the first received atom.
+ */
+static void startPersistentReceives(const gmx_domdec_t gmx_unused *dd,
+                                    HaloExchange gmx_unused       *halo,
+                                    bool gmx_unused                forForces,
+                                    rvec gmx_unused               *x)
+{
+#if GMX_LIB_MPI
+    for (int d = 0; d < dd->ndim; d++)
+    {
+        for (HaloPulse &pulse : halo->pulses[d])
+        {
+            if (!forForces && pulse.inPlace)
+            {
+                if (pulse.numAtomsRecv > 0)
+                {
+                    MPI_Irecv(x[pulse.atomStartRecv], pulse.numAtomsRecv*sizeof(rvec), MPI_BYTE,
+                              dd->neighbor[d][0], pulse.tag, dd->mpi_comm_all,
+                              &pulse.inPlaceRequest);
+                }
+                continue;
+            }
+            MPI_Request *request = (forForces ? &pulse.fRecvRequest : &pulse.xRecvRequest);
+            if (*request != MPI_REQUEST_NULL)
+            {
+                MPI_Start(request);
+            }
+        }
+    }
+#endif
+}
+
+/*! \brief Waits for the coordinate or force sends of all pulses to complete */
+static void waitPersistentSends(HaloExchange gmx_unused *halo,
+                                int gmx_unused           numDims,
+                                bool gmx_unused          forForces)
+{
+#if GMX_LIB_MPI
+    for (int d = 0; d < numDims; d++)
+    {
+        for (HaloPulse &pulse : halo->pulses[d])
+        {
+            MPI_Request *request = (forForces ? &pulse.fSendRequest : &pulse.xSendRequest);
+            if (forForces && pulse.inPlace)
+            {
+                request = &pulse.inPlaceRequest;
+            }
+            if (*request != MPI_REQUEST_NULL)
+            {
+                MPI_Wait(request, MPI_STATUS_IGNORE);
+            }
+        }
+    }
+#endif
+}
+
+#if GMX_LIB_MPI
+/*! \brief Starts the send and completes the, already started, receive of one pulse */
+static void persistentSendRecv(MPI_Request *sendRequest,
+                               MPI_Request *recvRequest)
+{
+    if (*sendRequest != MPI_REQUEST_NULL)
+    {
+        MPI_Start(sendRequest);
+    }
+    if (*recvRequest != MPI_REQUEST_NULL)
+    {
+        MPI_Wait(recvRequest, MPI_STATUS_IGNORE);
+    }
+}
+#endif
+
+/*! \brief Packs the coordinates to send for \p pulse, applying the PBC shift or screw when requested */
+static void packCoordinates(const HaloExchange *halo,
+                            HaloPulse          *pulse,
+                            const rvec         *x,
+                            bool                bPBC,
+                            bool                bScrew,
+                            const rvec          shift,
+                            const matrix        box)
+{
+    const int  *index = pulse->atomIndex.data();
+    const int   n     = pulse->atomIndex.size();
+    rvec       *buf   = as_rvec_array(pulse->sendBuffer.data());
+    const int   nth   = numThreadsForAtoms(halo, n);
+
+    if (!bPBC)
+    {
+#pragma omp parallel for num_threads(nth) schedule(static)
+        for (int i = 0; i < n; i++)
+        {
+            copy_rvec(x[index[i]], buf[i]);
+        }
+    }
+    else if (!bScrew)
+    {
+#pragma omp parallel for num_threads(nth) schedule(static)
+        for (int i = 0; i < n; i++)
+        {
+            /* We need to shift the coordinates */
+            rvec_add(x[index[i]], shift, buf[i]);
+        }
+    }
+    else
+    {
+#pragma omp parallel for num_threads(nth) schedule(static)
+        for (int i = 0; i < n; i++)
+        {
+            const int j = index[i];
+            /* Shift x */
+            buf[i][XX] = x[j][XX] + shift[XX];
+            /* Rotate y and z.
+             * This operation requires a special shift force
+             * treatment, which is performed in calc_vir.
+             */
+            buf[i][YY] = box[YY][YY] - x[j][YY];
+            buf[i][ZZ] = box[ZZ][ZZ] - x[j][ZZ];
+        }
+    }
+}
+
+void dd_move_x(gmx_domdec_t *dd, matrix box, rvec x[], gmx_wallcycle *wcycle)
+{
+    wallcycle_start(wcycle, ewcMOVEX);
+
+    gmx_domdec_comm_t *comm = dd->comm;
+    HaloExchange      *halo = comm->haloExchange;
+
+    /* Post the receives for all pulses, they only depend on the setup */
+    if (halo->usePersistentRequests)
+    {
+        startPersistentReceives(dd, halo, false, x);
+    }
+
+    int nzone   = 1;
+    int nat_tot = dd->nat_home;
+    for (int d = 0; d < dd->ndim; d++)
+    {
+        const gmx_bool bPBC   = (dd->ci[dd->dim[d]] == 0);
+        const gmx_bool bScrew = (bPBC && dd->bScrewPBC && dd->dim[d] == XX);
+        rvec           shift  = {0, 0, 0};
+        if (bPBC)
+        {
+            copy_rvec(box[dd->dim[d]], shift);
+        }
+        const gmx_domdec_comm_dim_t *cd = &comm->cd[d];
+        for (int p = 0; p < cd->np; p++)
+        {
+            const gmx_domdec_ind_t *ind   = &cd->ind[p];
+            HaloPulse              *pulse = &halo->pulses[d][p];
+
+            packCoordinates(halo, pulse, x, bPBC, bScrew, shift, box);
+
+            rvec *rbuf;
+            if (cd->bInPlace)
+            {
+                rbuf = x + nat_tot;
+            }
+            else
+            {
+                rbuf = as_rvec_array(pulse->recvBuffer.data());
+            }
+            /* Send and receive the coordinates */
+            if (halo->usePersistentRequests)
+            {
+#if GMX_LIB_MPI
+                persistentSendRecv(&pulse->xSendRequest,
+                                   cd->bInPlace ? &pulse->inPlaceRequest : &pulse->xRecvRequest);
+#endif
+            }
+            else
+            {
+                dd_sendrecv_rvec(dd, d, dddirBackward,
+                                 as_rvec_array(pulse->sendBuffer.data()), pulse->atomIndex.size(),
+                                 rbuf, pulse->numAtomsRecv);
+            }
+            if (!cd->bInPlace)
+            {
+                int j = 0;
+                for (int zone = 0; zone < nzone; zone++)
+                {
+                    for (int i = ind->cell2at0[zone]; i < ind->cell2at1[zone]; i++)
+                    {
+                        copy_rvec(rbuf[j], x[i]);
+                        j++;
+                    }
+                }
+            }
+            nat_tot += ind->nrecv[nzone+1];
+        }
+        nzone += nzone;
+    }
+
+    /* The send buffers can only be reused after the sends completed */
+    if (halo->usePersistentRequests)
+    {
+        waitPersistentSends(halo, dd->ndim, false);
+    }
+
+    wallcycle_stop(wcycle, ewcMOVEX);
+}
+
+void dd_move_f(gmx_domdec_t *dd, rvec f[], rvec *fshift, gmx_wallcycle *wcycle)
+{
+    wallcycle_start(wcycle, ewcMOVEF);
+
+    gmx_domdec_comm_t *comm = dd->comm;
+    HaloExchange      *halo = comm->haloExchange;
+
+    if (halo->usePersistentRequests)
+    {
+        startPersistentReceives(dd, halo, true, nullptr);
+    }
+
+    int nzone   = comm->zones.n/2;
+    int nat_tot = dd->nat_tot;
+    for (int d = dd->ndim-1; d >= 0; d--)
+    {
+        /* Only forces in domains near the PBC boundaries need to
+           consider PBC in the treatment of fshift */
+        gmx_bool bShiftForcesNeedPbc = (dd->ci[dd->dim[d]] == 0);
+        gmx_bool bScrew              = (bShiftForcesNeedPbc && dd->bScrewPBC && dd->dim[d] == XX);
+        if (fshift == nullptr && !bScrew)
+        {
+            bShiftForcesNeedPbc = FALSE;
+        }
+        /* Determine which shift vector we need */
+        ivec vis;
+        clear_ivec(vis);
+        vis[dd->dim[d]] = 1;
+        const int is    = IVEC2IS(vis);
+
+        const gmx_domdec_comm_dim_t *cd = &comm->cd[d];
+        for (int p = cd->np-1; p >= 0; p--)
+        {
+            const gmx_domdec_ind_t *ind   = &cd->ind[p];
+            HaloPulse              *pulse = &halo->pulses[d][p];
+
+            nat_tot -= ind->nrecv[nzone+1];
+
+            rvec *sbuf;
+            if (cd->bInPlace)
+            {
+                sbuf = f + nat_tot;
+            }
+            else
+            {
+                sbuf  = as_rvec_array(pulse->recvBuffer.data());
+                int j = 0;
+                for (int zone = 0; zone < nzone; zone++)
+                {
+                    for (int i = ind->cell2at0[zone]; i < ind->cell2at1[zone]; i++)
+                    {
+                        copy_rvec(f[i], sbuf[j]);
+                        j++;
+                    }
+                }
+            }
+            rvec *buf = as_rvec_array(pulse->sendBuffer.data());
+            /* Communicate the forces */
+            if (halo->usePersistentRequests)
+            {
+#if GMX_LIB_MPI
+                if (cd->bInPlace && pulse->numAtomsRecv > 0)
+                {
+                    /* Send directly from the force array */
+                    MPI_Isend(sbuf[0], pulse->numAtomsRecv*sizeof(rvec), MPI_BYTE,
+                              dd->neighbor[d][0], pulse->tag + 1, dd->mpi_comm_all,
+                              &pulse->inPlaceRequest);
+                }
+                persistentSendRecv(&pulse->fSendRequest, &pulse->fRecvRequest);
+#endif
+            }
+            else
+            {
+                dd_sendrecv_rvec(dd, d, dddirForward,
+                                 sbuf, pulse->numAtomsRecv,
+                                 buf,  pulse->atomIndex.size());
+            }
+
+            /* Add the received forces, each atom occurs at most once per pulse */
+            const int *index = pulse->atomIndex.data();
+            const int  n     = pulse->atomIndex.size();
+            const int  nth   = numThreadsForAtoms(halo, n);
+            if (!bScrew)
+            {
+#pragma omp parallel for num_threads(nth) schedule(static)
+                for (int i = 0; i < n; i++)
+                {
+                    rvec_inc(f[index[i]], buf[i]);
+                }
+            }
+            else
+            {
+#pragma omp parallel for num_threads(nth) schedule(static)
+                for (int i = 0; i < n; i++)
+                {
+                    /* Rotate the force */
+                    const int j = index[i];
+                    f[j][XX] += buf[i][XX];
+                    f[j][YY] -= buf[i][YY];
+                    f[j][ZZ] -= buf[i][ZZ];
+                }
+            }
+            if (bShiftForcesNeedPbc && fshift != nullptr)
+            {
+                /* Add the received forces to the shift force */
+                for (int i = 0; i < n; i++)
+                {
+                    rvec_inc(fshift[is], buf[i]);
+                }
+            }
+        }
+        nzone /= 2;
+    }
+
+    if (halo->usePersistentRequests)
+    {
+        waitPersistentSends(halo, dd->ndim, true);
+    }
+
+    wallcycle_stop(wcycle, ewcMOVEF);
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+/*! \internal \file
+ *
+ * \brief Declares the halo exchange setup for coordinates and forces.
+ *
+ * The atoms to send in each grid pulse are stored as flat local atom
+ * index lists that are (re)computed once per repartitioning, so
+ * dd_move_x and dd_move_f do not need to go through the charge group
+ * indices every step. With a library MPI the pulses use persistent
+ * send and receive requests on buffers owned by the halo exchange.
+ *
+ * \author Berk Hess <hess@kth.se>
+ * \ingroup module_domdec
+ */
+#ifndef GMX_DOMDEC_HALOEXCHANGE_H
+#define GMX_DOMDEC_HALOEXCHANGE_H
+
+struct gmx_domdec_t;
+struct HaloExchange;
+
+/*! \brief Returns a pointer to a constructed \p HaloExchange struct */
+HaloExchange *dd_halo_exchange_allocate();
+
+/*! \brief Frees the persistent MPI requests of \p halo and deletes it
+ *
+ * Should be called before MPI is finalized.
+ */
+void dd_halo_exchange_free(HaloExchange *halo);
+
+/*! \brief (Re)sets up the atom index lists, buffers and requests for the halo exchange
+ *
+ * Should be called after the communication setup at each repartitioning,
+ * after which dd->cgindex and the pulse setup in dd->comm->cd are final.
+ */
+void dd_halo_exchange_setup(gmx_domdec_t *dd);
+
+#endif
@@ -224,7 +224,18 @@ static inline void gmx_hash_del(gmx_hash_t *hash, int key)
             if (ind_prev >= 0)
             {
                 hash->hash[ind_prev].next = hash->hash[ind].next;
-
+            }
+            else if (hash->hash[ind].next >= 0)
+            {
+                /* We delete the head of a list, move the next element
+                 * into the head position, so the list stays reachable.
+                 */
+                int ind_next    = hash->hash[ind].next;
+                hash->hash[ind] = hash->hash[ind_next];
+                ind             = ind_next;
+            }
+            if (ind >= hash->mod)
+            {
                 /* This index is a linked entry, so we free an entry.
                  * Check if we are creating the first empty space.
                  */
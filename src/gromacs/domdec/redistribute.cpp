@@ -332,6 +332,11 @@ static void rotate_state_atom(t_state *state, int a)
         state->cg_p[a][YY] = -state->cg_p[a][YY];
         state->cg_p[a][ZZ] = -state->cg_p[a][ZZ];
     }
+    for (auto &vec : state->em_vecs)
+    {
+        vec[a][YY] = -vec[a][YY];
+        vec[a][ZZ] = -vec[a][ZZ];
+    }
 }
 
 static int *get_moved(gmx_domdec_comm_t *comm, int natoms)
@@ -676,6 +681,7 @@ void dd_redistribute_cg(FILE *fplog, gmx_int64_t step,
     {
         nvec++;
     }
+    nvec += static_cast<int>(state->em_vecs.size());
 
     /* Make sure the communication buffers are large enough */
     for (mc = 0; mc < dd->ndim*2; mc++)
@@ -733,6 +739,12 @@ void dd_redistribute_cg(FILE *fplog, gmx_int64_t step,
                                 nvec, vec++, as_rvec_array(state->cg_p.data()),
                                 comm, bCompact);
     }
+    for (auto &emVec : state->em_vecs)
+    {
+        compact_and_copy_vec_at(dd->ncg_home, move, cgindex,
+                                nvec, vec++, as_rvec_array(emVec.data()),
+                                comm, bCompact);
+    }
 
     if (bCompact)
     {
@@ -962,6 +974,14 @@ void dd_redistribute_cg(FILE *fplog, gmx_int64_t step,
                                   state->cg_p[home_pos_at+i]);
                     }
                 }
+                for (auto &emVec : state->em_vecs)
+                {
+                    for (i = 0; i < nrcg; i++)
+                    {
+                        copy_rvec(comm->vbuf.v[buf_pos++],
+                                  emVec[home_pos_at+i]);
+                    }
+                }
                 home_pos_cg += 1;
                 home_pos_at += nrcg;
             }
@@ -0,0 +1,232 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the global to local atom lookup and the domdec hash table.
+ *
+ * \author Berk Hess <hess@kth.se>
+ * \ingroup module_domdec
+ */
+#include "gmxpre.h"
+
+#include "gromacs/domdec/ga2la.h"
+
+#include <future>
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/domdec/hash.h"
+#include "gromacs/utility/smalloc.h"
+
+namespace gmx
+{
+namespace
+{
+
+/*! \brief Returns a set of global atom indices as they occur in a domain
+ *
+ * These are a few contiguous ranges, as for a home domain with halo,
+ * so many keys map to nearby hash entries.
+ */
+std::vector<int> localGlobalIndices(int numAtomsTotal, int numAtomsLocal)
+{
+    std::vector<int> indices;
+    const int        numRanges = 8;
+    for (int r = 0; r < numRanges; r++)
+    {
+        int start = (r*numAtomsTotal)/numRanges;
+        for (int a = start; a < start + numAtomsLocal/numRanges; a++)
+        {
+            indices.push_back(a);
+        }
+    }
+
+    return indices;
+}
+
+class GlobalToLocalTest : public ::testing::TestWithParam<int>
+{
+};
+
+TEST_P(GlobalToLocalTest, SetGetDeleteMatchesReference)
+{
+    const int          numAtomsTotal = GetParam();
+    const int          numAtomsLocal = numAtomsTotal/20;
+    gmx_ga2la_t       *ga2la         = ga2la_init(numAtomsTotal, numAtomsLocal/2);
+    std::vector<int>   indices       = localGlobalIndices(numAtomsTotal, numAtomsLocal);
+    std::map<int, int> reference;
+
+    /* Use a too small estimate, so the table needs to grow */
+    EXPECT_FALSE(ga2la->bDirectList);
+
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        ga2la_set(ga2la, indices[i], static_cast<int>(i), static_cast<int>(i % 3));
+        reference[indices[i]] = static_cast<int>(i);
+    }
+    /* Delete every fifth atom and move the local index of every seventh */
+    for (size_t i = 0; i < indices.size(); i += 5)
+    {
+        ga2la_del(ga2la, indices[i]);
+        reference.erase(indices[i]);
+    }
+    for (size_t i = 1; i < indices.size(); i += 7)
+    {
+        if (reference.count(indices[i]) > 0)
+        {
+            ga2la_change_la(ga2la, indices[i], static_cast<int>(i + 1));
+            reference[indices[i]] = static_cast<int>(i + 1);
+        }
+    }
+
+    for (int a = 0; a < numAtomsTotal; a += 3)
+    {
+        int  a_loc, cell;
+        bool found = ga2la_get(ga2la, a, &a_loc, &cell);
+        auto it    = reference.find(a);
+        ASSERT_EQ(it != reference.end(), found) << "global atom " << a;
+        if (found)
+        {
+            EXPECT_EQ(it->second, a_loc);
+        }
+    }
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        int a_loc;
+        EXPECT_EQ(reference.count(indices[i]) > 0 && i % 3 == 0,
+                  ga2la_get_home(ga2la, indices[i], &a_loc));
+        EXPECT_EQ(reference.count(indices[i]) > 0 && i % 3 == 0,
+                  ga2la_is_home(ga2la, indices[i]));
+    }
+
+    ga2la_clear(ga2la);
+    int a_loc, cell;
+    EXPECT_FALSE(ga2la_get(ga2la, indices[1], &a_loc, &cell));
+
+    sfree(ga2la->lal);
+    sfree(ga2la);
+}
+
+TEST_P(GlobalToLocalTest, ConcurrentLookupsMatchSerialLookups)
+{
+    const int        numAtomsTotal = GetParam();
+    const int        numAtomsLocal = numAtomsTotal/20;
+    gmx_ga2la_t     *ga2la         = ga2la_init(numAtomsTotal, numAtomsLocal);
+    std::vector<int> indices       = localGlobalIndices(numAtomsTotal, numAtomsLocal);
+
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        ga2la_set(ga2la, indices[i], static_cast<int>(i), static_cast<int>(i % 3));
+    }
+
+    /* Look up all atoms, local and non-local, in a strided order */
+    auto lookupSum = [ga2la, numAtomsTotal](int first, int stride)
+    {
+        long sum = 0;
+        for (int a = first; a < numAtomsTotal; a += stride)
+        {
+            int a_loc, cell;
+            if (ga2la_get(ga2la, a, &a_loc, &cell))
+            {
+                sum += a + a_loc + cell;
+            }
+        }
+        return sum;
+    };
+
+    /* Lookups only read the table, so several threads can do them at
+     * the same time. The launch policy forces actual threads.
+     */
+    const int         numThreads = 4;
+    std::future<long> partialSums[numThreads];
+    for (int t = 0; t < numThreads; t++)
+    {
+        partialSums[t] = std::async(std::launch::async, lookupSum, t, numThreads);
+    }
+    long concurrentSum = 0;
+    for (int t = 0; t < numThreads; t++)
+    {
+        concurrentSum += partialSums[t].get();
+    }
+    EXPECT_EQ(lookupSum(0, 1), concurrentSum);
+
+    sfree(ga2la->lal);
+    sfree(ga2la);
+}
+
+INSTANTIATE_TEST_CASE_P(WithSystemSizes, GlobalToLocalTest,
+                        ::testing::Values(10000, 100000, 1000000));
+
+TEST(HashTest, SetGetDeleteMatchesReference)
+{
+    gmx_hash_t        *hash = gmx_hash_init(10);
+    std::map<int, int> reference;
+
+    for (int key = 0; key < 5000; key += 3)
+    {
+        gmx_hash_set(hash, key, key + 1);
+        reference[key] = key + 1;
+    }
+    for (int key = 0; key < 5000; key += 9)
+    {
+        gmx_hash_del(hash, key);
+        reference.erase(key);
+    }
+    for (int key = 1; key < 5000; key += 2)
+    {
+        gmx_hash_change_or_set(hash, key, -2);
+        reference[key] = -2;
+    }
+    EXPECT_EQ(static_cast<int>(reference.size()), hash->nkey);
+
+    for (int key = 0; key < 6000; key++)
+    {
+        auto it = reference.find(key);
+        EXPECT_EQ(it == reference.end() ? -1 : it->second,
+                  gmx_hash_get_minone(hash, key)) << "key " << key;
+    }
+
+    gmx_hash_clear_and_optimize(hash);
+    EXPECT_EQ(0, hash->nkey);
+    EXPECT_EQ(-1, gmx_hash_get_minone(hash, 3));
+
+    sfree(hash->hash);
+    sfree(hash);
+}
+
+} // namespace
+} // namespace gmx
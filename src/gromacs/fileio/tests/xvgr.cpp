@@ -0,0 +1,169 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for reading xvg files.
+ *
+ * \ingroup module_fileio
+ */
+#include "gmxpre.h"
+
+#include "gromacs/fileio/xvgr.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/testfilemanager.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+class ReadXvgLegendTest : public ::testing::Test
+{
+    public:
+        ReadXvgLegendTest() : y_(nullptr), ny_(0), subtitle_(nullptr), legend_(nullptr)
+        {
+        }
+        ~ReadXvgLegendTest()
+        {
+            for (int i = 0; i < ny_; i++)
+            {
+                sfree(y_[i]);
+            }
+            sfree(y_);
+            sfree(subtitle_);
+            if (legend_ != nullptr)
+            {
+                for (int i = 0; i < ny_ - 1; i++)
+                {
+                    sfree(legend_[i]);
+                }
+                sfree(legend_);
+            }
+        }
+
+        //! Writes \p contents to a file and reads it with read_xvg_legend
+        int readXvg(const std::string &contents)
+        {
+            std::string filename = fileManager_.getTemporaryFilePath("test.xvg");
+            TextWriter::writeFileFromString(filename, contents);
+            return read_xvg_legend(filename.c_str(), &y_, &ny_, &subtitle_, &legend_);
+        }
+
+        TestFileManager fileManager_;
+        double        **y_;
+        int             ny_;
+        char           *subtitle_;
+        char          **legend_;
+};
+
+TEST_F(ReadXvgLegendTest, ReadsColumnsAndLegends)
+{
+    int nx = readXvg("# comment\n"
+                     "@ subtitle \"T = 300 (K)\"\n"
+                     "@ s0 legend \"dH/d\\xl\\f{}\"\n"
+                     "@ s1 legend \"\\xD\\f{}H 0.5\"\n"
+                     "0    1.5   -2e-3\n"
+                     "  0.2\t2.5 1e+2  \n"
+                     "&\n"
+                     "1 2 3\n");
+
+    ASSERT_EQ(2, nx);
+    ASSERT_EQ(3, ny_);
+    EXPECT_STREQ("T = 300 (K)", subtitle_);
+    ASSERT_NE(nullptr, legend_);
+    EXPECT_STREQ("dH/d\\xl\\f{}", legend_[0]);
+    EXPECT_STREQ("\\xD\\f{}H 0.5", legend_[1]);
+    EXPECT_EQ(0.0, y_[0][0]);
+    EXPECT_EQ(1.5, y_[1][0]);
+    EXPECT_EQ(-2e-3, y_[2][0]);
+    EXPECT_EQ(0.2, y_[0][1]);
+    EXPECT_EQ(2.5, y_[1][1]);
+    EXPECT_EQ(1e+2, y_[2][1]);
+}
+
+TEST_F(ReadXvgLegendTest, SkipsTrailingJunkInColumns)
+{
+    /* Anything after a number up to the next white space is skipped,
+     * as well as any columns beyond those of the first data line.
+     */
+    int nx = readXvg("1.0 2.0kJ 3.0\n"
+                     "4.0abc 5.0,6.0 7.0 8.0 9.0\n");
+
+    ASSERT_EQ(2, nx);
+    ASSERT_EQ(3, ny_);
+    EXPECT_EQ(1.0, y_[0][0]);
+    EXPECT_EQ(2.0, y_[1][0]);
+    EXPECT_EQ(3.0, y_[2][0]);
+    EXPECT_EQ(4.0, y_[0][1]);
+    EXPECT_EQ(5.0, y_[1][1]);
+    EXPECT_EQ(7.0, y_[2][1]);
+}
+
+TEST_F(ReadXvgLegendTest, ZeroesMissingColumns)
+{
+    /* A line that is short, or has a column that is not a number,
+     * gets zeros from there on.
+     */
+    int nx = readXvg("1 2 3 4\n"
+                     "5 6\n"
+                     "7 x 9 10\n"
+                     "11 12 13 14\n");
+
+    ASSERT_EQ(4, nx);
+    ASSERT_EQ(4, ny_);
+    EXPECT_EQ(5.0, y_[0][1]);
+    EXPECT_EQ(6.0, y_[1][1]);
+    EXPECT_EQ(0.0, y_[2][1]);
+    EXPECT_EQ(0.0, y_[3][1]);
+    EXPECT_EQ(7.0, y_[0][2]);
+    EXPECT_EQ(0.0, y_[1][2]);
+    EXPECT_EQ(0.0, y_[2][2]);
+    EXPECT_EQ(0.0, y_[3][2]);
+    EXPECT_EQ(11.0, y_[0][3]);
+    EXPECT_EQ(14.0, y_[3][3]);
+}
+
+} // namespace
+} // namespace test
+} // namespace gmx
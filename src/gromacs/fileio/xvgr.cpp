@@ -40,6 +40,7 @@
 
 #include <cassert>
 #include <cctype>
+#include <cstdlib>
 #include <cstring>
 
 #include <string>
@@ -575,9 +576,8 @@ int read_xvg_legend(const char *fn, double ***y, int *ny,
 {
     FILE    *fp;
     char    *ptr;
-    char    *base = nullptr;
-    char    *fmt  = nullptr;
-    int      k, line = 0, nny, nx, maxx, rval, legend_nalloc, set, nchar;
+    char    *end;
+    int      k, line = 0, nny, nx, maxx, legend_nalloc, set, nchar;
     double   lf;
     double **yy = nullptr;
     char    *tmpbuf;
@@ -661,8 +661,6 @@ int read_xvg_legend(const char *fn, double ***y, int *ny,
                     return 0;
                 }
                 snew(yy, nny);
-                snew(fmt, 3*nny+1);
-                snew(base, 3*nny+1);
             }
             /* Allocate column space */
             if (nx >= maxx)
@@ -673,25 +671,23 @@ int read_xvg_legend(const char *fn, double ***y, int *ny,
                     srenew(yy[k], maxx);
                 }
             }
-            /* Initiate format string */
-            fmt[0]  = '\0';
-            base[0] = '\0';
-
-            /* fprintf(stderr,"ptr='%s'\n",ptr);*/
+            /* Parse the columns in a single pass over the line. As with
+             * scanning "%*s...%lf", anything trailing a number up to the
+             * next white space is skipped.
+             */
             for (k = 0; (k < nny); k++)
             {
-                std::strcpy(fmt, base);
-                std::strcat(fmt, "%lf");
-                rval = sscanf(ptr, fmt, &lf);
-                /* fprintf(stderr,"rval = %d\n",rval);*/
-                if ((rval == EOF) || (rval == 0))
+                lf = std::strtod(ptr, &end);
+                if (end == ptr)
                 {
                     break;
                 }
                 yy[k][nx] = lf;
-                srenew(fmt, 3*(nny+1)+1);
-                srenew(base, 3*nny+1);
-                std::strcat(base, "%*s");
+                ptr       = end;
+                while (*ptr != '\0' && !std::isspace(*ptr))
+                {
+                    ptr++;
+                }
             }
             if (k != nny)
             {
@@ -709,8 +705,6 @@ int read_xvg_legend(const char *fn, double ***y, int *ny,
 
     *y = yy;
     sfree(tmpbuf);
-    sfree(base);
-    sfree(fmt);
 
     if (legend_nalloc > 0)
     {
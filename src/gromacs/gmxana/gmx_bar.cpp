@@ -47,6 +47,8 @@
 #include "gromacs/fileio/enxio.h"
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/mbar.h"
+#include "gromacs/math/functions.h"
 #include "gromacs/math/units.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/mdlib/mdebin.h"
@@ -54,6 +56,7 @@
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
 #include "gromacs/utility/dir_separator.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/gmxassert.h"
 #include "gromacs/utility/smalloc.h"
@@ -98,6 +101,9 @@ typedef struct xvg_t
                                     the native lambda and the 'foreign' lambdas. */
     lambda_vec_t  native_lambda; /* the native lambda */
 
+    char         *subtitle;      /* the subtitle and legends as read, until */
+    char        **legend;        /* they have been interpreted */
+
     struct xvg_t *next, *prev;   /*location in the global linked list of xvg_ts*/
 } xvg_t;
 
@@ -571,6 +577,8 @@ static void xvg_init(xvg_t *ba)
     ba->np_alloc = 0;
     ba->np       = nullptr;
     ba->y        = nullptr;
+    ba->subtitle = nullptr;
+    ba->legend   = nullptr;
 }
 
 static void samples_init(samples_t *s, lambda_vec_t *native_lambda,
@@ -2202,6 +2210,236 @@ static double bar_err(int nbmin, int nbmax, const double *partsum)
     return std::sqrt(svar/(nbmax + 1 - nbmin));
 }
 
+/* The sampled states for an MBAR calculation. This points into the
+   sample collections of the simulation data. */
+typedef struct mbar_t
+{
+    int             nstates;   /* the number of sampled states */
+    lambda_data_t **lambda;    /* the sampled states */
+    sample_coll_t **sc;        /* sc[i*nstates+k] holds the energy differences
+                                  from sampled state i to state k. NULL for
+                                  k == i when these (zero) were not written */
+    sample_coll_t **ref;       /* the sample ranges to use for each state */
+    gmx_mbar_t     *mbar;      /* the MBAR samples and solver */
+} mbar_t;
+
+/* pass the sample ranges in ref, with the energy differences from sc,
+   to the MBAR solver */
+static void mbar_set_units(mbar_t *mb, sample_coll_t **ref)
+{
+    int            K = mb->nstates;
+    const double **du;
+    int            i, j, k;
+
+    snew(du, K);
+    gmx_mbar_clear_samples(mb->mbar);
+    for (i = 0; i < K; i++)
+    {
+        if (ref[i]->ntot == 0)
+        {
+            char buf[STRLEN];
+            lambda_vec_print(mb->lambda[i]->lambda, buf, FALSE);
+            gmx_fatal(FARGS, "No samples for lambda = %s, can not use MBAR", buf);
+        }
+        for (j = 0; j < ref[i]->nsamples; j++)
+        {
+            const sample_range_t *r = &(ref[i]->r[j]);
+
+            if (!r->use)
+            {
+                continue;
+            }
+            for (k = 0; k < K; k++)
+            {
+                const sample_coll_t *sc = mb->sc[i*K + k];
+                du[k] = sc ? sc->s[j]->du : nullptr;
+            }
+            gmx_mbar_add_samples(mb->mbar, i, du, r->start, r->end);
+        }
+    }
+    sfree(du);
+}
+
+/* Collect the sampled states for MBAR. This requires the energy
+   differences of every sampled state to all other sampled states,
+   written for the same samples. */
+static void mbar_init(mbar_t *mb, sim_data_t *sd, double temp)
+{
+    lambda_data_t *l;
+    int            i, j, k, K;
+
+    K = 0;
+    for (l = sd->lb->next; l != sd->lb; l = l->next)
+    {
+        K++;
+    }
+    if (K < 2)
+    {
+        gmx_fatal(FARGS, "MBAR needs at least two sampled lambda states");
+    }
+    mb->nstates = K;
+    snew(mb->lambda, K);
+    snew(mb->sc, K*K);
+    snew(mb->ref, K);
+    mb->mbar = gmx_mbar_init(K, 1/(BOLTZ*temp));
+
+    i = 0;
+    for (l = sd->lb->next; l != sd->lb; l = l->next)
+    {
+        mb->lambda[i++] = l;
+    }
+
+    for (i = 0; i < K; i++)
+    {
+        for (k = 0; k < K; k++)
+        {
+            sample_coll_t *sc = lambda_data_find_sample_coll(mb->lambda[i],
+                                                             mb->lambda[k]->lambda);
+            if (!sc && k != i)
+            {
+                char descX[STRLEN], descY[STRLEN];
+                snprint_lambda_vec(descX, STRLEN, "X", mb->lambda[k]->lambda);
+                snprint_lambda_vec(descY, STRLEN, "Y", mb->lambda[i]->lambda);
+                gmx_fatal(FARGS, "Could not find a set for foreign lambda (state X below)\nin the files for main lambda (state Y below).\nMBAR needs the energy differences to all sampled states.\n\n%s\n%s\n", descX, descY);
+            }
+            if (!sc)
+            {
+                continue;
+            }
+            for (j = 0; j < sc->nsamples; j++)
+            {
+                if (sc->s[j]->hist)
+                {
+                    gmx_fatal(FARGS, "File %s contains histograms of energy differences, MBAR needs the energy differences themselves", sc->s[j]->filename);
+                }
+            }
+            mb->sc[i*K + k] = sc;
+            if (!mb->ref[i])
+            {
+                mb->ref[i] = sc;
+            }
+        }
+        /* all energy differences should belong to the same samples */
+        for (k = 0; k < K; k++)
+        {
+            const sample_coll_t *sc  = mb->sc[i*K + k];
+            const sample_coll_t *ref = mb->ref[i];
+
+            if (!sc || sc == ref)
+            {
+                continue;
+            }
+            if (sc->nsamples != ref->nsamples)
+            {
+                gmx_fatal(FARGS, "The number of files with energy differences to different states is not the same for the simulations of file %s, can not use MBAR", ref->s[0]->filename);
+            }
+            for (j = 0; j < ref->nsamples; j++)
+            {
+                if (sc->r[j].use != ref->r[j].use ||
+                    sc->r[j].start != ref->r[j].start ||
+                    sc->r[j].end != ref->r[j].end)
+                {
+                    gmx_fatal(FARGS, "The energy differences to different states in files %s and %s do not belong to the same samples, can not use MBAR", ref->s[j]->filename, sc->s[j]->filename);
+                }
+            }
+        }
+    }
+
+    mbar_set_units(mb, mb->ref);
+}
+
+static void mbar_destroy(mbar_t *mb)
+{
+    sfree(mb->lambda);
+    sfree(mb->sc);
+    sfree(mb->ref);
+    gmx_mbar_done(mb->mbar);
+}
+
+/* Calculate the MBAR reduced free energies f of all sampled states,
+   starting from the estimate in f. The errors in the differences between
+   subsequent states, dg_err, and between the first and the last state,
+   dg_tot_err, are estimated from blocks as for BAR. Returns the number
+   of iterations for all data. */
+static int calc_mbar(mbar_t *mb, double *f, double tol, int npee_min,
+                     int npee_max, double *dg_err, double *dg_tot_err)
+{
+    int             K = mb->nstates;
+    int             niter, npee, p, i;
+    sample_coll_t  *sub, **subp;
+    double         *fp, *dgs, *dgs2, *dg_sig2;
+    double          tots, tots2, tot_sig2;
+
+    niter = gmx_mbar_solve(mb->mbar, f, tol);
+
+    snew(sub, K);
+    snew(subp, K);
+    snew(fp, K);
+    snew(dgs, K);
+    snew(dgs2, K);
+    snew(dg_sig2, K);
+    tot_sig2 = 0;
+    for (npee = npee_min; npee <= npee_max; npee++)
+    {
+        for (i = 0; i < K - 1; i++)
+        {
+            dgs[i]  = 0;
+            dgs2[i] = 0;
+        }
+        tots  = 0;
+        tots2 = 0;
+        for (p = 0; p < npee; p++)
+        {
+            for (i = 0; i < K; i++)
+            {
+                /* only du-style data, so this always succeeds */
+                sample_coll_create_subsample(&(sub[i]), mb->ref[i], p, npee);
+                subp[i] = &(sub[i]);
+                fp[i]   = f[i];
+            }
+            mbar_set_units(mb, subp);
+            gmx_mbar_solve(mb->mbar, fp, tol);
+            for (i = 0; i < K - 1; i++)
+            {
+                dgs[i]  += fp[i + 1] - fp[i];
+                dgs2[i] += gmx::square(fp[i + 1] - fp[i]);
+            }
+            tots  += fp[K - 1] - fp[0];
+            tots2 += gmx::square(fp[K - 1] - fp[0]);
+            for (i = 0; i < K; i++)
+            {
+                sample_coll_destroy(&(sub[i]));
+            }
+        }
+        for (i = 0; i < K - 1; i++)
+        {
+            dgs[i]     /= npee;
+            dgs2[i]    /= npee;
+            dg_sig2[i] += (dgs2[i] - dgs[i]*dgs[i])/(npee - 1);
+        }
+        tots     /= npee;
+        tots2    /= npee;
+        tot_sig2 += (tots2 - tots*tots)/(npee - 1);
+    }
+    for (i = 0; i < K - 1; i++)
+    {
+        dg_err[i] = std::sqrt(dg_sig2[i]/(npee_max - npee_min + 1));
+    }
+    *dg_tot_err = std::sqrt(tot_sig2/(npee_max - npee_min + 1));
+
+    /* restore the work units for all data */
+    mbar_set_units(mb, mb->ref);
+
+    sfree(sub);
+    sfree(subp);
+    sfree(fp);
+    sfree(dgs);
+    sfree(dgs2);
+    sfree(dg_sig2);
+
+    return niter;
+}
+
 
 /* Seek the end of an identifier (consecutive non-spaces), followed by
    an optional number of spaces or '='-signs. Returns a pointer to the
@@ -2713,20 +2951,19 @@ static double filename2lambda(const char *fn)
     return lambda;
 }
 
-static void read_bar_xvg_lowlevel(const char *fn, real *temp, xvg_t *ba,
-                                  lambda_components_t *lc)
+/* Read the data, subtitle and legends of a dhdl.xvg file. This only parses
+   the text and does not touch any shared data, so files can be read in
+   parallel. */
+static void read_bar_xvg_data(const char *fn, xvg_t *ba)
 {
-    int          i;
-    char        *subtitle, **legend, *ptr;
-    int          np;
-    gmx_bool     native_lambda_read = FALSE;
-    char         buf[STRLEN];
+    int i;
+    int np;
 
     xvg_init(ba);
 
     ba->filename = fn;
 
-    np = read_xvg_legend(fn, &ba->y, &ba->nset, &subtitle, &legend);
+    np = read_xvg_legend(fn, &ba->y, &ba->nset, &ba->subtitle, &ba->legend);
     if (!ba->y)
     {
         gmx_fatal(FARGS, "File %s contains no usable data.", fn);
@@ -2744,6 +2981,16 @@ static void read_bar_xvg_lowlevel(const char *fn, real *temp, xvg_t *ba,
     {
         ba->np[i] = np;
     }
+}
+
+static void read_bar_xvg_lowlevel(real *temp, xvg_t *ba,
+                                  lambda_components_t *lc)
+{
+    int          i;
+    const char  *fn       = ba->filename;
+    char        *subtitle = ba->subtitle, **legend = ba->legend, *ptr;
+    gmx_bool     native_lambda_read = FALSE;
+    char         buf[STRLEN];
 
     ba->temp = -1;
     if (subtitle != nullptr)
@@ -2842,18 +3089,19 @@ static void read_bar_xvg_lowlevel(const char *fn, real *temp, xvg_t *ba,
             sfree(legend[i]);
         }
         sfree(legend);
+        ba->legend = nullptr;
     }
 }
 
-static void read_bar_xvg(const char *fn, real *temp, sim_data_t *sd)
+/* Add the samples of a dhdl.xvg file, read with read_bar_xvg_data(), to
+   the simulation data */
+static void read_bar_xvg(xvg_t *barsim, real *temp, sim_data_t *sd)
 {
-    xvg_t     *barsim;
-    samples_t *s;
-    int        i;
-
-    snew(barsim, 1);
+    const char *fn = barsim->filename;
+    samples_t  *s;
+    int         i;
 
-    read_bar_xvg_lowlevel(fn, temp, barsim, &(sd->lc));
+    read_bar_xvg_lowlevel(temp, barsim, &(sd->lc));
 
     if (barsim->nset < 1)
     {
@@ -3547,12 +3795,23 @@ int gmx_bar(int argc, char *argv[])
 
         "To get a visual estimate of the phase space overlap, use the ",
         "[TT]-oh[tt] option to write series of histograms, together with the ",
-        "[TT]-nbin[tt] option.[PAR]"
+        "[TT]-nbin[tt] option.[PAR]",
+
+        "With [TT]-mbar[tt] the free energies of all sampled states are ",
+        "additionally estimated at once with the multistate Bennett ",
+        "acceptance ratio method (MBAR), ",
+        "Shirts & Chodera, J. Chem. Phys. 129 124105 (2008). ",
+        "This needs the energy differences of every simulation to all ",
+        "sampled states, i.e. [TT]foreign_lambda[tt] should include all ",
+        "[GRK]lambda[grk] values of the simulations, and can not use ",
+        "histograms. The BAR estimates serve as the starting point and ",
+        "the errors are estimated from the same blocks as for BAR.[PAR]"
     };
     static real        begin    = 0, end = -1, temp = -1;
     int                nd       = 2, nbmin = 5, nbmax = 5;
     int                nbin     = 100;
     gmx_bool           use_dhdl = FALSE;
+    gmx_bool           bMBAR    = FALSE;
     t_pargs            pa[]     = {
         { "-b",    FALSE, etREAL, {&begin},  "Begin time for BAR" },
         { "-e",    FALSE, etREAL, {&end},    "End time for BAR" },
@@ -3561,7 +3820,8 @@ int gmx_bar(int argc, char *argv[])
         { "-nbmin",  FALSE, etINT,  {&nbmin}, "Minimum number of blocks for error estimation" },
         { "-nbmax",  FALSE, etINT,  {&nbmax}, "Maximum number of blocks for error estimation" },
         { "-nbin",  FALSE, etINT, {&nbin}, "Number of bins for histogram output"},
-        { "-extp",  FALSE, etBOOL, {&use_dhdl}, "Whether to linearly extrapolate dH/dl values to use as energies"}
+        { "-extp",  FALSE, etBOOL, {&use_dhdl}, "Whether to linearly extrapolate dH/dl values to use as energies"},
+        { "-mbar",  FALSE, etBOOL, {&bMBAR}, "Also estimate the free energies of all sampled states at once with MBAR"}
     };
 
     t_filenm           fnm[] = {
@@ -3576,6 +3836,7 @@ int gmx_bar(int argc, char *argv[])
     int               f;
     int               nf = 0;    /* file counter */
     int               nfile_tot; /* total number of input files */
+    xvg_t            *xvgs;      /* the contents of the xvg files */
     sim_data_t        sim_data;  /* the simulation data */
     barres_t         *results;   /* the results */
     int               nresults;  /* number of results in results array */
@@ -3633,10 +3894,21 @@ int gmx_bar(int argc, char *argv[])
     snew(partsum, (nbmax+1)*(nbmax+1));
     nf = 0;
 
-    /* read in all files. First xvg files */
-    for (const std::string &filenm : xvgFiles)
+    /* read in all files. First xvg files, for which the text parsing
+       is done in parallel */
+    snew(xvgs, xvgFiles.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(xvgFiles.size()); i++)
     {
-        read_bar_xvg(filenm.c_str(), &temp, &sim_data);
+        try
+        {
+            read_bar_xvg_data(xvgFiles[i].c_str(), &(xvgs[i]));
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+    for (size_t i = 0; i < xvgFiles.size(); i++)
+    {
+        read_bar_xvg(&(xvgs[i]), &temp, &sim_data);
         nf++;
     }
     /* then .edr files */
@@ -3911,6 +4183,53 @@ int gmx_bar(int argc, char *argv[])
     }
     printf("\n");
 
+    if (bMBAR)
+    {
+        mbar_t  mbar;
+        double *fmbar, *dg_err, dg_tot_err;
+        int     niter;
+
+        mbar_init(&mbar, &sim_data, temp);
+        /* start from the BAR free energies */
+        snew(fmbar, mbar.nstates);
+        snew(dg_err, mbar.nstates);
+        for (f = 0; f < nresults; f++)
+        {
+            fmbar[f + 1] = fmbar[f] + results[f].dg;
+        }
+        /* as for BAR, with 10 times the requested precision in kJ/mol */
+        niter = calc_mbar(&mbar, fmbar, 0.1*prec*std::min(1.0, 1/kT),
+                          nbmin, nbmax, dg_err, &dg_tot_err);
+
+        printf("\nMBAR results in kJ/mol (converged in %d iterations):\n\n", niter);
+        for (f = 0; f < mbar.nstates - 1; f++)
+        {
+            printf("point ");
+            lambda_vec_print_short(mbar.lambda[f]->lambda, buf);
+            lambda_vec_print_short(mbar.lambda[f + 1]->lambda, buf2);
+            printf("%s - %s", buf, buf2);
+            printf(",   DG ");
+            printf(dgformat, (fmbar[f + 1] - fmbar[f])*kT);
+            printf(" +/- ");
+            printf(dgformat, dg_err[f]*kT);
+            printf("\n");
+        }
+        printf("\n");
+        printf("total ");
+        lambda_vec_print_short(mbar.lambda[0]->lambda, buf);
+        lambda_vec_print_short(mbar.lambda[mbar.nstates - 1]->lambda, buf2);
+        printf("%s - %s", buf, buf2);
+        printf(",   DG ");
+        printf(dgformat, (fmbar[mbar.nstates - 1] - fmbar[0])*kT);
+        printf(" +/- ");
+        printf(dgformat, dg_tot_err*kT);
+        printf("\n\n");
+
+        sfree(fmbar);
+        sfree(dg_err);
+        mbar_destroy(&mbar);
+    }
+
 
     if (fpi != nullptr)
     {
@@ -50,6 +50,7 @@
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxana/cmat.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/gmxana/rmsdmatrix.h"
 #include "gromacs/linearalgebra/eigensolver.h"
 #include "gromacs/math/do_fit.h"
 #include "gromacs/math/vec.h"
@@ -427,6 +428,64 @@ static void gather(t_mat *m, real cutoff, t_clusters *clust)
     sfree(d);
 }
 
+static int find_root(int *root, int i)
+{
+    while (root[i] != i)
+    {
+        root[i] = root[root[i]];
+        i       = root[i];
+    }
+    return i;
+}
+
+static void gather_nblist(const gmx_rmsd_nblist_t *nbl, t_clusters *clust)
+{
+    int *root, *cid;
+    int  i, r1, r2, ncl;
+
+    /* Join the neighbors with union-find, the lowest frame is the root */
+    fprintf(stderr, "Linking structures\n");
+    snew(root, nbl->n);
+    for (i = 0; i < nbl->n; i++)
+    {
+        root[i] = i;
+    }
+    for (i = 0; i < nbl->n; i++)
+    {
+        for (gmx_int64_t k = nbl->index[i]; k < nbl->index[i+1]; k++)
+        {
+            r1 = find_root(root, i);
+            r2 = find_root(root, nbl->nb[k]);
+            if (r1 < r2)
+            {
+                root[r2] = r1;
+            }
+            else if (r2 < r1)
+            {
+                root[r1] = r2;
+            }
+        }
+    }
+
+    /* Number the clusters in order of their first structure, as gather does */
+    snew(cid, nbl->n);
+    ncl = 0;
+    for (i = 0; i < nbl->n; i++)
+    {
+        r1 = find_root(root, i);
+        if (r1 == i)
+        {
+            ncl++;
+            cid[i] = ncl;
+        }
+        clust->cl[i] = cid[r1];
+    }
+    clust->ncl = ncl;
+
+    sfree(cid);
+    sfree(root);
+}
+
 static gmx_bool jp_same(int **nnb, int i, int j, int P)
 {
     gmx_bool bIn;
@@ -649,7 +708,8 @@ static void dump_nnb (FILE *fp, const char *title, int n1, t_nnb *nnb)
     }
 }
 
-static void gromos(int n1, real **mat, real rmsdcut, t_clusters *clust)
+static void gromos(int n1, real **mat, const gmx_rmsd_nblist_t *nbl,
+                   real rmsdcut, t_clusters *clust)
 {
     t_dist *row;
     t_nnb  *nnb;
@@ -659,7 +719,14 @@ static void gromos(int n1, real **mat, real rmsdcut, t_clusters *clust)
     fprintf(stderr, "Making list of neighbors within cutoff ");
     snew(nnb, n1);
     snew(row, n1);
-    for (i = 0; (i < n1); i++)
+    for (i = 0; (i < n1) && nbl; i++)
+    {
+        /* copy the precomputed list */
+        nnb[i].nr = static_cast<int>(nbl->index[i+1] - nbl->index[i]);
+        snew(nnb[i].nb, nnb[i].nr);
+        std::copy(nbl->nb + nbl->index[i], nbl->nb + nbl->index[i+1], nnb[i].nb);
+    }
+    for (i = 0; (i < n1) && !nbl; i++)
     {
         maxval = 0;
         k      = 0;
@@ -972,7 +1039,20 @@ static void ana_trans(t_clusters *clust, int nf,
     sfree(axis);
 }
 
+/* Returns the RMSD between structures i and j, from the matrix rmsd when
+ * present, otherwise computed from the stored frames.
+ */
+static real cluster_rmsd(real **rmsd, const gmx_rmsd_frames_t *frames, int i, int j)
+{
+    if (rmsd)
+    {
+        return rmsd[i][j];
+    }
+    return (i == j ? 0 : gmx_rmsd_pair(frames, i, frames, j));
+}
+
 static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
+                             const gmx_rmsd_frames_t *rmsd_frames,
                              int natom, t_atoms *atoms, rvec *xtps,
                              real *mass, rvec **xx, real *time,
                              int ifsize, int *fitidx,
@@ -990,7 +1070,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
     t_trxstatus *trxsout = nullptr;
     int          i, i1, cl, nstr, *structure, first = 0, midstr;
     gmx_bool    *bWrite = nullptr;
-    real         r, clrmsd, midrmsd;
+    real         r, clrmsd, midrmsd, *rav;
     rvec        *xav = nullptr;
     matrix       zerobox;
 
@@ -1081,6 +1161,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
         }
     }
     snew(structure, nf);
+    snew(rav, nf);
     fprintf(log, "\n%3s | %3s  %4s | %6s %4s | cluster members\n",
             "cl.", "#st", "rmsd", "middle", "rmsd");
     for (cl = 1; cl <= clust->ncl; cl++)
@@ -1128,27 +1209,34 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
         {
             fprintf(size_fp, "%8d %8d\n", cl, nstr);
         }
-        clrmsd  = 0;
-        midstr  = 0;
-        midrmsd = 10000;
-        for (i1 = 0; i1 < nstr; i1++)
+        /* Without matrix the RMSD sums are the expensive part */
+#pragma omp parallel for schedule(dynamic) if (rmsd == nullptr)
+        for (int m = 0; m < nstr; m++)
         {
-            r = 0;
+            real rsum = 0;
             if (nstr > 1)
             {
-                for (i = 0; i < nstr; i++)
+                for (int k = 0; k < nstr; k++)
                 {
-                    if (i < i1)
+                    if (k < m)
                     {
-                        r += rmsd[structure[i]][structure[i1]];
+                        rsum += cluster_rmsd(rmsd, rmsd_frames, structure[k], structure[m]);
                     }
                     else
                     {
-                        r += rmsd[structure[i1]][structure[i]];
+                        rsum += cluster_rmsd(rmsd, rmsd_frames, structure[m], structure[k]);
                     }
                 }
-                r /= (nstr - 1);
+                rsum /= (nstr - 1);
             }
+            rav[m] = rsum;
+        }
+        clrmsd  = 0;
+        midstr  = 0;
+        midrmsd = 10000;
+        for (i1 = 0; i1 < nstr; i1++)
+        {
+            r = rav[i1];
             if (r < midrmsd)
             {
                 midstr  = structure[i1];
@@ -1218,7 +1306,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
                         {
                             if (bWrite[i1])
                             {
-                                bWrite[i] = rmsd[structure[i1]][structure[i]] > rmsmin;
+                                bWrite[i] = cluster_rmsd(rmsd, rmsd_frames, structure[i1], structure[i]) > rmsmin;
                             }
                         }
                     }
@@ -1267,6 +1355,7 @@ static void analyze_clusters(int nf, t_clusters *clust, real **rmsd,
         }
     }
     sfree(structure);
+    sfree(rav);
     if (trxsfn)
     {
         sfree(trxsfn);
@@ -1344,6 +1433,15 @@ int gmx_cluster(int argc, char *argv[])
         "and eliminate it from the pool of clusters. Repeat for remaining",
         "structures in pool.[PAR]",
 
+        "With [TT]-nomatrix[tt] the single linkage and gromos methods work",
+        "from lists of the structures within [TT]cutoff[tt] of each other",
+        "instead of the full RMSD matrix, so memory scales with the number",
+        "of neighbors instead of the square of the number of structures.",
+        "This requires a trajectory and RMS deviations of coordinates.",
+        "The matrix files and the RMSD distribution are not written.",
+        "As [TT]-minstruct[tt] only sets the colors of the clusters in the",
+        "[TT]-o[tt] matrix, it can not be combined with [TT]-nomatrix[tt].[PAR]",
+
         "When the clustering algorithm assigns each structure to exactly one",
         "cluster (single linkage, Jarvis Patrick and gromos) and a trajectory",
         "file is supplied, the structure with",
@@ -1388,7 +1486,7 @@ int gmx_cluster(int argc, char *argv[])
     gmx_int64_t        nrms = 0;
 
     matrix             box;
-    rvec              *xtps, *usextps, *x1, **xx = nullptr;
+    rvec              *xtps, *usextps, **xx = nullptr;
     const char        *fn, *trx_out_fn;
     t_clusters         clust;
     t_mat             *rms, *orig = nullptr;
@@ -1402,9 +1500,11 @@ int gmx_cluster(int argc, char *argv[])
     int                isize = 0, ifsize = 0, iosize = 0;
     int               *index = nullptr, *fitidx = nullptr, *outidx = nullptr;
     char              *grpname;
-    real               rmsd, **d1, **d2, *time = nullptr, time_invfac, *mass = nullptr;
+    real              **d1, **d2, *time = nullptr, time_invfac, *mass = nullptr;
     char               buf[STRLEN], buf1[80];
     gmx_bool           bAnalyze, bUseRmsdCut, bJP_RMSD = FALSE, bReadMat, bReadTraj, bPBC = TRUE;
+    gmx_rmsd_frames_t *rmsd_frames = nullptr;
+    gmx_rmsd_nblist_t *nbl         = nullptr;
 
     int                method, ncluster = 0;
     static const char *methodname[] = {
@@ -1423,6 +1523,7 @@ int gmx_cluster(int argc, char *argv[])
     static int        nlevels  = 40, skip = 1;
     static real       scalemax = -1.0, rmsdcut = 0.1, rmsmin = 0.0;
     gmx_bool          bRMSdist = FALSE, bBinary = FALSE, bAverage = FALSE, bFit = TRUE;
+    gmx_bool          bMatrix  = TRUE;
     static int        niter    = 10000, nrandom = 0, seed = 0, write_ncl = 0, write_nst = 1, minstruct = 1;
     static real       kT       = 1e-3;
     static int        M        = 10, P = 3;
@@ -1438,6 +1539,9 @@ int gmx_cluster(int argc, char *argv[])
           "RMSD cut-off (nm) for two structures to be neighbor" },
         { "-fit",   FALSE, etBOOL, {&bFit},
           "Use least squares fitting before RMSD calculation" },
+        { "-matrix", FALSE, etBOOL, {&bMatrix},
+          "Store the full RMSD matrix, with [TT]-nomatrix[tt] only neighbor lists are stored "
+          "(linkage and gromos only)" },
         { "-max",   FALSE, etREAL, {&scalemax},
           "Maximum level in RMSD matrix" },
         { "-skip",  FALSE, etINT,  {&skip},
@@ -1541,6 +1645,21 @@ int gmx_cluster(int argc, char *argv[])
 
     bAnalyze = (method == m_linkage || method == m_jarvis_patrick ||
                 method == m_gromos );
+    if (!bMatrix)
+    {
+        if (method != m_linkage && method != m_gromos)
+        {
+            gmx_fatal(FARGS, "Method %s requires the full RMSD matrix", methodname[0]);
+        }
+        if (bReadMat || bRMSdist || bBinary)
+        {
+            gmx_fatal(FARGS, "Options -dm, -dista and -binary require the full RMSD matrix");
+        }
+        if (minstruct > 1)
+        {
+            gmx_fatal(FARGS, "Option -minstruct only affects the cluster depiction in the -o matrix, which is not written with -nomatrix");
+        }
+    }
 
     /* Open log file */
     log = ftp2FILE(efLOG, NFILE, fnm, "w");
@@ -1717,35 +1836,38 @@ int gmx_cluster(int argc, char *argv[])
 
         nlevels = readmat[0].nmap;
     }
+    else if (!bMatrix)
+    {
+        rms = nullptr;
+        fprintf(stderr, "Computing lists of structures within %g nm RMSD of %d structures\n",
+                rmsdcut, nf);
+        rmsd_frames = gmx_rmsd_frames_init(nf, isize, xx, mass, bFit);
+        nbl         = gmx_rmsd_neighbors(rmsd_frames, rmsdcut);
+        ffprintf_d(stderr, log, buf, "Number of structures %d\n", nf);
+        sprintf(buf, "Number of neighbor pairs within the cutoff %" GMX_PRId64 "\n",
+                (nbl->index[nf] - nf)/2);
+        ffprintf(stderr, log, buf);
+    }
     else   /* !bReadMat */
     {
         rms  = init_mat(nf, method == m_diagonalize);
         nrms = (static_cast<gmx_int64_t>(nf)*static_cast<gmx_int64_t>(nf-1))/2;
         if (!bRMSdist)
         {
+            gmx_rmsd_frames_t *rmsd_frames;
+
             fprintf(stderr, "Computing %dx%d RMS deviation matrix\n", nf, nf);
-            /* Initialize work array */
-            snew(x1, isize);
+            rmsd_frames = gmx_rmsd_frames_init(nf, isize, xx, mass, bFit);
+            gmx_rmsd_matrix(rmsd_frames, nullptr, rms->mat);
+            gmx_rmsd_frames_done(rmsd_frames);
+            /* Update the matrix statistics */
             for (i1 = 0; i1 < nf; i1++)
             {
                 for (i2 = i1+1; i2 < nf; i2++)
                 {
-                    for (i = 0; i < isize; i++)
-                    {
-                        copy_rvec(xx[i1][i], x1[i]);
-                    }
-                    if (bFit)
-                    {
-                        do_fit(isize, mass, xx[i2], x1);
-                    }
-                    rmsd = rmsdev(isize, mass, xx[i2], x1);
-                    set_mat_entry(rms, i1, i2, rmsd);
+                    set_mat_entry(rms, i1, i2, rms->mat[i1][i2]);
                 }
-                nrms -= nf-i1-1;
-                fprintf(stderr, "\r# RMSD calculations left: " "%" GMX_PRId64 "   ", nrms);
-                fflush(stderr);
             }
-            sfree(x1);
         }
         else /* bRMSdist */
         {
@@ -1782,43 +1904,46 @@ int gmx_cluster(int argc, char *argv[])
         }
         fprintf(stderr, "\n\n");
     }
-    ffprintf_gg(stderr, log, buf, "The RMSD ranges from %g to %g nm\n",
-                rms->minrms, rms->maxrms);
-    ffprintf_g(stderr, log, buf, "Average RMSD is %g\n", 2*rms->sumrms/(nf*(nf-1)));
-    ffprintf_d(stderr, log, buf, "Number of structures for matrix %d\n", nf);
-    ffprintf_g(stderr, log, buf, "Energy of the matrix is %g.\n", mat_energy(rms));
-    if (bUseRmsdCut && (rmsdcut < rms->minrms || rmsdcut > rms->maxrms) )
+    if (bMatrix)
     {
-        fprintf(stderr, "WARNING: rmsd cutoff %g is outside range of rmsd values "
-                "%g to %g\n", rmsdcut, rms->minrms, rms->maxrms);
-    }
-    if (bAnalyze && (rmsmin < rms->minrms) )
-    {
-        fprintf(stderr, "WARNING: rmsd minimum %g is below lowest rmsd value %g\n",
-                rmsmin, rms->minrms);
-    }
-    if (bAnalyze && (rmsmin > rmsdcut) )
-    {
-        fprintf(stderr, "WARNING: rmsd minimum %g is above rmsd cutoff %g\n",
-                rmsmin, rmsdcut);
-    }
+        ffprintf_gg(stderr, log, buf, "The RMSD ranges from %g to %g nm\n",
+                    rms->minrms, rms->maxrms);
+        ffprintf_g(stderr, log, buf, "Average RMSD is %g\n", 2*rms->sumrms/(nf*(nf-1)));
+        ffprintf_d(stderr, log, buf, "Number of structures for matrix %d\n", nf);
+        ffprintf_g(stderr, log, buf, "Energy of the matrix is %g.\n", mat_energy(rms));
+        if (bUseRmsdCut && (rmsdcut < rms->minrms || rmsdcut > rms->maxrms) )
+        {
+            fprintf(stderr, "WARNING: rmsd cutoff %g is outside range of rmsd values "
+                    "%g to %g\n", rmsdcut, rms->minrms, rms->maxrms);
+        }
+        if (bAnalyze && (rmsmin < rms->minrms) )
+        {
+            fprintf(stderr, "WARNING: rmsd minimum %g is below lowest rmsd value %g\n",
+                    rmsmin, rms->minrms);
+        }
+        if (bAnalyze && (rmsmin > rmsdcut) )
+        {
+            fprintf(stderr, "WARNING: rmsd minimum %g is above rmsd cutoff %g\n",
+                    rmsmin, rmsdcut);
+        }
 
-    /* Plot the rmsd distribution */
-    rmsd_distribution(opt2fn("-dist", NFILE, fnm), rms, oenv);
+        /* Plot the rmsd distribution */
+        rmsd_distribution(opt2fn("-dist", NFILE, fnm), rms, oenv);
 
-    if (bBinary)
-    {
-        for (i1 = 0; (i1 < nf); i1++)
+        if (bBinary)
         {
-            for (i2 = 0; (i2 < nf); i2++)
+            for (i1 = 0; (i1 < nf); i1++)
             {
-                if (rms->mat[i1][i2] < rmsdcut)
+                for (i2 = 0; (i2 < nf); i2++)
                 {
-                    rms->mat[i1][i2] = 0;
-                }
-                else
-                {
-                    rms->mat[i1][i2] = 1;
+                    if (rms->mat[i1][i2] < rmsdcut)
+                    {
+                        rms->mat[i1][i2] = 0;
+                    }
+                    else
+                    {
+                        rms->mat[i1][i2] = 1;
+                    }
                 }
             }
         }
@@ -1828,8 +1953,15 @@ int gmx_cluster(int argc, char *argv[])
     switch (method)
     {
         case m_linkage:
-            /* Now sort the matrix and write it out again */
-            gather(rms, rmsdcut, &clust);
+            if (nbl)
+            {
+                gather_nblist(nbl, &clust);
+            }
+            else
+            {
+                /* Now sort the matrix and write it out again */
+                gather(rms, rmsdcut, &clust);
+            }
             break;
         case m_diagonalize:
             /* Do a diagonalization */
@@ -1858,7 +1990,14 @@ int gmx_cluster(int argc, char *argv[])
             jarvis_patrick(rms->nn, rms->mat, M, P, bJP_RMSD ? rmsdcut : -1, &clust);
             break;
         case m_gromos:
-            gromos(rms->nn, rms->mat, rmsdcut, &clust);
+            if (nbl)
+            {
+                gromos(nf, nullptr, nbl, rmsdcut, &clust);
+            }
+            else
+            {
+                gromos(rms->nn, rms->mat, nullptr, rmsdcut, &clust);
+            }
             break;
         default:
             gmx_fatal(FARGS, "DEATH HORROR unknown method \"%s\"", methodname[0]);
@@ -1872,7 +2011,11 @@ int gmx_cluster(int argc, char *argv[])
 
     if (bAnalyze)
     {
-        if (minstruct > 1)
+        if (!bMatrix)
+        {
+            gmx_rmsd_nblist_done(nbl);
+        }
+        else if (minstruct > 1)
         {
             ncluster = plot_clusters(nf, rms->mat, &clust, minstruct);
         }
@@ -1891,7 +2034,8 @@ int gmx_cluster(int argc, char *argv[])
             copy_rvec(xtps[index[i]], usextps[i]);
         }
         useatoms.nr = isize;
-        analyze_clusters(nf, &clust, rms->mat, isize, &useatoms, usextps, mass, xx, time,
+        analyze_clusters(nf, &clust, bMatrix ? rms->mat : nullptr, rmsd_frames,
+                         isize, &useatoms, usextps, mass, xx, time,
                          ifsize, fitidx, iosize, outidx,
                          bReadTraj ? trx_out_fn : nullptr,
                          opt2fn_null("-sz", NFILE, fnm),
@@ -1902,6 +2046,17 @@ int gmx_cluster(int argc, char *argv[])
                          rlo_bot, rhi_bot, oenv);
     }
     gmx_ffclose(log);
+    if (!bMatrix)
+    {
+        gmx_rmsd_frames_done(rmsd_frames);
+        fprintf(stderr, "Not writing %s without the RMSD matrix\n", opt2fn("-o", NFILE, fnm));
+        do_view(oenv, opt2fn_null("-sz", NFILE, fnm), "-nxy");
+        do_view(oenv, opt2fn_null("-tr", NFILE, fnm), "-nxy");
+        do_view(oenv, opt2fn_null("-ntr", NFILE, fnm), "-nxy");
+        do_view(oenv, opt2fn_null("-clid", NFILE, fnm), "-nxy");
+
+        return 0;
+    }
 
     if (bBinary && !bAnalyze)
     {
@@ -39,6 +39,9 @@
 #include <cmath>
 #include <cstring>
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/matio.h"
@@ -51,15 +54,240 @@
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/pbcutil/rmpbc.h"
+#include "gromacs/random/normaldistribution.h"
+#include "gromacs/random/threefry.h"
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/sysinfo.h"
 
+/* Settings for reading the fitted structures of the analysis group */
+typedef struct {
+    const char             *trxfile;
+    const gmx_output_env_t *oenv;
+    gmx_rmpbc_t             gpbc;      /* nullptr without pbc correction */
+    int                     nfit;      /* 0 without fit */
+    int                    *ifit;
+    real                   *w_rls;
+    rvec                   *xref;      /* the fit reference */
+    rvec                   *xdev;      /* the structure to take deviations from */
+    int                     natoms;    /* the size of the analysis group */
+    int                    *index;
+    real                   *sqrtm;
+    int                     maxframes; /* the number of frames to use, -1 is all */
+} t_covar_traj;
+
+/* Number of frames that are processed together in covar_product */
+static const int c_covarBlockSize = 64;
+
+/* Multiplies the covariance matrix C with the nvec column vectors in q,
+ * stored as ndim rows of length nvec, and stores the result in y.
+ * C is never formed. Instead the trajectory is read and the deviations
+ * of blocks of frames X are used to accumulate X^T (X q), with the
+ * atom range divided over the threads.
+ * Returns the number of frames used. When trace != nullptr, the trace
+ * of C is returned in *trace and the time span in *tstart and *tend.
+ */
+static int covar_product(const t_covar_traj *ct, int nvec, const double *q, double *y,
+                         real *trace, real *tstart, real *tend)
+{
+    t_trxstatus        *status;
+    rvec               *xread;
+    matrix              box;
+    real                t;
+    int                 ndim, nat, nframes, nb, nthreads;
+    gmx_bool            bMore;
+    double              tr;
+    std::vector<real>   xb;
+    std::vector<double> z, zt;
+
+    ndim     = ct->natoms*DIM;
+    nthreads = gmx_omp_get_max_threads();
+    xb.resize(c_covarBlockSize*ndim);
+    z.resize(c_covarBlockSize*nvec);
+    zt.resize(nthreads*c_covarBlockSize*nvec);
+    std::fill(y, y + ndim*nvec, 0.0);
+
+    nframes = 0;
+    nb      = 0;
+    tr      = 0;
+    nat     = read_first_x(ct->oenv, &status, ct->trxfile, &t, &xread, box);
+    if (tstart)
+    {
+        *tstart = t;
+    }
+    do
+    {
+        if (tend)
+        {
+            *tend = t;
+        }
+        nframes++;
+        /* calculate the (fitted) deviation of the selected atoms */
+        if (ct->gpbc)
+        {
+            gmx_rmpbc(ct->gpbc, nat, box, xread);
+        }
+        if (ct->nfit > 0)
+        {
+            reset_x(ct->nfit, ct->ifit, nat, nullptr, xread, ct->w_rls);
+            do_fit(nat, ct->w_rls, ct->xref, xread);
+        }
+        for (int i = 0; i < ct->natoms; i++)
+        {
+            for (int d = 0; d < DIM; d++)
+            {
+                real dx = (xread[ct->index[i]][d] - ct->xdev[i][d])*ct->sqrtm[i];
+
+                xb[nb*ndim + DIM*i + d] = dx;
+                tr                     += dx*dx;
+            }
+        }
+        nb++;
+
+        bMore = (read_next_x(ct->oenv, status, &t, xread, box) &&
+                 (ct->maxframes < 0 || nframes < ct->maxframes));
+
+        if (nb == c_covarBlockSize || !bMore)
+        {
+#pragma omp parallel num_threads(nthreads)
+            {
+                try
+                {
+                    int     thread_id = gmx_omp_get_thread_num();
+                    int     i0        = (thread_id*ndim)/nthreads;
+                    int     i1        = ((thread_id+1)*ndim)/nthreads;
+                    double *ztt       = zt.data() + thread_id*c_covarBlockSize*nvec;
+
+                    /* z = X q, summed over the threads below */
+                    for (int b = 0; b < nb; b++)
+                    {
+                        const real *xrow = xb.data() + b*ndim;
+                        for (int c = 0; c < nvec; c++)
+                        {
+                            ztt[b*nvec + c] = 0;
+                        }
+                        for (int i = i0; i < i1; i++)
+                        {
+                            for (int c = 0; c < nvec; c++)
+                            {
+                                ztt[b*nvec + c] += xrow[i]*q[i*nvec + c];
+                            }
+                        }
+                    }
+                }
+                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+            }
+            for (int k = 0; k < nb*nvec; k++)
+            {
+                z[k] = 0;
+                for (int th = 0; th < nthreads; th++)
+                {
+                    z[k] += zt[th*c_covarBlockSize*nvec + k];
+                }
+            }
+#pragma omp parallel num_threads(nthreads)
+            {
+                try
+                {
+                    int thread_id = gmx_omp_get_thread_num();
+                    int i0        = (thread_id*ndim)/nthreads;
+                    int i1        = ((thread_id+1)*ndim)/nthreads;
+
+                    /* y += X^T z */
+                    for (int b = 0; b < nb; b++)
+                    {
+                        const real   *xrow = xb.data() + b*ndim;
+                        const double *zb   = z.data() + b*nvec;
+                        for (int i = i0; i < i1; i++)
+                        {
+                            for (int c = 0; c < nvec; c++)
+                            {
+                                y[i*nvec + c] += xrow[i]*zb[c];
+                            }
+                        }
+                    }
+                }
+                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+            }
+            nb = 0;
+        }
+    }
+    while (bMore);
+    close_trx(status);
+    sfree(xread);
+
+    for (int k = 0; k < ndim*nvec; k++)
+    {
+        y[k] /= nframes;
+    }
+    if (trace)
+    {
+        *trace = tr/nframes;
+    }
+
+    return nframes;
+}
+
+/* Orthonormalizes the nvec columns of q, stored as ndim rows of length nvec,
+ * with two passes of modified Gram-Schmidt. Columns that are (nearly)
+ * linearly dependent on the previous ones are replaced by random vectors.
+ */
+static void orthonormalize(int ndim, int nvec, double *q, gmx::DefaultRandomEngine *rng)
+{
+    gmx::NormalDistribution<real> dist;
+
+    for (int c = 0; c < nvec; c++)
+    {
+        double norm0 = 0, norm = 0;
+
+        for (int i = 0; i < ndim; i++)
+        {
+            norm0 += q[i*nvec + c]*q[i*nvec + c];
+        }
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (int c2 = 0; c2 < c; c2++)
+            {
+                double dot = 0;
+                for (int i = 0; i < ndim; i++)
+                {
+                    dot += q[i*nvec + c]*q[i*nvec + c2];
+                }
+                for (int i = 0; i < ndim; i++)
+                {
+                    q[i*nvec + c] -= dot*q[i*nvec + c2];
+                }
+            }
+        }
+        for (int i = 0; i < ndim; i++)
+        {
+            norm += q[i*nvec + c]*q[i*nvec + c];
+        }
+        if (norm <= 1e-20*norm0 || norm == 0)
+        {
+            /* No new direction left, start again from a random vector */
+            for (int i = 0; i < ndim; i++)
+            {
+                q[i*nvec + c] = dist(*rng);
+            }
+            c--;
+            continue;
+        }
+        norm = 1/std::sqrt(norm);
+        for (int i = 0; i < ndim; i++)
+        {
+            q[i*nvec + c] *= norm;
+        }
+    }
+}
+
 int gmx_covar(int argc, char *argv[])
 {
     const char       *desc[] = {
@@ -94,10 +322,21 @@ int gmx_covar(int argc, char *argv[])
         "of atoms involved. It is easy to run out of memory, in which",
         "case this tool will probably exit with a 'Segmentation fault'. You",
         "should consider carefully whether a reduced set of atoms will meet",
-        "your needs for lower costs."
+        "your needs for lower costs.",
+        "[PAR]",
+        "For large selections, option [TT]-nvec[tt] computes only the",
+        "eigenvectors with the largest eigenvalues by randomized subspace",
+        "iteration. The covariance matrix is then never constructed; each of",
+        "the [TT]-niter[tt] iterations reads the trajectory once and multiplies",
+        "the deviations of blocks of frames with the current subspace.",
+        "Memory and time then scale linearly with the number of atoms.",
+        "The change of the eigenvalues in each iteration is printed,",
+        "which shows whether [TT]-niter[tt] suffices.",
+        "Options [TT]-ascii[tt], [TT]-xpm[tt] and [TT]-xpma[tt] need the",
+        "full matrix and can not be used with [TT]-nvec[tt]."
     };
     static gmx_bool   bFit = TRUE, bRef = FALSE, bM = FALSE, bPBC = TRUE;
-    static int        end  = -1;
+    static int        end  = -1, nvec = 0, niter = 6;
     t_pargs           pa[] = {
         { "-fit",  FALSE, etBOOL, {&bFit},
           "Fit to a reference structure"},
@@ -108,7 +347,11 @@ int gmx_covar(int argc, char *argv[])
         { "-last",  FALSE, etINT, {&end},
           "Last eigenvector to write away (-1 is till the last)" },
         { "-pbc",  FALSE,  etBOOL, {&bPBC},
-          "Apply corrections for periodic boundary conditions" }
+          "Apply corrections for periodic boundary conditions" },
+        { "-nvec", FALSE, etINT, {&nvec},
+          "Only compute this number of eigenvectors, without constructing the covariance matrix (0 is all)" },
+        { "-niter", FALSE, etINT, {&niter},
+          "Number of subspace iterations, each reading the trajectory, with [TT]-nvec[tt]" }
     };
     FILE             *out = nullptr; /* initialization makes all compilers happy */
     t_trxstatus      *status;
@@ -122,7 +365,7 @@ int gmx_covar(int argc, char *argv[])
     real              xj, *w_rls = nullptr;
     real              min, max, *axis;
     int               natoms, nat, nframes0, nframes, nlevels;
-    gmx_int64_t       ndim, i, j, k, l;
+    gmx_int64_t       ndim, neig, i, j, k, l;
     int               WriteXref;
     const char       *fitfile, *trxfile, *ndxfile;
     const char       *eigvalfile, *eigvecfile, *averfile, *logfile;
@@ -170,6 +413,15 @@ int gmx_covar(int argc, char *argv[])
     xpmfile    = opt2fn_null("-xpm", NFILE, fnm);
     xpmafile   = opt2fn_null("-xpma", NFILE, fnm);
 
+    if (nvec < 0 || niter < 1)
+    {
+        gmx_fatal(FARGS, "-nvec should be >= 0 and -niter >= 1");
+    }
+    if (nvec > 0 && (asciifile || xpmfile || xpmafile))
+    {
+        gmx_fatal(FARGS, "Options -ascii, -xpm and -xpma require the full covariance matrix and can not be used with -nvec");
+    }
+
     read_tps_conf(fitfile, &top, &ePBC, &xref, nullptr, box, TRUE);
     atoms = &top.atoms;
 
@@ -254,11 +506,6 @@ int gmx_covar(int argc, char *argv[])
     snew(x, natoms);
     snew(xav, natoms);
     ndim = natoms*DIM;
-    if (std::sqrt(static_cast<real>(GMX_INT64_MAX)) < static_cast<real>(ndim))
-    {
-        gmx_fatal(FARGS, "Number of degrees of freedoms to large for matrix.\n");
-    }
-    snew(mat, ndim*ndim);
 
     fprintf(stderr, "Calculating the average structure ...\n");
     nframes0 = 0;
@@ -301,242 +548,375 @@ int gmx_covar(int argc, char *argv[])
                            atoms, xread, nullptr, epbcNONE, zerobox, natoms, index);
     sfree(xread);
 
-    fprintf(stderr, "Constructing covariance matrix (%dx%d) ...\n", static_cast<int>(ndim), static_cast<int>(ndim));
-    nframes = 0;
-    nat     = read_first_x(oenv, &status, trxfile, &t, &xread, box);
-    tstart  = t;
-    do
+    if (bRef)
     {
-        nframes++;
-        tend = t;
-        /* calculate x: a (fitted) structure of the selected atoms */
-        if (bPBC)
+        /* copy the reference structure to the ouput array x */
+        snew(xproj, natoms);
+        for (i = 0; i < natoms; i++)
         {
-            gmx_rmpbc(gpbc, nat, box, xread);
+            copy_rvec(xref[index[i]], xproj[i]);
         }
-        if (bFit)
+    }
+    else
+    {
+        xproj = xav;
+    }
+
+    if (nvec > 0)
+    {
+        t_covar_traj             ct;
+        gmx::DefaultRandomEngine rng(12345);
+        double                  *q, *y, dev;
+        real                    *bmat, *bval, *bvec, *bvalprev;
+        int                      nsub, c, c2, iter;
+
+        /* Randomized subspace iteration with the covariance matrix
+         * applied from the trajectory, with some oversampling for faster
+         * convergence of the requested eigenvectors.
+         */
+        nvec = std::min(nvec, static_cast<int>(ndim));
+        nsub = std::min(nvec + 10, static_cast<int>(ndim));
+
+        ct.trxfile   = trxfile;
+        ct.oenv      = oenv;
+        ct.gpbc      = gpbc;
+        ct.nfit      = nfit;
+        ct.ifit      = ifit;
+        ct.w_rls     = w_rls;
+        ct.xref      = xref;
+        ct.xdev      = xproj;
+        ct.natoms    = natoms;
+        ct.index     = index;
+        ct.sqrtm     = sqrtm;
+        ct.maxframes = bRef ? -1 : nframes0;
+
+        snew(q, ndim*nsub);
+        snew(y, ndim*nsub);
+        snew(bmat, nsub*nsub);
+        snew(bval, nsub);
+        snew(bvec, nsub*nsub);
+        snew(bvalprev, nsub);
+        gmx::NormalDistribution<real> dist;
+        for (i = 0; i < ndim*nsub; i++)
         {
-            reset_x(nfit, ifit, nat, nullptr, xread, w_rls);
-            do_fit(nat, w_rls, xref, xread);
+            q[i] = dist(rng);
         }
-        if (bRef)
+        orthonormalize(ndim, nsub, q, &rng);
+
+        fprintf(stderr, "Computing %d eigenvectors with %d subspace iterations ...\n",
+                nvec, niter);
+        nframes = 0;
+        trace   = 0;
+        tstart  = 0;
+        tend    = 0;
+        for (iter = 0; iter < niter; iter++)
         {
-            for (i = 0; i < natoms; i++)
+            nframes = covar_product(&ct, nsub, q, y, &trace, &tstart, &tend);
+
+            /* Rayleigh-Ritz: diagonalize the projection of C on the subspace */
+            for (c = 0; c < nsub; c++)
             {
-                rvec_sub(xread[index[i]], xref[index[i]], x[i]);
+                for (c2 = 0; c2 <= c; c2++)
+                {
+                    double b = 0;
+                    for (i = 0; i < ndim; i++)
+                    {
+                        b += q[i*nsub + c]*y[i*nsub + c2] + q[i*nsub + c2]*y[i*nsub + c];
+                    }
+                    bmat[c*nsub + c2] = 0.5*b;
+                    bmat[c2*nsub + c] = 0.5*b;
+                }
             }
-        }
-        else
-        {
-            for (i = 0; i < natoms; i++)
+            eigensolver(bmat, nsub, 0, nsub, bval, bvec);
+
+            dev = 0;
+            for (c = nsub - nvec; c < nsub; c++)
+            {
+                dev         = std::max(dev, static_cast<double>(std::abs(bval[c] - bvalprev[c])));
+                bvalprev[c] = bval[c];
+            }
+            /* The largest change relative to the largest eigenvalue */
+            fprintf(stderr, "Iteration %2d: largest eigenvalue %g, eigenvalue change %g\n",
+                    iter + 1, bval[nsub-1], iter > 0 && bval[nsub-1] > 0 ? dev/bval[nsub-1] : 1.0);
+
+            if (iter < niter - 1)
             {
-                rvec_sub(xread[index[i]], xav[i], x[i]);
+                std::swap(q, y);
+                orthonormalize(ndim, nsub, q, &rng);
             }
         }
+        fprintf(stderr, "Read %d frames %d times\n", nframes, niter);
 
-        for (j = 0; j < natoms; j++)
+        /* The Ritz vectors q bvec, with the largest eigenvalue first */
+        snew(eigenvalues, nvec);
+        snew(mat, nvec*ndim);
+        for (j = 0; j < nvec; j++)
         {
-            for (dj = 0; dj < DIM; dj++)
+            const real *v = bvec + (nsub - 1 - j)*nsub;
+
+            eigenvalues[j] = bval[nsub - 1 - j];
+            for (i = 0; i < ndim; i++)
             {
-                k  = ndim*(DIM*j+dj);
-                xj = x[j][dj];
-                for (i = j; i < natoms; i++)
+                double u = 0;
+                for (c = 0; c < nsub; c++)
                 {
-                    l = k+DIM*i;
-                    for (d = 0; d < DIM; d++)
-                    {
-                        mat[l+d] += x[i][d]*xj;
-                    }
+                    u += q[i*nsub + c]*v[c];
                 }
+                mat[j*ndim + i] = u;
             }
         }
-    }
-    while (read_next_x(oenv, status, &t, xread, box) &&
-           (bRef || nframes < nframes0));
-    close_trx(status);
-    gmx_rmpbc_done(gpbc);
-
-    fprintf(stderr, "Read %d frames\n", nframes);
+        sfree(q);
+        sfree(y);
+        sfree(bmat);
+        sfree(bval);
+        sfree(bvec);
+        sfree(bvalprev);
 
-    if (bRef)
-    {
-        /* copy the reference structure to the ouput array x */
-        snew(xproj, natoms);
-        for (i = 0; i < natoms; i++)
-        {
-            copy_rvec(xref[index[i]], xproj[i]);
-        }
+        fprintf(stderr, "\nTrace of the covariance matrix: %g (%snm^2)\n",
+                trace, bM ? "u " : "");
     }
     else
     {
-        xproj = xav;
-    }
+        if (std::sqrt(static_cast<real>(GMX_INT64_MAX)) < static_cast<real>(ndim))
+        {
+            gmx_fatal(FARGS, "Number of degrees of freedoms to large for matrix.\n");
+        }
+        snew(mat, ndim*ndim);
 
-    /* correct the covariance matrix for the mass */
-    inv_nframes = 1.0/nframes;
-    for (j = 0; j < natoms; j++)
-    {
-        for (dj = 0; dj < DIM; dj++)
+        fprintf(stderr, "Constructing covariance matrix (%dx%d) ...\n", static_cast<int>(ndim), static_cast<int>(ndim));
+        nframes = 0;
+        nat     = read_first_x(oenv, &status, trxfile, &t, &xread, box);
+        tstart  = t;
+        do
         {
-            for (i = j; i < natoms; i++)
+            nframes++;
+            tend = t;
+            /* calculate x: a (fitted) structure of the selected atoms */
+            if (bPBC)
+            {
+                gmx_rmpbc(gpbc, nat, box, xread);
+            }
+            if (bFit)
             {
-                k = ndim*(DIM*j+dj)+DIM*i;
-                for (d = 0; d < DIM; d++)
+                reset_x(nfit, ifit, nat, nullptr, xread, w_rls);
+                do_fit(nat, w_rls, xref, xread);
+            }
+            if (bRef)
+            {
+                for (i = 0; i < natoms; i++)
                 {
-                    mat[k+d] = mat[k+d]*inv_nframes*sqrtm[i]*sqrtm[j];
+                    rvec_sub(xread[index[i]], xref[index[i]], x[i]);
+                }
+            }
+            else
+            {
+                for (i = 0; i < natoms; i++)
+                {
+                    rvec_sub(xread[index[i]], xav[i], x[i]);
                 }
             }
-        }
-    }
 
-    /* symmetrize the matrix */
-    for (j = 0; j < ndim; j++)
-    {
-        for (i = j; i < ndim; i++)
-        {
-            mat[ndim*i+j] = mat[ndim*j+i];
+            for (j = 0; j < natoms; j++)
+            {
+                for (dj = 0; dj < DIM; dj++)
+                {
+                    k  = ndim*(DIM*j+dj);
+                    xj = x[j][dj];
+                    for (i = j; i < natoms; i++)
+                    {
+                        l = k+DIM*i;
+                        for (d = 0; d < DIM; d++)
+                        {
+                            mat[l+d] += x[i][d]*xj;
+                        }
+                    }
+                }
+            }
         }
-    }
+        while (read_next_x(oenv, status, &t, xread, box) &&
+               (bRef || nframes < nframes0));
+        close_trx(status);
 
-    trace = 0;
-    for (i = 0; i < ndim; i++)
-    {
-        trace += mat[i*ndim+i];
-    }
-    fprintf(stderr, "\nTrace of the covariance matrix: %g (%snm^2)\n",
-            trace, bM ? "u " : "");
+        fprintf(stderr, "Read %d frames\n", nframes);
 
-    if (asciifile)
-    {
-        out = gmx_ffopen(asciifile, "w");
-        for (j = 0; j < ndim; j++)
+        /* correct the covariance matrix for the mass */
+        inv_nframes = 1.0/nframes;
+        for (j = 0; j < natoms; j++)
         {
-            for (i = 0; i < ndim; i += 3)
+            for (dj = 0; dj < DIM; dj++)
             {
-                fprintf(out, "%g %g %g\n",
-                        mat[ndim*j+i], mat[ndim*j+i+1], mat[ndim*j+i+2]);
+                for (i = j; i < natoms; i++)
+                {
+                    k = ndim*(DIM*j+dj)+DIM*i;
+                    for (d = 0; d < DIM; d++)
+                    {
+                        mat[k+d] = mat[k+d]*inv_nframes*sqrtm[i]*sqrtm[j];
+                    }
+                }
             }
         }
-        gmx_ffclose(out);
-    }
 
-    if (xpmfile)
-    {
-        min = 0;
-        max = 0;
-        snew(mat2, ndim);
+        /* symmetrize the matrix */
         for (j = 0; j < ndim; j++)
         {
-            mat2[j] = &(mat[ndim*j]);
-            for (i = 0; i <= j; i++)
+            for (i = j; i < ndim; i++)
             {
-                if (mat2[j][i] < min)
-                {
-                    min = mat2[j][i];
-                }
-                if (mat2[j][j] > max)
-                {
-                    max = mat2[j][i];
-                }
+                mat[ndim*i+j] = mat[ndim*j+i];
             }
         }
-        snew(axis, ndim);
+
+        trace = 0;
         for (i = 0; i < ndim; i++)
         {
-            axis[i] = i+1;
+            trace += mat[i*ndim+i];
         }
-        rlo.r   = 0; rlo.g = 0; rlo.b = 1;
-        rmi.r   = 1; rmi.g = 1; rmi.b = 1;
-        rhi.r   = 1; rhi.g = 0; rhi.b = 0;
-        out     = gmx_ffopen(xpmfile, "w");
-        nlevels = 80;
-        write_xpm3(out, 0, "Covariance", bM ? "u nm^2" : "nm^2",
-                   "dim", "dim", ndim, ndim, axis, axis,
-                   mat2, min, 0.0, max, rlo, rmi, rhi, &nlevels);
-        gmx_ffclose(out);
-        sfree(axis);
-        sfree(mat2);
-    }
+        fprintf(stderr, "\nTrace of the covariance matrix: %g (%snm^2)\n",
+                trace, bM ? "u " : "");
 
-    if (xpmafile)
-    {
-        min = 0;
-        max = 0;
-        snew(mat2, ndim/DIM);
-        for (i = 0; i < ndim/DIM; i++)
+        if (asciifile)
         {
-            snew(mat2[i], ndim/DIM);
-        }
-        for (j = 0; j < ndim/DIM; j++)
-        {
-            for (i = 0; i <= j; i++)
+            out = gmx_ffopen(asciifile, "w");
+            for (j = 0; j < ndim; j++)
             {
-                mat2[j][i] = 0;
-                for (d = 0; d < DIM; d++)
-                {
-                    mat2[j][i] += mat[ndim*(DIM*j+d)+DIM*i+d];
-                }
-                if (mat2[j][i] < min)
+                for (i = 0; i < ndim; i += 3)
                 {
-                    min = mat2[j][i];
+                    fprintf(out, "%g %g %g\n",
+                            mat[ndim*j+i], mat[ndim*j+i+1], mat[ndim*j+i+2]);
                 }
-                if (mat2[j][j] > max)
-                {
-                    max = mat2[j][i];
-                }
-                mat2[i][j] = mat2[j][i];
             }
+            gmx_ffclose(out);
         }
-        snew(axis, ndim/DIM);
-        for (i = 0; i < ndim/DIM; i++)
+
+        if (xpmfile)
         {
-            axis[i] = i+1;
+            min = 0;
+            max = 0;
+            snew(mat2, ndim);
+            for (j = 0; j < ndim; j++)
+            {
+                mat2[j] = &(mat[ndim*j]);
+                for (i = 0; i <= j; i++)
+                {
+                    if (mat2[j][i] < min)
+                    {
+                        min = mat2[j][i];
+                    }
+                    if (mat2[j][j] > max)
+                    {
+                        max = mat2[j][i];
+                    }
+                }
+            }
+            snew(axis, ndim);
+            for (i = 0; i < ndim; i++)
+            {
+                axis[i] = i+1;
+            }
+            rlo.r   = 0; rlo.g = 0; rlo.b = 1;
+            rmi.r   = 1; rmi.g = 1; rmi.b = 1;
+            rhi.r   = 1; rhi.g = 0; rhi.b = 0;
+            out     = gmx_ffopen(xpmfile, "w");
+            nlevels = 80;
+            write_xpm3(out, 0, "Covariance", bM ? "u nm^2" : "nm^2",
+                       "dim", "dim", ndim, ndim, axis, axis,
+                       mat2, min, 0.0, max, rlo, rmi, rhi, &nlevels);
+            gmx_ffclose(out);
+            sfree(axis);
+            sfree(mat2);
         }
-        rlo.r   = 0; rlo.g = 0; rlo.b = 1;
-        rmi.r   = 1; rmi.g = 1; rmi.b = 1;
-        rhi.r   = 1; rhi.g = 0; rhi.b = 0;
-        out     = gmx_ffopen(xpmafile, "w");
-        nlevels = 80;
-        write_xpm3(out, 0, "Covariance", bM ? "u nm^2" : "nm^2",
-                   "atom", "atom", ndim/DIM, ndim/DIM, axis, axis,
-                   mat2, min, 0.0, max, rlo, rmi, rhi, &nlevels);
-        gmx_ffclose(out);
-        sfree(axis);
-        for (i = 0; i < ndim/DIM; i++)
+
+        if (xpmafile)
         {
-            sfree(mat2[i]);
+            min = 0;
+            max = 0;
+            snew(mat2, ndim/DIM);
+            for (i = 0; i < ndim/DIM; i++)
+            {
+                snew(mat2[i], ndim/DIM);
+            }
+            for (j = 0; j < ndim/DIM; j++)
+            {
+                for (i = 0; i <= j; i++)
+                {
+                    mat2[j][i] = 0;
+                    for (d = 0; d < DIM; d++)
+                    {
+                        mat2[j][i] += mat[ndim*(DIM*j+d)+DIM*i+d];
+                    }
+                    if (mat2[j][i] < min)
+                    {
+                        min = mat2[j][i];
+                    }
+                    if (mat2[j][j] > max)
+                    {
+                        max = mat2[j][i];
+                    }
+                    mat2[i][j] = mat2[j][i];
+                }
+            }
+            snew(axis, ndim/DIM);
+            for (i = 0; i < ndim/DIM; i++)
+            {
+                axis[i] = i+1;
+            }
+            rlo.r   = 0; rlo.g = 0; rlo.b = 1;
+            rmi.r   = 1; rmi.g = 1; rmi.b = 1;
+            rhi.r   = 1; rhi.g = 0; rhi.b = 0;
+            out     = gmx_ffopen(xpmafile, "w");
+            nlevels = 80;
+            write_xpm3(out, 0, "Covariance", bM ? "u nm^2" : "nm^2",
+                       "atom", "atom", ndim/DIM, ndim/DIM, axis, axis,
+                       mat2, min, 0.0, max, rlo, rmi, rhi, &nlevels);
+            gmx_ffclose(out);
+            sfree(axis);
+            for (i = 0; i < ndim/DIM; i++)
+            {
+                sfree(mat2[i]);
+            }
+            sfree(mat2);
         }
-        sfree(mat2);
-    }
 
 
-    /* call diagonalization routine */
+        /* call diagonalization routine */
 
-    snew(eigenvalues, ndim);
-    snew(eigenvectors, ndim*ndim);
+        snew(eigenvalues, ndim);
+        snew(eigenvectors, ndim*ndim);
 
-    std::memcpy(eigenvectors, mat, ndim*ndim*sizeof(real));
-    fprintf(stderr, "\nDiagonalizing ...\n");
-    fflush(stderr);
-    eigensolver(eigenvectors, ndim, 0, ndim, eigenvalues, mat);
-    sfree(eigenvectors);
+        std::memcpy(eigenvectors, mat, ndim*ndim*sizeof(real));
+        fprintf(stderr, "\nDiagonalizing ...\n");
+        fflush(stderr);
+        eigensolver(eigenvectors, ndim, 0, ndim, eigenvalues, mat);
+        sfree(eigenvectors);
+    }
+    gmx_rmpbc_done(gpbc);
 
     /* now write the output */
 
-    sum = 0;
-    for (i = 0; i < ndim; i++)
+    /* With -nvec only the largest eigenvalues are present, in decreasing order */
+    neig = (nvec > 0 ? nvec : ndim);
+    sum  = 0;
+    for (i = 0; i < neig; i++)
     {
         sum += eigenvalues[i];
     }
     fprintf(stderr, "\nSum of the eigenvalues: %g (%snm^2)\n",
             sum, bM ? "u " : "");
-    if (std::abs(trace-sum) > 0.01*trace)
+    if (nvec > 0)
+    {
+        fprintf(stderr, "The %d largest eigenvalues sum to %.1f%% of the trace\n",
+                nvec, 100*sum/trace);
+    }
+    else if (std::abs(trace-sum) > 0.01*trace)
     {
         fprintf(stderr, "\nWARNING: eigenvalue sum deviates from the trace of the covariance matrix\n");
     }
 
     /* Set 'end', the maximum eigenvector and -value index used for output */
-    if (end == -1)
+    if (nvec > 0 && (end == -1 || end > nvec))
+    {
+        end = std::min(nvec, nframes-1);
+    }
+    else if (end == -1)
     {
         if (nframes-1 < ndim)
         {
@@ -559,7 +939,7 @@ int gmx_covar(int argc, char *argv[])
                    "Eigenvector index", str, oenv);
     for (i = 0; (i < end); i++)
     {
-        fprintf (out, "%10d %g\n", static_cast<int>(i+1), eigenvalues[ndim-1-i]);
+        fprintf (out, "%10d %g\n", static_cast<int>(i+1), eigenvalues[nvec > 0 ? i : ndim-1-i]);
     }
     xvgrclose(out);
 
@@ -585,7 +965,7 @@ int gmx_covar(int argc, char *argv[])
         WriteXref = eWXR_NOFIT;
     }
 
-    write_eigenvectors(eigvecfile, natoms, mat, TRUE, 1, end,
+    write_eigenvectors(eigvecfile, natoms, mat, nvec == 0, 1, end,
                        WriteXref, x, bDiffMass1, xproj, bM, eigenvalues);
 
     out = gmx_ffopen(logfile, "w");
@@ -624,11 +1004,27 @@ int gmx_covar(int argc, char *argv[])
     {
         fprintf(out, "Fit is %smass weighted\n", bDiffMass1 ? "" : "non-");
     }
-    fprintf(out, "Diagonalized the %dx%d covariance matrix\n", static_cast<int>(ndim), static_cast<int>(ndim));
+    if (nvec > 0)
+    {
+        fprintf(out, "Computed the %d largest eigenvalues of the %dx%d covariance matrix\n"
+                "with %d iterations of randomized subspace iteration\n",
+                nvec, static_cast<int>(ndim), static_cast<int>(ndim), niter);
+    }
+    else
+    {
+        fprintf(out, "Diagonalized the %dx%d covariance matrix\n", static_cast<int>(ndim), static_cast<int>(ndim));
+    }
     fprintf(out, "Trace of the covariance matrix before diagonalizing: %g\n",
             trace);
-    fprintf(out, "Trace of the covariance matrix after diagonalizing: %g\n\n",
-            sum);
+    if (nvec > 0)
+    {
+        fprintf(out, "Sum of the %d computed eigenvalues: %g\n\n", nvec, sum);
+    }
+    else
+    {
+        fprintf(out, "Trace of the covariance matrix after diagonalizing: %g\n\n",
+                sum);
+    }
 
     fprintf(out, "Wrote %d eigenvalues to %s\n", static_cast<int>(end), eigvalfile);
     if (WriteXref == eWXR_YES)
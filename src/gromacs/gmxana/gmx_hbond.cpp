@@ -47,9 +47,9 @@
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
 #include "gromacs/correlationfunctions/autocorr.h"
-#include "gromacs/correlationfunctions/crosscorr.h"
 #include "gromacs/correlationfunctions/expfit.h"
 #include "gromacs/correlationfunctions/integrate.h"
+#include "gromacs/correlationfunctions/manyautocorrelation.h"
 #include "gromacs/fileio/matio.h"
 #include "gromacs/fileio/tpxio.h"
 #include "gromacs/fileio/trxio.h"
@@ -129,18 +129,28 @@ typedef struct {
 typedef int     t_icell[grNR];
 typedef int h_id[MAXHYDRO];
 
+/* Run-length encoded existence of a hbond over time. The runs are
+ * sorted, disjoint half-open frame intervals [begin, end) counted from
+ * the first frame t_hbond::n0, so that a bond that is present for long
+ * stretches costs a few integers instead of one bit per frame.
+ */
+typedef struct {
+    int      nrun, maxrun;
+    int     *run;          /* begin and end of each run, 2*nrun entries */
+} t_hbexist;
+
 typedef struct {
     int      history[MAXHYDRO];
     /* Has this hbond existed ever? If so as hbDist or hbHB or both.
      * Result is stored as a bitmap (1 = hbDist) || (2 = hbHB)
      */
-    /* Bitmask array which tells whether a hbond is present
-     * at a given time. Either of these may be NULL
+    /* Existence of the hbond (h) or distance (g) per hydrogen
+     * over time. Either of these may be NULL
      */
     int            n0;                 /* First frame a HB was found     */
-    int            nframes, maxframes; /* Amount of frames in this hbond */
-    unsigned int **h;
-    unsigned int **g;
+    int            nframes;            /* Last frame, counted from n0    */
+    t_hbexist    **h;
+    t_hbexist    **g;
     /* See Xu and Berne, JPCB 105 (2001), p. 11929. We define the
      * function g(t) = [1-h(t)] H(t) where H(t) is one when the donor-
      * acceptor distance is less than the user-specified distance (typically
@@ -167,7 +177,6 @@ typedef struct {
 
 typedef struct {
     gmx_bool        bHBmap, bDAnr;
-    int             wordlen;
     /* The following arrays are nframes long */
     int             nframes, max_frames, maxhydro;
     int            *nhb, *ndist;
@@ -194,7 +203,6 @@ static t_hbdata *mk_hbdata(gmx_bool bHBmap, gmx_bool bDAnr, gmx_bool oneHB)
     t_hbdata *hb;
 
     snew(hb, 1);
-    hb->wordlen = 8*sizeof(unsigned int);
     hb->bHBmap  = bHBmap;
     hb->bDAnr   = bDAnr;
     if (oneHB)
@@ -245,29 +253,146 @@ static void add_frames(t_hbdata *hb, int nframes)
     hb->nframes = nframes;
 }
 
-#define OFFSET(frame) (frame / 32)
-#define MASK(frame)   (1 << (frame % 32))
+/* Mark frames [begin, end) as present, merging with the neighbouring
+ * runs where they touch. Frames normally arrive in increasing order,
+ * so the common case only extends or appends the last run.
+ */
+static void add_hb_run(t_hbexist *e, int begin, int end)
+{
+    int *run = e->run;
+    int  n   = e->nrun;
+    int  i, j, k;
+
+    if (begin >= end)
+    {
+        return;
+    }
+    if (n == 0 || begin > run[2*n-1])
+    {
+        if (n == e->maxrun)
+        {
+            e->maxrun = std::max(4, 2*e->maxrun);
+            srenew(e->run, 2*e->maxrun);
+            run = e->run;
+        }
+        run[2*n]   = begin;
+        run[2*n+1] = end;
+        e->nrun++;
+        return;
+    }
+    if (begin >= run[2*n-2])
+    {
+        run[2*n-1] = std::max(run[2*n-1], end);
+        return;
+    }
+    /* Out of order: find the first run ending at or after begin
+     * and the first run starting after end, and fuse everything between.
+     */
+    i = 0;
+    while (i < n && run[2*i+1] < begin)
+    {
+        i++;
+    }
+    j = i;
+    while (j < n && run[2*j] <= end)
+    {
+        j++;
+    }
+    if (i == j)
+    {
+        if (n == e->maxrun)
+        {
+            e->maxrun = std::max(4, 2*e->maxrun);
+            srenew(e->run, 2*e->maxrun);
+            run = e->run;
+        }
+        for (k = n; k > i; k--)
+        {
+            run[2*k]   = run[2*k-2];
+            run[2*k+1] = run[2*k-1];
+        }
+        run[2*i]   = begin;
+        run[2*i+1] = end;
+        e->nrun++;
+        return;
+    }
+    run[2*i]   = std::min(run[2*i], begin);
+    run[2*i+1] = std::max(run[2*j-1], end);
+    for (k = j; k < n; k++)
+    {
+        run[2*(i+1+k-j)]   = run[2*k];
+        run[2*(i+1+k-j)+1] = run[2*k+1];
+    }
+    e->nrun -= j-i-1;
+}
+
+static void _set_hb(t_hbexist *hbexist, int frame)
+{
+    add_hb_run(hbexist, frame, frame+1);
+}
 
-static void _set_hb(unsigned int hbexist[], unsigned int frame, gmx_bool bValue)
+static gmx_bool is_hb(const t_hbexist *hbexist, int frame)
 {
-    if (bValue)
+    int lo = 0, hi = hbexist->nrun, mid;
+
+    /* Find the last run starting at or before frame */
+    while (hi - lo > 1)
     {
-        hbexist[OFFSET(frame)] |= MASK(frame);
+        mid = (lo+hi)/2;
+        if (hbexist->run[2*mid] <= frame)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
     }
-    else
+    return (hi > lo && hbexist->run[2*lo] <= frame && frame < hbexist->run[2*lo+1]);
+}
+
+/* Number of frames before frame n in which the hbond is present */
+static int count_hb(const t_hbexist *hbexist, int n)
+{
+    int i, nhb = 0;
+
+    for (i = 0; i < hbexist->nrun && hbexist->run[2*i] < n; i++)
+    {
+        nhb += std::min(hbexist->run[2*i+1], n) - hbexist->run[2*i];
+    }
+    return nhb;
+}
+
+/* Expand the first n frames of an existence series into x */
+static void expand_hb(const t_hbexist *hbexist, int n, real x[])
+{
+    int i, j;
+
+    for (j = 0; j < n; j++)
+    {
+        x[j] = 0;
+    }
+    for (i = 0; i < hbexist->nrun && hbexist->run[2*i] < n; i++)
     {
-        hbexist[OFFSET(frame)] &= ~MASK(frame);
+        for (j = hbexist->run[2*i]; j < std::min(hbexist->run[2*i+1], n); j++)
+        {
+            x[j] = 1;
+        }
     }
 }
 
-static gmx_bool is_hb(unsigned int hbexist[], int frame)
+static void free_hb(t_hbexist *hbexist)
 {
-    return ((hbexist[OFFSET(frame)] & MASK(frame)) != 0) ? 1 : 0;
+    if (hbexist)
+    {
+        sfree(hbexist->run);
+        sfree(hbexist);
+    }
 }
 
 static void set_hb(t_hbdata *hb, int id, int ih, int ia, int frame, int ihb)
 {
-    unsigned int *ghptr = nullptr;
+    t_hbexist *ghptr = nullptr;
 
     if (ihb == hbHB)
     {
@@ -282,49 +407,27 @@ static void set_hb(t_hbdata *hb, int id, int ih, int ia, int frame, int ihb)
         gmx_fatal(FARGS, "Incomprehensible iValue %d in set_hb", ihb);
     }
 
-    _set_hb(ghptr, frame-hb->hbmap[id][ia]->n0, TRUE);
+    _set_hb(ghptr, frame-hb->hbmap[id][ia]->n0);
 }
 
 static void add_ff(t_hbdata *hbd, int id, int h, int ia, int frame, int ihb)
 {
-    int         i, j, n;
+    int         i;
     t_hbond    *hb       = hbd->hbmap[id][ia];
     int         maxhydro = std::min(hbd->maxhydro, hbd->d.nhydro[id]);
-    int         wlen     = hbd->wordlen;
-    int         delta    = 32*wlen;
 
     if (!hb->h[0])
     {
         hb->n0        = frame;
-        hb->maxframes = delta;
         for (i = 0; (i < maxhydro); i++)
         {
-            snew(hb->h[i], hb->maxframes/wlen);
-            snew(hb->g[i], hb->maxframes/wlen);
+            snew(hb->h[i], 1);
+            snew(hb->g[i], 1);
         }
     }
     else
     {
         hb->nframes = frame-hb->n0;
-        /* We need a while loop here because hbonds may be returning
-         * after a long time.
-         */
-        while (hb->nframes >= hb->maxframes)
-        {
-            n = hb->maxframes + delta;
-            for (i = 0; (i < maxhydro); i++)
-            {
-                srenew(hb->h[i], n/wlen);
-                srenew(hb->g[i], n/wlen);
-                for (j = hb->maxframes/wlen; (j < n/wlen); j++)
-                {
-                    hb->h[i][j] = 0;
-                    hb->g[i][j] = 0;
-                }
-            }
-
-            hb->maxframes = n;
-        }
     }
     if (frame >= 0)
     {
@@ -1356,71 +1459,46 @@ static int is_hbond(t_hbdata *hb, int grpd, int grpa, int d, int a,
 /* Merging is now done on the fly, so do_merge is most likely obsolete now.
  * Will do some more testing before removing the function entirely.
  * - Erik Marklund, MAY 10 2010 */
-static void do_merge(t_hbdata *hb, int ntmp,
-                     unsigned int htmp[], unsigned int gtmp[],
-                     t_hbond *hb0, t_hbond *hb1)
+static void do_merge(t_hbond *hb0, t_hbond *hb1)
 {
     /* Here we need to make sure we're treating periodicity in
      * the right way for the geminate recombination kinetics. */
 
-    int       m, mm, n00, n01, nn0, nnframes;
+    int       i, n00, n01, nn0, nnframes;
 
     /* Decide where to start from when merging */
     n00      = hb0->n0;
     n01      = hb1->n0;
     nn0      = std::min(n00, n01);
     nnframes = std::max(n00 + hb0->nframes, n01 + hb1->nframes) - nn0;
-    /* Initiate tmp arrays */
-    for (m = 0; (m < ntmp); m++)
-    {
-        htmp[m] = 0;
-        gtmp[m] = 0;
-    }
-    /* Fill tmp arrays with values due to first HB */
-    /* Once again '<' had to be replaced with '<='
-       to catch the last frame in which the hbond
-       appears.
-       - Erik Marklund, June 1, 2006 */
-    for (m = 0; (m <= hb0->nframes); m++)
+
+    /* Shift the first HB to the new origin */
+    for (i = 0; (i < 2*hb0->h[0]->nrun); i++)
     {
-        mm       = m+n00-nn0;
-        htmp[mm] = is_hb(hb0->h[0], m);
+        hb0->h[0]->run[i] += n00-nn0;
     }
-    for (m = 0; (m <= hb0->nframes); m++)
+    for (i = 0; (i < 2*hb0->g[0]->nrun); i++)
     {
-        mm       = m+n00-nn0;
-        gtmp[mm] = is_hb(hb0->g[0], m);
+        hb0->g[0]->run[i] += n00-nn0;
     }
     /* Next HB */
-    for (m = 0; (m <= hb1->nframes); m++)
+    for (i = 0; (i < hb1->h[0]->nrun); i++)
     {
-        mm       = m+n01-nn0;
-        htmp[mm] = htmp[mm] || is_hb(hb1->h[0], m);
-        gtmp[mm] = gtmp[mm] || is_hb(hb1->g[0], m);
+        add_hb_run(hb0->h[0], hb1->h[0]->run[2*i]+n01-nn0, hb1->h[0]->run[2*i+1]+n01-nn0);
     }
-    /* Reallocate target array */
-    if (nnframes > hb0->maxframes)
+    for (i = 0; (i < hb1->g[0]->nrun); i++)
     {
-        srenew(hb0->h[0], 4+nnframes/hb->wordlen);
-        srenew(hb0->g[0], 4+nnframes/hb->wordlen);
-    }
-
-    /* Copy temp array to target array */
-    for (m = 0; (m <= nnframes); m++)
-    {
-        _set_hb(hb0->h[0], m, htmp[m]);
-        _set_hb(hb0->g[0], m, gtmp[m]);
+        add_hb_run(hb0->g[0], hb1->g[0]->run[2*i]+n01-nn0, hb1->g[0]->run[2*i+1]+n01-nn0);
     }
 
     /* Set scalar variables */
-    hb0->n0        = nn0;
-    hb0->maxframes = nnframes;
+    hb0->n0      = nn0;
+    hb0->nframes = nnframes;
 }
 
 static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
 {
-    int           i, inrnew, indnew, j, ii, jj, id, ia, ntmp;
-    unsigned int *htmp, *gtmp;
+    int           i, inrnew, indnew, j, ii, jj, id, ia;
     t_hbond      *hb0, *hb1;
 
     inrnew = hb->nrhb;
@@ -1429,9 +1507,6 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
     /* Check whether donors are also acceptors */
     printf("Merging hbonds with Acceptor and Donor swapped\n");
 
-    ntmp = 2*hb->max_frames;
-    snew(gtmp, ntmp);
-    snew(htmp, ntmp);
     for (i = 0; (i < hb->d.nrd); i++)
     {
         fprintf(stderr, "\r%d/%d", i+1, hb->d.nrd);
@@ -1449,7 +1524,7 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
                 hb1 = hb->hbmap[jj][ii];
                 if (hb0 && hb1 && ISHB(hb0->history[0]) && ISHB(hb1->history[0]))
                 {
-                    do_merge(hb, ntmp, htmp, gtmp, hb0, hb1);
+                    do_merge(hb0, hb1);
                     if (ISHB(hb1->history[0]))
                     {
                         inrnew--;
@@ -1467,8 +1542,8 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
                     {
                         gmx_incons("Neither hydrogen bond nor distance");
                     }
-                    sfree(hb1->h[0]);
-                    sfree(hb1->g[0]);
+                    free_hb(hb1->h[0]);
+                    free_hb(hb1->g[0]);
                     hb1->h[0]       = nullptr;
                     hb1->g[0]       = nullptr;
                     hb1->history[0] = hbNo;
@@ -1481,8 +1556,6 @@ static void merge_hb(t_hbdata *hb, gmx_bool bTwo, gmx_bool bContact)
     printf("- Reduced number of distances from %d to %d\n", hb->nrdist, indnew);
     hb->nrhb   = inrnew;
     hb->nrdist = indnew;
-    sfree(gtmp);
-    sfree(htmp);
 }
 
 static void do_nhb_dist(FILE *fp, t_hbdata *hb, real t)
@@ -1518,9 +1591,9 @@ static void do_hblife(const char *fn, t_hbdata *hb, gmx_bool bMerge, gmx_bool bC
     FILE          *fp;
     const char    *leg[] = { "p(t)", "t p(t)" };
     int           *histo;
-    int            i, j, j0, k, m, nh, ihb, ohb, nhydro, ndump = 0;
+    int            i, j, j0, k, m, nh, r, nhydro, ndump = 0;
     int            nframes = hb->nframes;
-    unsigned int **h;
+    t_hbexist    **h;
     real           t, x1, dt;
     double         sum, integral;
     t_hbond       *hbh;
@@ -1560,27 +1633,20 @@ static void do_hblife(const char *fn, t_hbdata *hb, gmx_bool bMerge, gmx_bool bC
                 }
                 for (nh = 0; (nh < nhydro); nh++)
                 {
-                    ohb = 0;
-                    j0  = 0;
-
-                    for (j = 0; (j <= hbh->nframes); j++)
+                    /* Only runs that end within the lifetime of the pair
+                     * are complete, the last one may still be ongoing.
+                     */
+                    for (r = 0; (r < h[nh]->nrun); r++)
                     {
-                        ihb      = is_hb(h[nh], j);
+                        j0 = h[nh]->run[2*r];
+                        j  = h[nh]->run[2*r+1];
                         if (debug && (ndump < 10))
                         {
-                            fprintf(debug, "%5d  %5d\n", j, ihb);
+                            fprintf(debug, "%5d  %5d\n", j0, j);
                         }
-                        if (ihb != ohb)
+                        if (j <= hbh->nframes)
                         {
-                            if (ihb)
-                            {
-                                j0 = j;
-                            }
-                            else
-                            {
-                                histo[j-j0]++;
-                            }
-                            ohb = ihb;
+                            histo[j-j0]++;
                         }
                     }
                     ndump++;
@@ -1907,13 +1973,22 @@ static void normalizeACF(real *ct, real *gt, int nhb, int len)
     }
 }
 
+/* A single hbond (or contact) to be correlated */
+typedef struct {
+    const t_hbexist *h, *g;
+    int              len; /* Number of frames, counted from n0 */
+} t_hbacseries;
+
+/* Maximum number of hbonds correlated together */
+static const int c_hbacBatch = 1024;
+
 static void do_hbac(const char *fn, t_hbdata *hb,
                     int nDump, gmx_bool bMerge, gmx_bool bContact, real fit_start,
                     real temp, gmx_bool R2, const gmx_output_env_t *oenv,
                     int nThreads)
 {
     FILE          *fp;
-    int            i, j, k, m, ihb, idist, n2, nn;
+    int            i, i0, j, k, m, nb, nn, maxbuf;
 
     const char    *legLuzar[] = {
         "Ac\\sfin sys\\v{}\\z{}(t)",
@@ -1921,181 +1996,174 @@ static void do_hbac(const char *fn, t_hbdata *hb,
         "Cc\\scontact,hb\\v{}\\z{}(t)",
         "-dAc\\sfs\\v{}\\z{}/dt"
     };
-    gmx_bool       bNorm = FALSE;
     double         nhb   = 0;
-    real          *rhbex = nullptr, *ht, *gt, *ght, *dght, *kt;
+    real          *ght, *kt;
     real          *ct, tail, tail2, dtail, *cct;
     const real     tol     = 1e-3;
     int            nframes = hb->nframes;
-    unsigned int **h       = nullptr, **g = nullptr;
-    int            nh, nhbonds, nhydro;
+    int            nhbonds, nser;
     t_hbond       *hbh;
-    int            acType;
-    int           *dondata      = nullptr;
-
-    enum {
-        AC_NONE, AC_NN, AC_GEM, AC_LUZAR
-    };
-
-    const bool bOMP = GMX_OPENMP;
+    t_hbacseries  *ser;
+    gmx_many_correl_t mc;
+    real          *hbuf, *gbuf, **hptr, **gptr;
+    double        *ctsum, *ghtsum;
+    int           *len;
+    gmx_bool       bOneMinusH;
 
     printf("Doing autocorrelation ");
-
-    acType = AC_LUZAR;
     printf("according to the theory of Luzar and Chandler.\n");
     fflush(stdout);
 
-    /* build hbexist matrix in reals for autocorr */
-    /* Allocate memory for computing ACF (rhbex) and aggregating the ACF (ct) */
-    n2 = 1;
-    while (n2 < nframes)
-    {
-        n2 *= 2;
-    }
-
-    nn = nframes/2;
-
-    if (acType != AC_NN || bOMP)
-    {
-        snew(h, hb->maxhydro);
-        snew(g, hb->maxhydro);
-    }
-
     /* Dump hbonds for debugging */
     dump_ac(hb, bMerge || bContact, nDump);
 
-    /* Total number of hbonds analyzed here */
+    /* Collect the hbonds analyzed here */
     nhbonds = 0;
-
-    if (acType != AC_LUZAR && bOMP)
+    nser    = 0;
+    for (i = 0; (i < hb->d.nrd); i++)
     {
-        nThreads = std::min((nThreads <= 0) ? INT_MAX : nThreads, gmx_omp_get_max_threads());
-
-        gmx_omp_set_num_threads(nThreads);
-        snew(dondata, nThreads);
-        for (i = 0; i < nThreads; i++)
-        {
-            dondata[i] = -1;
-        }
-        printf("ACF calculations parallelized with OpenMP using %i threads.\n"
-               "Expect close to linear scaling over this donor-loop.\n", nThreads);
-        fflush(stdout);
-        fprintf(stderr, "Donors: [thread no]\n");
+        for (k = 0; (k < hb->a.nra); k++)
         {
-            char tmpstr[7];
-            for (i = 0; i < nThreads; i++)
+            if (hb->hbmap[i][k])
             {
-                snprintf(tmpstr, 7, "[%i]", i);
-                fprintf(stderr, "%-7s", tmpstr);
+                nser += hb->maxhydro;
             }
         }
-        fprintf(stderr, "\n");
     }
-
-
-    /* Build the ACF */
-    snew(rhbex, 2*n2);
-    snew(ct, 2*n2);
-    snew(gt, 2*n2);
-    snew(ht, 2*n2);
-    snew(ght, 2*n2);
-    snew(dght, 2*n2);
-
-    snew(kt, nn);
-    snew(cct, nn);
-
+    snew(ser, nser);
     for (i = 0; (i < hb->d.nrd); i++)
     {
         for (k = 0; (k < hb->a.nra); k++)
         {
-            nhydro = 0;
             hbh    = hb->hbmap[i][k];
 
             if (hbh)
             {
-                if (bMerge || bContact)
+                for (m = 0; (m < hb->maxhydro); m++)
                 {
-                    if (ISHB(hbh->history[0]))
+                    if ((bMerge || bContact) ? (m == 0 && ISHB(hbh->history[0])) :
+                        (bContact ? ISDIST(hbh->history[m]) : ISHB(hbh->history[m])))
                     {
-                        h[0]   = hbh->h[0];
-                        g[0]   = hbh->g[0];
-                        nhydro = 1;
-                    }
-                }
-                else
-                {
-                    for (m = 0; (m < hb->maxhydro); m++)
-                    {
-                        if (bContact ? ISDIST(hbh->history[m]) : ISHB(hbh->history[m]))
-                        {
-                            g[nhydro] = hbh->g[m];
-                            h[nhydro] = hbh->h[m];
-                            nhydro++;
-                        }
+                        ser[nhbonds].h   = hbh->h[m];
+                        ser[nhbonds].g   = hbh->g[m];
+                        ser[nhbonds].len = std::min(hbh->nframes+1, nframes);
+                        nhb             += count_hb(hbh->h[m], ser[nhbonds].len);
+                        nhbonds++;
                     }
                 }
+            }
+        }
+    }
 
-                int nf = hbh->nframes;
-                for (nh = 0; (nh < nhydro); nh++)
-                {
-                    int nrint = bContact ? hb->nrdist : hb->nrhb;
-                    if ((((nhbonds+1) % 10) == 0) || (nhbonds+1 == nrint))
-                    {
-                        fprintf(stderr, "\rACF %d/%d", nhbonds+1, nrint);
-                        fflush(stderr);
-                    }
-                    nhbonds++;
-                    for (j = 0; (j < nframes); j++)
-                    {
-                        if (j <= nf)
-                        {
-                            ihb   = is_hb(h[nh], j);
-                            idist = is_hb(g[nh], j);
-                        }
-                        else
-                        {
-                            ihb = idist = 0;
-                        }
-                        rhbex[j] = ihb;
-                        /* For contacts: if a second cut-off is provided, use it,
-                         * otherwise use g(t) = 1-h(t) */
-                        if (!R2 && bContact)
-                        {
-                            gt[j]  = 1-ihb;
-                        }
-                        else
-                        {
-                            gt[j]  = idist*(1-ihb);
-                        }
-                        ht[j]    = rhbex[j];
-                        nhb     += ihb;
-                    }
+    nn = nframes/2;
+    /* For contacts: if a second cut-off is provided, use it,
+     * otherwise use g(t) = 1-h(t) */
+    bOneMinusH = (!R2 && bContact);
 
-                    /* The autocorrelation function is normalized after summation only */
-                    low_do_autocorr(nullptr, oenv, nullptr, nframes, 1, -1, &rhbex, hb->time[1]-hb->time[0],
-                                    eacNormal, 1, FALSE, bNorm, FALSE, 0, -1, 0);
+    nThreads = std::min((nThreads <= 0) ? INT_MAX : nThreads, gmx_omp_get_max_threads());
+    printf("Computing %d correlation functions using %d thread%s.\n",
+           nhbonds, nThreads, nThreads > 1 ? "s" : "");
+    fflush(stdout);
 
-                    /* Cross correlation analysis for thermodynamics */
-                    for (j = nframes; (j < n2); j++)
-                    {
-                        ht[j] = 0;
-                        gt[j] = 0;
-                    }
+    /* Build the ACF, the autocorrelation function is normalized
+     * after summation only. The hbonds are expanded and correlated in
+     * batches, limiting the memory to a few series per thread.
+     */
+    maxbuf = std::max(1 << 22, nThreads*nframes);
+    snew(ctsum, nn);
+    snew(ghtsum, nn);
+    snew(hbuf, maxbuf);
+    snew(gbuf, maxbuf);
+    snew(hptr, c_hbacBatch);
+    snew(gptr, c_hbacBatch);
+    snew(len, c_hbacBatch);
+    mc = init_many_correl(nThreads);
+    for (i0 = 0; (i0 < nhbonds); i0 += nb)
+    {
+        int nbuf = 0;
+
+        for (nb = 0; (nb < c_hbacBatch) && (i0+nb < nhbonds) &&
+             (nbuf + ser[i0+nb].len <= maxbuf); nb++)
+        {
+            const t_hbacseries *sr = &ser[i0+nb];
+
+            len[nb]  = sr->len;
+            hptr[nb] = hbuf + nbuf;
+            gptr[nb] = gbuf + nbuf;
+            nbuf    += sr->len;
+            expand_hb(sr->h, sr->len, hptr[nb]);
+            if (bOneMinusH)
+            {
+                /* Keep h(t), the cross correlation follows from it */
+                std::copy(hptr[nb], hptr[nb] + sr->len, gptr[nb]);
+            }
+            else
+            {
+                /* g(t) = H(t) [1-h(t)] */
+                expand_hb(sr->g, sr->len, gptr[nb]);
+                for (j = 0; (j < sr->len); j++)
+                {
+                    gptr[nb][j] *= 1 - hptr[nb][j];
+                }
+            }
+        }
+        if (bOneMinusH)
+        {
+            many_correl_auto(mc, nb, len, hptr);
+        }
+        else
+        {
+            many_correl_cross(mc, nb, len, hptr, gptr);
+        }
 
-                    cross_corr(n2, ht, gt, dght);
+        /* The sums are over products of zeros and ones, so they are
+         * integers and can be rounded to remove the transform noise.
+         */
+        for (i = 0; (i < nb); i++)
+        {
+            int nlag = std::min(len[i], nn);
 
-                    for (j = 0; (j < nn); j++)
-                    {
-                        ct[j]  += rhbex[j];
-                        ght[j] += dght[j];
-                    }
+            if (bOneMinusH)
+            {
+                /* sum_k h(k+j) [1-h(k)] = sum_{k >= j} h(k) - c(j) */
+                double hsum = 0;
+                for (j = len[i]-1; (j >= nlag); j--)
+                {
+                    hsum += gptr[i][j];
+                }
+                for (j = nlag-1; (j >= 0); j--)
+                {
+                    hsum      += gptr[i][j];
+                    gptr[i][j] = hsum - std::round(hptr[i][j]);
                 }
             }
+            for (j = 0; (j < nlag); j++)
+            {
+                ctsum[j]  += std::round(hptr[i][j]);
+                ghtsum[j] += std::round(gptr[i][j]);
+            }
         }
     }
-    fprintf(stderr, "\n");
-    sfree(h);
-    sfree(g);
+    done_many_correl(mc);
+    sfree(ser);
+    sfree(hbuf);
+    sfree(gbuf);
+    sfree(hptr);
+    sfree(gptr);
+    sfree(len);
+
+    snew(ct, nn);
+    snew(ght, nn);
+    snew(kt, nn);
+    snew(cct, nn);
+    for (j = 0; (j < nn); j++)
+    {
+        ct[j]  = ctsum[j]/(nframes-j);
+        ght[j] = ghtsum[j];
+    }
+    sfree(ctsum);
+    sfree(ghtsum);
+
     normalizeACF(ct, ght, static_cast<int>(nhb), nn);
 
     /* Determine tail value for statistics */
@@ -2153,12 +2221,8 @@ static void do_hbac(const char *fn, t_hbdata *hb,
                  fit_start, temp);
 
     do_view(oenv, fn, nullptr);
-    sfree(rhbex);
     sfree(ct);
-    sfree(gt);
-    sfree(ht);
     sfree(ght);
-    sfree(dght);
     sfree(cct);
     sfree(kt);
 }
@@ -2213,7 +2277,7 @@ static void analyse_donor_properties(FILE *fp, t_hbdata *hb, int nframes, real t
             for (j = 0; (j < hb->a.nra) && (nb == 0); j++)
             {
                 if (hb->hbmap[i][j] && hb->hbmap[i][j]->h[k] &&
-                    is_hb(hb->hbmap[i][j]->h[k], nframes))
+                    is_hb(hb->hbmap[i][j]->h[k], nframes-hb->hbmap[i][j]->n0))
                 {
                     nb = 1;
                 }
@@ -2820,7 +2884,6 @@ int gmx_hbond(int argc, char *argv[])
 
             p_hb[i]->bHBmap     = hb->bHBmap;
             p_hb[i]->bDAnr      = hb->bDAnr;
-            p_hb[i]->wordlen    = hb->wordlen;
             p_hb[i]->nframes    = hb->nframes;
             p_hb[i]->maxhydro   = hb->maxhydro;
             p_hb[i]->danr       = hb->danr;
@@ -3343,11 +3406,16 @@ int gmx_hbond(int argc, char *argv[])
                             {
                                 if (ISHB(hb->hbmap[id][ia]->history[hh]))
                                 {
-                                    for (x = 0; (x <= hb->hbmap[id][ia]->nframes); x++)
+                                    const t_hbexist *hbex = hb->hbmap[id][ia]->h[hh];
+                                    int              nn0  = hb->hbmap[id][ia]->n0;
+                                    int              nx   = hb->hbmap[id][ia]->nframes;
+                                    range_check(y, 0, mat.ny);
+                                    for (int r = 0; (r < hbex->nrun); r++)
                                     {
-                                        int nn0 = hb->hbmap[id][ia]->n0;
-                                        range_check(y, 0, mat.ny);
-                                        mat.matrix[x+nn0][y] = is_hb(hb->hbmap[id][ia]->h[hh], x);
+                                        for (x = hbex->run[2*r]; (x < hbex->run[2*r+1]) && (x <= nx); x++)
+                                        {
+                                            mat.matrix[x+nn0][y] = 1;
+                                        }
                                     }
                                     y++;
                                 }
@@ -41,6 +41,7 @@
 #include <cstring>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
@@ -53,24 +54,389 @@
 #include "gromacs/mdtypes/md_enums.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/pbcutil/rmpbc.h"
+#include "gromacs/selection/nbsearch.h"
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
+#include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 
+/* A grid of cells over the bounding box of a group of atoms. The atoms
+ * are sorted by cell and each cell stores the bounding box of its atoms.
+ */
+typedef struct {
+    int   ncell[DIM];
+    int   nc;        /* the total number of cells */
+    rvec  origin;
+    rvec  invsize;   /* the inverse cell size, 0 for a single cell */
+    int  *start;     /* the atoms of cell c are start[c] to start[c+1]-1 */
+    int  *atom;      /* the index in the group of each sorted atom */
+    rvec *x;         /* the sorted coordinates */
+    rvec *bbmin;     /* the bounding box of the atoms in each cell */
+    rvec *bbmax;
+} t_atomgrid;
+
+static void init_atomgrid(t_atomgrid *grid, const rvec x[], int n, const int index[],
+                          int natoms_cell)
+{
+    rvec  lo, hi, size;
+    real  volume, edge;
+    int   i, c, d, *cell, *pos;
+
+    copy_rvec(x[index[0]], lo);
+    copy_rvec(x[index[0]], hi);
+    for (i = 1; i < n; i++)
+    {
+        for (d = 0; d < DIM; d++)
+        {
+            lo[d] = std::min(lo[d], x[index[i]][d]);
+            hi[d] = std::max(hi[d], x[index[i]][d]);
+        }
+    }
+    /* Cubic cells with natoms_cell atoms on average, flat dimensions get 0.1 nm */
+    volume = 1;
+    for (d = 0; d < DIM; d++)
+    {
+        size[d] = hi[d] - lo[d];
+        volume *= std::max(size[d], static_cast<real>(0.1));
+    }
+    edge     = std::cbrt(volume*natoms_cell/n);
+    grid->nc = 1;
+    for (d = 0; d < DIM; d++)
+    {
+        grid->ncell[d]   = std::max(1, std::min(static_cast<int>(size[d]/edge), 1024));
+        grid->invsize[d] = (grid->ncell[d] > 1 ? grid->ncell[d]/size[d] : 0);
+        grid->nc        *= grid->ncell[d];
+    }
+    copy_rvec(lo, grid->origin);
+
+    /* Sort the atoms on cell */
+    snew(cell, n);
+    snew(pos, grid->nc);
+    snew(grid->start, grid->nc + 1);
+    for (i = 0; i < n; i++)
+    {
+        ivec ci;
+        for (d = 0; d < DIM; d++)
+        {
+            ci[d] = std::min(static_cast<int>((x[index[i]][d] - lo[d])*grid->invsize[d]),
+                             grid->ncell[d] - 1);
+        }
+        cell[i] = (ci[XX]*grid->ncell[YY] + ci[YY])*grid->ncell[ZZ] + ci[ZZ];
+        grid->start[cell[i] + 1]++;
+    }
+    for (c = 0; c < grid->nc; c++)
+    {
+        grid->start[c + 1] += grid->start[c];
+        pos[c]              = grid->start[c];
+    }
+    snew(grid->atom, n);
+    snew(grid->x, n);
+    for (i = 0; i < n; i++)
+    {
+        int k = pos[cell[i]]++;
+        grid->atom[k] = i;
+        copy_rvec(x[index[i]], grid->x[k]);
+    }
+    sfree(pos);
+    sfree(cell);
+
+    snew(grid->bbmin, grid->nc);
+    snew(grid->bbmax, grid->nc);
+    for (c = 0; c < grid->nc; c++)
+    {
+        for (d = 0; d < DIM; d++)
+        {
+            grid->bbmin[c][d] = GMX_REAL_MAX;
+            grid->bbmax[c][d] = -GMX_REAL_MAX;
+        }
+        for (i = grid->start[c]; i < grid->start[c + 1]; i++)
+        {
+            for (d = 0; d < DIM; d++)
+            {
+                grid->bbmin[c][d] = std::min(grid->bbmin[c][d], grid->x[i][d]);
+                grid->bbmax[c][d] = std::max(grid->bbmax[c][d], grid->x[i][d]);
+            }
+        }
+    }
+}
+
+static void done_atomgrid(t_atomgrid *grid)
+{
+    sfree(grid->start);
+    sfree(grid->atom);
+    sfree(grid->x);
+    sfree(grid->bbmin);
+    sfree(grid->bbmax);
+}
+
+/* Returns the minimum squared distance between the box [min1,max1]
+ * shifted by shift and the box [min2,max2].
+ */
+static real bbox_mindist2(const rvec min1, const rvec max1, const rvec shift,
+                          const rvec min2, const rvec max2)
+{
+    real r2 = 0;
+
+    for (int d = 0; d < DIM; d++)
+    {
+        real dx = std::max(min2[d] - max1[d] - shift[d], min1[d] + shift[d] - max2[d]);
+        if (dx > 0)
+        {
+            r2 += dx*dx;
+        }
+    }
+    return r2;
+}
+
+/* Returns the maximum squared distance between two boxes */
+static real bbox_maxdist2(const rvec min1, const rvec max1,
+                          const rvec min2, const rvec max2)
+{
+    real r2 = 0;
+
+    for (int d = 0; d < DIM; d++)
+    {
+        real dx = std::max(max2[d] - min1[d], max1[d] - min2[d]);
+        r2 += dx*dx;
+    }
+    return r2;
+}
+
+/* Finds the minimum distance below sqrt(r2lim) between atoms and periodic
+ * images of other atoms in the group. Returns TRUE when found.
+ */
+static gmx_bool periodic_mindist_grid(const t_atomgrid *grid, int nshift, rvec shift[],
+                                      real r2lim, real *r2min, int *min_ind)
+{
+    int      nc    = grid->nc;
+    real     best2 = r2lim;
+    int      bi    = -1, bj = -1;
+
+    for (int s = 0; s < nshift; s++)
+    {
+#pragma omp parallel
+        {
+            real best2_t = best2;
+            int  bi_t    = -1, bj_t = -1;
+
+#pragma omp for schedule(dynamic)
+            for (int a = 0; a < nc; a++)
+            {
+                ivec cmin, cmax;
+                real r    = std::sqrt(best2_t);
+                bool bEmpty = (grid->start[a] == grid->start[a + 1]);
+
+                /* The range of cells close to the shifted cell a */
+                for (int d = 0; d < DIM && !bEmpty; d++)
+                {
+                    real lo = (grid->bbmin[a][d] + shift[s][d] - r - grid->origin[d])*grid->invsize[d];
+                    real hi = (grid->bbmax[a][d] + shift[s][d] + r - grid->origin[d])*grid->invsize[d];
+                    if (hi < 0 || lo >= grid->ncell[d])
+                    {
+                        bEmpty = true;
+                    }
+                    cmin[d] = std::max(0, static_cast<int>(std::floor(lo)));
+                    cmax[d] = std::min(grid->ncell[d] - 1, static_cast<int>(std::floor(hi)));
+                }
+                for (int cx = cmin[XX]; cx <= cmax[XX] && !bEmpty; cx++)
+                {
+                    for (int cy = cmin[YY]; cy <= cmax[YY]; cy++)
+                    {
+                        for (int cz = cmin[ZZ]; cz <= cmax[ZZ]; cz++)
+                        {
+                            int b = (cx*grid->ncell[YY] + cy)*grid->ncell[ZZ] + cz;
+                            if (grid->start[b] == grid->start[b + 1] ||
+                                bbox_mindist2(grid->bbmin[a], grid->bbmax[a], shift[s],
+                                              grid->bbmin[b], grid->bbmax[b]) >= best2_t)
+                            {
+                                continue;
+                            }
+                            for (int ka = grid->start[a]; ka < grid->start[a + 1]; ka++)
+                            {
+                                for (int kb = grid->start[b]; kb < grid->start[b + 1]; kb++)
+                                {
+                                    int  i = grid->atom[ka], j = grid->atom[kb];
+                                    rvec d0, d;
+                                    real r2;
+
+                                    if (i == j)
+                                    {
+                                        continue;
+                                    }
+                                    /* Same operations as the pair i<j with the shift */
+                                    if (i < j)
+                                    {
+                                        rvec_sub(grid->x[ka], grid->x[kb], d0);
+                                        rvec_add(d0, shift[s], d);
+                                    }
+                                    else
+                                    {
+                                        std::swap(i, j);
+                                        rvec_sub(grid->x[kb], grid->x[ka], d0);
+                                        rvec_sub(d0, shift[s], d);
+                                    }
+                                    r2 = norm2(d);
+                                    if (r2 < best2_t ||
+                                        (r2 == best2_t && bi_t >= 0 &&
+                                         (i < bi_t || (i == bi_t && j < bj_t))))
+                                    {
+                                        best2_t = r2;
+                                        bi_t    = i;
+                                        bj_t    = j;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+#pragma omp critical
+            {
+                if (bi_t >= 0 &&
+                    (best2_t < best2 ||
+                     (best2_t == best2 && (bi < 0 || bi_t < bi || (bi_t == bi && bj_t < bj)))))
+                {
+                    best2 = best2_t;
+                    bi    = bi_t;
+                    bj    = bj_t;
+                }
+            }
+        }
+    }
+    if (bi >= 0)
+    {
+        *r2min     = best2;
+        min_ind[0] = bi;
+        min_ind[1] = bj;
+    }
+
+    return (bi >= 0);
+}
+
+/* Returns the maximum squared distance between two atoms in the group */
+static real internal_maxdist2(const rvec x[], int n, const int index[])
+{
+    t_atomgrid                        grid;
+    std::vector<std::pair<real, int> > cellpairs;
+    int                               ext[2*DIM];
+    real                              best2 = 0;
+
+    if (n < 2)
+    {
+        return 0;
+    }
+
+    /* Start from the largest distance of the extreme atoms along each axis */
+    for (int d = 0; d < DIM; d++)
+    {
+        ext[2*d] = ext[2*d + 1] = 0;
+        for (int i = 1; i < n; i++)
+        {
+            if (x[index[i]][d] < x[index[ext[2*d]]][d])
+            {
+                ext[2*d] = i;
+            }
+            if (x[index[i]][d] > x[index[ext[2*d + 1]]][d])
+            {
+                ext[2*d + 1] = i;
+            }
+        }
+    }
+    for (int e = 0; e < 2*DIM; e++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            rvec d0;
+            if (ext[e] < j)
+            {
+                rvec_sub(x[index[ext[e]]], x[index[j]], d0);
+            }
+            else
+            {
+                rvec_sub(x[index[j]], x[index[ext[e]]], d0);
+            }
+            best2 = std::max(best2, norm2(d0));
+        }
+    }
+
+    /* Only cell pairs that can be further apart need to be checked */
+    init_atomgrid(&grid, x, n, index, std::max(16, n/4096));
+    for (int a = 0; a < grid.nc; a++)
+    {
+        for (int b = a; b < grid.nc && grid.start[a] < grid.start[a + 1]; b++)
+        {
+            if (grid.start[b] < grid.start[b + 1])
+            {
+                real ub2 = bbox_maxdist2(grid.bbmin[a], grid.bbmax[a], grid.bbmin[b], grid.bbmax[b]);
+                if (ub2 > best2)
+                {
+                    cellpairs.push_back(std::make_pair(ub2, a*grid.nc + b));
+                }
+            }
+        }
+    }
+    std::sort(cellpairs.begin(), cellpairs.end(),
+              [](const std::pair<real, int> &p1, const std::pair<real, int> &p2)
+              { return p1.first > p2.first; });
+
+    int npair = cellpairs.size();
+#pragma omp parallel
+    {
+        real best2_t = best2;
+
+#pragma omp for schedule(dynamic)
+        for (int p = 0; p < npair; p++)
+        {
+            int a = cellpairs[p].second/grid.nc;
+            int b = cellpairs[p].second % grid.nc;
+            if (cellpairs[p].first <= best2_t)
+            {
+                continue;
+            }
+            for (int ka = grid.start[a]; ka < grid.start[a + 1]; ka++)
+            {
+                for (int kb = (a == b ? ka + 1 : grid.start[b]); kb < grid.start[b + 1]; kb++)
+                {
+                    rvec d0;
+                    if (grid.atom[ka] < grid.atom[kb])
+                    {
+                        rvec_sub(grid.x[ka], grid.x[kb], d0);
+                    }
+                    else
+                    {
+                        rvec_sub(grid.x[kb], grid.x[ka], d0);
+                    }
+                    best2_t = std::max(best2_t, norm2(d0));
+                }
+            }
+        }
+#pragma omp critical
+        {
+            best2 = std::max(best2, best2_t);
+        }
+    }
+    done_atomgrid(&grid);
+
+    return best2;
+}
+
 static void periodic_dist(int ePBC,
                           matrix box, rvec x[], int n, int index[],
                           real *rmin, real *rmax, int *min_ind)
 {
 #define NSHIFT_MAX 26
-    int  nsz, nshift, sx, sy, sz, i, j, s;
-    real sqr_box, r2min, r2max, r2;
-    rvec shift[NSHIFT_MAX], d0, d;
+    int        nsz, nshift, sx, sy, sz, i;
+    real       sqr_box, r2min, r2max, r2lim;
+    rvec       shift[NSHIFT_MAX];
+    t_atomgrid grid;
 
     sqr_box = std::min(norm2(box[XX]), norm2(box[YY]));
     if (ePBC == epbcXYZ)
@@ -110,30 +476,30 @@ static void periodic_dist(int ePBC,
     }
 
     r2min = sqr_box;
-    r2max = 0;
+    r2max = internal_maxdist2(x, n, index);
 
-    for (i = 0; i < n; i++)
+    /* Search the images with a cell grid, doubling the search distance
+     * from the cell size until a pair is found. All pairs below the search
+     * distance are checked, so the first distance found is the minimum.
+     */
+    if (n > 1)
     {
-        for (j = i+1; j < n; j++)
+        init_atomgrid(&grid, x, n, index, 16);
+        r2lim = 0;
+        for (i = 0; i < DIM; i++)
         {
-            rvec_sub(x[index[i]], x[index[j]], d0);
-            r2 = norm2(d0);
-            if (r2 > r2max)
-            {
-                r2max = r2;
-            }
-            for (s = 0; s < nshift; s++)
+            if (grid.invsize[i] > 0)
             {
-                rvec_add(d0, shift[s], d);
-                r2 = norm2(d);
-                if (r2 < r2min)
-                {
-                    r2min      = r2;
-                    min_ind[0] = i;
-                    min_ind[1] = j;
-                }
+                r2lim = std::max(r2lim, 1/gmx::square(grid.invsize[i]));
             }
         }
+        r2lim = (r2lim > 0 ? r2lim : sqr_box);
+        while (!periodic_mindist_grid(&grid, nshift, shift, std::min(r2lim, sqr_box),
+                                      &r2min, min_ind) && r2lim < sqr_box)
+        {
+            r2lim *= 4;
+        }
+        done_atomgrid(&grid);
     }
 
     *rmin = std::sqrt(r2min);
@@ -216,9 +582,112 @@ static void periodic_mindist_plot(const char *trxfn, const char *outfn,
             index[ind_mini]+1, index[ind_minj]+1);
 }
 
+/* Computes the minimum distance and the number of contacts within rcut
+ * between atoms index1 and index3 using a neighbor search, threaded over
+ * the atoms in index3. With bSelf only pairs with i > j are used.
+ * The search cutoff is increased when there are no pairs within rcut.
+ */
+static void calc_mindist_nbsearch(real rcut, const t_pbc *pbc, rvec x[],
+                                  int nx1, int nx3, int index1[], int index3[],
+                                  gmx_bool bSelf, gmx_bool bGroup,
+                                  real *rmin, int *nmin, int *ixmin, int *jxmin)
+{
+    int  nthreads = gmx_omp_get_max_threads();
+    real rcut2    = gmx::square(rcut);
+    real cutoff   = rcut;
+    real rmin2    = 1e12;
+    int  bi       = -1, bj = -1;
+
+    *nmin = 0;
+    for (int pass = 0;; pass++)
+    {
+        gmx::AnalysisNeighborhood       nb;
+        nb.setCutoff(cutoff);
+        gmx::AnalysisNeighborhoodSearch search =
+            nb.initSearch(pbc, gmx::AnalysisNeighborhoodPositions(x, 0).indexed(
+                                  gmx::constArrayRefFromArray(index1, nx1)));
+
+#pragma omp parallel num_threads(nthreads)
+        {
+            try
+            {
+                int               t      = gmx_omp_get_thread_num();
+                int               j0     = (nx3*t)/nthreads;
+                int               j1     = (nx3*(t + 1))/nthreads;
+                real              rmin2t = 1e12;
+                int               bit    = -1, bjt = -1, nmint = 0;
+                std::vector<char> bContact(bGroup ? j1 - j0 : 0, 0);
+
+                if (j1 > j0)
+                {
+                    gmx::AnalysisNeighborhoodPairSearch pairSearch =
+                        search.startPairSearch(gmx::AnalysisNeighborhoodPositions(x, 0).indexed(
+                                                       gmx::constArrayRefFromArray(index3 + j0, j1 - j0)));
+                    gmx::AnalysisNeighborhoodPair       pair;
+                    while (pairSearch.findNextPair(&pair))
+                    {
+                        int  i  = pair.refIndex();
+                        int  j  = j0 + pair.testIndex();
+                        real r2 = pair.distance2();
+
+                        if (index1[i] == index3[j] || (bSelf && i <= j))
+                        {
+                            continue;
+                        }
+                        /* Ties go to the first pair of the loop over j and i */
+                        if (r2 < rmin2t || (r2 == rmin2t && (j < bjt || (j == bjt && i < bit))))
+                        {
+                            rmin2t = r2;
+                            bit    = i;
+                            bjt    = j;
+                        }
+                        if (pass == 0 && r2 <= rcut2)
+                        {
+                            if (bGroup)
+                            {
+                                bContact[j - j0] = 1;
+                            }
+                            else
+                            {
+                                nmint++;
+                            }
+                        }
+                    }
+                }
+                if (bGroup)
+                {
+                    nmint = std::count(bContact.begin(), bContact.end(), 1);
+                }
+#pragma omp critical
+                {
+                    *nmin += nmint;
+                    if (bit >= 0 &&
+                        (rmin2t < rmin2 || (rmin2t == rmin2 && (bjt < bj || (bjt == bj && bit < bi)))))
+                    {
+                        rmin2 = rmin2t;
+                        bi    = bit;
+                        bj    = bjt;
+                    }
+                }
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+        }
+        if (bi >= 0 || cutoff <= 0)
+        {
+            break;
+        }
+        /* No pairs within the cutoff, a few doublings before searching all pairs */
+        cutoff = (pass < 4 ? 2*cutoff : 0);
+    }
+
+    *rmin  = std::sqrt(rmin2);
+    *ixmin = (bi >= 0 ? index1[bi] : -1);
+    *jxmin = (bj >= 0 ? index3[bj] : -1);
+}
+
 static void calc_dist(real rcut, gmx_bool bPBC, int ePBC, matrix box, rvec x[],
                       int nx1, int nx2, int index1[], int index2[],
-                      gmx_bool bGroup,
+                      gmx_bool bGroup, gmx_bool bMin,
                       real *rmin, real *rmax, int *nmin, int *nmax,
                       int *ixmin, int *jxmin, int *ixmax, int *jxmax)
 {
@@ -256,6 +725,15 @@ static void calc_dist(real rcut, gmx_bool bPBC, int ePBC, matrix box, rvec x[],
         index3 = index1;
     }
 
+    /* Only the maximum distance and the contacts beyond rcut need all pairs */
+    if (bMin)
+    {
+        calc_mindist_nbsearch(rcut, bPBC ? &pbc : nullptr, x, nx1, j1, index1, index3,
+                              index2 == nullptr, bGroup, rmin, nmin, ixmin, jxmin);
+        *rmax = 0;
+        return;
+    }
+
     rmin2 = 1e12;
     rmax2 = -1e12;
 
@@ -466,7 +944,7 @@ static void dist_plot(const char *fn, const char *afile, const char *dfile,
         {
             if (ng == 1)
             {
-                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[0], index[0], index[0], bGroup,
+                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[0], index[0], index[0], bGroup, bMin,
                           &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
                 fprintf(dist, "  %12e", bMin ? dmin : dmax);
                 if (num)
@@ -481,7 +959,7 @@ static void dist_plot(const char *fn, const char *afile, const char *dfile,
                     for (k = i+1; (k < ng); k++)
                     {
                         calc_dist(rcut, bPBC, ePBC, box, x0, gnx[i], gnx[k], index[i], index[k],
-                                  bGroup, &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
+                                  bGroup, bMin, &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
                         fprintf(dist, "  %12e", bMin ? dmin : dmax);
                         if (num)
                         {
@@ -495,7 +973,7 @@ static void dist_plot(const char *fn, const char *afile, const char *dfile,
         {
             for (i = 1; (i < ng); i++)
             {
-                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[i], index[0], index[i], bGroup,
+                calc_dist(rcut, bPBC, ePBC, box, x0, gnx[0], gnx[i], index[0], index[i], bGroup, bMin,
                           &dmin, &dmax, &nmin, &nmax, &min1, &min2, &max1, &max2);
                 fprintf(dist, "  %12e", bMin ? dmin : dmax);
                 if (num)
@@ -507,7 +985,7 @@ static void dist_plot(const char *fn, const char *afile, const char *dfile,
                     for (j = 0; j < nres; j++)
                     {
                         calc_dist(rcut, bPBC, ePBC, box, x0, residue[j+1]-residue[j], gnx[i],
-                                  &(index[0][residue[j]]), index[i], bGroup,
+                                  &(index[0][residue[j]]), index[i], bGroup, bMin,
                                   &dmin, &dmax, &nmin, &nmax, &min1r, &min2r, &max1r, &max2r);
                         mindres[i-1][j] = std::min(mindres[i-1][j], dmin);
                         maxdres[i-1][j] = std::max(maxdres[i-1][j], dmax);
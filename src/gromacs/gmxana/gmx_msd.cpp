@@ -39,8 +39,12 @@
 #include <cmath>
 #include <cstring>
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/commandline/pargs.h"
 #include "gromacs/commandline/viewit.h"
+#include "gromacs/fft/fft.h"
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/trxio.h"
 #include "gromacs/fileio/xvgr.h"
@@ -54,9 +58,11 @@
 #include "gromacs/topology/index.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 #define FACTOR  1000.0  /* Convert nm^2/ps to 10e-5 cm^2/s */
@@ -83,6 +89,10 @@ typedef struct {
     rvec        **x0;         /* original positions */
     rvec         *com;        /* center of mass correction for each frame */
     gmx_stats_t **lsq;        /* fitting stats for individual molecule msds */
+    gmx_bool      bFFT;       /* use all frames as origins, through FFTs */
+    rvec        **xt;         /* with bFFT: the coordinates of each group
+                                 for all frames, frame-major */
+    rvec         *comt;       /* with bFFT: the center of mass for all frames */
     msd_type      type;       /* the type of msd to calculate (lateral, etc.)*/
     int           axis;       /* the axis along which to calculate */
     int           ncoords;
@@ -110,8 +120,8 @@ static gmx_bool in_data(t_corr *curr, int nx00)
 }
 
 static t_corr *init_corr(int nrgrp, int type, int axis, real dim_factor,
-                         int nmol, gmx_bool bTen, gmx_bool bMass, real dt, const t_topology *top,
-                         real beginfit, real endfit)
+                         int nmol, gmx_bool bTen, gmx_bool bMass, gmx_bool bFFT, real dt,
+                         const t_topology *top, real beginfit, real endfit)
 {
     t_corr  *curr;
     int      i;
@@ -129,6 +139,13 @@ static t_corr *init_corr(int nrgrp, int type, int axis, real dim_factor,
     curr->nframes    = 0;
     curr->nlast      = 0;
     curr->dim_factor = dim_factor;
+    curr->bFFT       = bFFT;
+    curr->xt         = nullptr;
+    curr->comt       = nullptr;
+    if (bFFT)
+    {
+        snew(curr->xt, nrgrp);
+    }
 
     snew(curr->ndata, nrgrp);
     snew(curr->data, nrgrp);
@@ -544,6 +561,285 @@ static real calc1_mol(t_corr *curr, int nx, int gmx_unused index[], int nx0, rve
     return gtot/nx;
 }
 
+/* Returns the smallest even FFT length >= n with only factors 2, 3 and 5 */
+static int fft_length(int n)
+{
+    for (int len = n + n % 2;; len += 2)
+    {
+        int r = len;
+        for (int f = 2; f <= 5; f++)
+        {
+            while (r % f == 0)
+            {
+                r /= f;
+            }
+        }
+        if (r == 1)
+        {
+            return len;
+        }
+    }
+}
+
+/* Converts the power spectrum spec and squared positions sq of one component
+ * pair, both summed over particles, into the sum over all time origins of
+ * the displacement products for each lag, using
+ * sum_t (a(t+m)-a(t))(b(t+m)-b(t)) = S(m) - 2 C(m), where C is the
+ * symmetrized cross correlation of a and b and S the running sum of a*b.
+ */
+static void fft_origin_sum(gmx_fft_t fft, int nframes, int nfft,
+                           const double *spec, const double *sq,
+                           real *work, real *corr, double *sum)
+{
+    int    m;
+    double s;
+
+    for (m = 0; m <= nfft/2; m++)
+    {
+        work[2*m]   = spec[m];
+        work[2*m+1] = 0;
+    }
+    gmx_fft_1d_real(fft, GMX_FFT_COMPLEX_TO_REAL, work, corr);
+
+    s = 0;
+    for (m = 0; m < nframes; m++)
+    {
+        s += 2*sq[m];
+    }
+    for (m = 0; m < nframes; m++)
+    {
+        if (m > 0)
+        {
+            s -= sq[m-1] + sq[nframes-m];
+        }
+        sum[m] += s - 2.0*corr[m]/nfft;
+    }
+}
+
+/* Computes the MSD of group nr over all frames as time origins from the
+ * coordinates stored by corr_loop. Instead of looping over the origins,
+ * the correlation of the positions is computed with FFTs, which costs
+ * O(T log T) per atom or molecule for T frames. The transforms of the
+ * particles are summed in frequency space, so only the summed spectra
+ * need to be transformed back. Threaded over the atoms or molecules.
+ */
+static void calc_corr_fft(t_corr *curr, int nr, int nx, int index[],
+                          gmx_bool bMol, gmx_bool bRmCOMM, gmx_bool bTen)
+{
+    int     nframes = curr->nframes;
+    int     nfft    = fft_length(2*nframes);
+    int     nspec   = nfft/2 + 1;
+    int     ndim, npair, dims[DIM], pa[6], pb[6];
+    int     nthreads, m, p, t;
+    double  wtot;
+
+    /* Set up the components, the diagonal pairs come first */
+    ndim = 0;
+    switch (curr->type)
+    {
+        case NORMAL:
+            for (m = 0; m < DIM; m++)
+            {
+                dims[ndim++] = m;
+            }
+            break;
+        case X:
+        case Y:
+        case Z:
+            dims[ndim++] = curr->type - X;
+            break;
+        case LATERAL:
+            for (m = 0; m < DIM; m++)
+            {
+                if (m != curr->axis)
+                {
+                    dims[ndim++] = m;
+                }
+            }
+            break;
+        default:
+            gmx_fatal(FARGS, "Error: did not expect option value %d", curr->type);
+    }
+    for (npair = 0; npair < ndim; npair++)
+    {
+        pa[npair] = npair;
+        pb[npair] = npair;
+    }
+    if (bTen)
+    {
+        for (m = 1; m < ndim; m++)
+        {
+            for (p = 0; p < m; p++)
+            {
+                pa[npair] = m;
+                pb[npair] = p;
+                npair++;
+            }
+        }
+    }
+
+    wtot = 0;
+    for (int i = 0; i < nx; i++)
+    {
+        wtot += (curr->mass ? curr->mass[bMol ? i : index[i]] : 1);
+    }
+
+    nthreads = gmx_omp_get_max_threads();
+    std::vector<std::vector<double> > spec(nthreads), sq(nthreads);
+
+#pragma omp parallel num_threads(nthreads)
+    {
+        try
+        {
+            int                  thread_id = gmx_omp_get_thread_num();
+            int                  i0        = (thread_id*nx)/nthreads;
+            int                  i1        = std::min(nx, ((thread_id+1)*nx)/nthreads);
+            gmx_fft_t            fft;
+            std::vector<real>    ser(ndim*nfft), ft(ndim*2*nspec);
+            std::vector<real>    work(2*nspec), corr(nfft);
+            std::vector<double> &tspec = spec[thread_id];
+            std::vector<double> &tsq   = sq[thread_id];
+            std::vector<double>  molspec, molsq, molsum;
+
+            gmx_fft_init_1d_real(&fft, nfft, GMX_FFT_FLAG_CONSERVATIVE);
+            tspec.resize(npair*nspec, 0);
+            tsq.resize(npair*nframes, 0);
+            if (bMol)
+            {
+                molspec.resize(nspec);
+                molsq.resize(nframes);
+                molsum.resize(nframes);
+            }
+
+            for (int i = i0; i < i1; i++)
+            {
+                real w = (curr->mass ? curr->mass[bMol ? i : index[i]] : 1);
+                if (w == 0)
+                {
+                    continue;
+                }
+                for (int c = 0; c < ndim; c++)
+                {
+                    real  *x = ser.data() + c*nfft;
+                    double xav;
+
+                    /* Subtracting the average position does not change
+                     * the displacements, but reduces the cancellation
+                     * between the two terms in fft_origin_sum.
+                     */
+                    xav = 0;
+                    for (int f = 0; f < nframes; f++)
+                    {
+                        x[f] = curr->xt[nr][f*nx + i][dims[c]];
+                        if (bRmCOMM)
+                        {
+                            x[f] -= curr->comt[f][dims[c]];
+                        }
+                        xav += x[f];
+                    }
+                    xav /= nframes;
+                    for (int f = 0; f < nframes; f++)
+                    {
+                        x[f] -= xav;
+                    }
+                    std::fill(x + nframes, x + nfft, 0);
+                    gmx_fft_1d_real(fft, GMX_FFT_REAL_TO_COMPLEX, x, ft.data() + c*2*nspec);
+                }
+                if (bMol)
+                {
+                    std::fill(molspec.begin(), molspec.end(), 0);
+                    std::fill(molsq.begin(), molsq.end(), 0);
+                    std::fill(molsum.begin(), molsum.end(), 0);
+                }
+                for (int q = 0; q < npair; q++)
+                {
+                    const real *fa = ft.data() + pa[q]*2*nspec;
+                    const real *fb = ft.data() + pb[q]*2*nspec;
+                    const real *xa = ser.data() + pa[q]*nfft;
+                    const real *xb = ser.data() + pb[q]*nfft;
+                    for (int k = 0; k < nspec; k++)
+                    {
+                        double s = fa[2*k]*fb[2*k] + fa[2*k+1]*fb[2*k+1];
+                        tspec[q*nspec + k] += w*s;
+                        if (bMol && q < ndim)
+                        {
+                            molspec[k] += s;
+                        }
+                    }
+                    for (int f = 0; f < nframes; f++)
+                    {
+                        double s = xa[f]*xb[f];
+                        tsq[q*nframes + f] += w*s;
+                        if (bMol && q < ndim)
+                        {
+                            molsq[f] += s;
+                        }
+                    }
+                }
+                if (bMol)
+                {
+                    /* The individual molecule msd for the diffusion fit */
+                    fft_origin_sum(fft, nframes, nfft, molspec.data(), molsq.data(),
+                                   work.data(), corr.data(), molsum.data());
+                    for (int f = 0; f < nframes; f++)
+                    {
+                        real tt = curr->time[f];
+                        if (tt >= curr->beginfit && (curr->endfit < 0 || tt <= curr->endfit))
+                        {
+                            gmx_stats_add_point(curr->lsq[0][i], tt, w*molsum[f]/(nframes - f), 0, 0);
+                        }
+                    }
+                }
+            }
+            gmx_fft_destroy(fft);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+
+    /* Reduce over the threads and transform back */
+    for (t = 1; t < nthreads; t++)
+    {
+        for (size_t k = 0; k < spec[0].size(); k++)
+        {
+            spec[0][k] += spec[t][k];
+        }
+        for (size_t k = 0; k < sq[0].size(); k++)
+        {
+            sq[0][k] += sq[t][k];
+        }
+    }
+
+    gmx_fft_t           fft;
+    std::vector<real>   work(2*nspec), corr(nfft);
+    std::vector<double> sum(nframes);
+
+    gmx_fft_init_1d_real(&fft, nfft, GMX_FFT_FLAG_CONSERVATIVE);
+    for (p = 0; p < npair; p++)
+    {
+        std::fill(sum.begin(), sum.end(), 0);
+        fft_origin_sum(fft, nframes, nfft, spec[0].data() + p*nspec, sq[0].data() + p*nframes,
+                       work.data(), corr.data(), sum.data());
+        for (t = 0; t < nframes; t++)
+        {
+            if (p < ndim)
+            {
+                curr->data[nr][t] += sum[t]/wtot;
+            }
+            if (bTen)
+            {
+                curr->datam[nr][t][dims[pa[p]]][dims[pb[p]]] = sum[t]/wtot;
+            }
+        }
+    }
+    gmx_fft_destroy(fft);
+
+    /* Each frame acts as an origin for all later frames */
+    for (t = 0; t < nframes; t++)
+    {
+        curr->ndata[nr][t] = nframes - t;
+    }
+}
+
 static void printmol(t_corr *curr, const char *fn,
                      const char *fn_pdb, int *molindex, const t_topology *top,
                      rvec *x, int ePBC, matrix box, const gmx_output_env_t *oenv)
@@ -569,7 +865,7 @@ static void printmol(t_corr *curr, const char *fn,
     for (i = 0; (i < curr->nmol); i++)
     {
         lsq1 = gmx_stats_init();
-        for (j = 0; (j < curr->nrestart); j++)
+        for (j = 0; (j < (curr->bFFT ? 1 : curr->nrestart)); j++)
         {
             real xx, yy, dx, dy;
 
@@ -645,7 +941,7 @@ static int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int eP
     rvec            *xa[2]; /* the coordinates to calculate displacements for */
     rvec             com = {0};
     real             t, t_prev = 0;
-    int              natoms, i, j, cur = 0, maxframes = 0;
+    int              natoms, i, j, cur = 0, maxframes = 0, nalloc_fft = 0;
     t_trxstatus     *status;
 #define        prev (1-cur)
     matrix           box;
@@ -711,7 +1007,7 @@ static int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int eP
 
 
         /* check whether we've reached a restart point */
-        if (bRmod(t, curr->t0, dt))
+        if (!curr->bFFT && bRmod(t, curr->t0, dt))
         {
             curr->nrestart++;
 
@@ -808,12 +1104,37 @@ static int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int eP
                      &top->atoms, com);
         }
 
-        /* loop over all groups in index file */
-        for (i = 0; (i < curr->ngrp); i++)
+        if (curr->bFFT)
+        {
+            /* store the coordinates, the msd is computed after the last frame */
+            if (curr->nframes >= nalloc_fft)
+            {
+                nalloc_fft = over_alloc_large(curr->nframes + 1);
+                for (i = 0; (i < curr->ngrp); i++)
+                {
+                    srenew(curr->xt[i], nalloc_fft*gnx[i]);
+                }
+                srenew(curr->comt, nalloc_fft);
+            }
+            for (i = 0; (i < curr->ngrp); i++)
+            {
+                for (j = 0; j < gnx[i]; j++)
+                {
+                    copy_rvec(xa[cur][bMol ? j : index[i][j]],
+                              curr->xt[i][curr->nframes*gnx[i] + j]);
+                }
+            }
+            copy_rvec(com, curr->comt[curr->nframes]);
+        }
+        else
         {
-            /* calculate something useful, like mean square displacements */
-            calc_corr(curr, i, gnx[i], index[i], xa[cur], (gnx_com != nullptr), com,
-                      calc1, bTen);
+            /* loop over all groups in index file */
+            for (i = 0; (i < curr->ngrp); i++)
+            {
+                /* calculate something useful, like mean square displacements */
+                calc_corr(curr, i, gnx[i], index[i], xa[cur], (gnx_com != nullptr), com,
+                          calc1, bTen);
+            }
         }
         cur    = prev;
         t_prev = t;
@@ -821,11 +1142,40 @@ static int corr_loop(t_corr *curr, const char *fn, const t_topology *top, int eP
         curr->nframes++;
     }
     while (read_next_x(oenv, status, &t, x[cur], box));
-    fprintf(stderr, "\nUsed %d restart points spaced %g %s over %g %s\n\n",
-            curr->nrestart,
-            output_env_conv_time(oenv, dt), output_env_get_time_unit(oenv).c_str(),
-            output_env_conv_time(oenv, curr->time[curr->nframes-1]),
-            output_env_get_time_unit(oenv).c_str() );
+
+    if (curr->bFFT)
+    {
+        /* all frames are restart points, the molecule fits are gathered
+         * in a single set of stats */
+        curr->nrestart = curr->nframes;
+        if (curr->nmol > 0)
+        {
+            snew(curr->lsq, 1);
+            snew(curr->lsq[0], curr->nmol);
+            for (i = 0; i < curr->nmol; i++)
+            {
+                curr->lsq[0][i] = gmx_stats_init();
+            }
+        }
+        for (i = 0; (i < curr->ngrp); i++)
+        {
+            calc_corr_fft(curr, i, gnx[i], index[i], bMol, (gnx_com != nullptr), bTen);
+            sfree(curr->xt[i]);
+        }
+        sfree(curr->comt);
+        fprintf(stderr, "\nUsed all %d frames as restart points over %g %s\n\n",
+                curr->nframes,
+                output_env_conv_time(oenv, curr->time[curr->nframes-1]),
+                output_env_get_time_unit(oenv).c_str() );
+    }
+    else
+    {
+        fprintf(stderr, "\nUsed %d restart points spaced %g %s over %g %s\n\n",
+                curr->nrestart,
+                output_env_conv_time(oenv, dt), output_env_get_time_unit(oenv).c_str(),
+                output_env_conv_time(oenv, curr->time[curr->nframes-1]),
+                output_env_get_time_unit(oenv).c_str() );
+    }
 
     if (bMol)
     {
@@ -874,7 +1224,7 @@ static void index_atom2mol(int *n, int *index, const t_block *mols)
 static void do_corr(const char *trx_file, const char *ndx_file, const char *msd_file,
                     const char *mol_file, const char *pdb_file, real t_pdb,
                     int nrgrp, t_topology *top, int ePBC,
-                    gmx_bool bTen, gmx_bool bMW, gmx_bool bRmCOMM,
+                    gmx_bool bTen, gmx_bool bMW, gmx_bool bRmCOMM, gmx_bool bFFT,
                     int type, real dim_factor, int axis,
                     real dt, real beginfit, real endfit, const gmx_output_env_t *oenv)
 {
@@ -913,7 +1263,7 @@ static void do_corr(const char *trx_file, const char *ndx_file, const char *msd_
     }
 
     msd = init_corr(nrgrp, type, axis, dim_factor,
-                    mol_file == nullptr ? 0 : gnx[0], bTen, bMW, dt, top,
+                    mol_file == nullptr ? 0 : gnx[0], bTen, bMW, bFFT, dt, top,
                     beginfit, endfit);
 
     nat_trx =
@@ -1041,6 +1391,13 @@ int gmx_msd(int argc, char *argv[])
         "not simulation time). An error estimate given, which is the difference",
         "of the diffusion coefficients obtained from fits over the two halves",
         "of the fit interval.[PAR]",
+        "With [TT]-fft[tt] every frame is used as a reference point, i.e.",
+        "[TT]-trestart[tt] is ignored. The MSD over all reference points is",
+        "then computed from the autocorrelation of the positions using FFTs,",
+        "at a cost that scales as T log T with the number of frames T,",
+        "instead of the T^2/trestart of the default algorithm.",
+        "This requires storing the coordinates of the selected groups",
+        "for all frames and assumes the frames are equally spaced in time.[PAR]",
         "There are three, mutually exclusive, options to determine different",
         "types of mean square displacement: [TT]-type[tt], [TT]-lateral[tt]",
         "and [TT]-ten[tt]. Option [TT]-ten[tt] writes the full MSD tensor for",
@@ -1083,6 +1440,7 @@ int gmx_msd(int argc, char *argv[])
     static gmx_bool    bTen       = FALSE;
     static gmx_bool    bMW        = TRUE;
     static gmx_bool    bRmCOMM    = FALSE;
+    static gmx_bool    bFFT       = FALSE;
     t_pargs            pa[]       = {
         { "-type",    FALSE, etENUM, {normtype},
           "Compute diffusion coefficient in one direction" },
@@ -1100,6 +1458,8 @@ int gmx_msd(int argc, char *argv[])
           "The frame to use for option [TT]-pdb[tt] (%t)" },
         { "-trestart", FALSE, etTIME, {&dt},
           "Time between restarting points in trajectory (%t)" },
+        { "-fft", FALSE, etBOOL, {&bFFT},
+          "Use every frame as restarting point and compute the MSD with FFTs" },
         { "-beginfit", FALSE, etTIME, {&beginfit},
           "Start time for fitting the MSD (%t), -1 is 10%" },
         { "-endfit", FALSE, etTIME, {&endfit},
@@ -1201,7 +1561,7 @@ int gmx_msd(int argc, char *argv[])
     }
 
     do_corr(trx_file, ndx_file, msd_file, mol_file, pdb_file, t_pdb, ngroup,
-            &top, ePBC, bTen, bMW, bRmCOMM, type, dim_factor, axis, dt, beginfit, endfit,
+            &top, ePBC, bTen, bMW, bRmCOMM, bFFT, type, dim_factor, axis, dt, beginfit, endfit,
             oenv);
 
     view_all(oenv, NFILE, fnm);
@@ -50,6 +50,7 @@
 #include "gromacs/gmxana/cmat.h"
 #include "gromacs/gmxana/gmx_ana.h"
 #include "gromacs/gmxana/princ.h"
+#include "gromacs/gmxana/rmsdmatrix.h"
 #include "gromacs/math/do_fit.h"
 #include "gromacs/math/functions.h"
 #include "gromacs/math/utilities.h"
@@ -227,7 +228,7 @@ int gmx_rms(int argc, char *argv[])
     int             maxframe = NFRAME, maxframe2 = NFRAME;
     real            t, *w_rls, *w_rms, *w_rls_m = nullptr, *w_rms_m = nullptr;
     gmx_bool        bNorm, bAv, bFreq2, bFile2, bMat, bBond, bDelta, bMirror, bMass;
-    gmx_bool        bFit, bReset;
+    gmx_bool        bFit, bReset, bQCP;
     t_topology      top;
     int             ePBC;
     t_iatom        *iatom = nullptr;
@@ -862,7 +863,36 @@ int gmx_rms(int argc, char *argv[])
             }
         }
 
-        if (bFitAll)
+        /* Plain RMSD matrices with the same fit and RMSD atoms and weights
+         * are computed in parallel with the QCP method.
+         */
+        bQCP = (bMat && !bBond && ewhat == ewRMSD);
+        for (k = 0; k < n_ind_m && bQCP && bFitAll; k++)
+        {
+            bQCP = (w_rls_m[k] == w_rms_m[k]);
+        }
+        if (bQCP)
+        {
+            gmx_rmsd_frames_t *rmsd_frames, *rmsd_frames2 = nullptr;
+
+            for (i = 0; i < tel_mat; i++)
+            {
+                snew(rmsd_mat[i], tel_mat2);
+            }
+            rmsd_frames = gmx_rmsd_frames_init(tel_mat, n_ind_m, mat_x, w_rms_m, bFitAll);
+            if (bFile2)
+            {
+                rmsd_frames2 = gmx_rmsd_frames_init(tel_mat2, n_ind_m, mat_x2, w_rms_m, bFitAll);
+            }
+            gmx_rmsd_matrix(rmsd_frames, rmsd_frames2, rmsd_mat);
+            gmx_rmsd_frames_done(rmsd_frames);
+            if (rmsd_frames2)
+            {
+                gmx_rmsd_frames_done(rmsd_frames2);
+            }
+        }
+
+        if (bFitAll && !bQCP)
         {
             snew(mat_x2_j, natoms);
         }
@@ -871,7 +901,7 @@ int gmx_rms(int argc, char *argv[])
             axis[i] = time[freq*i];
             fprintf(stderr, "\r element %5d; time %5.2f  ", i, axis[i]);
             fflush(stderr);
-            if (bMat)
+            if (bMat && !bQCP)
             {
                 snew(rmsd_mat[i], tel_mat2);
             }
@@ -881,7 +911,7 @@ int gmx_rms(int argc, char *argv[])
             }
             for (j = 0; j < tel_mat2; j++)
             {
-                if (bFitAll)
+                if (bFitAll && !bQCP)
                 {
                     for (k = 0; k < n_ind_m; k++)
                     {
@@ -897,9 +927,12 @@ int gmx_rms(int argc, char *argv[])
                 {
                     if (bFile2 || (i < j))
                     {
-                        rmsd_mat[i][j] =
-                            calc_similar_ind(ewhat != ewRMSD, irms[0], ind_rms_m,
-                                             w_rms_m, mat_x[i], mat_x2_j);
+                        if (!bQCP)
+                        {
+                            rmsd_mat[i][j] =
+                                calc_similar_ind(ewhat != ewRMSD, irms[0], ind_rms_m,
+                                                 w_rms_m, mat_x[i], mat_x2_j);
+                        }
                         if (rmsd_mat[i][j] > rmsd_max)
                         {
                             rmsd_max = rmsd_mat[i][j];
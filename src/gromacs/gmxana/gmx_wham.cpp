@@ -58,6 +58,7 @@
 #include "gromacs/fileio/tpxio.h"
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxana/gmx_ana.h"
+#include "gromacs/linearalgebra/matrix.h"
 #include "gromacs/math/functions.h"
 #include "gromacs/math/units.h"
 #include "gromacs/math/vec.h"
@@ -233,6 +234,7 @@ typedef struct
     real     min, max, dz;
     real     Temperature, Tolerance; //!< temperature, converged when probability changes less than Tolerance
     gmx_bool bCycl;                  //!< generate cyclic (periodic) PMF
+    int      mixDepth;               //!< nr of previous iterations used for Anderson mixing of z, 0: plain iteration
     /*!\}*/
     /*!
      * \name Output control
@@ -318,8 +320,6 @@ typedef struct
     double                            *tabX, *tabY, tabMin, tabMax, tabDz;
     int                                tabNbins;
     /*!\}*/
-    gmx::DefaultRandomEngine           rng;                 //!< gromacs random number generator
-    gmx::TabulatedNormalDistribution<> normalDistribution;  //!< Uses default: real output, 14-bit table
 } t_UmbrellaOptions;
 
 //! Make an umbrella window (may contain several histograms)
@@ -832,24 +832,22 @@ static double tabulated_pot(double dist, t_UmbrellaOptions *opt)
  * Don't worry, that routine does not mean we compute the PMF in limited precision.
  * After rapid convergence (using only substiantal contributions), we always switch to
  * full precision.
+ * With bFirst, the number of evaluated expressions is printed,
+ * with bVerbose also on every update.
  */
 static void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWindows,
-                           t_UmbrellaOptions *opt)
+                           t_UmbrellaOptions *opt, gmx_bool bFirst, gmx_bool bVerbose)
 {
     int           i, j, k, nGrptot = 0, nContrib = 0, nTot = 0;
     double        U, min = opt->min, dz = opt->dz, temp, ztot_half, distance, ztot, contrib1, contrib2;
     gmx_bool      bAnyContrib;
-    static int    bFirst = 1;
-    static double wham_contrib_lim;
+    double        wham_contrib_lim;
 
-    if (bFirst)
+    for (i = 0; i < nWindows; ++i)
     {
-        for (i = 0; i < nWindows; ++i)
-        {
-            nGrptot += window[i].nPull;
-        }
-        wham_contrib_lim = opt->Tolerance/nGrptot;
+        nGrptot += window[i].nPull;
     }
+    wham_contrib_lim = opt->Tolerance/nGrptot;
 
     ztot      = opt->max-opt->min;
     ztot_half = ztot/2;
@@ -925,12 +923,11 @@ static void setup_acc_wham(double *profile, t_UmbrellaWindow * window, int nWind
                "Evaluating only %d of %d expressions.\n\n", wham_contrib_lim, nContrib, nTot);
     }
 
-    if (opt->verbose)
+    if (bVerbose)
     {
         printf("Updated rapid wham stuff. (evaluating only %d of %d contributions)\n",
                nContrib, nTot);
     }
-    bFirst = 0;
 }
 
 //! Compute the PMF (one of the two main WHAM routines)
@@ -942,59 +939,53 @@ static void calc_profile(double *profile, t_UmbrellaWindow * window, int nWindow
     ztot      = opt->max-opt->min;
     ztot_half = ztot/2;
 
-#pragma omp parallel
+    /* The loop runs serially when called from a bootstrap replica,
+     * which is already running in a parallel region */
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < opt->bins; ++i)
     {
         try
         {
-            int nthreads  = gmx_omp_get_max_threads();
-            int thread_id = gmx_omp_get_thread_num();
-            int i;
-            int i0        = thread_id*opt->bins/nthreads;
-            int i1        = std::min(opt->bins, ((thread_id+1)*opt->bins)/nthreads);
-
-            for (i = i0; i < i1; ++i)
+            int    j, k;
+            double num, denom, invg, temp = 0, distance, U = 0;
+            num = denom = 0.;
+            for (j = 0; j < nWindows; ++j)
             {
-                int    j, k;
-                double num, denom, invg, temp = 0, distance, U = 0;
-                num = denom = 0.;
-                for (j = 0; j < nWindows; ++j)
+                for (k = 0; k < window[j].nPull; ++k)
                 {
-                    for (k = 0; k < window[j].nPull; ++k)
-                    {
-                        invg = 1.0/window[j].g[k] * window[j].bsWeight[k];
-                        temp = (1.0*i+0.5)*dz+min;
-                        num += invg*window[j].Histo[k][i];
+                    invg = 1.0/window[j].g[k] * window[j].bsWeight[k];
+                    temp = (1.0*i+0.5)*dz+min;
+                    num += invg*window[j].Histo[k][i];
 
-                        if (!(bExact || window[j].bContrib[k][i]))
-                        {
-                            continue;
-                        }
-                        distance = temp - window[j].pos[k];   /* distance to umbrella center */
-                        if (opt->bCycl)
-                        {                                     /* in cyclic wham:             */
-                            if (distance > ztot_half)         /*    |distance| < ztot_half   */
-                            {
-                                distance -= ztot;
-                            }
-                            else if (distance < -ztot_half)
-                            {
-                                distance += ztot;
-                            }
-                        }
-
-                        if (!opt->bTab)
+                    if (!(bExact || window[j].bContrib[k][i]))
+                    {
+                        continue;
+                    }
+                    distance = temp - window[j].pos[k];   /* distance to umbrella center */
+                    if (opt->bCycl)
+                    {                                     /* in cyclic wham:             */
+                        if (distance > ztot_half)         /*    |distance| < ztot_half   */
                         {
-                            U = 0.5*window[j].k[k]*gmx::square(distance);       /* harmonic potential assumed. */
+                            distance -= ztot;
                         }
-                        else
+                        else if (distance < -ztot_half)
                         {
-                            U = tabulated_pot(distance, opt);            /* Use tabulated potential     */
+                            distance += ztot;
                         }
-                        denom += invg*window[j].N[k]*std::exp(-U/(BOLTZ*opt->Temperature) + window[j].z[k]);
                     }
+
+                    if (!opt->bTab)
+                    {
+                        U = 0.5*window[j].k[k]*gmx::square(distance);       /* harmonic potential assumed. */
+                    }
+                    else
+                    {
+                        U = tabulated_pot(distance, opt);            /* Use tabulated potential     */
+                    }
+                    denom += invg*window[j].N[k]*std::exp(-U/(BOLTZ*opt->Temperature) + window[j].z[k]);
                 }
-                profile[i] = num/denom;
             }
+            profile[i] = num/denom;
         }
         GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
     }
@@ -1014,14 +1005,11 @@ static double calc_z(double * profile, t_UmbrellaWindow * window, int nWindows,
     {
         try
         {
-            int    nthreads  = gmx_omp_get_max_threads();
-            int    thread_id = gmx_omp_get_thread_num();
-            int    i;
-            int    i0        = thread_id*nWindows/nthreads;
-            int    i1        = std::min(nWindows, ((thread_id+1)*nWindows)/nthreads);
-            double maxloc    = -1e20;
+            double maxloc = -1e20;
 
-            for (i = i0; i < i1; ++i)
+            /* Serial when called from a bootstrap replica */
+#pragma omp for schedule(static)
+            for (int i = 0; i < nWindows; ++i)
             {
                 double total     = 0, temp, distance, U = 0;
                 int    j, k;
@@ -1094,6 +1082,257 @@ static double calc_z(double * profile, t_UmbrellaWindow * window, int nWindows,
     return maxglob;
 }
 
+/*! \brief History of the WHAM iteration for Anderson mixing of the offsets z
+ *
+ * WHAM is a fixed-point iteration z -> g(z) of the offsets z of all
+ * histograms, with g given by calc_profile() followed by calc_z(). Anderson
+ * mixing extrapolates the next z from the last few iterations, which cuts
+ * the number of iterations for poorly overlapping histograms by one or two
+ * orders of magnitude.
+ */
+typedef struct
+{
+    int      n;     //!< nr of offsets, the total nr of histograms
+    int      depth; //!< max nr of stored iterations
+    int      nhist; //!< nr of stored iterations, -1 before the first iteration
+    int      next;  //!< storage slot of the next iteration
+    double  *z;     //!< input offsets of the current iteration
+    double  *f;     //!< residual g(z)-z of the last iteration
+    double  *g;     //!< output offsets g(z) of the last iteration
+    double **dF;    //!< differences of successive residuals
+    double **dG;    //!< differences of successive outputs
+} t_UmbrellaMixing;
+
+//! Set up Anderson mixing over the last \p depth iterations
+static void initUmbrellaMixing(t_UmbrellaMixing *mix, t_UmbrellaWindow *window, int nWindows, int depth)
+{
+    int i;
+
+    mix->n = 0;
+    for (i = 0; i < nWindows; i++)
+    {
+        mix->n += window[i].nPull;
+    }
+    mix->depth = depth;
+    mix->nhist = -1;
+    mix->next  = 0;
+    snew(mix->z, mix->n);
+    snew(mix->f, mix->n);
+    snew(mix->g, mix->n);
+    snew(mix->dF, depth);
+    snew(mix->dG, depth);
+    for (i = 0; i < depth; i++)
+    {
+        snew(mix->dF[i], mix->n);
+        snew(mix->dG[i], mix->n);
+    }
+}
+
+//! Free the Anderson mixing history
+static void doneUmbrellaMixing(t_UmbrellaMixing *mix)
+{
+    for (int i = 0; i < mix->depth; i++)
+    {
+        sfree(mix->dF[i]);
+        sfree(mix->dG[i]);
+    }
+    sfree(mix->dF);
+    sfree(mix->dG);
+    sfree(mix->z);
+    sfree(mix->f);
+    sfree(mix->g);
+}
+
+//! Store the offsets z of all windows as the input of the current iteration
+static void storeMixingInput(t_UmbrellaMixing *mix, t_UmbrellaWindow *window, int nWindows)
+{
+    int i, j, n = 0;
+
+    for (i = 0; i < nWindows; i++)
+    {
+        for (j = 0; j < window[i].nPull; j++)
+        {
+            mix->z[n++] = window[i].z[j];
+        }
+    }
+}
+
+/*! \brief Replace the new offsets z in the windows by the Anderson extrapolation
+ *
+ * The windows contain g(z) of the input z stored by storeMixingInput().
+ * The coefficients gamma minimize |f - dF gamma| with the residual
+ * f = g(z) - z, and the next input is g(z) - dG gamma.
+ * With bReset, the history is cleared, e.g. because the iteration map
+ * changed, and the plain iteration step is taken.
+ */
+static void mixUmbrellaOffsets(t_UmbrellaMixing *mix, t_UmbrellaWindow *window, int nWindows,
+                               gmx_bool bReset)
+{
+    int      i, j, k, l, n = 0, m;
+    double  *f, *g, **a, *b, *gamma;
+
+    snew(f, mix->n);
+    snew(g, mix->n);
+    for (i = 0; i < nWindows; i++)
+    {
+        for (j = 0; j < window[i].nPull; j++)
+        {
+            g[n] = window[i].z[j];
+            f[n] = g[n] - mix->z[n];
+            n++;
+        }
+    }
+    /* Without a previous iteration there are no differences to store */
+    if (bReset || mix->nhist < 0)
+    {
+        mix->nhist = 0;
+        mix->next  = 0;
+    }
+    else
+    {
+        for (k = 0; k < mix->n; k++)
+        {
+            mix->dF[mix->next][k] = f[k] - mix->f[k];
+            mix->dG[mix->next][k] = g[k] - mix->g[k];
+        }
+        mix->next  = (mix->next + 1) % mix->depth;
+        mix->nhist = std::min(mix->nhist + 1, mix->depth);
+    }
+    std::memcpy(mix->f, f, mix->n*sizeof(double));
+    std::memcpy(mix->g, g, mix->n*sizeof(double));
+
+    m = mix->nhist;
+    if (m > 0)
+    {
+        /* Solve the normal equations dF^T dF gamma = dF^T f */
+        a = alloc_matrix(m, m);
+        snew(b, m);
+        snew(gamma, m);
+        for (k = 0; k < m; k++)
+        {
+            for (l = 0; l <= k; l++)
+            {
+                double sum = 0;
+                for (i = 0; i < mix->n; i++)
+                {
+                    sum += mix->dF[k][i]*mix->dF[l][i];
+                }
+                a[k][l] = a[l][k] = sum;
+            }
+            /* Slight regularization against (nearly) linear dependence */
+            a[k][k] *= 1 + 1e-10;
+        }
+        for (k = 0; k < m; k++)
+        {
+            for (i = 0; i < mix->n; i++)
+            {
+                b[k] += mix->dF[k][i]*f[i];
+            }
+        }
+        if (matrix_invert(nullptr, m, a) == 0)
+        {
+            for (k = 0; k < m; k++)
+            {
+                for (l = 0; l < m; l++)
+                {
+                    gamma[k] += a[k][l]*b[l];
+                }
+            }
+            for (i = 0; i < mix->n; i++)
+            {
+                for (k = 0; k < m; k++)
+                {
+                    g[i] -= gamma[k]*mix->dG[k][i];
+                }
+            }
+        }
+        else
+        {
+            mix->nhist = 0;
+        }
+        sfree(b);
+        sfree(gamma);
+        free_matrix(a);
+    }
+
+    n = 0;
+    for (i = 0; i < nWindows; i++)
+    {
+        for (j = 0; j < window[i].nPull; j++)
+        {
+            window[i].z[j] = g[n++];
+        }
+    }
+    sfree(f);
+    sfree(g);
+}
+
+/*! \brief Iterate the WHAM equations until the offsets z are converged
+ *
+ * profile contains the initial guess and returns the PMF (as probability).
+ * With bVerbose, progress is printed as in the main WHAM run, otherwise
+ * nothing is printed, as in the (concurrent) bootstrap replicas.
+ * Returns the nr of iterations, the final maximum change is returned
+ * in \p maxchangeRet.
+ */
+static int wham_iterate(double *profile, t_UmbrellaWindow *window, int nWindows,
+                        t_UmbrellaOptions *opt, gmx_bool bVerbose, double *maxchangeRet)
+{
+    t_UmbrellaMixing mix;
+    double           maxchange = 1e20;
+    gmx_bool         bExact    = FALSE, bReset;
+    gmx_bool         bMix      = (opt->mixDepth > 0);
+    int              i         = 0;
+
+    if (bMix)
+    {
+        initUmbrellaMixing(&mix, window, nWindows, opt->mixDepth);
+    }
+    do
+    {
+        bReset = FALSE;
+        if ( (i%opt->stepUpdateContrib) == 0)
+        {
+            setup_acc_wham(profile, window, nWindows, opt, bVerbose && i == 0, bVerbose && opt->verbose);
+            bReset = TRUE;
+        }
+        if (maxchange < opt->Tolerance)
+        {
+            bExact = TRUE;
+            bReset = TRUE;
+            if (bVerbose)
+            {
+                printf("Switched to exact iteration in iteration %d\n", i);
+            }
+        }
+        calc_profile(profile, window, nWindows, opt, bExact);
+        if (bVerbose && ((i%opt->stepchange) == 0 || i == 1) && i != 0)
+        {
+            printf("\t%4d) Maximum change %e\n", i, maxchange);
+        }
+        i++;
+        if (bMix)
+        {
+            storeMixingInput(&mix, window, nWindows);
+        }
+        maxchange = calc_z(profile, window, nWindows, opt, bExact);
+        if (bMix && (maxchange > opt->Tolerance || !bExact))
+        {
+            /* Restart the mixing when the iteration map changes */
+            mixUmbrellaOffsets(&mix, window, nWindows, bReset);
+        }
+    }
+    while (maxchange > opt->Tolerance || !bExact);
+
+    if (bMix)
+    {
+        doneUmbrellaMixing(&mix);
+    }
+    *maxchangeRet = maxchange;
+
+    return i;
+}
+
 //! Make PMF symmetric around 0 (useful e.g. for membranes)
 static void symmetrizeProfile(double* profile, t_UmbrellaOptions *opt)
 {
@@ -1248,7 +1487,6 @@ static void copy_pullgrp_to_synthwindow(t_UmbrellaWindow *synthWindow,
     synthWindow->pos     [0] = thisWindow->pos      [pullid];
     synthWindow->z       [0] = thisWindow->z        [pullid];
     synthWindow->k       [0] = thisWindow->k        [pullid];
-    synthWindow->bContrib[0] = thisWindow->bContrib [pullid];
     synthWindow->g       [0] = thisWindow->g        [pullid];
     synthWindow->bsWeight[0] = thisWindow->bsWeight [pullid];
 }
@@ -1358,7 +1596,9 @@ static void searchCumulative(double xx[], int n, double x, int *j)
 
 //! Bootstrap new trajectories and thereby generate new (bootstrapped) histograms
 static void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWindow *thisWindow,
-                                   int pullid, t_UmbrellaOptions *opt)
+                                   int pullid, t_UmbrellaOptions *opt,
+                                   gmx::DefaultRandomEngine *rng,
+                                   gmx::TabulatedNormalDistribution<> *normalDistribution)
 {
     int    N, i, nbins, r_index, ibin;
     double r, tausteps = 0.0, a, ap, dt, x, invsqrt2, g, y, sig = 0., z, mu = 0.;
@@ -1399,7 +1639,6 @@ static void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWind
     synthWindow->pos     [0] = thisWindow->pos[pullid];
     synthWindow->z       [0] = thisWindow->z[pullid];
     synthWindow->k       [0] = thisWindow->k[pullid];
-    synthWindow->bContrib[0] = thisWindow->bContrib[pullid];
     synthWindow->g       [0] = thisWindow->g       [pullid];
     synthWindow->bsWeight[0] = thisWindow->bsWeight[pullid];
 
@@ -1435,14 +1674,14 @@ static void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWind
     invsqrt2 = 1.0/std::sqrt(2.0);
 
     /* init random sequence */
-    x = opt->normalDistribution(opt->rng);
+    x = (*normalDistribution)(*rng);
 
     if (opt->bsMethod == bsMethod_traj)
     {
         /* bootstrap points from the umbrella histograms */
         for (i = 0; i < N; i++)
         {
-            y = opt->normalDistribution(opt->rng);
+            y = (*normalDistribution)(*rng);
             x = a*x+ap*y;
             /* get flat distribution in [0,1] using cumulative distribution function of Gauusian
                Note: CDF(Gaussian) = 0.5*{1+erf[x/sqrt(2)]}
@@ -1462,7 +1701,7 @@ static void create_synthetic_histo(t_UmbrellaWindow *synthWindow, t_UmbrellaWind
         i = 0;
         while (i < N)
         {
-            y    = opt->normalDistribution(opt->rng);
+            y    = (*normalDistribution)(*rng);
             x    = a*x+ap*y;
             z    = x*sig+mu;
             ibin = static_cast<int> (std::floor((z-opt->min)/opt->dz));
@@ -1569,7 +1808,7 @@ static int func_wham_is_larger(const void *a, const void *b)
 }
 
 //! Make random weights for histograms for the Bayesian bootstrap of complete histograms)
-static void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_UmbrellaOptions *opt)
+static void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, gmx::DefaultRandomEngine *rng)
 {
     int     i;
     double *r;
@@ -1580,7 +1819,7 @@ static void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_Umbre
     /* generate ordered random numbers between 0 and nAllPull  */
     for (i = 0; i < nAllPull-1; i++)
     {
-        r[i] = dist(opt->rng);
+        r[i] = dist(*rng);
     }
     qsort((void *)r, nAllPull-1, sizeof(double), &func_wham_is_larger);
     r[nAllPull-1] = 1.0*nAllPull;
@@ -1603,26 +1842,78 @@ static void setRandomBsWeights(t_UmbrellaWindow *synthwin, int nAllPull, t_Umbre
     sfree(r);
 }
 
-//! The main bootstrapping routine
+//! Make the synthetic windows of a bootstrap replica, one for each pull group
+static t_UmbrellaWindow *initSyntheticWindows(int nAllPull, t_UmbrellaOptions *opt)
+{
+    t_UmbrellaWindow *synthWindow;
+
+    snew(synthWindow, nAllPull);
+    for (int i = 0; i < nAllPull; i++)
+    {
+        synthWindow[i].nPull = 1;
+        synthWindow[i].nBin  = opt->bins;
+        snew(synthWindow[i].Histo, 1);
+        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
+        {
+            snew(synthWindow[i].Histo[0], opt->bins);
+        }
+        snew(synthWindow[i].N, 1);
+        snew(synthWindow[i].pos, 1);
+        snew(synthWindow[i].z, 1);
+        snew(synthWindow[i].k, 1);
+        /* Each replica needs its own contribution table, set up by setup_acc_wham */
+        snew(synthWindow[i].bContrib, 1);
+        snew(synthWindow[i].g, 1);
+        snew(synthWindow[i].bsWeight, 1);
+    }
+
+    return synthWindow;
+}
+
+//! Free the synthetic windows of a bootstrap replica
+static void freeSyntheticWindows(t_UmbrellaWindow *synthWindow, int nAllPull, t_UmbrellaOptions *opt)
+{
+    for (int i = 0; i < nAllPull; i++)
+    {
+        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
+        {
+            sfree(synthWindow[i].Histo[0]);
+        }
+        sfree(synthWindow[i].Histo);
+        sfree(synthWindow[i].N);
+        sfree(synthWindow[i].pos);
+        sfree(synthWindow[i].z);
+        sfree(synthWindow[i].k);
+        sfree(synthWindow[i].bContrib[0]);
+        sfree(synthWindow[i].bContrib);
+        sfree(synthWindow[i].g);
+        sfree(synthWindow[i].bsWeight);
+    }
+    sfree(synthWindow);
+}
+
+/*! \brief The main bootstrapping routine
+ *
+ * The bootstrap replicas run concurrently, each with its own synthetic
+ * windows and its own random stream, so the result does not depend
+ * on the number of threads.
+ */
 static void do_bootstrapping(const char *fnres, const char* fnprof, const char *fnhist,
                              const char *xlabel, char* ylabel, double *profile,
                              t_UmbrellaWindow * window, int nWindows, t_UmbrellaOptions *opt)
 {
-    t_UmbrellaWindow * synthWindow;
-    double            *bsProfile, *bsProfiles_av, *bsProfiles_av2, maxchange = 1e20, tmp, stddev;
-    int                i, j, *randomArray = nullptr, winid, pullid, ib;
+    double           **bsProfiles, *bsProfiles_av, *bsProfiles_av2, tmp, stddev;
+    int                i, j, ib;
     int                iAllPull, nAllPull, *allPull_winId, *allPull_pullId;
     FILE              *fp;
-    gmx_bool           bExact = FALSE;
 
     /* init random generator */
     if (opt->bsSeed == 0)
     {
         opt->bsSeed = static_cast<int>(gmx::makeRandomSeed());
     }
-    opt->rng.seed(opt->bsSeed);
 
-    snew(bsProfile,     opt->bins);
+    snew(bsProfiles,     opt->nBootStrap);
     snew(bsProfiles_av, opt->bins);
     snew(bsProfiles_av2, opt->bins);
 
@@ -1648,41 +1939,13 @@ static void do_bootstrapping(const char *fnres, const char* fnprof, const char *
         }
     }
 
-    /* setup stuff for synthetic windows */
-    snew(synthWindow, nAllPull);
-    for (i = 0; i < nAllPull; i++)
-    {
-        synthWindow[i].nPull = 1;
-        synthWindow[i].nBin  = opt->bins;
-        snew(synthWindow[i].Histo, 1);
-        if (opt->bsMethod == bsMethod_traj || opt->bsMethod == bsMethod_trajGauss)
-        {
-            snew(synthWindow[i].Histo[0], opt->bins);
-        }
-        snew(synthWindow[i].N, 1);
-        snew(synthWindow[i].pos, 1);
-        snew(synthWindow[i].z, 1);
-        snew(synthWindow[i].k, 1);
-        snew(synthWindow[i].bContrib, 1);
-        snew(synthWindow[i].g, 1);
-        snew(synthWindow[i].bsWeight, 1);
-    }
-
     switch (opt->bsMethod)
     {
         case bsMethod_hist:
-            snew(randomArray, nAllPull);
             printf("\n\nWhen computing statistical errors by bootstrapping entire histograms:\n");
             please_cite(stdout, "Hub2006");
             break;
         case bsMethod_BayesianHist:
-            /* just copy all histogams into synthWindow array */
-            for (i = 0; i < nAllPull; i++)
-            {
-                winid  = allPull_winId [i];
-                pullid = allPull_pullId[i];
-                copy_pullgrp_to_synthwindow(synthWindow+i, window+winid, pullid);
-            }
             break;
         case bsMethod_traj:
         case bsMethod_trajGauss:
@@ -1693,95 +1956,107 @@ static void do_bootstrapping(const char *fnres, const char* fnprof, const char *
     }
 
     /* do bootstrapping */
-    fp = xvgropen(fnprof, "Bootstrap profiles", xlabel, ylabel, opt->oenv);
+    printf("Running %d bootstraps on %d threads\n", opt->nBootStrap, gmx_omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic)
     for (ib = 0; ib < opt->nBootStrap; ib++)
     {
-        printf("  *******************************************\n"
-               "  ******** Start bootstrap nr %d ************\n"
-               "  *******************************************\n", ib+1);
-
-        switch (opt->bsMethod)
+        try
         {
-            case bsMethod_hist:
-                /* bootstrap complete histograms from given histograms */
-                getRandomIntArray(nAllPull, opt->histBootStrapBlockLength, randomArray, &opt->rng);
-                for (i = 0; i < nAllPull; i++)
-                {
-                    winid  = allPull_winId [randomArray[i]];
-                    pullid = allPull_pullId[randomArray[i]];
-                    copy_pullgrp_to_synthwindow(synthWindow+i, window+winid, pullid);
-                }
-                break;
-            case bsMethod_BayesianHist:
-                /* keep histos, but assign random weights ("Bayesian bootstrap") */
-                setRandomBsWeights(synthWindow, nAllPull, opt);
-                break;
-            case bsMethod_traj:
-            case bsMethod_trajGauss:
-                /* create new histos from given histos, that is generate new hypothetical
-                   trajectories */
-                for (i = 0; i < nAllPull; i++)
-                {
-                    winid  = allPull_winId[i];
-                    pullid = allPull_pullId[i];
-                    create_synthetic_histo(synthWindow+i, window+winid, pullid, opt);
-                }
-                break;
-        }
+            t_UmbrellaWindow                  *synthWindow;
+            gmx::DefaultRandomEngine           rng(opt->bsSeed);
+            gmx::TabulatedNormalDistribution<> normalDistribution;
+            int                               *randomArray, winid, pullid, niter;
+            double                             maxchange;
 
-        /* write histos in case of verbose output */
-        if (opt->bs_verbose)
-        {
-            print_histograms(fnhist, synthWindow, nAllPull, ib, opt, xlabel);
-        }
+            /* Every bootstrap uses its own random stream */
+            rng.restart(ib, 0);
+            synthWindow = initSyntheticWindows(nAllPull, opt);
+            snew(bsProfiles[ib], opt->bins);
 
-        /* do wham */
-        i         = 0;
-        bExact    = FALSE;
-        maxchange = 1e20;
-        std::memcpy(bsProfile, profile, opt->bins*sizeof(double)); /* use profile as guess */
-        do
-        {
-            if ( (i%opt->stepUpdateContrib) == 0)
+            switch (opt->bsMethod)
             {
-                setup_acc_wham(bsProfile, synthWindow, nAllPull, opt);
+                case bsMethod_hist:
+                    /* bootstrap complete histograms from given histograms */
+                    snew(randomArray, nAllPull);
+                    getRandomIntArray(nAllPull, opt->histBootStrapBlockLength, randomArray, &rng);
+                    for (int k = 0; k < nAllPull; k++)
+                    {
+                        winid  = allPull_winId [randomArray[k]];
+                        pullid = allPull_pullId[randomArray[k]];
+                        copy_pullgrp_to_synthwindow(synthWindow+k, window+winid, pullid);
+                    }
+                    sfree(randomArray);
+                    break;
+                case bsMethod_BayesianHist:
+                    /* keep histos, but assign random weights ("Bayesian bootstrap") */
+                    for (int k = 0; k < nAllPull; k++)
+                    {
+                        winid  = allPull_winId [k];
+                        pullid = allPull_pullId[k];
+                        copy_pullgrp_to_synthwindow(synthWindow+k, window+winid, pullid);
+                    }
+                    setRandomBsWeights(synthWindow, nAllPull, &rng);
+                    break;
+                case bsMethod_traj:
+                case bsMethod_trajGauss:
+                    /* create new histos from given histos, that is generate new hypothetical
+                       trajectories */
+                    for (int k = 0; k < nAllPull; k++)
+                    {
+                        winid  = allPull_winId[k];
+                        pullid = allPull_pullId[k];
+                        create_synthetic_histo(synthWindow+k, window+winid, pullid, opt,
+                                               &rng, &normalDistribution);
+                    }
+                    break;
             }
-            if (maxchange < opt->Tolerance)
+
+            /* write histos in case of verbose output */
+            if (opt->bs_verbose)
             {
-                bExact = TRUE;
+#pragma omp critical
+                print_histograms(fnhist, synthWindow, nAllPull, ib, opt, xlabel);
             }
-            if (((i%opt->stepchange) == 0 || i == 1) && i != 0)
+
+            /* do wham, use profile as guess */
+            std::memcpy(bsProfiles[ib], profile, opt->bins*sizeof(double));
+            niter = wham_iterate(bsProfiles[ib], synthWindow, nAllPull, opt, FALSE, &maxchange);
+#pragma omp critical
+            printf("\tBootstrap %d converged in %d iterations. Final maximum change %g\n",
+                   ib+1, niter, maxchange);
+
+            if (opt->bLog)
             {
-                printf("\t%4d) Maximum change %e\n", i, maxchange);
+                prof_normalization_and_unit(bsProfiles[ib], opt);
             }
-            calc_profile(bsProfile, synthWindow, nAllPull, opt, bExact);
-            i++;
-        }
-        while ( (maxchange = calc_z(bsProfile, synthWindow, nAllPull, opt, bExact)) > opt->Tolerance || !bExact);
-        printf("\tConverged in %d iterations. Final maximum change %g\n", i, maxchange);
 
-        if (opt->bLog)
-        {
-            prof_normalization_and_unit(bsProfile, opt);
-        }
+            /* symmetrize profile around z=0 */
+            if (opt->bSym)
+            {
+                symmetrizeProfile(bsProfiles[ib], opt);
+            }
 
-        /* symmetrize profile around z=0 */
-        if (opt->bSym)
-        {
-            symmetrizeProfile(bsProfile, opt);
+            freeSyntheticWindows(synthWindow, nAllPull, opt);
         }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
 
-        /* save stuff to get average and stddev */
+    /* save stuff to get average and stddev */
+    fp = xvgropen(fnprof, "Bootstrap profiles", xlabel, ylabel, opt->oenv);
+    for (ib = 0; ib < opt->nBootStrap; ib++)
+    {
         for (i = 0; i < opt->bins; i++)
         {
-            tmp                = bsProfile[i];
+            tmp                = bsProfiles[ib][i];
             bsProfiles_av[i]  += tmp;
             bsProfiles_av2[i] += tmp*tmp;
             fprintf(fp, "%e\t%e\n", (i+0.5)*opt->dz+opt->min, tmp);
         }
         fprintf(fp, "%s\n", output_env_get_print_xvgr_codes(opt->oenv) ? "&" : "");
+        sfree(bsProfiles[ib]);
     }
     xvgrclose(fp);
+    sfree(bsProfiles);
 
     /* write average and stddev */
     fp = xvgropen(fnres, "Average and stddev from bootstrapping", xlabel, ylabel, opt->oenv);
@@ -1799,6 +2074,10 @@ static void do_bootstrapping(const char *fnres, const char* fnprof, const char *
     }
     xvgrclose(fp);
     printf("Wrote boot strap result to %s\n", fnres);
+    sfree(bsProfiles_av);
+    sfree(bsProfiles_av2);
+    sfree(allPull_winId);
+    sfree(allPull_pullId);
 }
 
 //! Return type of input file based on file extension (xvg, pdo, or tpr)
@@ -3320,13 +3599,21 @@ int gmx_wham(int argc, char *argv[])
         "periodicity of the system and generate a periodic PMF. The first and the last bin of the",
         "reaction coordinate will assumed be be neighbors.[PAR]",
         "Option [TT]-sym[tt] symmetrizes the profile around z=0 before output, ",
-        "which may be useful for, e.g. membranes.",
+        "which may be useful for, e.g. membranes.[PAR]",
+        "The WHAM equations are iterated until the free energy offsets of the ",
+        "windows change less than [TT]-tol[tt]. The iteration is accelerated by ",
+        "Anderson mixing of the offsets over the last [TT]-mix[tt] iterations, ",
+        "which greatly reduces the number of iterations for windows with limited ",
+        "overlap. Use [TT]-mix 0[tt] for the plain iteration.",
         "",
         "Parallelization",
         "^^^^^^^^^^^^^^^",
         "",
         "If available, the number of OpenMP threads used by gmx wham can be controlled by setting",
         "the [TT]OMP_NUM_THREADS[tt] environment variable.",
+        "With bootstrapping, the bootstraps run concurrently. Each bootstrap uses",
+        "its own random stream, so the result for a given [TT]-bs-seed[tt] does",
+        "not depend on the number of threads.",
         "",
         "Autocorrelations",
         "^^^^^^^^^^^^^^^^",
@@ -3412,6 +3699,8 @@ int gmx_wham(int argc, char *argv[])
           "Temperature"},
         { "-tol", FALSE, etREAL, {&opt.Tolerance},
           "Tolerance"},
+        { "-mix", FALSE, etINT, {&opt.mixDepth},
+          "Number of previous iterations used for Anderson mixing of the free energy offsets (0: plain iteration)"},
         { "-v", FALSE, etBOOL, {&opt.verbose},
           "Verbose mode"},
         { "-b", FALSE, etREAL, {&opt.tmin},
@@ -3481,8 +3770,8 @@ int gmx_wham(int argc, char *argv[])
     int                      i, j, l, nfiles, nwins, nfiles2;
     t_UmbrellaHeader         header;
     t_UmbrellaWindow       * window = nullptr;
-    double                  *profile, maxchange = 1e20;
-    gmx_bool                 bMinSet, bMaxSet, bAutoSet, bExact = FALSE;
+    double                  *profile, maxchange;
+    gmx_bool                 bMinSet, bMaxSet, bAutoSet;
     char                   **fninTpr, **fninPull, **fninPdo;
     const char              *fnPull;
     FILE                    *histout, *profout;
@@ -3514,6 +3803,7 @@ int gmx_wham(int argc, char *argv[])
     opt.zProf0                = 0.;
     opt.Temperature           = 298;
     opt.Tolerance             = 1e-6;
+    opt.mixDepth              = 5;
     opt.bBoundsOnly           = FALSE;
     opt.bSym                  = FALSE;
     opt.bCalcTauInt           = FALSE;
@@ -3711,27 +4001,7 @@ int gmx_wham(int argc, char *argv[])
     {
         opt.stepchange = 1;
     }
-    i = 0;
-    do
-    {
-        if ( (i%opt.stepUpdateContrib) == 0)
-        {
-            setup_acc_wham(profile, window, nwins, &opt);
-        }
-        if (maxchange < opt.Tolerance)
-        {
-            bExact = TRUE;
-            /* if (opt.verbose) */
-            printf("Switched to exact iteration in iteration %d\n", i);
-        }
-        calc_profile(profile, window, nwins, &opt, bExact);
-        if (((i%opt.stepchange) == 0 || i == 1) && i != 0)
-        {
-            printf("\t%4d) Maximum change %e\n", i, maxchange);
-        }
-        i++;
-    }
-    while ( (maxchange = calc_z(profile, window, nwins, &opt, bExact)) > opt.Tolerance || !bExact);
+    i = wham_iterate(profile, window, nwins, &opt, TRUE, &maxchange);
     printf("Converged in %d iterations. Final maximum change %g\n", i, maxchange);
 
     /* calc error from Kumar's formula */
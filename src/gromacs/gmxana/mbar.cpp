@@ -0,0 +1,503 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+#include "gmxpre.h"
+
+#include "mbar.h"
+
+#include <cmath>
+#include <cstdio>
+
+#include <algorithm>
+#include <limits>
+
+#include "gromacs/linearalgebra/matrix.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
+#include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/smalloc.h"
+
+/* The number of samples the MBAR kernel processes at once, a multiple
+   of the SIMD width */
+static const int c_mbarChunkSize = 64;
+/* The maximum number of samples in a unit of MBAR work */
+static const int c_mbarUnitSize = 8192;
+/* The maximum number of blocks of consecutive work units. The partial
+   sums are accumulated per block and the blocks are added up in order,
+   so the results do not depend on the number of threads, while the
+   memory for the sums does not depend on the number of samples. */
+static const int c_mbarMaxBlocks = 64;
+/* The maximum number of MBAR iterations */
+static const int c_mbarMaxIter = 1000;
+/* Newton steps with all components below this size (in kT) are accepted
+   without checking the objective function, which is then dominated by
+   rounding errors */
+static const double c_mbarNewtonTrust = 0.1;
+/* The maximum size of a component of a Newton step (in kT), which keeps
+   the steps finite when the states do not all overlap */
+static const double c_mbarNewtonMaxStep = 10;
+/* The number of times a Newton step is halved before falling back
+   to a self-consistent iteration step */
+static const int c_mbarNewtonHalvings = 4;
+
+#if GMX_SIMD_HAVE_DOUBLE
+static_assert(c_mbarChunkSize % GMX_SIMD_DOUBLE_WIDTH == 0, "The MBAR chunks should consist of whole SIMD registers");
+#endif
+
+/* a contiguous range of samples from one simulation at a sampled state */
+typedef struct gmx_mbar_unit_t
+{
+    int state;      /* the sampled state */
+    int set;        /* the sample set */
+    int start, end; /* the sample range */
+} gmx_mbar_unit_t;
+
+/* the number of partial sums per block of MBAR work units: the objective
+   function, the normalization sums and the lower triangle of the second
+   order Hessian terms */
+static int mbar_block_stride(const gmx_mbar_t *mb)
+{
+    return 1 + mb->nstates + (mb->nstates*(mb->nstates + 1))/2;
+}
+
+gmx_mbar_t *gmx_mbar_init(int nstates, double beta)
+{
+    gmx_mbar_t *mb;
+
+    snew(mb, 1);
+    mb->nstates = nstates;
+    mb->beta    = beta;
+    snew(mb->N, nstates);
+    snew(mb->block_sums, c_mbarMaxBlocks*mbar_block_stride(mb));
+
+    return mb;
+}
+
+void gmx_mbar_add_samples(gmx_mbar_t *mb, int state,
+                          const double *const du[], int start, int end)
+{
+    int K = mb->nstates;
+    int k;
+
+    if (mb->nset + 1 > mb->nset_alloc)
+    {
+        mb->nset_alloc = std::max(2*mb->nset_alloc, 16);
+        srenew(mb->du, mb->nset_alloc*K);
+    }
+    for (k = 0; k < K; k++)
+    {
+        mb->du[mb->nset*K + k] = du[k];
+    }
+    for (; start < end; start += c_mbarUnitSize)
+    {
+        if (mb->nunit + 1 > mb->nunit_alloc)
+        {
+            mb->nunit_alloc = std::max(2*mb->nunit_alloc, 16);
+            srenew(mb->unit, mb->nunit_alloc);
+        }
+        mb->unit[mb->nunit].state  = state;
+        mb->unit[mb->nunit].set    = mb->nset;
+        mb->unit[mb->nunit].start  = start;
+        mb->unit[mb->nunit].end    = std::min(start + c_mbarUnitSize, end);
+        mb->N[state]              += mb->unit[mb->nunit].end - start;
+        mb->nunit++;
+    }
+    mb->nset++;
+}
+
+void gmx_mbar_clear_samples(gmx_mbar_t *mb)
+{
+    for (int k = 0; k < mb->nstates; k++)
+    {
+        mb->N[k] = 0;
+    }
+    mb->nset  = 0;
+    mb->nunit = 0;
+}
+
+void gmx_mbar_done(gmx_mbar_t *mb)
+{
+    sfree(mb->N);
+    sfree(mb->du);
+    sfree(mb->unit);
+    sfree(mb->block_sums);
+    sfree(mb);
+}
+
+/* the dot product of two padded chunks */
+static inline double mbar_dot(const double *a, const double *b, int n)
+{
+    double dot = 0;
+#if GMX_SIMD_HAVE_DOUBLE
+    gmx::SimdDouble acc = gmx::setZero();
+
+    for (int m = 0; m < n; m += GMX_SIMD_DOUBLE_WIDTH)
+    {
+        acc = gmx::fma(gmx::load<gmx::SimdDouble>(a + m),
+                       gmx::load<gmx::SimdDouble>(b + m), acc);
+    }
+    dot = gmx::reduce(acc);
+#else
+    for (int m = 0; m < n; m++)
+    {
+        dot += a[m]*b[m];
+    }
+#endif
+    return dot;
+}
+
+/* Add the MBAR sums over a work unit to sums: the logarithms of the
+   normalizations of the samples, the normalization sums of each state
+   and the products of the weights for the Hessian (lower triangle only).
+   c holds ln(N_k) + f_k, buf is scratch space of (nstates + 2)*c_mbarChunkSize
+   aligned doubles. */
+static void mbar_unit_sums(const gmx_mbar_t *mb, const gmx_mbar_unit_t *u,
+                           const double *c, double *buf, double *sums)
+{
+    int            K   = mb->nstates;
+    const double **du  = mb->du + u->set*K;
+    double        *mx  = buf + K*c_mbarChunkSize;
+    double        *sum = mx + c_mbarChunkSize;
+    double        *S   = sums + 1;
+    double        *H   = sums + 1 + K;
+    int            k, l, m, m0;
+
+    for (m0 = u->start; m0 < u->end; m0 += c_mbarChunkSize)
+    {
+        int n    = std::min(c_mbarChunkSize, u->end - m0);
+#if GMX_SIMD_HAVE_DOUBLE
+        int npad = ((n + GMX_SIMD_DOUBLE_WIDTH - 1)/GMX_SIMD_DOUBLE_WIDTH)*GMX_SIMD_DOUBLE_WIDTH;
+#else
+        int npad = n;
+#endif
+
+        /* the reduced energies of all states relative to the sampled state,
+           shifted by the free energies, and their maximum per sample */
+        for (m = 0; m < npad; m++)
+        {
+            mx[m] = -std::numeric_limits<double>::max();
+        }
+        for (k = 0; k < K; k++)
+        {
+            double *ek = buf + k*c_mbarChunkSize;
+
+            if (du[k])
+            {
+                const double *d = du[k] + m0;
+                for (m = 0; m < n; m++)
+                {
+                    ek[m] = c[k] - mb->beta*d[m];
+                }
+            }
+            else
+            {
+                for (m = 0; m < n; m++)
+                {
+                    ek[m] = c[k];
+                }
+            }
+            for (m = n; m < npad; m++)
+            {
+                ek[m] = 0;
+            }
+            for (m = 0; m < npad; m++)
+            {
+                mx[m] = std::max(mx[m], ek[m]);
+            }
+        }
+
+        /* the log-sum-exp, with the exponentials relative to the maximum */
+        for (m = 0; m < npad; m++)
+        {
+            sum[m] = 0;
+        }
+        for (k = 0; k < K; k++)
+        {
+            double *ek = buf + k*c_mbarChunkSize;
+#if GMX_SIMD_HAVE_DOUBLE
+            for (m = 0; m < npad; m += GMX_SIMD_DOUBLE_WIDTH)
+            {
+                gmx::SimdDouble x = gmx::exp(gmx::load<gmx::SimdDouble>(ek + m) -
+                                             gmx::load<gmx::SimdDouble>(mx + m));
+                gmx::store(ek + m, x);
+                gmx::store(sum + m, gmx::load<gmx::SimdDouble>(sum + m) + x);
+            }
+#else
+            for (m = 0; m < n; m++)
+            {
+                ek[m]   = std::exp(ek[m] - mx[m]);
+                sum[m] += ek[m];
+            }
+#endif
+        }
+        for (m = 0; m < n; m++)
+        {
+            sums[0] += mx[m] + std::log(sum[m]);
+            sum[m]   = 1/sum[m];
+        }
+
+        /* the weights of the samples in each state, times N_k */
+        for (k = 0; k < K; k++)
+        {
+            double *ek = buf + k*c_mbarChunkSize;
+            double  s  = 0;
+
+            for (m = 0; m < n; m++)
+            {
+                ek[m] *= sum[m];
+                s     += ek[m];
+            }
+            for (m = n; m < npad; m++)
+            {
+                ek[m] = 0;
+            }
+            S[k] += s;
+        }
+
+        for (k = 0; k < K; k++)
+        {
+            for (l = 0; l <= k; l++)
+            {
+                H[(k*(k + 1))/2 + l] += mbar_dot(buf + k*c_mbarChunkSize,
+                                                 buf + l*c_mbarChunkSize, npad);
+            }
+        }
+    }
+}
+
+/* Evaluate the MBAR objective function, its gradient and its Hessian at
+   the reduced free energies f. S receives the normalization sums, which
+   are N_k at the solution, and H the sums of the weight products. */
+static void mbar_evaluate(gmx_mbar_t *mb, const double *f, double *obj,
+                          double *S, double *H)
+{
+    int     K      = mb->nstates;
+    int     stride = mbar_block_stride(mb);
+    int     nblock = std::min(mb->nunit, c_mbarMaxBlocks);
+    double *c;
+    int     k, l, b;
+
+    snew(c, K);
+    for (k = 0; k < K; k++)
+    {
+        c[k] = std::log(mb->N[k]) + f[k];
+    }
+
+    /* The blocks are fixed ranges of work units, each summed by a single
+       thread in the order of the units */
+#pragma omp parallel
+    {
+        double *buf;
+
+        snew_aligned(buf, (K + 2)*c_mbarChunkSize, 64);
+#pragma omp for schedule(dynamic)
+        for (b = 0; b < nblock; b++)
+        {
+            try
+            {
+                double *sums = mb->block_sums + b*stride;
+
+                for (int i = 0; i < stride; i++)
+                {
+                    sums[i] = 0;
+                }
+                for (int u = (b*mb->nunit)/nblock; u < ((b + 1)*mb->nunit)/nblock; u++)
+                {
+                    mbar_unit_sums(mb, &(mb->unit[u]), c, buf, sums);
+                }
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+        }
+        sfree_aligned(buf);
+    }
+
+    /* add up the partial sums in a fixed order */
+    *obj = 0;
+    for (k = 0; k < K; k++)
+    {
+        S[k] = 0;
+        for (l = 0; l < K; l++)
+        {
+            H[k*K + l] = 0;
+        }
+    }
+    for (b = 0; b < nblock; b++)
+    {
+        const double *sums = mb->block_sums + b*stride;
+
+        *obj += sums[0];
+        for (k = 0; k < K; k++)
+        {
+            S[k] += sums[1 + k];
+            for (l = 0; l <= k; l++)
+            {
+                H[k*K + l] += sums[1 + K + (k*(k + 1))/2 + l];
+            }
+        }
+    }
+    for (k = 0; k < K; k++)
+    {
+        *obj -= mb->N[k]*f[k];
+        for (l = 0; l < k; l++)
+        {
+            H[l*K + k] = H[k*K + l];
+        }
+    }
+    sfree(c);
+}
+
+int gmx_mbar_solve(gmx_mbar_t *mb, double *f_result, double tol)
+{
+    int      K = mb->nstates;
+    double   obj, obj_try;
+    double  *f, *S, *H, *f_try, *S_try, *H_try, *step;
+    double **a;
+    int      iter, k, l, h;
+
+    snew(f, K);
+    for (k = 0; k < K; k++)
+    {
+        f[k] = f_result[k];
+    }
+    snew(S, K);
+    snew(H, K*K);
+    snew(f_try, K);
+    snew(S_try, K);
+    snew(H_try, K*K);
+    snew(step, K);
+    a = alloc_matrix(K - 1, K - 1);
+
+    mbar_evaluate(mb, f, &obj, S, H);
+    for (iter = 0; iter < c_mbarMaxIter; iter++)
+    {
+        double   dmax = 0;
+        gmx_bool bNewton;
+
+        /* the size of the self-consistent step measures convergence */
+        for (k = 0; k < K; k++)
+        {
+            dmax = std::max(dmax, std::abs(std::log(S[k]/mb->N[k])));
+        }
+        if (dmax < tol)
+        {
+            break;
+        }
+
+        /* the Newton step, the gradient of the objective is S - N */
+        bNewton = FALSE;
+        for (k = 1; k < K; k++)
+        {
+            for (l = 1; l < K; l++)
+            {
+                a[k - 1][l - 1] = (k == l ? S[k] : 0) - H[k*K + l];
+            }
+        }
+        if (matrix_invert(nullptr, K - 1, a) == 0)
+        {
+            double step_max = 0;
+
+            step[0] = 0;
+            for (k = 1; k < K; k++)
+            {
+                step[k] = 0;
+                for (l = 1; l < K; l++)
+                {
+                    step[k] -= a[k - 1][l - 1]*(S[l] - mb->N[l]);
+                }
+                step_max = std::max(step_max, std::abs(step[k]));
+            }
+            if (step_max > c_mbarNewtonMaxStep)
+            {
+                for (k = 0; k < K; k++)
+                {
+                    step[k] *= c_mbarNewtonMaxStep/step_max;
+                }
+                step_max = c_mbarNewtonMaxStep;
+            }
+            for (h = 0; h <= c_mbarNewtonHalvings && !bNewton; h++)
+            {
+                for (k = 0; k < K; k++)
+                {
+                    f_try[k] = f[k] + step[k];
+                }
+                mbar_evaluate(mb, f_try, &obj_try, S_try, H_try);
+                bNewton = (obj_try <= obj || step_max < c_mbarNewtonTrust);
+                for (k = 0; k < K; k++)
+                {
+                    step[k] *= 0.5;
+                }
+                step_max *= 0.5;
+            }
+        }
+        if (!bNewton)
+        {
+            double shift = -std::log(S[0]/mb->N[0]);
+            for (k = 0; k < K; k++)
+            {
+                f_try[k] = f[k] - std::log(S[k]/mb->N[k]) - shift;
+            }
+            mbar_evaluate(mb, f_try, &obj_try, S_try, H_try);
+        }
+        std::swap(f_try, f);
+        std::swap(S_try, S);
+        std::swap(H_try, H);
+        obj = obj_try;
+        if (debug)
+        {
+            fprintf(debug, "MBAR iteration %d: %s step, objective %.10g\n",
+                    iter, bNewton ? "Newton" : "self-consistent", obj);
+        }
+    }
+    if (iter == c_mbarMaxIter)
+    {
+        printf("\nWARNING: MBAR did not converge in %d iterations\n", iter);
+    }
+    for (k = 0; k < K; k++)
+    {
+        f_result[k] = f[k];
+    }
+
+    sfree(f);
+    sfree(S);
+    sfree(H);
+    sfree(f_try);
+    sfree(S_try);
+    sfree(H_try);
+    sfree(step);
+    free_matrix(a);
+
+    return iter;
+}
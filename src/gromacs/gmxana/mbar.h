@@ -0,0 +1,84 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+#ifndef GMX_GMXANA_MBAR_H
+#define GMX_GMXANA_MBAR_H
+
+/* The samples of an MBAR calculation with all sampled states at once.
+ * The energy differences are not copied, only pointers to them and the
+ * sample ranges to use are stored. The sample ranges are split into
+ * work units, which are distributed over the OpenMP threads.
+ */
+typedef struct gmx_mbar_t {
+    int                         nstates; /* the number of sampled states */
+    double                      beta;    /* 1/kT */
+    double                     *N;       /* the number of samples of each state */
+    int                         nset;    /* the number of sample sets */
+    int                         nset_alloc;
+    const double              **du;      /* du[set*nstates+k] are the energy
+                                            differences to state k of a set */
+    int                         nunit;   /* the number of work units */
+    int                         nunit_alloc;
+    struct gmx_mbar_unit_t     *unit;    /* the work units */
+    double                     *block_sums; /* the partial sums of each block
+                                               of work units */
+} gmx_mbar_t;
+
+gmx_mbar_t *gmx_mbar_init(int nstates, double beta);
+/* Returns an MBAR calculation for nstates states at inverse temperature
+ * beta, without samples.
+ */
+
+void gmx_mbar_add_samples(gmx_mbar_t *mb, int state,
+                          const double *const du[], int start, int end);
+/* Adds samples start to end-1 of a simulation at sampled state state.
+ * du[k][i] is the energy difference of sample i of state k relative to
+ * state state, in units of 1/beta. du[k] can be nullptr for zero
+ * differences, as for k = state. The arrays are not copied.
+ */
+
+void gmx_mbar_clear_samples(gmx_mbar_t *mb);
+/* Removes all samples, but keeps the allocated memory. */
+
+int gmx_mbar_solve(gmx_mbar_t *mb, double *f, double tol);
+/* Solves the MBAR equations for the reduced free energies f of all
+ * sampled states, starting from the estimate in f, with f[0] kept fixed.
+ * Converged is when the self-consistent iteration step is below tol
+ * for all states. Returns the number of iterations.
+ */
+
+void gmx_mbar_done(gmx_mbar_t *mb);
+
+#endif
@@ -39,11 +39,17 @@
 #include "config.h"
 
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 
+#include <algorithm>
+
+#include "gromacs/math/functions.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/random/threefry.h"
 #include "gromacs/random/uniformintdistribution.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/cstringutil.h"
 #include "gromacs/utility/exceptions.h"
@@ -53,6 +59,17 @@
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/strdb.h"
 
+/* The number of atoms per tile of the direct histogram, a multiple of the SIMD width */
+static const int c_debyeTileSize = 256;
+
+#if GMX_SIMD_HAVE_REAL
+static_assert(c_debyeTileSize % GMX_SIMD_REAL_WIDTH == 0, "The tiles should consist of whole SIMD registers");
+#endif
+
+/* The number of q values per block in the intensity curve, the sines
+ * are reseeded at the start of each block */
+static const int c_debyeQBlockSize = 64;
+
 void check_binwidth(real binwidth)
 {
     real smallest_bin = 0.1;
@@ -189,6 +206,144 @@ gmx_sans_t *gmx_sans_init (const t_topology *top, gmx_neutron_atomic_structurefa
     return gsans;
 }
 
+/*! \brief Adds the pairs i > j with i in [i0,i1) and j in [j0,j1) to gr
+ *
+ * x, y and z are the aligned coordinate arrays of the selection,
+ * sl are the scattering lengths.
+ * Distances beyond the last bin, binmax, which can only occur for
+ * atoms that stick out of the box, are counted in that bin.
+ * bin is an aligned buffer of c_debyeTileSize bin indices.
+ */
+static void add_histogram_tile(const real *x, const real *y, const real *z,
+                               const double *sl,
+                               int i0, int i1, int j0, int j1,
+                               real invbinwidth, int binmax, double *gr, std::int32_t *bin)
+{
+    for (int i = i0; i < i1; i++)
+    {
+        int    jend = std::min(j1, i);
+        int    j    = j0;
+        double sli  = sl[i];
+#if GMX_SIMD_HAVE_REAL
+        gmx::SimdReal xi(x[i]);
+        gmx::SimdReal yi(y[i]);
+        gmx::SimdReal zi(z[i]);
+        gmx::SimdReal invbw(invbinwidth);
+        int           jsimd = j0 + ((jend - j0)/GMX_SIMD_REAL_WIDTH)*GMX_SIMD_REAL_WIDTH;
+
+        for (; j < jsimd; j += GMX_SIMD_REAL_WIDTH)
+        {
+            gmx::SimdReal dx = xi - gmx::load<gmx::SimdReal>(x + j);
+            gmx::SimdReal dy = yi - gmx::load<gmx::SimdReal>(y + j);
+            gmx::SimdReal dz = zi - gmx::load<gmx::SimdReal>(z + j);
+            gmx::SimdReal r2 = dx*dx;
+            r2 = gmx::fma(dy, dy, r2);
+            r2 = gmx::fma(dz, dz, r2);
+            gmx::store(bin + j - j0, gmx::cvttR2I(gmx::sqrt(r2)*invbw));
+        }
+        for (int k = 0; k < jsimd - j0; k++)
+        {
+            gr[std::min(bin[k], binmax)] += sli*sl[j0 + k];
+        }
+#else
+        GMX_UNUSED_VALUE(bin);
+#endif
+        for (; j < jend; j++)
+        {
+            real r2 = gmx::square(x[i] - x[j]) + gmx::square(y[i] - y[j]) + gmx::square(z[i] - z[j]);
+            gr[std::min(static_cast<int>(std::sqrt(r2)*invbinwidth), binmax)] += sli*sl[j];
+        }
+    }
+}
+
+/*! \brief Computes the direct pair-distance histogram of the selection
+ *
+ * The selection is copied to aligned coordinate arrays and the lower
+ * triangle of atom pairs is processed in tiles that stay in cache,
+ * with dynamic load balancing over threads that each fill their own
+ * histogram.
+ */
+static void calc_direct_histogram(const gmx_sans_t *gsans, const rvec *x,
+                                  const int *index, int isize,
+                                  gmx_radial_distribution_histogram_t *pr)
+{
+    int      stride, ntile, npair, nthreads;
+    real    *xs;
+    double  *sl, **tgr;
+    real     invbinwidth = 1.0/pr->binwidth;
+
+    /* Padding to the tile size keeps every tile aligned */
+    stride = ((isize + c_debyeTileSize - 1)/c_debyeTileSize)*c_debyeTileSize;
+    snew_aligned(xs, std::max(DIM*stride, 1), 64);
+    snew(sl, std::max(isize, 1));
+    for (int i = 0; i < isize; i++)
+    {
+        xs[i]            = x[index[i]][XX];
+        xs[stride + i]   = x[index[i]][YY];
+        xs[2*stride + i] = x[index[i]][ZZ];
+        sl[i]            = gsans->slength[index[i]];
+    }
+    ntile = stride/c_debyeTileSize;
+    npair = ntile*(ntile + 1)/2;
+
+    nthreads = gmx_omp_get_max_threads();
+    snew(tgr, nthreads);
+    for (int t = 0; t < nthreads; t++)
+    {
+        snew(tgr[t], pr->grn);
+    }
+#pragma omp parallel num_threads(nthreads)
+    {
+#if GMX_SIMD_HAVE_REAL
+        alignas(GMX_SIMD_ALIGNMENT) std::int32_t bin[c_debyeTileSize];
+#else
+        std::int32_t *bin = nullptr;
+#endif
+        double       *gr = tgr[gmx_omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic)
+        for (int p = 0; p < npair; p++)
+        {
+            try
+            {
+                /* Unpack the lower triangle tile index, ti >= tj */
+                int ti = static_cast<int>((std::sqrt(8.0*p + 1) - 1)/2);
+                while (ti*(ti + 1)/2 > p)
+                {
+                    ti--;
+                }
+                while ((ti + 1)*(ti + 2)/2 <= p)
+                {
+                    ti++;
+                }
+                int tj = p - ti*(ti + 1)/2;
+                int i0 = ti*c_debyeTileSize;
+                int j0 = tj*c_debyeTileSize;
+                add_histogram_tile(xs, xs + stride, xs + 2*stride, sl,
+                                   i0, std::min(i0 + c_debyeTileSize, isize),
+                                   j0, std::min(j0 + c_debyeTileSize, isize),
+                                   invbinwidth, pr->grn - 1, gr, bin);
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+        }
+    }
+    /* collecting data for pr->gr */
+    for (int i = 0; i < pr->grn; i++)
+    {
+        for (int t = 0; t < nthreads; t++)
+        {
+            pr->gr[i] += tgr[t][i];
+        }
+    }
+    for (int t = 0; t < nthreads; t++)
+    {
+        sfree(tgr[t]);
+    }
+    sfree(tgr);
+    sfree(sl);
+    sfree_aligned(xs);
+}
+
 gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram (
         gmx_sans_t  *gsans,
         rvec        *x,
@@ -302,54 +457,7 @@ gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram (
     }
     else
     {
-#if GMX_OPENMP
-        nthreads = gmx_omp_get_max_threads();
-        /* Allocating memory for tgr arrays */
-        snew(tgr, nthreads);
-        for (i = 0; i < nthreads; i++)
-        {
-            snew(tgr[i], pr->grn);
-        }
-        #pragma omp parallel shared(tgr) private(tid,i,j)
-        {
-            tid = gmx_omp_get_thread_num();
-            /* starting parallel threads */
-            #pragma omp for
-            for (i = 0; i < isize; i++)
-            {
-                try
-                {
-                    for (j = 0; j < i; j++)
-                    {
-                        tgr[tid][static_cast<int>(std::floor(std::sqrt(distance2(x[index[i]], x[index[j]]))/binwidth))] += gsans->slength[index[i]]*gsans->slength[index[j]];
-                    }
-                }
-                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
-            }
-        }
-        /* collecating data for pr->gr */
-        for (i = 0; i < pr->grn; i++)
-        {
-            for (j = 0; j < nthreads; j++)
-            {
-                pr->gr[i] += tgr[j][i];
-            }
-        }
-        /* freeing memory for tgr */
-        for (i = 0; i < nthreads; i++)
-        {
-            sfree(tgr[i]);
-        }
-        sfree(tgr);
-#else
-        for (i = 0; i < isize; i++)
-        {
-            for (j = 0; j < i; j++)
-            {
-                pr->gr[static_cast<int>(std::floor(std::sqrt(distance2(x[index[i]], x[index[j]]))/binwidth))] += gsans->slength[index[i]]*gsans->slength[index[j]];
-            }
-        }
-#endif
+        calc_direct_histogram(gsans, x, index, isize, pr);
     }
 
     /* normalize if needed */
@@ -370,7 +478,7 @@ gmx_radial_distribution_histogram_t *calc_radial_distribution_histogram (
 gmx_static_structurefactor_t *convert_histogram_to_intensity_curve (gmx_radial_distribution_histogram_t *pr, double start_q, double end_q, double q_step)
 {
     gmx_static_structurefactor_t    *sq = nullptr;
-    int         i, j;
+    int         i, nblock;
     /* init data */
     snew(sq, 1);
     sq->qn = static_cast<int>(std::floor((end_q-start_q)/q_step));
@@ -381,27 +489,41 @@ gmx_static_structurefactor_t *convert_histogram_to_intensity_curve (gmx_radial_d
         sq->q[i] = start_q+i*q_step;
     }
 
-    if (start_q == 0.0)
+    /* The sines are computed with the angle addition recurrence over q,
+     * which is reseeded at the start of each block of q values */
+    nblock = (sq->qn + c_debyeQBlockSize - 1)/c_debyeQBlockSize;
+#pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < nblock; b++)
     {
-        sq->s[0] = 1.0;
-        for (i = 1; i < sq->qn; i++)
+        int i0 = b*c_debyeQBlockSize;
+        int i1 = std::min(i0 + c_debyeQBlockSize, sq->qn);
+        for (int j = 0; j < pr->grn; j++)
         {
-            for (j = 0; j < pr->grn; j++)
+            double w     = pr->gr[j]/pr->r[j];
+            double sinqr = std::sin(sq->q[i0]*pr->r[j]);
+            double cosqr = std::cos(sq->q[i0]*pr->r[j]);
+            double sind  = std::sin(q_step*pr->r[j]);
+            double cosd  = std::cos(q_step*pr->r[j]);
+            for (int i = i0; i < i1; i++)
             {
-                sq->s[i] += (pr->gr[j]/pr->r[j])*std::sin(sq->q[i]*pr->r[j]);
+                double tmp;
+
+                sq->s[i] += w*sinqr;
+                tmp       = sinqr*cosd + cosqr*sind;
+                cosqr     = cosqr*cosd - sinqr*sind;
+                sinqr     = tmp;
             }
-            sq->s[i] /= sq->q[i];
         }
-    }
-    else
-    {
-        for (i = 0; i < sq->qn; i++)
+        for (int i = i0; i < i1; i++)
         {
-            for (j = 0; j < pr->grn; j++)
+            if (start_q == 0.0 && i == 0)
+            {
+                sq->s[0] = 1.0;
+            }
+            else
             {
-                sq->s[i] += (pr->gr[j]/pr->r[j])*std::sin(sq->q[i]*pr->r[j]);
+                sq->s[i] /= sq->q[i];
             }
-            sq->s[i] /= sq->q[i];
         }
     }
 
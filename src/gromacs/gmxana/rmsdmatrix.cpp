@@ -0,0 +1,544 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+#include "gmxpre.h"
+
+#include "rmsdmatrix.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "gromacs/math/functions.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
+#include "gromacs/utility/smalloc.h"
+
+#if GMX_SIMD_HAVE_REAL
+/* The coordinate arrays are padded to the SIMD width */
+static const int c_rmsdPadding = GMX_SIMD_REAL_WIDTH;
+#else
+/* No padding needed without SIMD */
+static const int c_rmsdPadding = 1;
+#endif
+
+/* The number of frames per tile in gmx_rmsd_matrix */
+static const int c_rmsdTileSize = 32;
+
+/* The number of pivot frames for pruning in gmx_rmsd_neighbors */
+static const int c_rmsdNumPivots = 8;
+
+/* Relative margin on the cutoff for pruning, guards against rounding */
+static const real c_rmsdPruneMargin = 1.001;
+
+gmx_rmsd_frames_t *gmx_rmsd_frames_init(int nframes, int natoms, rvec *const x[],
+                                        const real w[], gmx_bool bFit)
+{
+    gmx_rmsd_frames_t *fr;
+    real              *sqrtw;
+    int               *ind;
+    int                n, f, i, d;
+
+    snew(fr, 1);
+    snew(sqrtw, natoms);
+    snew(ind, natoms);
+    n        = 0;
+    fr->wtot = 0;
+    for (i = 0; i < natoms; i++)
+    {
+        real wi = (w ? w[i] : 1);
+        if (wi != 0)
+        {
+            ind[n]      = i;
+            sqrtw[n]    = std::sqrt(wi);
+            fr->wtot   += wi;
+            n++;
+        }
+    }
+    fr->nframes = nframes;
+    fr->natoms  = n;
+    fr->stride  = ((n + c_rmsdPadding - 1)/c_rmsdPadding)*c_rmsdPadding;
+    fr->bFit    = bFit;
+    snew_aligned(fr->x, static_cast<size_t>(nframes)*DIM*fr->stride, 64);
+    snew(fr->norm2, nframes);
+
+    for (f = 0; f < nframes; f++)
+    {
+        real  *xf = fr->x + static_cast<size_t>(f)*DIM*fr->stride;
+        dvec   xc;
+        double norm2;
+
+        clear_dvec(xc);
+        if (bFit)
+        {
+            for (i = 0; i < n; i++)
+            {
+                for (d = 0; d < DIM; d++)
+                {
+                    xc[d] += sqrtw[i]*sqrtw[i]*x[f][ind[i]][d];
+                }
+            }
+            dsvmul(1/fr->wtot, xc, xc);
+        }
+        norm2 = 0;
+        for (d = 0; d < DIM; d++)
+        {
+            for (i = 0; i < n; i++)
+            {
+                xf[d*fr->stride + i] = sqrtw[i]*(x[f][ind[i]][d] - xc[d]);
+                norm2               += gmx::square(xf[d*fr->stride + i]);
+            }
+            for (i = n; i < fr->stride; i++)
+            {
+                xf[d*fr->stride + i] = 0;
+            }
+        }
+        fr->norm2[f] = norm2;
+    }
+    sfree(ind);
+    sfree(sqrtw);
+
+    return fr;
+}
+
+void gmx_rmsd_frames_done(gmx_rmsd_frames_t *fr)
+{
+    sfree_aligned(fr->x);
+    sfree(fr->norm2);
+    sfree(fr);
+}
+
+/* Returns the largest eigenvalue of the QCP key matrix for inner product
+ * matrix s, with e0 = (|A|^2 + |B|^2)/2 as starting point for the Newton
+ * iteration on the characteristic polynomial.
+ * See D.L. Theobald, Acta Cryst. A61, 478 (2005) and
+ * P. Liu, D.K. Agrafiotis and D.L. Theobald, J. Comput. Chem. 31, 1561 (2010).
+ */
+static double qcp_max_eigenvalue(const double s[DIM][DIM], double e0)
+{
+    double Sxx = s[XX][XX], Sxy = s[XX][YY], Sxz = s[XX][ZZ];
+    double Syx = s[YY][XX], Syy = s[YY][YY], Syz = s[YY][ZZ];
+    double Szx = s[ZZ][XX], Szy = s[ZZ][YY], Szz = s[ZZ][ZZ];
+    double Sxx2, Syy2, Szz2, Sxy2, Syz2, Sxz2, Syx2, Szy2, Szx2;
+    double SyzSzymSyySzz2, Sxx2Syy2Szz2Syz2Szy2, Sxy2Sxz2Syx2Szx2;
+    double SxzpSzx, SyzpSzy, SxypSyx, SyzmSzy, SxzmSzx, SxymSyx, SxxpSyy, SxxmSyy;
+    double c0, c1, c2, lambda;
+    int    iter;
+
+    Sxx2 = Sxx*Sxx;
+    Syy2 = Syy*Syy;
+    Szz2 = Szz*Szz;
+    Sxy2 = Sxy*Sxy;
+    Syz2 = Syz*Syz;
+    Sxz2 = Sxz*Sxz;
+    Syx2 = Syx*Syx;
+    Szy2 = Szy*Szy;
+    Szx2 = Szx*Szx;
+
+    SyzSzymSyySzz2       = 2.0*(Syz*Szy - Syy*Szz);
+    Sxx2Syy2Szz2Syz2Szy2 = Syy2 + Szz2 - Sxx2 + Syz2 + Szy2;
+
+    c2 = -2.0*(Sxx2 + Syy2 + Szz2 + Sxy2 + Syx2 + Sxz2 + Szx2 + Syz2 + Szy2);
+    c1 = 8.0*(Sxx*Syz*Szy + Syy*Szx*Sxz + Szz*Sxy*Syx -
+              Sxx*Syy*Szz - Syz*Szx*Sxy - Szy*Syx*Sxz);
+
+    SxzpSzx = Sxz + Szx;
+    SyzpSzy = Syz + Szy;
+    SxypSyx = Sxy + Syx;
+    SyzmSzy = Syz - Szy;
+    SxzmSzx = Sxz - Szx;
+    SxymSyx = Sxy - Syx;
+    SxxpSyy = Sxx + Syy;
+    SxxmSyy = Sxx - Syy;
+
+    Sxy2Sxz2Syx2Szx2 = Sxy2 + Sxz2 - Syx2 - Szx2;
+
+    c0 = Sxy2Sxz2Syx2Szx2*Sxy2Sxz2Syx2Szx2
+        + (Sxx2Syy2Szz2Syz2Szy2 + SyzSzymSyySzz2)*(Sxx2Syy2Szz2Syz2Szy2 - SyzSzymSyySzz2)
+        + (-SxzpSzx*SyzmSzy + SxymSyx*(SxxmSyy - Szz))*(-SxzmSzx*SyzpSzy + SxymSyx*(SxxmSyy + Szz))
+        + (-SxzpSzx*SyzpSzy - SxypSyx*(SxxpSyy - Szz))*(-SxzmSzx*SyzmSzy - SxypSyx*(SxxpSyy + Szz))
+        + (SxypSyx*SyzpSzy + SxzpSzx*(SxxmSyy + Szz))*(-SxymSyx*SyzmSzy + SxzpSzx*(SxxpSyy + Szz))
+        + (SxypSyx*SyzmSzy + SxzmSzx*(SxxmSyy - Szz))*(-SxymSyx*SyzpSzy + SxzmSzx*(SxxpSyy - Szz));
+
+    /* Newton-Raphson from the upper bound e0 converges to the largest root */
+    lambda = e0;
+    for (iter = 0; iter < 50; iter++)
+    {
+        double prev = lambda;
+        double x2   = lambda*lambda;
+        double b    = (x2 + c2)*lambda;
+        double a    = b + c1;
+        double den  = 2.0*x2*lambda + b + a;
+
+        if (den == 0)
+        {
+            break;
+        }
+        lambda -= (a*lambda + c0)/den;
+        if (std::abs(lambda - prev) <= 1e-11*std::abs(lambda))
+        {
+            break;
+        }
+    }
+
+    return lambda;
+}
+
+/* Computes the inner product matrix s of two stored frames */
+static void rmsd_inner_product(int stride, const real *xa, const real *xb,
+                               double s[DIM][DIM])
+{
+#if GMX_SIMD_HAVE_REAL
+    gmx::SimdReal sxx = gmx::setZero(), sxy = gmx::setZero(), sxz = gmx::setZero();
+    gmx::SimdReal syx = gmx::setZero(), syy = gmx::setZero(), syz = gmx::setZero();
+    gmx::SimdReal szx = gmx::setZero(), szy = gmx::setZero(), szz = gmx::setZero();
+
+    for (int i = 0; i < stride; i += GMX_SIMD_REAL_WIDTH)
+    {
+        gmx::SimdReal ax = gmx::load<gmx::SimdReal>(xa + i);
+        gmx::SimdReal ay = gmx::load<gmx::SimdReal>(xa + stride + i);
+        gmx::SimdReal az = gmx::load<gmx::SimdReal>(xa + 2*stride + i);
+        gmx::SimdReal bx = gmx::load<gmx::SimdReal>(xb + i);
+        gmx::SimdReal by = gmx::load<gmx::SimdReal>(xb + stride + i);
+        gmx::SimdReal bz = gmx::load<gmx::SimdReal>(xb + 2*stride + i);
+
+        sxx = gmx::fma(ax, bx, sxx);
+        sxy = gmx::fma(ax, by, sxy);
+        sxz = gmx::fma(ax, bz, sxz);
+        syx = gmx::fma(ay, bx, syx);
+        syy = gmx::fma(ay, by, syy);
+        syz = gmx::fma(ay, bz, syz);
+        szx = gmx::fma(az, bx, szx);
+        szy = gmx::fma(az, by, szy);
+        szz = gmx::fma(az, bz, szz);
+    }
+    s[XX][XX] = gmx::reduce(sxx);
+    s[XX][YY] = gmx::reduce(sxy);
+    s[XX][ZZ] = gmx::reduce(sxz);
+    s[YY][XX] = gmx::reduce(syx);
+    s[YY][YY] = gmx::reduce(syy);
+    s[YY][ZZ] = gmx::reduce(syz);
+    s[ZZ][XX] = gmx::reduce(szx);
+    s[ZZ][YY] = gmx::reduce(szy);
+    s[ZZ][ZZ] = gmx::reduce(szz);
+#else
+    for (int d = 0; d < DIM; d++)
+    {
+        for (int e = 0; e < DIM; e++)
+        {
+            s[d][e] = 0;
+        }
+    }
+    for (int i = 0; i < stride; i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            for (int e = 0; e < DIM; e++)
+            {
+                s[d][e] += xa[d*stride + i]*xb[e*stride + i];
+            }
+        }
+    }
+#endif
+}
+
+real gmx_rmsd_pair(const gmx_rmsd_frames_t *fr1, int i,
+                   const gmx_rmsd_frames_t *fr2, int j)
+{
+    const real *xa = fr1->x + static_cast<size_t>(i)*DIM*fr1->stride;
+    const real *xb = fr2->x + static_cast<size_t>(j)*DIM*fr2->stride;
+    double      s[DIM][DIM], e0, lambda, msd;
+
+    GMX_ASSERT(fr1->stride == fr2->stride && fr1->bFit == fr2->bFit,
+               "Can only compare frames of the same atoms");
+
+    rmsd_inner_product(fr1->stride, xa, xb, s);
+    e0 = 0.5*(fr1->norm2[i] + fr2->norm2[j]);
+    if (fr1->bFit)
+    {
+        lambda = qcp_max_eigenvalue(s, e0);
+    }
+    else
+    {
+        lambda = s[XX][XX] + s[YY][YY] + s[ZZ][ZZ];
+    }
+    msd = 2*(e0 - lambda)/fr1->wtot;
+
+    return std::sqrt(std::max(msd, 0.0));
+}
+
+void gmx_rmsd_matrix(const gmx_rmsd_frames_t *fr1, const gmx_rmsd_frames_t *fr2,
+                     real **mat)
+{
+    gmx_bool bSame = (fr2 == nullptr || fr2 == fr1);
+    int      nt1, nt2, ntile;
+
+    if (bSame)
+    {
+        fr2 = fr1;
+    }
+    nt1 = (fr1->nframes + c_rmsdTileSize - 1)/c_rmsdTileSize;
+    nt2 = (fr2->nframes + c_rmsdTileSize - 1)/c_rmsdTileSize;
+    /* With the same frames only the tiles on and above the diagonal */
+    ntile = (bSame ? nt1*(nt1 + 1)/2 : nt1*nt2);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < ntile; tile++)
+    {
+        try
+        {
+            int t1, t2;
+
+            if (bSame)
+            {
+                /* Unpack the upper triangle tile index */
+                t1 = 0;
+                t2 = tile;
+                while (t2 >= nt1 - t1)
+                {
+                    t2 -= nt1 - t1;
+                    t1++;
+                }
+                t2 += t1;
+            }
+            else
+            {
+                t1 = tile/nt2;
+                t2 = tile % nt2;
+            }
+            int i0 = t1*c_rmsdTileSize;
+            int i1 = std::min(i0 + c_rmsdTileSize, fr1->nframes);
+            int j0 = t2*c_rmsdTileSize;
+            int j1 = std::min(j0 + c_rmsdTileSize, fr2->nframes);
+            for (int i = i0; i < i1; i++)
+            {
+                for (int j = (bSame ? std::max(j0, i) : j0); j < j1; j++)
+                {
+                    if (bSame && j == i)
+                    {
+                        mat[i][i] = 0;
+                    }
+                    else
+                    {
+                        mat[i][j] = gmx_rmsd_pair(fr1, i, fr2, j);
+                        if (bSame)
+                        {
+                            mat[j][i] = mat[i][j];
+                        }
+                    }
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
+/* Returns whether two frames or tiles with pivot distance ranges
+ * [min1,max1] and [min2,max2] can be within the cutoff of each other.
+ */
+static inline bool pivot_in_range(int npivot,
+                                  const real *min1, const real *max1,
+                                  const real *min2, const real *max2,
+                                  real cutoff)
+{
+    for (int p = 0; p < npivot; p++)
+    {
+        if (min2[p] - max1[p] > cutoff || min1[p] - max2[p] > cutoff)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+gmx_rmsd_nblist_t *gmx_rmsd_neighbors(const gmx_rmsd_frames_t *fr, real cutoff)
+{
+    gmx_rmsd_nblist_t *nbl;
+    int                n      = fr->nframes;
+    int                npivot = std::min(c_rmsdNumPivots, n);
+    int                ntile  = (n + c_rmsdTileSize - 1)/c_rmsdTileSize;
+    real              *dpivot, *tmin, *tmax, *dmin;
+    real               cut_prune;
+    gmx_int64_t       *count;
+
+    /* Pick the pivots one by one as the frame furthest from the previous
+     * ones, store the frame to pivot distances frame-major.
+     */
+    snew(dpivot, static_cast<size_t>(n)*npivot);
+    snew(dmin, n);
+    int pivot = 0;
+    for (int p = 0; p < npivot; p++)
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+        {
+            dpivot[static_cast<size_t>(i)*npivot + p] = gmx_rmsd_pair(fr, pivot, fr, i);
+        }
+        /* Keep the largest distance separately, since dmin[pivot]
+         * of the current pivot changes during the loop.
+         */
+        real dmax = -1;
+        for (int i = 0; i < n; i++)
+        {
+            real d = dpivot[static_cast<size_t>(i)*npivot + p];
+            dmin[i] = (p == 0 ? d : std::min(dmin[i], d));
+            if (dmin[i] > dmax)
+            {
+                dmax  = dmin[i];
+                pivot = i;
+            }
+        }
+    }
+    sfree(dmin);
+
+    /* The pivot distance ranges of each tile */
+    snew(tmin, static_cast<size_t>(ntile)*npivot);
+    snew(tmax, static_cast<size_t>(ntile)*npivot);
+    for (int t = 0; t < ntile; t++)
+    {
+        for (int p = 0; p < npivot; p++)
+        {
+            tmin[t*npivot + p] = GMX_REAL_MAX;
+            tmax[t*npivot + p] = 0;
+        }
+        for (int i = t*c_rmsdTileSize; i < std::min((t + 1)*c_rmsdTileSize, n); i++)
+        {
+            for (int p = 0; p < npivot; p++)
+            {
+                tmin[t*npivot + p] = std::min(tmin[t*npivot + p], dpivot[static_cast<size_t>(i)*npivot + p]);
+                tmax[t*npivot + p] = std::max(tmax[t*npivot + p], dpivot[static_cast<size_t>(i)*npivot + p]);
+            }
+        }
+    }
+
+    /* Collect the pairs i < j within the cutoff per thread */
+    cut_prune = c_rmsdPruneMargin*cutoff;
+    std::vector<std::vector<std::pair<int, int> > > threadPairs(gmx_omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic)
+    for (int t1 = 0; t1 < ntile; t1++)
+    {
+        try
+        {
+            std::vector<std::pair<int, int> > &pairs = threadPairs[gmx_omp_get_thread_num()];
+            int i0 = t1*c_rmsdTileSize;
+            int i1 = std::min(i0 + c_rmsdTileSize, n);
+            for (int t2 = t1; t2 < ntile; t2++)
+            {
+                if (!pivot_in_range(npivot, tmin + t1*npivot, tmax + t1*npivot,
+                                    tmin + t2*npivot, tmax + t2*npivot, cut_prune))
+                {
+                    continue;
+                }
+                int j0 = t2*c_rmsdTileSize;
+                int j1 = std::min(j0 + c_rmsdTileSize, n);
+                for (int i = i0; i < i1; i++)
+                {
+                    const real *di = dpivot + static_cast<size_t>(i)*npivot;
+                    for (int j = std::max(j0, i + 1); j < j1; j++)
+                    {
+                        const real *dj = dpivot + static_cast<size_t>(j)*npivot;
+                        if (pivot_in_range(npivot, di, di, dj, dj, cut_prune) &&
+                            gmx_rmsd_pair(fr, i, fr, j) < cutoff)
+                        {
+                            pairs.push_back(std::make_pair(i, j));
+                        }
+                    }
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+    sfree(tmin);
+    sfree(tmax);
+    sfree(dpivot);
+
+    /* Convert the pairs to sorted lists for each frame */
+    snew(nbl, 1);
+    nbl->n = n;
+    snew(nbl->index, n + 1);
+    snew(count, n);
+    for (int i = 0; i < n; i++)
+    {
+        count[i] = 1;
+    }
+    for (const auto &pairs : threadPairs)
+    {
+        for (const auto &pair : pairs)
+        {
+            count[pair.first]++;
+            count[pair.second]++;
+        }
+    }
+    nbl->index[0] = 0;
+    for (int i = 0; i < n; i++)
+    {
+        nbl->index[i + 1] = nbl->index[i] + count[i];
+        count[i]          = nbl->index[i];
+    }
+    snew(nbl->nb, nbl->index[n]);
+    for (int i = 0; i < n; i++)
+    {
+        nbl->nb[count[i]++] = i;
+    }
+    for (auto &pairs : threadPairs)
+    {
+        for (const auto &pair : pairs)
+        {
+            nbl->nb[count[pair.first]++]  = pair.second;
+            nbl->nb[count[pair.second]++] = pair.first;
+        }
+        std::vector<std::pair<int, int> >().swap(pairs);
+    }
+    sfree(count);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        std::sort(nbl->nb + nbl->index[i], nbl->nb + nbl->index[i + 1]);
+    }
+
+    return nbl;
+}
+
+void gmx_rmsd_nblist_done(gmx_rmsd_nblist_t *nbl)
+{
+    sfree(nbl->index);
+    sfree(nbl->nb);
+    sfree(nbl);
+}
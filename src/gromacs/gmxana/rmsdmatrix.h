@@ -0,0 +1,105 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+
+
+#ifndef GMX_GMXANA_RMSDMATRIX_H
+#define GMX_GMXANA_RMSDMATRIX_H
+
+#include "gromacs/math/vectypes.h"
+#include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/real.h"
+
+/* A set of frames stored for fast pairwise RMSD computation.
+ * Atoms with zero weight are left out. With fitting, each frame is
+ * centered on its weighted center. The coordinates are multiplied
+ * by the square root of the weights and stored per frame as separate
+ * x, y and z arrays, padded with zeros to the SIMD width.
+ */
+typedef struct gmx_rmsd_frames_t {
+    int       nframes;
+    int       natoms;  /* the number of atoms with non-zero weight */
+    int       stride;  /* natoms padded to the SIMD width */
+    gmx_bool  bFit;    /* superimpose the frames before computing the RMSD */
+    real     *x;       /* the coordinates, DIM*stride per frame, aligned */
+    double   *norm2;   /* the weighted sum of squared coordinates of each frame */
+    double    wtot;    /* the sum of the weights */
+} gmx_rmsd_frames_t;
+
+gmx_rmsd_frames_t *gmx_rmsd_frames_init(int nframes, int natoms, rvec *const x[],
+                                        const real w[], gmx_bool bFit);
+/* Stores the natoms coordinates of nframes frames x[0..nframes-1] with
+ * weights w (w=nullptr gives weights 1). With bFit the RMSD is computed
+ * after optimal superposition, otherwise from the coordinates as given.
+ */
+
+void gmx_rmsd_frames_done(gmx_rmsd_frames_t *fr);
+
+real gmx_rmsd_pair(const gmx_rmsd_frames_t *fr1, int i,
+                   const gmx_rmsd_frames_t *fr2, int j);
+/* Returns the weighted RMSD between frame i of fr1 and frame j of fr2.
+ * With fitting the minimal RMSD over all rotations is obtained from
+ * the quaternion characteristic polynomial (QCP) of the inner product
+ * matrix, without constructing the rotation.
+ */
+
+void gmx_rmsd_matrix(const gmx_rmsd_frames_t *fr1, const gmx_rmsd_frames_t *fr2,
+                     real **mat);
+/* Computes mat[i][j] = gmx_rmsd_pair(fr1, i, fr2, j) for all frame pairs.
+ * When fr2 is nullptr or fr1, only the upper triangle is computed and
+ * mirrored, with zeros on the diagonal. The pairs are processed in
+ * cache-sized tiles of frames, distributed over the OpenMP threads.
+ */
+
+/* Lists of frames within an RMSD cutoff of each other, in compressed
+ * row format. The neighbors of frame i, including i itself, are
+ * nb[index[i]] to nb[index[i+1]-1], in increasing order.
+ */
+typedef struct gmx_rmsd_nblist_t {
+    int          n;      /* the number of frames */
+    gmx_int64_t *index;  /* the start of each list, n+1 entries */
+    int         *nb;     /* the neighbor frames */
+} gmx_rmsd_nblist_t;
+
+gmx_rmsd_nblist_t *gmx_rmsd_neighbors(const gmx_rmsd_frames_t *fr, real cutoff);
+/* Returns, for all frames in fr, the frames with an RMSD below cutoff.
+ * Memory scales with the number of neighbor pairs instead of the square
+ * of the number of frames. Distances to a few pivot frames are used with
+ * the triangle inequality to skip most pairs and tiles of pairs that
+ * cannot be within the cutoff.
+ */
+
+void gmx_rmsd_nblist_done(gmx_rmsd_nblist_t *nbl);
+
+#endif
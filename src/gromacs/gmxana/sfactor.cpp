@@ -42,6 +42,7 @@
 #include <cstring>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/fileio/confio.h"
 #include "gromacs/fileio/trxio.h"
@@ -55,6 +56,7 @@
 #include "gromacs/trajectory/trajectoryframe.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/smalloc.h"
@@ -168,8 +170,9 @@ extern void compute_structure_factor (structure_factor_t * sft, matrix box,
 
     t_complex      ***tmpSF;
     rvec              k_factor;
-    real              kdotx, asf, kx, ky, kz, krr;
+    real              kx, ky, kz, krr;
     int               kr, maxkx, maxky, maxkz, i, j, k, p, *counter;
+    double           *step_re, *step_im, *x_re, *x_im;
 
 
     k_factor[XX] = 2 * M_PI / box[XX][XX];
@@ -183,16 +186,9 @@ extern void compute_structure_factor (structure_factor_t * sft, matrix box,
     snew (counter, sf->n_angles);
 
     tmpSF = rc_tensor_allocation(maxkx, maxky, maxkz);
-/*
- * The big loop...
- * compute real and imaginary part of the structure factor for every
- * (kx,ky,kz))
- */
-    fprintf(stderr, "\n");
+    /* The number of k-vectors in each shell, used for the average */
     for (i = 0; i < maxkx; i++)
     {
-        fprintf (stderr, "\rdone %3.1f%%     ", (100.0*(i+1))/maxkx);
-        fflush(stderr);
         kx = i * k_factor[XX];
         for (j = 0; j < maxky; j++)
         {
@@ -208,24 +204,141 @@ extern void compute_structure_factor (structure_factor_t * sft, matrix box,
                         kr = static_cast<int>(krr/sf->ref_k + 0.5);
                         if (kr < sf->n_angles)
                         {
-                            counter[kr]++; /* will be used for the copmutation
-                                              of the average*/
-                            for (p = 0; p < isize; p++)
+                            counter[kr]++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* The phase factors exp(i k.x) of one k_factor step along each
+     * dimension, the phases on the k grid are then obtained by complex
+     * multiplication instead of evaluating cos and sin for every k
+     */
+    snew(step_re, DIM*isize);
+    snew(step_im, DIM*isize);
+    snew(x_re, isize);
+    snew(x_im, isize);
+    for (p = 0; p < isize; p++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            step_re[d*isize + p] = std::cos(k_factor[d]*redt[p].x[d]);
+            step_im[d*isize + p] = std::sin(k_factor[d]*redt[p].x[d]);
+        }
+        x_re[p] = 1;
+        x_im[p] = 0;
+    }
+/*
+ * The big loop...
+ * compute real and imaginary part of the structure factor for every
+ * (kx,ky,kz))
+ */
+    fprintf(stderr, "\n");
+    for (i = 0; i < maxkx; i++)
+    {
+        fprintf (stderr, "\rdone %3.1f%%     ", (100.0*(i+1))/maxkx);
+        fflush(stderr);
+#pragma omp parallel
+        {
+            std::vector<int>    shell(maxkz);
+            std::vector<double> re(maxkz), im(maxkz);
+            std::vector<double> y_re(isize), y_im(isize);
+            int                 jprev = -2;
+
+            /* Static scheduling gives each thread a contiguous range of ky,
+             * so the phases along y only need to be computed at its start
+             */
+#pragma omp for schedule(static)
+            for (int jy = 0; jy < maxky; jy++)
+            {
+                try
+                {
+                    real kxi  = i * k_factor[XX];
+                    real kyj  = jy * k_factor[YY];
+                    bool bAny = false;
+
+                    if (jy != jprev + 1)
+                    {
+                        for (int pp = 0; pp < isize; pp++)
+                        {
+                            y_re[pp] = std::cos(jy*static_cast<double>(k_factor[YY])*redt[pp].x[YY]);
+                            y_im[pp] = std::sin(jy*static_cast<double>(k_factor[YY])*redt[pp].x[YY]);
+                        }
+                    }
+                    jprev = jy;
+
+                    /* The shell of each kz, -1 when outside the q range */
+                    for (int kk = 0; kk < maxkz; kk++)
+                    {
+                        real kzk = kk * k_factor[ZZ];
+                        real kn  = std::sqrt(gmx::square(kxi) + gmx::square(kyj) + gmx::square(kzk));
+
+                        shell[kk] = -1;
+                        if ((i != 0 || jy != 0 || kk != 0) &&
+                            kn >= start_q && kn <= end_q)
+                        {
+                            int s = static_cast<int>(kn/sf->ref_k + 0.5);
+                            if (s < sf->n_angles)
                             {
-                                asf = sf_table[redt[p].t][kr];
+                                shell[kk] = s;
+                                bAny      = true;
+                            }
+                        }
+                        re[kk] = 0;
+                        im[kk] = 0;
+                    }
+                    for (int pp = 0; bAny && pp < isize; pp++)
+                    {
+                        const real   *asf_t = sf_table[redt[pp].t];
+                        const double  zr    = step_re[ZZ*isize + pp];
+                        const double  zi    = step_im[ZZ*isize + pp];
+                        double        c     = x_re[pp]*y_re[pp] - x_im[pp]*y_im[pp];
+                        double        sn    = x_re[pp]*y_im[pp] + x_im[pp]*y_re[pp];
 
-                                kdotx = kx * redt[p].x[XX] +
-                                    ky * redt[p].x[YY] + kz * redt[p].x[ZZ];
+                        for (int kk = 0; kk < maxkz; kk++)
+                        {
+                            double tmp;
 
-                                tmpSF[i][j][k].re += std::cos(kdotx) * asf;
-                                tmpSF[i][j][k].im += std::sin(kdotx) * asf;
+                            if (shell[kk] >= 0)
+                            {
+                                re[kk] += c * asf_t[shell[kk]];
+                                im[kk] += sn * asf_t[shell[kk]];
                             }
+                            tmp = c*zr - sn*zi;
+                            sn  = sn*zr + c*zi;
+                            c   = tmp;
                         }
                     }
+                    for (int kk = 0; kk < maxkz; kk++)
+                    {
+                        tmpSF[i][jy][kk].re = re[kk];
+                        tmpSF[i][jy][kk].im = im[kk];
+                    }
+                    /* Advance the phases along y to the next ky */
+                    for (int pp = 0; pp < isize; pp++)
+                    {
+                        double tmp = y_re[pp]*step_re[YY*isize + pp] - y_im[pp]*step_im[YY*isize + pp];
+                        y_im[pp]   = y_im[pp]*step_re[YY*isize + pp] + y_re[pp]*step_im[YY*isize + pp];
+                        y_re[pp]   = tmp;
+                    }
                 }
+                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
             }
         }
+        /* Advance the phases along x to the next kx */
+        for (p = 0; p < isize; p++)
+        {
+            double tmp = x_re[p]*step_re[XX*isize + p] - x_im[p]*step_im[XX*isize + p];
+            x_im[p]    = x_im[p]*step_re[XX*isize + p] + x_re[p]*step_im[XX*isize + p];
+            x_re[p]    = tmp;
+        }
     }               /* end loop on i */
+    sfree(step_re);
+    sfree(step_im);
+    sfree(x_re);
+    sfree(x_im);
 /*
  *  compute the square modulus of the structure factor, averaging on the surface
  *  kx*kx + ky*ky + kz*kz = krr*krr
@@ -0,0 +1,223 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the MBAR free energy estimator
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxana/mbar.h"
+
+#include <cmath>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/functions.h"
+#include "gromacs/utility/gmxomp.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+
+namespace
+{
+
+/*! \brief Samples of harmonic states u_k(x) = kappa_k/2 (x - mu_k)^2 in units of kT
+ *
+ * The samples of each state are evenly spaced in the cumulative
+ * distribution, so averages over them have much smaller errors than
+ * with random samples. The exact reduced free energy differences are
+ * f_k - f_0 = ln(kappa_k/kappa_0)/2, independently of the shifts mu_k.
+ */
+class HarmonicStates
+{
+    public:
+        HarmonicStates(const std::vector<double> &kappa,
+                       const std::vector<double> &mu,
+                       const std::vector<int>    &numSamples) :
+            kappa_(kappa), mu_(mu), du_(kappa.size())
+        {
+            int K = kappa_.size();
+            for (int k = 0; k < K; k++)
+            {
+                du_[k].resize(K);
+                for (int i = 0; i < numSamples[k]; i++)
+                {
+                    double p = (i + 0.5)/numSamples[k];
+                    double x = mu_[k] + std::sqrt(2/kappa_[k])*erfinv(2*p - 1);
+                    for (int l = 0; l < K; l++)
+                    {
+                        du_[k][l].push_back(energy(l, x) - energy(k, x));
+                    }
+                }
+            }
+        }
+
+        //! Returns the reduced energy of state \p k at \p x
+        double energy(int k, double x) const
+        {
+            return 0.5*kappa_[k]*square(x - mu_[k]);
+        }
+
+        //! Returns an MBAR calculation with samples [start,end) of all states in \p numRanges ranges
+        gmx_mbar_t *makeMbar(int numRanges) const
+        {
+            int         K    = kappa_.size();
+            gmx_mbar_t *mbar = gmx_mbar_init(K, 1.0);
+            for (int k = 0; k < K; k++)
+            {
+                std::vector<const double *> du;
+                for (int l = 0; l < K; l++)
+                {
+                    du.push_back(l == k ? nullptr : du_[k][l].data());
+                }
+                int n = du_[k][0].size();
+                for (int r = 0; r < numRanges; r++)
+                {
+                    gmx_mbar_add_samples(mbar, k, du.data(), (r*n)/numRanges, ((r + 1)*n)/numRanges);
+                }
+            }
+            return mbar;
+        }
+
+        //! Returns the reduced free energy difference between states 0 and 1 from Bennett's acceptance ratio equation
+        double barFreeEnergy() const
+        {
+            /* Solve for C in
+             *   sum_{i in 0} fermi(M + du01_i - C) = sum_{j in 1} fermi(-M + du10_j + C)
+             * with M = ln(N0/N1) and fermi(x) = 1/(1 + exp(x)), by bisection.
+             */
+            const std::vector<double> &du01 = du_[0][1];
+            const std::vector<double> &du10 = du_[1][0];
+            double                     M    = std::log(double(du01.size())/du10.size());
+            double                     lo   = -20, hi = 20;
+            for (int iter = 0; iter < 200; iter++)
+            {
+                double C    = 0.5*(lo + hi);
+                double sum0 = 0, sum1 = 0;
+                for (double du : du01)
+                {
+                    sum0 += 1/(1 + std::exp(M + du - C));
+                }
+                for (double du : du10)
+                {
+                    sum1 += 1/(1 + std::exp(-M + du + C));
+                }
+                if (sum0 < sum1)
+                {
+                    lo = C;
+                }
+                else
+                {
+                    hi = C;
+                }
+            }
+            return 0.5*(lo + hi);
+        }
+
+    private:
+        std::vector<double>                            kappa_;
+        std::vector<double>                            mu_;
+        //! du_[k][l][i] is u_l - u_k for sample i of state k
+        std::vector < std::vector < std::vector<double> > > du_;
+};
+
+TEST(MbarTest, TwoStatesMatchBar)
+{
+    HarmonicStates states({ 1, 3 }, { 0, 0.8 }, { 3000, 5000 });
+    gmx_mbar_t    *mbar = states.makeMbar(1);
+    double         f[2] = { 0, 0 };
+
+    gmx_mbar_solve(mbar, f, 1e-12);
+    gmx_mbar_done(mbar);
+
+    EXPECT_NEAR(states.barFreeEnergy(), f[1] - f[0], 1e-9);
+}
+
+TEST(MbarTest, ThreeHarmonicStatesMatchAnalyticFreeEnergies)
+{
+    HarmonicStates states({ 1, 2, 4 }, { 0, 0.5, 1 }, { 20000, 20000, 20000 });
+    gmx_mbar_t    *mbar = states.makeMbar(1);
+    double         f[3] = { 0, 0, 0 };
+
+    gmx_mbar_solve(mbar, f, 1e-10);
+    gmx_mbar_done(mbar);
+
+    EXPECT_NEAR(0.5*std::log(2.0), f[1] - f[0], 2e-5);
+    EXPECT_NEAR(0.5*std::log(4.0), f[2] - f[0], 2e-5);
+}
+
+TEST(MbarTest, ResultDoesNotDependOnThreadsOrRanges)
+{
+    /* Enough samples for several work units per state */
+    HarmonicStates states({ 1, 2, 4 }, { 0, 0.5, 1 }, { 20000, 30000, 25000 });
+    double         fRef[3] = { 0, 0, 0 };
+
+    int            numThreads = gmx_omp_get_max_threads();
+    gmx_omp_set_num_threads(1);
+    gmx_mbar_t    *mbar = states.makeMbar(1);
+    gmx_mbar_solve(mbar, fRef, 1e-10);
+
+    /* The same work units with more threads give identical results */
+    gmx_omp_set_num_threads(4);
+    double f[3] = { 0, 0, 0 };
+    gmx_mbar_solve(mbar, f, 1e-10);
+    gmx_mbar_done(mbar);
+    gmx_omp_set_num_threads(numThreads);
+    for (int k = 0; k < 3; k++)
+    {
+        EXPECT_EQ(fRef[k], f[k]);
+    }
+
+    /* Other work units only change the rounding */
+    mbar = states.makeMbar(7);
+    for (int k = 0; k < 3; k++)
+    {
+        f[k] = 0;
+    }
+    gmx_mbar_solve(mbar, f, 1e-10);
+    gmx_mbar_done(mbar);
+    for (int k = 0; k < 3; k++)
+    {
+        EXPECT_NEAR(fRef[k], f[k], 1e-9);
+    }
+}
+
+} // namespace
+
+} // namespace gmx
@@ -0,0 +1,232 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the pairwise RMSD matrix code
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxana/rmsdmatrix.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/do_fit.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/random/threefry.h"
+#include "gromacs/random/uniformrealdistribution.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+
+namespace
+{
+
+class RmsdMatrix : public ::testing::Test
+{
+    protected:
+        static const int  c_numAtoms  = 37;
+        static const int  c_numFrames = 41;
+
+        RmsdMatrix() : rng_(1234), frames_(c_numFrames), weights_(c_numAtoms)
+        {
+            UniformRealDistribution<real> dist;
+            std::vector<RVec>             base(c_numAtoms);
+
+            for (int i = 0; i < c_numAtoms; i++)
+            {
+                base[i]     = { 2*dist(rng_), 2*dist(rng_), 2*dist(rng_) };
+                /* A few atoms do not contribute */
+                weights_[i] = (i % 7 == 3 ? 0 : 1 + 15*dist(rng_));
+            }
+            for (int f = 0; f < c_numFrames; f++)
+            {
+                real   a = 6*dist(rng_), b = 6*dist(rng_), c = 6*dist(rng_);
+                matrix rot;
+                rvec   shift = { dist(rng_), dist(rng_), dist(rng_) };
+
+                /* A random rotation, translation and deformation */
+                rot[XX][XX] = std::cos(a)*std::cos(b);
+                rot[XX][YY] = std::cos(a)*std::sin(b)*std::sin(c) - std::sin(a)*std::cos(c);
+                rot[XX][ZZ] = std::cos(a)*std::sin(b)*std::cos(c) + std::sin(a)*std::sin(c);
+                rot[YY][XX] = std::sin(a)*std::cos(b);
+                rot[YY][YY] = std::sin(a)*std::sin(b)*std::sin(c) + std::cos(a)*std::cos(c);
+                rot[YY][ZZ] = std::sin(a)*std::sin(b)*std::cos(c) - std::cos(a)*std::sin(c);
+                rot[ZZ][XX] = -std::sin(b);
+                rot[ZZ][YY] = std::cos(b)*std::sin(c);
+                rot[ZZ][ZZ] = std::cos(b)*std::cos(c);
+                frames_[f].resize(c_numAtoms);
+                for (int i = 0; i < c_numAtoms; i++)
+                {
+                    rvec xi;
+                    for (int d = 0; d < DIM; d++)
+                    {
+                        xi[d] = base[i][d] + (0.02 + 0.01*f)*(dist(rng_) - 0.5);
+                    }
+                    mvmul(rot, xi, frames_[f][i]);
+                    rvec_inc(frames_[f][i], shift);
+                }
+            }
+        }
+
+        //! Returns the RMSD between frames i and j with do_fit and rmsdev
+        real referenceRmsd(int i, int j, bool bFit)
+        {
+            std::vector<RVec> xi(frames_[i]), xj(frames_[j]);
+
+            if (bFit)
+            {
+                reset_x(c_numAtoms, nullptr, c_numAtoms, nullptr, as_rvec_array(xi.data()), weights_.data());
+                reset_x(c_numAtoms, nullptr, c_numAtoms, nullptr, as_rvec_array(xj.data()), weights_.data());
+                do_fit(c_numAtoms, weights_.data(), as_rvec_array(xi.data()), as_rvec_array(xj.data()));
+            }
+            return rmsdev(c_numAtoms, weights_.data(), as_rvec_array(xi.data()), as_rvec_array(xj.data()));
+        }
+
+        //! Checks the full matrix of the first n1 against the last n2 frames
+        void checkMatrix(bool bFit, int n1, int n2)
+        {
+            std::vector<rvec *> x;
+            for (auto &frame : frames_)
+            {
+                x.push_back(as_rvec_array(frame.data()));
+            }
+            bool               bSame   = (n2 == 0);
+            int                offset2 = c_numFrames - n2;
+            gmx_rmsd_frames_t *fr1     = gmx_rmsd_frames_init(n1, c_numAtoms, x.data(), weights_.data(), bFit);
+            gmx_rmsd_frames_t *fr2     = nullptr;
+            if (!bSame)
+            {
+                fr2 = gmx_rmsd_frames_init(n2, c_numAtoms, x.data() + offset2, weights_.data(), bFit);
+            }
+            else
+            {
+                n2      = n1;
+                offset2 = 0;
+            }
+            std::vector<std::vector<real> > mat(n1, std::vector<real>(n2, -1));
+            std::vector<real *> rows;
+            for (auto &row : mat)
+            {
+                rows.push_back(row.data());
+            }
+            gmx_rmsd_matrix(fr1, fr2, rows.data());
+
+            for (int i = 0; i < n1; i++)
+            {
+                for (int j = 0; j < n2; j++)
+                {
+                    real ref = (bSame && i == j ? 0 : referenceRmsd(i, offset2 + j, bFit));
+                    EXPECT_REAL_EQ_TOL(ref, mat[i][j], test::absoluteTolerance(2e-4))
+                    << "for frames " << i << " and " << j;
+                }
+            }
+            gmx_rmsd_frames_done(fr1);
+            if (fr2)
+            {
+                gmx_rmsd_frames_done(fr2);
+            }
+        }
+
+        //! Checks the neighbor lists against the reference RMSD
+        void checkNeighbors(bool bFit, real cutoff)
+        {
+            std::vector<rvec *> x;
+            for (auto &frame : frames_)
+            {
+                x.push_back(as_rvec_array(frame.data()));
+            }
+            gmx_rmsd_frames_t *fr  = gmx_rmsd_frames_init(c_numFrames, c_numAtoms, x.data(), weights_.data(), bFit);
+            gmx_rmsd_nblist_t *nbl = gmx_rmsd_neighbors(fr, cutoff);
+
+            ASSERT_EQ(static_cast<int>(c_numFrames), nbl->n);
+            for (int i = 0; i < c_numFrames; i++)
+            {
+                std::vector<int> nb(nbl->nb + nbl->index[i], nbl->nb + nbl->index[i+1]);
+                for (int j = 0; j < c_numFrames; j++)
+                {
+                    real ref = (i == j ? 0 : referenceRmsd(i, j, bFit));
+                    bool bNb = std::binary_search(nb.begin(), nb.end(), j);
+                    /* Pairs at the cutoff can go either way due to rounding */
+                    if (std::abs(ref - cutoff) > 2e-4)
+                    {
+                        EXPECT_EQ(ref < cutoff, bNb) << "for frames " << i << " and " << j;
+                    }
+                }
+                EXPECT_TRUE(std::is_sorted(nb.begin(), nb.end()));
+            }
+            gmx_rmsd_nblist_done(nbl);
+            gmx_rmsd_frames_done(fr);
+        }
+
+        DefaultRandomEngine             rng_;
+        std::vector<std::vector<RVec> > frames_;
+        std::vector<real>               weights_;
+};
+
+TEST_F(RmsdMatrix, FittedMatchesDoFit)
+{
+    checkMatrix(true, c_numFrames, 0);
+}
+
+TEST_F(RmsdMatrix, UnfittedMatchesRmsdev)
+{
+    checkMatrix(false, c_numFrames, 0);
+}
+
+TEST_F(RmsdMatrix, TwoSetsMatchDoFit)
+{
+    checkMatrix(true, 35, 13);
+}
+
+TEST_F(RmsdMatrix, FittedNeighborsMatchDoFit)
+{
+    checkNeighbors(true, 0.1);
+}
+
+TEST_F(RmsdMatrix, UnfittedNeighborsMatchRmsdev)
+{
+    checkNeighbors(false, 2.5);
+}
+
+} // namespace
+
+} // namespace gmx
@@ -338,6 +338,63 @@ void gmx_sumd(int gmx_unused nr, double gmx_unused r[], const t_commrec gmx_unus
 #endif
 }
 
+/* Non-blocking collectives were introduced in MPI 3.0 */
+#define GMX_MPI_NONBLOCKING_COLLECTIVES (GMX_LIB_MPI && MPI_IN_PLACE_EXISTS && MPI_VERSION >= 3)
+
+void gmx_sumd_start(int nr, double r[], const t_commrec *cr,
+                    gmx_sumd_request_t *req)
+{
+    req->r        = r;
+    req->nr       = nr;
+    req->bPending = FALSE;
+#if GMX_MPI_NONBLOCKING_COLLECTIVES
+    if (cr->nc.bUse)
+    {
+        /* Reduce within the node first, the node-local communication
+         * is cheap and the intra-node roots all need the full result
+         * before they can start the inter-node sum.
+         */
+        if (cr->nc.rank_intra == 0)
+        {
+            MPI_Reduce(MPI_IN_PLACE, r, nr, MPI_DOUBLE, MPI_SUM, 0,
+                       cr->nc.comm_intra);
+            MPI_Iallreduce(MPI_IN_PLACE, r, nr, MPI_DOUBLE, MPI_SUM,
+                           cr->nc.comm_inter, &req->request);
+            req->bPending = TRUE;
+        }
+        else
+        {
+            MPI_Reduce(r, nullptr, nr, MPI_DOUBLE, MPI_SUM, 0, cr->nc.comm_intra);
+        }
+    }
+    else
+    {
+        MPI_Iallreduce(MPI_IN_PLACE, r, nr, MPI_DOUBLE, MPI_SUM,
+                       cr->mpi_comm_mygroup, &req->request);
+        req->bPending = TRUE;
+    }
+#else
+    gmx_sumd(nr, r, cr);
+#endif
+}
+
+void gmx_sumd_wait(const t_commrec gmx_unused *cr, gmx_sumd_request_t *req)
+{
+#if GMX_MPI_NONBLOCKING_COLLECTIVES
+    if (req->bPending)
+    {
+        MPI_Wait(&req->request, MPI_STATUS_IGNORE);
+        req->bPending = FALSE;
+    }
+    if (cr->nc.bUse)
+    {
+        MPI_Bcast(req->r, req->nr, MPI_DOUBLE, 0, cr->nc.comm_intra);
+    }
+#else
+    GMX_UNUSED_VALUE(req);
+#endif
+}
+
 void gmx_sumf(int gmx_unused nr, float gmx_unused r[], const t_commrec gmx_unused *cr)
 {
 #if !GMX_MPI
@@ -578,6 +635,34 @@ void gmx_sumd_sim(int gmx_unused nr, double gmx_unused r[], const gmx_multisim_t
 #endif
 }
 
+void gmx_sumd_sim_start(int nr, double r[], const gmx_multisim_t *ms,
+                        gmx_sumd_request_t *req)
+{
+    req->r        = r;
+    req->nr       = nr;
+    req->bPending = FALSE;
+#if GMX_MPI_NONBLOCKING_COLLECTIVES
+    MPI_Iallreduce(MPI_IN_PLACE, r, nr, MPI_DOUBLE, MPI_SUM,
+                   ms->mpi_comm_masters, &req->request);
+    req->bPending = TRUE;
+#else
+    gmx_sumd_sim(nr, r, ms);
+#endif
+}
+
+void gmx_sumd_sim_wait(gmx_sumd_request_t *req)
+{
+#if GMX_MPI_NONBLOCKING_COLLECTIVES
+    if (req->bPending)
+    {
+        MPI_Wait(&req->request, MPI_STATUS_IGNORE);
+        req->bPending = FALSE;
+    }
+#else
+    GMX_UNUSED_VALUE(req);
+#endif
+}
+
 void gmx_sumf_sim(int gmx_unused nr, float gmx_unused r[], const gmx_multisim_t gmx_unused *ms)
 {
 #if !GMX_MPI
@@ -91,6 +91,36 @@ void gmx_sumf(int nr, float r[], const struct t_commrec *cr);
 void gmx_sumd(int nr, double r[], const struct t_commrec *cr);
 /* Calculate the global sum of an array of doubles */
 
+/* State of a non-blocking sum started with gmx_sumd_start */
+typedef struct gmx_sumd_request_t {
+    double     *r;        /* The buffer that is being summed */
+    int         nr;       /* The number of elements in r */
+    gmx_bool    bPending; /* TRUE when request needs to be waited for */
+    MPI_Request request;  /* The request of the (inter-node) allreduce */
+} gmx_sumd_request_t;
+
+void gmx_sumd_start(int nr, double r[], const struct t_commrec *cr,
+                    gmx_sumd_request_t *req);
+/* Start summing r over cr->mpi_comm_mygroup, r should not be accessed
+ * until gmx_sumd_wait has returned. With two-step summing the intra-node
+ * reduction is done directly and only the inter-node allreduce is
+ * non-blocking. When non-blocking collectives are not supported,
+ * this performs a blocking gmx_sumd.
+ */
+
+void gmx_sumd_wait(const struct t_commrec *cr, gmx_sumd_request_t *req);
+/* Complete the sum started by gmx_sumd_start */
+
+void gmx_sumd_sim_start(int nr, double r[], const struct gmx_multisim_t *ms,
+                        gmx_sumd_request_t *req);
+/* Start summing r over the simulations, r should not be accessed
+ * until gmx_sumd_sim_wait has returned. When non-blocking collectives
+ * are not supported, this performs a blocking gmx_sumd_sim.
+ */
+
+void gmx_sumd_sim_wait(gmx_sumd_request_t *req);
+/* Complete the sum started by gmx_sumd_sim_start */
+
 void gmx_sumi_sim(int nr, int r[], const struct gmx_multisim_t *ms);
 /* Calculate the sum over the simulations of an array of ints */
 
@@ -41,6 +41,7 @@
 #include <cmath>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/gmxlib/nrnb.h"
 #include "gromacs/gmxlib/nonbonded/nb_kernel.h"
@@ -49,8 +50,921 @@
 #include "gromacs/math/vec.h"
 #include "gromacs/mdtypes/forcerec.h"
 #include "gromacs/mdtypes/md_enums.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
+#include "gromacs/simd/vector_operations.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/fatalerror.h"
 
+#if GMX_SIMD_HAVE_REAL
+
+using namespace gmx; // TODO: Remove when this file is moved into gmx namespace
+
+#define  STATE_A  0
+#define  STATE_B  1
+#define  NSTATES  2
+
+/*! \brief Returns whether the SIMD free-energy kernels support the setup in \p fr
+ *
+ * The SIMD kernels handle the interactions that can occur with
+ * the Verlet cut-off scheme: reaction-field (incl. plain cut-off) or
+ * Ewald electrostatics and LJ or LJ-PME, with soft-core power sc-r-power=6.
+ * The only modifier that changes the functional form is the LJ potential
+ * switch. All other setups are handled by the plain-C kernel.
+ */
+static bool
+nb_free_energy_simd_supported(const t_forcerec *fr)
+{
+    const interaction_const_t *ic = fr->ic;
+
+    return (fr->cutoff_scheme == ecutsVERLET &&
+            fr->sc_r_power == 6.0 &&
+            (ic->eeltype == eelCUT || EEL_RF(ic->eeltype) || EEL_PME_EWALD(ic->eeltype)) &&
+            ic->coulomb_modifier != eintmodPOTSWITCH &&
+            !(EVDW_PME(ic->vdwtype) && ic->vdw_modifier == eintmodPOTSWITCH));
+}
+
+/*! \brief Lambda dependent factors of the A and B states */
+struct FepLambdaFactors
+{
+    real LFC[NSTATES];        /**< Coulomb lambda weight of each state */
+    real LFV[NSTATES];        /**< VdW lambda weight of each state */
+    real lfac_coul[NSTATES];  /**< Coulomb soft-core lambda factor */
+    real dlfac_coul[NSTATES]; /**< Lambda derivative of lfac_coul, divided by sc-r-power */
+    real lfac_vdw[NSTATES];   /**< VdW soft-core lambda factor */
+    real dlfac_vdw[NSTATES];  /**< Lambda derivative of lfac_vdw, divided by sc-r-power */
+};
+
+/*! \brief Derivative of the lambda weights of the A and B states */
+static const real c_fepDLF[NSTATES] = { -1, 1 };
+
+//! Sets the lambda factors, identical to the plain-C kernel
+static void
+setFepLambdaFactors(const t_forcerec *fr, real lambda_coul, real lambda_vdw,
+                    FepLambdaFactors *lf)
+{
+    const int  lam_power  = fr->sc_power;
+    const real sc_r_power = fr->sc_r_power;
+
+    lf->LFC[STATE_A] = 1 - lambda_coul;
+    lf->LFV[STATE_A] = 1 - lambda_vdw;
+    lf->LFC[STATE_B] = lambda_coul;
+    lf->LFV[STATE_B] = lambda_vdw;
+    for (int i = 0; i < NSTATES; i++)
+    {
+        const real LFC = lf->LFC[i];
+        const real LFV = lf->LFV[i];
+
+        lf->lfac_coul[i]  = (lam_power == 2 ? (1-LFC)*(1-LFC) : (1-LFC));
+        lf->dlfac_coul[i] = c_fepDLF[i]*lam_power/sc_r_power*(lam_power == 2 ? (1-LFC) : 1);
+        lf->lfac_vdw[i]   = (lam_power == 2 ? (1-LFV)*(1-LFV) : (1-LFV));
+        lf->dlfac_vdw[i]  = c_fepDLF[i]*lam_power/sc_r_power*(lam_power == 2 ? (1-LFV) : 1);
+    }
+}
+
+/*! \brief Lambda independent setup shared by the SIMD free-energy kernels */
+struct FepSimdSetup
+{
+    //! Constructor, extracts the interaction setup from \p fr
+    explicit FepSimdSetup(const t_forcerec *fr);
+
+    /* With the Verlet scheme Ewald and LJ-PME are always converted
+     * to plain Coulomb and LJ6, see the plain-C kernel below.
+     */
+    bool        bEwald;           /**< Subtract the Ewald reciprocal-space part */
+    bool        bEwaldLJ;         /**< Subtract the LJ-PME reciprocal-space part */
+    bool        bVdwSwitch;       /**< Use the LJ potential switch */
+    real        rcoulomb;         /**< Coulomb cut-off */
+    real        rvdw;             /**< VdW cut-off */
+    real        rcutoff_max;      /**< Max of the two cut-offs */
+    const real *ewtab;            /**< Ewald FDV0 table */
+    const real *tab_ewald_F_lj;   /**< LJ-PME force table */
+    const real *tab_ewald_V_lj;   /**< LJ-PME potential table */
+    real        ewtabscale;       /**< Scale of the Ewald tables */
+    real        ewtabhalfspace;   /**< Half the Ewald table spacing */
+
+    SimdReal    rcutoff_max2_S;   /**< Squared max cut-off */
+    SimdReal    rcoulomb_S;       /**< Coulomb cut-off */
+    SimdReal    rvdw_S;           /**< VdW cut-off */
+    SimdReal    krf_S;            /**< Reaction-field constant */
+    SimdReal    crf_S;            /**< Reaction-field potential shift */
+    SimdReal    sh_ewald_S;       /**< Ewald potential shift */
+    SimdReal    sh_invrc6_S;      /**< LJ potential shift */
+    SimdReal    sh_lj_ewald_S;    /**< LJ-PME potential shift */
+    SimdReal    sigma6_def_S;     /**< Default soft-core sigma^6 */
+    SimdReal    sigma6_min_S;     /**< Minimum soft-core sigma^6 */
+    SimdReal    alpha_coul_S;     /**< Coulomb soft-core alpha */
+    SimdReal    alpha_vdw_S;      /**< VdW soft-core alpha */
+    SimdReal    rvdw_switch_S;    /**< LJ switch radius */
+    SimdReal    vdw_swV3_S;       /**< LJ potential switch coefficients */
+    SimdReal    vdw_swV4_S;       /**< LJ potential switch coefficients */
+    SimdReal    vdw_swV5_S;       /**< LJ potential switch coefficients */
+    SimdReal    vdw_swF2_S;       /**< LJ force switch coefficients */
+    SimdReal    vdw_swF3_S;       /**< LJ force switch coefficients */
+    SimdReal    vdw_swF4_S;       /**< LJ force switch coefficients */
+};
+
+FepSimdSetup::FepSimdSetup(const t_forcerec *fr)
+{
+    const interaction_const_t *ic = fr->ic;
+
+    bEwald         = EEL_PME_EWALD(ic->eeltype);
+    bEwaldLJ       = EVDW_PME(ic->vdwtype);
+    bVdwSwitch     = (ic->vdw_modifier == eintmodPOTSWITCH);
+    rcoulomb       = ic->rcoulomb;
+    rvdw           = ic->rvdw;
+    rcutoff_max    = std::max(rcoulomb, rvdw);
+
+    ewtab          = nullptr;
+    tab_ewald_F_lj = nullptr;
+    tab_ewald_V_lj = nullptr;
+    ewtabscale     = 0;
+    ewtabhalfspace = 0;
+    real sh_ewald  = 0;
+    if (bEwald || bEwaldLJ)
+    {
+        sh_ewald       = ic->sh_ewald;
+        ewtab          = ic->tabq_coul_FDV0;
+        ewtabscale     = ic->tabq_scale;
+        ewtabhalfspace = 0.5/ewtabscale;
+        tab_ewald_F_lj = ic->tabq_vdw_F;
+        tab_ewald_V_lj = ic->tabq_vdw_V;
+    }
+
+    real vdw_swV3 = 0, vdw_swV4 = 0, vdw_swV5 = 0, vdw_swF2 = 0, vdw_swF3 = 0, vdw_swF4 = 0;
+    if (bVdwSwitch)
+    {
+        real d   = ic->rvdw - ic->rvdw_switch;
+        vdw_swV3 = -10.0/(d*d*d);
+        vdw_swV4 =  15.0/(d*d*d*d);
+        vdw_swV5 =  -6.0/(d*d*d*d*d);
+        vdw_swF2 = -30.0/(d*d*d);
+        vdw_swF3 =  60.0/(d*d*d*d);
+        vdw_swF4 = -30.0/(d*d*d*d*d);
+    }
+
+    rcutoff_max2_S = SimdReal(rcutoff_max*rcutoff_max);
+    rcoulomb_S     = SimdReal(rcoulomb);
+    rvdw_S         = SimdReal(rvdw);
+    krf_S          = SimdReal(ic->k_rf);
+    crf_S          = SimdReal(ic->c_rf);
+    sh_ewald_S     = SimdReal(sh_ewald);
+    sh_invrc6_S    = SimdReal(ic->sh_invrc6);
+    sh_lj_ewald_S  = SimdReal(ic->sh_lj_ewald);
+    sigma6_def_S   = SimdReal(fr->sc_sigma6_def);
+    sigma6_min_S   = SimdReal(fr->sc_sigma6_min);
+    alpha_coul_S   = SimdReal(fr->sc_alphacoul);
+    alpha_vdw_S    = SimdReal(fr->sc_alphavdw);
+    rvdw_switch_S  = SimdReal(ic->rvdw_switch);
+    vdw_swV3_S     = SimdReal(vdw_swV3);
+    vdw_swV4_S     = SimdReal(vdw_swV4);
+    vdw_swV5_S     = SimdReal(vdw_swV5);
+    vdw_swF2_S     = SimdReal(vdw_swF2);
+    vdw_swF3_S     = SimdReal(vdw_swF3);
+    vdw_swF4_S     = SimdReal(vdw_swF4);
+}
+
+/*! \brief The j-particle data of a batch of GMX_SIMD_REAL_WIDTH FEP pairs */
+struct FepSimdBatch
+{
+    alignas(GMX_SIMD_ALIGNMENT) real jx[GMX_SIMD_REAL_WIDTH];               /**< j x-coordinates */
+    alignas(GMX_SIMD_ALIGNMENT) real jy[GMX_SIMD_REAL_WIDTH];               /**< j y-coordinates */
+    alignas(GMX_SIMD_ALIGNMENT) real jz[GMX_SIMD_REAL_WIDTH];               /**< j z-coordinates */
+    alignas(GMX_SIMD_ALIGNMENT) real qq[NSTATES][GMX_SIMD_REAL_WIDTH];      /**< Charge products */
+    alignas(GMX_SIMD_ALIGNMENT) real c6[NSTATES][GMX_SIMD_REAL_WIDTH];      /**< 6*C6 */
+    alignas(GMX_SIMD_ALIGNMENT) real c12[NSTATES][GMX_SIMD_REAL_WIDTH];     /**< 12*C12 */
+    alignas(GMX_SIMD_ALIGNMENT) real c6grid[NSTATES][GMX_SIMD_REAL_WIDTH];  /**< LJ-PME grid C6 */
+    alignas(GMX_SIMD_ALIGNMENT) real interact[GMX_SIMD_REAL_WIDTH];         /**< 1 when not excluded */
+    alignas(GMX_SIMD_ALIGNMENT) real self[GMX_SIMD_REAL_WIDTH];             /**< 1 for the i-i pair */
+    alignas(GMX_SIMD_ALIGNMENT) real r[GMX_SIMD_REAL_WIDTH];                /**< Pair distances */
+    alignas(GMX_SIMD_ALIGNMENT) real fLr[GMX_SIMD_REAL_WIDTH];              /**< Reciprocal-space force */
+    alignas(GMX_SIMD_ALIGNMENT) real vLr[GMX_SIMD_REAL_WIDTH];              /**< Reciprocal-space potential */
+    int                              jnr[GMX_SIMD_REAL_WIDTH];              /**< j-particle, -1 for padding */
+};
+
+/*! \brief Gathers the j-particle data for list entries \p k0 up to \p nj1
+ *
+ * Lanes beyond \p nj1 are filled with a dummy particle beyond the cut-off.
+ */
+static inline void
+gatherFepSimdBatch(const t_nblist *nlist, int k0, int nj1,
+                   int ii, const real *x, real ix, real iy, real iz,
+                   const t_forcerec *fr, const t_mdatoms *mdatoms,
+                   const FepSimdSetup &setup,
+                   FepSimdBatch *b)
+{
+    const real facel = fr->ic->epsfac;
+    const int  ntype = fr->ntype;
+    const real iqA   = facel*mdatoms->chargeA[ii];
+    const real iqB   = facel*mdatoms->chargeB[ii];
+    const int  ntiA  = 2*ntype*mdatoms->typeA[ii];
+    const int  ntiB  = 2*ntype*mdatoms->typeB[ii];
+
+    for (int s = 0; s < GMX_SIMD_REAL_WIDTH; s++)
+    {
+        const int k = k0 + s;
+        if (k < nj1)
+        {
+            const int j   = nlist->jjnr[k];
+            const int tjA = ntiA + 2*mdatoms->typeA[j];
+            const int tjB = ntiB + 2*mdatoms->typeB[j];
+
+            b->jnr[s]          = j;
+            b->jx[s]           = x[3*j];
+            b->jy[s]           = x[3*j+1];
+            b->jz[s]           = x[3*j+2];
+            b->qq[STATE_A][s]  = iqA*mdatoms->chargeA[j];
+            b->qq[STATE_B][s]  = iqB*mdatoms->chargeB[j];
+            b->c6[STATE_A][s]  = fr->nbfp[tjA];
+            b->c6[STATE_B][s]  = fr->nbfp[tjB];
+            b->c12[STATE_A][s] = fr->nbfp[tjA+1];
+            b->c12[STATE_B][s] = fr->nbfp[tjB+1];
+            if (setup.bEwaldLJ)
+            {
+                b->c6grid[STATE_A][s] = fr->ljpme_c6grid[tjA];
+                b->c6grid[STATE_B][s] = fr->ljpme_c6grid[tjB];
+            }
+            else
+            {
+                b->c6grid[STATE_A][s] = 0;
+                b->c6grid[STATE_B][s] = 0;
+            }
+            b->interact[s]     = (nlist->excl_fep == nullptr || nlist->excl_fep[k]) ? 1 : 0;
+            b->self[s]         = (ii == j) ? 1 : 0;
+        }
+        else
+        {
+            b->jnr[s]          = -1;
+            b->jx[s]           = ix + 2*setup.rcutoff_max + 1;
+            b->jy[s]           = iy;
+            b->jz[s]           = iz;
+            for (int i = 0; i < NSTATES; i++)
+            {
+                b->qq[i][s]     = 0;
+                b->c6[i][s]     = 0;
+                b->c12[i][s]    = 0;
+                b->c6grid[i][s] = 0;
+            }
+            b->interact[s]     = 0;
+            b->self[s]         = 0;
+        }
+    }
+}
+
+/*! \brief Looks up the Ewald reciprocal-space Coulomb correction for the lanes in \p b
+ *
+ * Stores the force, still to be multiplied by 1/r, and the potential
+ * in b->fLr and b->vLr, zero beyond the cut-off. Expects b->r to be set.
+ */
+static inline void
+ewaldCoulombCorrectionLanes(const FepSimdSetup &setup, FepSimdBatch *b)
+{
+    const real *ewtab = setup.ewtab;
+
+    for (int s = 0; s < GMX_SIMD_REAL_WIDTH; s++)
+    {
+        if (b->r[s] < setup.rcoulomb)
+        {
+            real ewrt   = b->r[s]*setup.ewtabscale;
+            int  ewitab = static_cast<int>(ewrt);
+            real eweps  = ewrt - ewitab;
+            ewitab      = 4*ewitab;
+            b->fLr[s]   = ewtab[ewitab] + eweps*ewtab[ewitab+1];
+            b->vLr[s]   = ewtab[ewitab+2] - setup.ewtabhalfspace*eweps*(ewtab[ewitab] + b->fLr[s]);
+        }
+        else
+        {
+            b->fLr[s]   = 0;
+            b->vLr[s]   = 0;
+        }
+    }
+}
+
+/*! \brief Looks up the LJ-PME reciprocal-space correction for the lanes in \p b
+ *
+ * As ewaldCoulombCorrectionLanes(), but for LJ-PME and including the factor 1/6.
+ */
+static inline void
+ewaldLJCorrectionLanes(const FepSimdSetup &setup, FepSimdBatch *b)
+{
+    for (int s = 0; s < GMX_SIMD_REAL_WIDTH; s++)
+    {
+        if (b->r[s] < setup.rvdw)
+        {
+            real rs     = b->r[s]*setup.ewtabscale;
+            int  ri     = static_cast<int>(rs);
+            real frac   = rs - ri;
+            real f_lr   = (1 - frac)*setup.tab_ewald_F_lj[ri] + frac*setup.tab_ewald_F_lj[ri+1];
+            /* TODO: Currently the Ewald LJ table does not contain
+             * the factor 1/6, we should add this.
+             */
+            b->fLr[s]   = f_lr/6;
+            b->vLr[s]   = (setup.tab_ewald_V_lj[ri] - setup.ewtabhalfspace*frac*(setup.tab_ewald_F_lj[ri] + f_lr))/6;
+        }
+        else
+        {
+            b->fLr[s]   = 0;
+            b->vLr[s]   = 0;
+        }
+    }
+}
+
+/*! \brief Computes the soft-core interactions of one state for a batch of pairs
+ *
+ * Returns the potentials and the scalar forces dV/drC*rC^(1-p) in
+ * the output arguments, which are zero for lanes without interaction.
+ * \p alphaCoulLfac_S and \p alphaVdwLfac_S are the effective soft-core
+ * alphas times the lambda factors of this state.
+ */
+static inline void gmx_simdcall
+softcoreStateSimd(const FepSimdSetup &setup,
+                  SimdReal r_S, SimdReal rp_S, SimdBool active_S,
+                  SimdReal qq_S, SimdReal c6_S, SimdReal c12_S, SimdReal c6grid_S,
+                  SimdReal sigma6_S,
+                  SimdReal alphaCoulLfac_S, SimdReal alphaVdwLfac_S,
+                  SimdReal *vcoul_S, SimdReal *fscalC_S,
+                  SimdReal *vvdw_S, SimdReal *fscalV_S)
+{
+    const SimdReal zero_S(0.0);
+    const SimdReal one_S(1.0);
+    const SimdReal onesixth_S(1.0/6.0);
+    const SimdReal onetwelfth_S(1.0/12.0);
+
+    /* Inactive lanes get a dummy soft-core r^6 of 1 to avoid
+     * floating-point exceptions in the log below.
+     */
+    SimdReal rpC_S    = blend(one_S, fma(alphaCoulLfac_S, sigma6_S, rp_S), active_S);
+    SimdReal rpinvC_S = inv(rpC_S);
+    SimdReal rC_S     = exp(onesixth_S*log(rpC_S));
+    SimdReal rinvC_S  = inv(rC_S);
+
+    SimdReal rpV_S    = blend(one_S, fma(alphaVdwLfac_S, sigma6_S, rp_S), active_S);
+    SimdReal rpinvV_S = inv(rpV_S);
+    SimdReal rV_S     = exp(onesixth_S*log(rpV_S));
+
+    SimdReal vcoul, fscalC;
+    SimdBool elecInRange_S;
+    if (setup.bEwald)
+    {
+        /* Ewald FEP is done only on the 1/r part */
+        vcoul         = qq_S*(rinvC_S - setup.sh_ewald_S);
+        fscalC        = qq_S*rinvC_S;
+        elecInRange_S = (r_S < setup.rcoulomb_S);
+    }
+    else
+    {
+        /* reaction-field */
+        SimdReal rC2_S = rC_S*rC_S;
+        vcoul          = qq_S*(rinvC_S + fms(setup.krf_S, rC2_S, setup.crf_S));
+        fscalC         = qq_S*(rinvC_S - SimdReal(2.0)*setup.krf_S*rC2_S);
+        elecInRange_S  = (rC_S < setup.rcoulomb_S);
+    }
+    SimdBool elec_S = active_S && (qq_S != zero_S) && elecInRange_S;
+    *vcoul_S        = selectByMask(vcoul, elec_S);
+    *fscalC_S       = selectByMask(fscalC*rpinvC_S, elec_S);
+
+    /* cutoff LJ, with LJ-PME converted to LJ6 */
+    SimdReal rinv6_S         = rpinvV_S;
+    SimdReal vvdw6_S         = c6_S*rinv6_S;
+    SimdReal vvdw12_S        = c12_S*rinv6_S*rinv6_S;
+    SimdReal vvdwDispShift_S = c6_S*setup.sh_invrc6_S;
+    if (setup.bEwaldLJ)
+    {
+        vvdwDispShift_S = fma(c6grid_S, setup.sh_lj_ewald_S, vvdwDispShift_S);
+    }
+    SimdReal vvdw   = (onetwelfth_S*fnma(c12_S*setup.sh_invrc6_S, setup.sh_invrc6_S, vvdw12_S) -
+                       onesixth_S*(vvdw6_S - vvdwDispShift_S));
+    SimdReal fscalV = vvdw12_S - vvdw6_S;
+    if (setup.bVdwSwitch)
+    {
+        SimdReal d_S   = max(rV_S - setup.rvdw_switch_S, zero_S);
+        SimdReal d2_S  = d_S*d_S;
+        SimdReal sw_S  = one_S + d2_S*d_S*(setup.vdw_swV3_S + d_S*(setup.vdw_swV4_S + d_S*setup.vdw_swV5_S));
+        SimdReal dsw_S = d2_S*(setup.vdw_swF2_S + d_S*(setup.vdw_swF3_S + d_S*setup.vdw_swF4_S));
+
+        fscalV         = fscalV*sw_S - rV_S*vvdw*dsw_S;
+        vvdw           = vvdw*sw_S;
+    }
+    SimdBool vdwInRange_S = setup.bEwaldLJ ? (r_S < setup.rvdw_S) : (rV_S < setup.rvdw_S);
+    SimdBool vdw_S        = active_S && ((c6_S != zero_S) || (c12_S != zero_S)) && vdwInRange_S;
+    *vvdw_S               = selectByMask(vvdw, vdw_S);
+    *fscalV_S             = selectByMask(fscalV*rpinvV_S, vdw_S);
+}
+
+/*! \brief Returns the soft-core sigma^6 of a state, as in the plain-C kernel */
+static inline SimdReal gmx_simdcall
+softcoreSigma6Simd(const FepSimdSetup &setup, SimdReal c6_S, SimdReal c12_S)
+{
+    const SimdReal zero_S(0.0);
+
+    /* c12 is stored scaled with 12.0 and c6 is scaled with 6.0 - correct for this */
+    SimdBool hasLJ_S  = (zero_S < c6_S) && (zero_S < c12_S);
+    SimdReal sigma6_S = SimdReal(0.5)*c12_S*maskzInv(c6_S, hasLJ_S);
+
+    return blend(setup.sigma6_def_S, max(sigma6_S, setup.sigma6_min_S), hasLJ_S);
+}
+
+/*! \brief SIMD free-energy kernel for the Verlet scheme
+ *
+ * Computes the same interactions as the plain-C kernel below for the
+ * setups accepted by nb_free_energy_simd_supported(). The j-particles
+ * of each i-entry in the FEP list are processed GMX_SIMD_REAL_WIDTH at
+ * a time. The pair parameters are gathered into aligned buffers, after
+ * which all soft-core arithmetic for both states, including the r^(1/6)
+ * powers, is done in SIMD. Only the Ewald table lookups and the force
+ * reduction on the j-particles, which needs atomics, are done per lane.
+ */
+static void
+nb_free_energy_kernel_simd(const t_nblist * gmx_restrict    nlist,
+                           rvec * gmx_restrict              xx,
+                           rvec * gmx_restrict              ff,
+                           t_forcerec * gmx_restrict        fr,
+                           const t_mdatoms * gmx_restrict   mdatoms,
+                           nb_kernel_data_t * gmx_restrict  kernel_data,
+                           t_nrnb * gmx_restrict            nrnb)
+{
+    const real                *x        = xx[0];
+    real                      *f        = ff[0];
+    real                      *fshift   = fr->fshift[0];
+    const real                *shiftvec = fr->shift_vec[0];
+
+    const int                  nri    = nlist->nri;
+    const int                 *iinr   = nlist->iinr;
+    const int                 *jindex = nlist->jindex;
+    const int                 *shift  = nlist->shift;
+    const int                 *gid    = nlist->gid;
+
+    real                      *Vc     = kernel_data->energygrp_elec;
+    real                      *Vv     = kernel_data->energygrp_vdw;
+    real                      *dvdl   = kernel_data->dvdl;
+
+    const gmx_bool             bDoForces      = kernel_data->flags & GMX_NONBONDED_DO_FORCE;
+    const gmx_bool             bDoShiftForces = kernel_data->flags & GMX_NONBONDED_DO_SHIFTFORCE;
+    const gmx_bool             bDoPotential   = kernel_data->flags & GMX_NONBONDED_DO_POTENTIAL;
+
+    const FepSimdSetup         setup(fr);
+    FepLambdaFactors           lf;
+    setFepLambdaFactors(fr, kernel_data->lambda[efptCOUL], kernel_data->lambda[efptVDW], &lf);
+
+    const SimdReal             zero_S(0.0);
+    const SimdReal             half_S(0.5);
+
+    FepSimdBatch               b;
+    alignas(GMX_SIMD_ALIGNMENT) real tx[GMX_SIMD_REAL_WIDTH];
+    alignas(GMX_SIMD_ALIGNMENT) real ty[GMX_SIMD_REAL_WIDTH];
+    alignas(GMX_SIMD_ALIGNMENT) real tz[GMX_SIMD_REAL_WIDTH];
+    alignas(GMX_SIMD_ALIGNMENT) real rsq[GMX_SIMD_REAL_WIDTH];
+
+    double                     dvdl_coul = 0;
+    double                     dvdl_vdw  = 0;
+
+    for (int n = 0; n < nri; n++)
+    {
+        const int  is3  = 3*shift[n];
+        const int  ii   = iinr[n];
+        const int  ii3  = 3*ii;
+        const real ix   = shiftvec[is3]   + x[ii3+0];
+        const real iy   = shiftvec[is3+1] + x[ii3+1];
+        const real iz   = shiftvec[is3+2] + x[ii3+2];
+        const int  nj0  = jindex[n];
+        const int  nj1  = jindex[n+1];
+
+        const SimdReal ix_S(ix);
+        const SimdReal iy_S(iy);
+        const SimdReal iz_S(iz);
+        SimdReal       fix_S      = setZero();
+        SimdReal       fiy_S      = setZero();
+        SimdReal       fiz_S      = setZero();
+        SimdReal       vctot_S    = setZero();
+        SimdReal       vvtot_S    = setZero();
+        SimdReal       dvdlCoul_S = setZero();
+        SimdReal       dvdlVdw_S  = setZero();
+        bool           anyPairWithinCutoff = false;
+
+        for (int k0 = nj0; k0 < nj1; k0 += GMX_SIMD_REAL_WIDTH)
+        {
+            gatherFepSimdBatch(nlist, k0, nj1, ii, x, ix, iy, iz, fr, mdatoms, setup, &b);
+
+            SimdReal dx_S  = ix_S - load<SimdReal>(b.jx);
+            SimdReal dy_S  = iy_S - load<SimdReal>(b.jy);
+            SimdReal dz_S  = iz_S - load<SimdReal>(b.jz);
+            SimdReal rsq_S = norm2(dx_S, dy_S, dz_S);
+
+            /* As in the plain-C kernel, we can skip all pairs beyond the
+             * cut-off, since the soft-core distance is always larger than r.
+             */
+            SimdBool withinCutoff_S = (rsq_S < setup.rcutoff_max2_S);
+            if (!anyTrue(withinCutoff_S))
+            {
+                continue;
+            }
+            anyPairWithinCutoff = true;
+
+            /* The force at r=0 is zero, because of symmetry */
+            SimdReal rinv_S = maskzInvsqrt(rsq_S, zero_S < rsq_S);
+            SimdReal r_S    = rsq_S*rinv_S;
+            SimdReal rpm2_S = rsq_S*rsq_S;
+            SimdReal rp_S   = rpm2_S*rsq_S;
+
+            SimdReal interactFlag_S = load<SimdReal>(b.interact);
+            SimdBool interact_S     = (zero_S < interactFlag_S) && withinCutoff_S;
+            SimdBool excluded_S     = (interactFlag_S == zero_S) && withinCutoff_S;
+            SimdBool self_S         = (zero_S < load<SimdReal>(b.self));
+
+            /* Only use soft-core if one of the states has a zero end state */
+            SimdBool noSoftCore_S     = ((zero_S < load<SimdReal>(b.c12[STATE_A])) &&
+                                         (zero_S < load<SimdReal>(b.c12[STATE_B])));
+            SimdReal alpha_vdw_eff_S  = selectByNotMask(setup.alpha_vdw_S, noSoftCore_S);
+            SimdReal alpha_coul_eff_S = selectByNotMask(setup.alpha_coul_S, noSoftCore_S);
+
+            SimdReal fscal_S = setZero();
+
+            for (int i = 0; i < NSTATES; i++)
+            {
+                SimdReal qq_S     = load<SimdReal>(b.qq[i]);
+                SimdReal c6_S     = load<SimdReal>(b.c6[i]);
+                SimdReal c12_S    = load<SimdReal>(b.c12[i]);
+                SimdReal c6grid_S = load<SimdReal>(b.c6grid[i]);
+                SimdReal sigma6_S = softcoreSigma6Simd(setup, c6_S, c12_S);
+
+                /* Only spend time on A or B state if it is non-zero */
+                SimdBool active_S = interact_S && ((qq_S != zero_S) || (c6_S != zero_S) || (c12_S != zero_S));
+
+                SimdReal vcoul_S, fscalC_S, vvdw_S, fscalV_S;
+                softcoreStateSimd(setup, r_S, rp_S, active_S,
+                                  qq_S, c6_S, c12_S, c6grid_S, sigma6_S,
+                                  alpha_coul_eff_S*SimdReal(lf.lfac_coul[i]),
+                                  alpha_vdw_eff_S*SimdReal(lf.lfac_vdw[i]),
+                                  &vcoul_S, &fscalC_S, &vvdw_S, &fscalV_S);
+
+                /* Assemble A and B states */
+                SimdReal LFC_S(lf.LFC[i]);
+                SimdReal LFV_S(lf.LFV[i]);
+                SimdReal DLF_S(c_fepDLF[i]);
+
+                vctot_S    = fma(LFC_S, vcoul_S, vctot_S);
+                vvtot_S    = fma(LFV_S, vvdw_S, vvtot_S);
+                fscal_S    = fma(fma(LFC_S, fscalC_S, LFV_S*fscalV_S), rpm2_S, fscal_S);
+                dvdlCoul_S = dvdlCoul_S + vcoul_S*DLF_S + LFC_S*alpha_coul_eff_S*SimdReal(lf.dlfac_coul[i])*fscalC_S*sigma6_S;
+                dvdlVdw_S  = dvdlVdw_S + vvdw_S*DLF_S + LFV_S*alpha_vdw_eff_S*SimdReal(lf.dlfac_vdw[i])*fscalV_S*sigma6_S;
+
+                if (!setup.bEwald)
+                {
+                    /* For excluded pairs we only have the reaction-field
+                     * correction, which has no singularity, so no soft-core.
+                     */
+                    SimdReal vv_S   = fms(setup.krf_S, rsq_S, setup.crf_S);
+                    vv_S            = blend(vv_S, half_S*vv_S, self_S);
+                    SimdReal qqEx_S = selectByMask(qq_S, excluded_S);
+
+                    vctot_S    = fma(LFC_S*qqEx_S, vv_S, vctot_S);
+                    fscal_S    = fnma(LFC_S*qqEx_S, SimdReal(2.0)*setup.krf_S, fscal_S);
+                    dvdlCoul_S = fma(DLF_S*qqEx_S, vv_S, dvdlCoul_S);
+                }
+            }
+
+            if (setup.bEwald || setup.bEwaldLJ)
+            {
+                store(b.r, r_S);
+            }
+
+            if (setup.bEwald)
+            {
+                /* Subtract the reciprocal-space part, see the plain-C kernel */
+                ewaldCoulombCorrectionLanes(setup, &b);
+                SimdReal f_lr_S = load<SimdReal>(b.fLr)*rinv_S;
+                SimdReal v_lr_S = load<SimdReal>(b.vLr);
+                v_lr_S          = blend(v_lr_S, half_S*v_lr_S, self_S);
+
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    SimdReal qq_S = load<SimdReal>(b.qq[i]);
+                    SimdReal LFC_S(lf.LFC[i]);
+
+                    vctot_S    = fnma(LFC_S*qq_S, v_lr_S, vctot_S);
+                    fscal_S    = fnma(LFC_S*qq_S, f_lr_S, fscal_S);
+                    dvdlCoul_S = fnma(SimdReal(c_fepDLF[i])*qq_S, v_lr_S, dvdlCoul_S);
+                }
+            }
+
+            if (setup.bEwaldLJ)
+            {
+                /* Subtract the reciprocal-space part, see the plain-C kernel */
+                ewaldLJCorrectionLanes(setup, &b);
+                SimdReal ff_S = load<SimdReal>(b.fLr)*rinv_S;
+                SimdReal vv_S = load<SimdReal>(b.vLr);
+                vv_S          = blend(vv_S, half_S*vv_S, self_S);
+
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    SimdReal c6grid_S = load<SimdReal>(b.c6grid[i]);
+                    SimdReal LFV_S(lf.LFV[i]);
+
+                    vvtot_S   = fma(LFV_S*c6grid_S, vv_S, vvtot_S);
+                    fscal_S   = fma(LFV_S*c6grid_S, ff_S, fscal_S);
+                    dvdlVdw_S = fma(SimdReal(c_fepDLF[i])*c6grid_S, vv_S, dvdlVdw_S);
+                }
+            }
+
+            if (bDoForces)
+            {
+                fscal_S        = selectByMask(fscal_S, withinCutoff_S);
+                SimdReal tx_S  = fscal_S*dx_S;
+                SimdReal ty_S  = fscal_S*dy_S;
+                SimdReal tz_S  = fscal_S*dz_S;
+                fix_S          = fix_S + tx_S;
+                fiy_S          = fiy_S + ty_S;
+                fiz_S          = fiz_S + tz_S;
+                store(tx, tx_S);
+                store(ty, ty_S);
+                store(tz, tz_S);
+                store(rsq, rsq_S);
+
+                /* Other threads can update the same j-particles, see the plain-C kernel */
+                for (int s = 0; s < GMX_SIMD_REAL_WIDTH && b.jnr[s] >= 0; s++)
+                {
+                    if (rsq[s] < setup.rcutoff_max*setup.rcutoff_max)
+                    {
+                        const int j3 = 3*b.jnr[s];
+#pragma omp atomic
+                        f[j3]     -= tx[s];
+#pragma omp atomic
+                        f[j3+1]   -= ty[s];
+#pragma omp atomic
+                        f[j3+2]   -= tz[s];
+                    }
+                }
+            }
+        }
+
+        if (anyPairWithinCutoff)
+        {
+            dvdl_coul += reduce(dvdlCoul_S);
+            dvdl_vdw  += reduce(dvdlVdw_S);
+
+            if (bDoForces)
+            {
+                real fix = reduce(fix_S);
+                real fiy = reduce(fiy_S);
+                real fiz = reduce(fiz_S);
+#pragma omp atomic
+                f[ii3]        += fix;
+#pragma omp atomic
+                f[ii3+1]      += fiy;
+#pragma omp atomic
+                f[ii3+2]      += fiz;
+                if (bDoShiftForces)
+                {
+#pragma omp atomic
+                    fshift[is3]   += fix;
+#pragma omp atomic
+                    fshift[is3+1] += fiy;
+#pragma omp atomic
+                    fshift[is3+2] += fiz;
+                }
+            }
+            if (bDoPotential)
+            {
+                int  ggid  = gid[n];
+                real vctot = reduce(vctot_S);
+                real vvtot = reduce(vvtot_S);
+#pragma omp atomic
+                Vc[ggid]  += vctot;
+#pragma omp atomic
+                Vv[ggid]  += vvtot;
+            }
+        }
+    }
+
+#pragma omp atomic
+    dvdl[efptCOUL]     += dvdl_coul;
+#pragma omp atomic
+    dvdl[efptVDW]      += dvdl_vdw;
+
+    /* Estimate flops, average for free energy stuff:
+     * 12  flops per outer iteration
+     * 150 flops per inner iteration
+     */
+#pragma omp atomic
+    inc_nrnb(nrnb, eNR_NBKERNEL_FREE_ENERGY, nlist->nri*12 + nlist->jindex[nri]*150);
+}
+
+/*! \brief SIMD kernel for the energies at many lambda values in one pass
+ *
+ * All lambda independent work, i.e. the list traversal, the gathering,
+ * the soft-core sigma's and the reciprocal-space corrections, is done
+ * once per pair. The parts that are linear in lambda are accumulated
+ * per state and combined with the lambda weights at the end. Only the
+ * soft-core distances and interactions are evaluated per lambda, into
+ * one SIMD accumulator per lambda.
+ */
+static void
+nb_free_energy_foreign_kernel_simd(const t_nblist * gmx_restrict    nlist,
+                                   rvec * gmx_restrict              xx,
+                                   t_forcerec * gmx_restrict        fr,
+                                   const t_mdatoms * gmx_restrict   mdatoms,
+                                   int                              numLambdas,
+                                   const real                      *lambdaCoul,
+                                   const real                      *lambdaVdw,
+                                   real                            *energies,
+                                   t_nrnb * gmx_restrict            nrnb)
+{
+    const real        *x        = xx[0];
+    const real        *shiftvec = fr->shift_vec[0];
+
+    const FepSimdSetup setup(fr);
+    const SimdReal     zero_S(0.0);
+    const SimdReal     half_S(0.5);
+
+    std::vector<FepLambdaFactors> lf(numLambdas);
+    for (int l = 0; l < numLambdas; l++)
+    {
+        setFepLambdaFactors(fr, lambdaCoul[l], lambdaVdw[l], &lf[l]);
+    }
+    std::vector<real, AlignedAllocator<real> > energyAcc(numLambdas*GMX_SIMD_REAL_WIDTH, 0);
+
+    /* The terms that are linear in lambda, per state */
+    SimdReal       linCoul_S[NSTATES] = { setZero(), setZero() };
+    SimdReal       linVdw_S[NSTATES]  = { setZero(), setZero() };
+
+    FepSimdBatch   b;
+
+    for (int n = 0; n < nlist->nri; n++)
+    {
+        const int  is3  = 3*nlist->shift[n];
+        const int  ii   = nlist->iinr[n];
+        const real ix   = shiftvec[is3]   + x[3*ii+0];
+        const real iy   = shiftvec[is3+1] + x[3*ii+1];
+        const real iz   = shiftvec[is3+2] + x[3*ii+2];
+        const int  nj0  = nlist->jindex[n];
+        const int  nj1  = nlist->jindex[n+1];
+
+        const SimdReal ix_S(ix);
+        const SimdReal iy_S(iy);
+        const SimdReal iz_S(iz);
+
+        for (int k0 = nj0; k0 < nj1; k0 += GMX_SIMD_REAL_WIDTH)
+        {
+            gatherFepSimdBatch(nlist, k0, nj1, ii, x, ix, iy, iz, fr, mdatoms, setup, &b);
+
+            SimdReal dx_S  = ix_S - load<SimdReal>(b.jx);
+            SimdReal dy_S  = iy_S - load<SimdReal>(b.jy);
+            SimdReal dz_S  = iz_S - load<SimdReal>(b.jz);
+            SimdReal rsq_S = norm2(dx_S, dy_S, dz_S);
+
+            SimdBool withinCutoff_S = (rsq_S < setup.rcutoff_max2_S);
+            if (!anyTrue(withinCutoff_S))
+            {
+                continue;
+            }
+
+            SimdReal rinv_S = maskzInvsqrt(rsq_S, zero_S < rsq_S);
+            SimdReal r_S    = rsq_S*rinv_S;
+            SimdReal rp_S   = rsq_S*rsq_S*rsq_S;
+
+            SimdReal interactFlag_S = load<SimdReal>(b.interact);
+            SimdBool interact_S     = (zero_S < interactFlag_S) && withinCutoff_S;
+            SimdBool excluded_S     = (interactFlag_S == zero_S) && withinCutoff_S;
+            SimdBool self_S         = (zero_S < load<SimdReal>(b.self));
+
+            SimdBool noSoftCore_S     = ((zero_S < load<SimdReal>(b.c12[STATE_A])) &&
+                                         (zero_S < load<SimdReal>(b.c12[STATE_B])));
+            SimdReal alpha_vdw_eff_S  = selectByNotMask(setup.alpha_vdw_S, noSoftCore_S);
+            SimdReal alpha_coul_eff_S = selectByNotMask(setup.alpha_coul_S, noSoftCore_S);
+
+            SimdReal qq_S[NSTATES], c6_S[NSTATES], c12_S[NSTATES], c6grid_S[NSTATES];
+            SimdReal sigma6_S[NSTATES];
+            SimdBool active_S[NSTATES];
+            for (int i = 0; i < NSTATES; i++)
+            {
+                qq_S[i]     = load<SimdReal>(b.qq[i]);
+                c6_S[i]     = load<SimdReal>(b.c6[i]);
+                c12_S[i]    = load<SimdReal>(b.c12[i]);
+                c6grid_S[i] = load<SimdReal>(b.c6grid[i]);
+                sigma6_S[i] = softcoreSigma6Simd(setup, c6_S[i], c12_S[i]);
+                active_S[i] = interact_S && ((qq_S[i] != zero_S) || (c6_S[i] != zero_S) || (c12_S[i] != zero_S));
+            }
+
+            for (int l = 0; l < numLambdas; l++)
+            {
+                SimdReal energy_S = load<SimdReal>(energyAcc.data() + l*GMX_SIMD_REAL_WIDTH);
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    SimdReal vcoul_S, fscalC_S, vvdw_S, fscalV_S;
+                    softcoreStateSimd(setup, r_S, rp_S, active_S[i],
+                                      qq_S[i], c6_S[i], c12_S[i], c6grid_S[i], sigma6_S[i],
+                                      alpha_coul_eff_S*SimdReal(lf[l].lfac_coul[i]),
+                                      alpha_vdw_eff_S*SimdReal(lf[l].lfac_vdw[i]),
+                                      &vcoul_S, &fscalC_S, &vvdw_S, &fscalV_S);
+                    energy_S = fma(SimdReal(lf[l].LFC[i]), vcoul_S, energy_S);
+                    energy_S = fma(SimdReal(lf[l].LFV[i]), vvdw_S, energy_S);
+                }
+                store(energyAcc.data() + l*GMX_SIMD_REAL_WIDTH, energy_S);
+            }
+
+            if (!setup.bEwald)
+            {
+                SimdReal vv_S = fms(setup.krf_S, rsq_S, setup.crf_S);
+                vv_S          = blend(vv_S, half_S*vv_S, self_S);
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    linCoul_S[i] = fma(selectByMask(qq_S[i], excluded_S), vv_S, linCoul_S[i]);
+                }
+            }
+
+            if (setup.bEwald || setup.bEwaldLJ)
+            {
+                store(b.r, r_S);
+            }
+
+            if (setup.bEwald)
+            {
+                ewaldCoulombCorrectionLanes(setup, &b);
+                SimdReal v_lr_S = load<SimdReal>(b.vLr);
+                v_lr_S          = blend(v_lr_S, half_S*v_lr_S, self_S);
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    linCoul_S[i] = fnma(qq_S[i], v_lr_S, linCoul_S[i]);
+                }
+            }
+
+            if (setup.bEwaldLJ)
+            {
+                ewaldLJCorrectionLanes(setup, &b);
+                SimdReal vv_S = load<SimdReal>(b.vLr);
+                vv_S          = blend(vv_S, half_S*vv_S, self_S);
+                for (int i = 0; i < NSTATES; i++)
+                {
+                    linVdw_S[i] = fma(c6grid_S[i], vv_S, linVdw_S[i]);
+                }
+            }
+        }
+    }
+
+    real linCoul[NSTATES], linVdw[NSTATES];
+    for (int i = 0; i < NSTATES; i++)
+    {
+        linCoul[i] = reduce(linCoul_S[i]);
+        linVdw[i]  = reduce(linVdw_S[i]);
+    }
+    for (int l = 0; l < numLambdas; l++)
+    {
+        real energy = reduce(load<SimdReal>(energyAcc.data() + l*GMX_SIMD_REAL_WIDTH));
+        for (int i = 0; i < NSTATES; i++)
+        {
+            energy += lf[l].LFC[i]*linCoul[i] + lf[l].LFV[i]*linVdw[i];
+        }
+        energies[l] += energy;
+    }
+
+    /* Count the foreign lambda evaluations as the pair cost once per lambda */
+    inc_nrnb(nrnb, eNR_NBKERNEL_FREE_ENERGY, numLambdas*(nlist->nri*12 + nlist->jindex[nlist->nri]*150));
+}
+
+#undef STATE_A
+#undef STATE_B
+#undef NSTATES
+
+#endif // GMX_SIMD_HAVE_REAL
+
+gmx_bool
+gmx_nb_free_energy_foreign_supported(const t_forcerec *fr)
+{
+#if GMX_SIMD_HAVE_REAL
+    return (fr->use_simd_kernels && nb_free_energy_simd_supported(fr));
+#else
+    GMX_UNUSED_VALUE(fr);
+    return FALSE;
+#endif
+}
+
+void
+gmx_nb_free_energy_foreign_kernel(const t_nblist * gmx_restrict    nlist,
+                                  rvec * gmx_restrict              xx,
+                                  t_forcerec * gmx_restrict        fr,
+                                  const t_mdatoms * gmx_restrict   mdatoms,
+                                  int                              numLambdas,
+                                  const real                      *lambdaCoul,
+                                  const real                      *lambdaVdw,
+                                  real                            *energies,
+                                  t_nrnb * gmx_restrict            nrnb)
+{
+#if GMX_SIMD_HAVE_REAL
+    nb_free_energy_foreign_kernel_simd(nlist, xx, fr, mdatoms, numLambdas, lambdaCoul, lambdaVdw, energies, nrnb);
+#else
+    GMX_UNUSED_VALUE(nlist);
+    GMX_UNUSED_VALUE(xx);
+    GMX_UNUSED_VALUE(fr);
+    GMX_UNUSED_VALUE(mdatoms);
+    GMX_UNUSED_VALUE(numLambdas);
+    GMX_UNUSED_VALUE(lambdaCoul);
+    GMX_UNUSED_VALUE(lambdaVdw);
+    GMX_UNUSED_VALUE(energies);
+    GMX_UNUSED_VALUE(nrnb);
+    gmx_incons("gmx_nb_free_energy_foreign_kernel called without SIMD support");
+#endif
+}
+
 void
 gmx_nb_free_energy_kernel(const t_nblist * gmx_restrict    nlist,
                           rvec * gmx_restrict              xx,
@@ -60,6 +974,13 @@ gmx_nb_free_energy_kernel(const t_nblist * gmx_restrict    nlist,
                           nb_kernel_data_t * gmx_restrict  kernel_data,
                           t_nrnb * gmx_restrict            nrnb)
 {
+#if GMX_SIMD_HAVE_REAL
+    if (fr->use_simd_kernels && nb_free_energy_simd_supported(fr))
+    {
+        nb_free_energy_kernel_simd(nlist, xx, ff, fr, mdatoms, kernel_data, nrnb);
+        return;
+    }
+#endif
 
 #define  STATE_A  0
 #define  STATE_B  1
@@ -59,6 +59,29 @@ void
                               nb_kernel_data_t * gmx_restrict  kernel_data,
                               t_nrnb * gmx_restrict            nrnb);
 
+gmx_bool
+gmx_nb_free_energy_foreign_supported(const t_forcerec *fr);
+/* Returns whether gmx_nb_free_energy_foreign_kernel can be used with fr,
+ * i.e. whether SIMD kernels are enabled and support the setup in fr.
+ */
+
+void
+    gmx_nb_free_energy_foreign_kernel(const t_nblist * gmx_restrict    nlist,
+                                      rvec * gmx_restrict              xx,
+                                      t_forcerec * gmx_restrict        fr,
+                                      const t_mdatoms * gmx_restrict   mdatoms,
+                                      int                              numLambdas,
+                                      const real                      *lambdaCoul,
+                                      const real                      *lambdaVdw,
+                                      real                            *energies,
+                                      t_nrnb * gmx_restrict            nrnb);
+/* Adds the free-energy pair potential energies of nlist, summed over
+ * all energy groups, at the numLambdas (lambdaCoul[l],lambdaVdw[l])
+ * values to energies[l], in a single pass over the list, and counts
+ * the flops in nrnb. Can be called concurrently by multiple threads on
+ * different lists, when each thread passes its own energies and nrnb.
+ */
+
 #ifdef __cplusplus
 }
 #endif
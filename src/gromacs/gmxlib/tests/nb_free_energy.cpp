@@ -0,0 +1,545 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the SIMD free-energy kernels.
+ *
+ * The SIMD kernel is compared with the plain-C kernel on the same
+ * perturbed pair list. The single-pass foreign-lambda kernel is
+ * compared with calling the plain-C kernel for each lambda. The
+ * plain-C kernel is selected by setting t_forcerec::use_simd_kernels
+ * to FALSE, as GMX_DISABLE_SIMD_KERNELS does in mdrun.
+ *
+ * Without SIMD support the kernel dispatch should fall back to the
+ * plain-C kernel, which is then checked instead, and the foreign-lambda
+ * test reports that it is skipped.
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxlib/nonbonded/nb_free_energy.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <iostream>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/gmxlib/nrnb.h"
+#include "gromacs/gmxlib/nonbonded/nonbonded.h"
+#include "gromacs/math/functions.h"
+#include "gromacs/math/units.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/math/vectypes.h"
+#include "gromacs/mdlib/forcerec.h"
+#include "gromacs/mdtypes/forcerec.h"
+#include "gromacs/mdtypes/interaction_const.h"
+#include "gromacs/mdtypes/md_enums.h"
+#include "gromacs/mdtypes/mdatom.h"
+#include "gromacs/mdtypes/nblist.h"
+#include "gromacs/random/threefry.h"
+#include "gromacs/random/uniformrealdistribution.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/smalloc.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+namespace
+{
+
+//! The VdW setups the SIMD kernel supports
+enum class VdwSetup
+{
+    LJPotentialShift,  //!< Plain LJ with potential-shift
+    LJPotentialSwitch, //!< Plain LJ with potential-switch
+    LJPme              //!< LJ-PME with potential-shift
+};
+
+//! Soft-core parameters: alpha and sc-power
+struct SoftCore
+{
+    real alpha; //!< Soft-core alpha for both Coulomb and VdW
+    int  power; //!< Soft-core lambda power
+};
+
+//! Soft-core off and on with both supported lambda powers
+const SoftCore c_softCores[] = { { 0, 1 }, { 0.5, 1 }, { 0.5, 2 } };
+
+//! Pure A and B states, mixed lambdas and different Coulomb and VdW lambdas
+const real     c_lambdas[][2] = { { 0, 0 }, { 1, 1 }, { 0.5, 0.5 }, { 0.3, 0.7 }, { 0.8, 0.2 } };
+
+//! Cut-off distance for both Coulomb and VdW
+const real     c_rcut     = 1.0;
+//! Number of atoms in the test system
+const int      c_numAtoms = 300;
+//! Every c_perturbedStride-th atom is perturbed
+const int      c_perturbedStride = 15;
+//! Number of atom types
+const int      c_numTypes = 3;
+
+//! Forces, energies and dV/dl computed by a kernel
+struct KernelOutput
+{
+    std::vector<RVec> f;        //!< Forces
+    real              vCoul;    //!< Coulomb energy
+    real              vVdw;     //!< VdW energy
+    real              dvdlCoul; //!< Coulomb dV/dlambda
+    real              dvdlVdw;  //!< VdW dV/dlambda
+};
+
+/*! \brief A box of random atoms with every c_perturbedStride-th atom perturbed
+ *
+ * Sets up all the data the free-energy kernels use for a Verlet
+ * cut-off scheme free-energy pair list with the given interactions.
+ */
+class FepKernelTestSystem
+{
+    public:
+        //! Constructs the system, the Ewald tables and the FEP pair list
+        FepKernelTestSystem(int eeltype, VdwSetup vdwSetup, const SoftCore &softCore)
+        {
+            ThreeFry2x64<64>              rng(123456, RandomDomain::Other);
+            UniformRealDistribution<real> dist;
+            const real                    boxSize = 3.0;
+
+            x_.resize(c_numAtoms);
+            for (auto &xi : x_)
+            {
+                for (int d = 0; d < DIM; d++)
+                {
+                    xi[d] = boxSize*dist(rng);
+                }
+            }
+            chargeA_.resize(c_numAtoms);
+            chargeB_.resize(c_numAtoms);
+            typeA_.resize(c_numAtoms);
+            typeB_.resize(c_numAtoms);
+            for (int i = 0; i < c_numAtoms; i++)
+            {
+                chargeA_[i] = dist(rng) - 0.5;
+                typeA_[i]   = i % 2;
+                chargeB_[i] = chargeA_[i];
+                typeB_[i]   = typeA_[i];
+                if (i % c_perturbedStride == 0)
+                {
+                    /* Decouple some atoms, for others change charge and type */
+                    chargeB_[i] = (i % 2 == 0) ? 0.3 : 0;
+                    typeB_[i]   = (i % 3 == 0) ? 2 : 1;
+                }
+            }
+
+            /* Type 2 has no LJ, as for decoupled atoms */
+            const real c6[c_numTypes]  = { 0.003, 0.002, 0 };
+            const real c12[c_numTypes] = { 3e-6, 2e-6, 0 };
+            nbfp_.resize(2*c_numTypes*c_numTypes);
+            ljPmeC6Grid_.resize(2*c_numTypes*c_numTypes);
+            for (int a = 0; a < c_numTypes; a++)
+            {
+                for (int b = 0; b < c_numTypes; b++)
+                {
+                    const int ab = a*c_numTypes + b;
+                    /* nbfp stores 6*C6 and 12*C12 */
+                    nbfp_[2*ab]        = 6*std::sqrt(c6[a]*c6[b]);
+                    nbfp_[2*ab + 1]    = 12*std::sqrt(c12[a]*c12[b]);
+                    ljPmeC6Grid_[2*ab] = 0.9*nbfp_[2*ab];
+                }
+            }
+
+            setupInteractionConst(eeltype, vdwSetup);
+            setupPairList();
+
+            fr_                   = t_forcerec();
+            fr_.ic                = &ic_;
+            fr_.cutoff_scheme     = ecutsVERLET;
+            fr_.ntype             = c_numTypes;
+            fr_.nbfp              = nbfp_.data();
+            fr_.ljpme_c6grid      = ljPmeC6Grid_.data();
+            fr_.sc_alphacoul      = softCore.alpha;
+            fr_.sc_alphavdw       = softCore.alpha;
+            fr_.sc_power          = softCore.power;
+            fr_.sc_r_power        = 6;
+            fr_.sc_sigma6_def     = gmx::power6(0.3);
+            fr_.sc_sigma6_min     = gmx::power6(0.25);
+            clear_rvec(shiftVec_[0]);
+            fr_.shift_vec         = shiftVec_;
+            fr_.fshift            = fshift_;
+
+            mdatoms_         = t_mdatoms();
+            mdatoms_.chargeA = chargeA_.data();
+            mdatoms_.chargeB = chargeB_.data();
+            mdatoms_.typeA   = typeA_.data();
+            mdatoms_.typeB   = typeB_.data();
+        }
+
+        ~FepKernelTestSystem()
+        {
+            sfree_aligned(ic_.tabq_coul_FDV0);
+            sfree_aligned(ic_.tabq_coul_F);
+            sfree_aligned(ic_.tabq_coul_V);
+            sfree_aligned(ic_.tabq_vdw_FDV0);
+            sfree_aligned(ic_.tabq_vdw_F);
+            sfree_aligned(ic_.tabq_vdw_V);
+        }
+
+        //! Runs gmx_nb_free_energy_kernel at (lambdaCoul,lambdaVdw)
+        KernelOutput runKernel(bool useSimd, real lambdaCoul, real lambdaVdw)
+        {
+            KernelOutput     out;
+            real             lambda[efptNR] = { 0 };
+            real             dvdl[efptNR]   = { 0 };
+            nb_kernel_data_t kernelData     = {};
+            t_nrnb           nrnb;
+
+            init_nrnb(&nrnb);
+            fr_.use_simd_kernels     = useSimd;
+            clear_rvec(fshift_[0]);
+
+            out.f.assign(c_numAtoms, RVec(0, 0, 0));
+            out.vCoul                = 0;
+            out.vVdw                 = 0;
+            lambda[efptCOUL]         = lambdaCoul;
+            lambda[efptVDW]          = lambdaVdw;
+            kernelData.flags         = (GMX_NONBONDED_DO_FORCE |
+                                        GMX_NONBONDED_DO_SHIFTFORCE |
+                                        GMX_NONBONDED_DO_POTENTIAL);
+            kernelData.lambda         = lambda;
+            kernelData.dvdl           = dvdl;
+            kernelData.energygrp_elec = &out.vCoul;
+            kernelData.energygrp_vdw  = &out.vVdw;
+
+            gmx_nb_free_energy_kernel(&nlist_, as_rvec_array(x_.data()), as_rvec_array(out.f.data()),
+                                      &fr_, &mdatoms_, &kernelData, &nrnb);
+
+            out.dvdlCoul = dvdl[efptCOUL];
+            out.dvdlVdw  = dvdl[efptVDW];
+
+            return out;
+        }
+
+        //! Returns whether the single-pass foreign-lambda kernel supports this system
+        bool foreignKernelSupported()
+        {
+            fr_.use_simd_kernels = TRUE;
+
+            return gmx_nb_free_energy_foreign_supported(&fr_);
+        }
+
+        //! Returns the energies at all lambdas from the single-pass foreign-lambda kernel
+        std::vector<real> runForeignKernel(const std::vector<real> &lambdaCoul,
+                                           const std::vector<real> &lambdaVdw)
+        {
+            std::vector<real> energies(lambdaCoul.size(), 0);
+            t_nrnb            nrnb;
+
+            init_nrnb(&nrnb);
+            fr_.use_simd_kernels = TRUE;
+            GMX_RELEASE_ASSERT(gmx_nb_free_energy_foreign_supported(&fr_), "The foreign-lambda kernel should support the test setups");
+
+            gmx_nb_free_energy_foreign_kernel(&nlist_, as_rvec_array(x_.data()), &fr_, &mdatoms_,
+                                              lambdaCoul.size(), lambdaCoul.data(), lambdaVdw.data(),
+                                              energies.data(), &nrnb);
+
+            return energies;
+        }
+
+        /*! \brief Returns the energies at all lambdas computed with one plain-C kernel call per lambda
+         *
+         * This is what do_nb_verlet_fep() does when the single-pass
+         * kernel can not be used.
+         */
+        std::vector<real> runPerLambdaLoop(const std::vector<real> &lambdaCoul,
+                                           const std::vector<real> &lambdaVdw)
+        {
+            std::vector<real> energies;
+            std::vector<RVec> f(c_numAtoms, RVec(0, 0, 0));
+            t_nrnb            nrnb;
+
+            init_nrnb(&nrnb);
+            fr_.use_simd_kernels = FALSE;
+            for (size_t l = 0; l < lambdaCoul.size(); l++)
+            {
+                real             lambda[efptNR] = { 0 };
+                real             dvdl[efptNR]   = { 0 };
+                real             vCoul          = 0;
+                real             vVdw           = 0;
+                nb_kernel_data_t kernelData     = {};
+
+                lambda[efptCOUL]          = lambdaCoul[l];
+                lambda[efptVDW]           = lambdaVdw[l];
+                kernelData.flags          = GMX_NONBONDED_DO_POTENTIAL | GMX_NONBONDED_DO_FOREIGNLAMBDA;
+                kernelData.lambda         = lambda;
+                kernelData.dvdl           = dvdl;
+                kernelData.energygrp_elec = &vCoul;
+                kernelData.energygrp_vdw  = &vVdw;
+
+                gmx_nb_free_energy_kernel(&nlist_, as_rvec_array(x_.data()), as_rvec_array(f.data()),
+                                          &fr_, &mdatoms_, &kernelData, &nrnb);
+
+                energies.push_back(vCoul + vVdw);
+            }
+
+            return energies;
+        }
+
+    private:
+        //! Sets the interaction constants as init_interaction_const does
+        void setupInteractionConst(int eeltype, VdwSetup vdwSetup)
+        {
+            ic_                  = interaction_const_t();
+            ic_.cutoff_scheme    = ecutsVERLET;
+            ic_.epsfac           = ONE_4PI_EPS0;
+            ic_.eeltype          = eeltype;
+            ic_.coulomb_modifier = eintmodPOTSHIFT;
+            ic_.rcoulomb         = c_rcut;
+            ic_.rvdw             = c_rcut;
+            if (EEL_RF(eeltype))
+            {
+                /* Reaction-field with eps_rf=infinity */
+                ic_.k_rf = 0.5/gmx::power3(c_rcut);
+                ic_.c_rf = 1/c_rcut + ic_.k_rf*c_rcut*c_rcut;
+            }
+            else
+            {
+                ic_.ewaldcoeff_q = 3.12;
+                ic_.sh_ewald     = std::erfc(ic_.ewaldcoeff_q*c_rcut)/c_rcut;
+            }
+
+            ic_.vdwtype      = (vdwSetup == VdwSetup::LJPme ? evdwPME : evdwCUT);
+            ic_.vdw_modifier = (vdwSetup == VdwSetup::LJPotentialSwitch ? eintmodPOTSWITCH : eintmodPOTSHIFT);
+            if (vdwSetup == VdwSetup::LJPotentialSwitch)
+            {
+                ic_.rvdw_switch = 0.8;
+            }
+            else
+            {
+                ic_.sh_invrc6 = 1/gmx::power6(c_rcut);
+            }
+            if (vdwSetup == VdwSetup::LJPme)
+            {
+                real crc2;
+
+                ic_.ewaldcoeff_lj = 2.5;
+                crc2              = gmx::square(ic_.ewaldcoeff_lj*c_rcut);
+                ic_.sh_lj_ewald   = (std::exp(-crc2)*(1 + crc2 + 0.5*crc2*crc2) - 1)/gmx::power6(c_rcut);
+            }
+
+            init_interaction_const_tables(nullptr, &ic_, 0);
+        }
+
+        /*! \brief Sets up the FEP list with all pairs of perturbed atoms within range
+         *
+         * Some pairs beyond the cut-off are included, as in the pair search
+         * with a buffer. The self pair and one neighbor are excluded.
+         */
+        void setupPairList()
+        {
+            const real rlist2 = gmx::square(1.1*c_rcut);
+
+            jindex_.push_back(0);
+            for (int i = 0; i < c_numAtoms; i += c_perturbedStride)
+            {
+                iinr_.push_back(i);
+                shift_.push_back(0);
+                gid_.push_back(0);
+                for (int j = 0; j < c_numAtoms; j++)
+                {
+                    /* Pairs of perturbed atoms should only occur once */
+                    if (j < i && j % c_perturbedStride == 0)
+                    {
+                        continue;
+                    }
+                    rvec dx;
+                    rvec_sub(x_[i], x_[j], dx);
+                    if (norm2(dx) < rlist2)
+                    {
+                        jjnr_.push_back(j);
+                        exclFep_.push_back((j == i || j == i + 1) ? 0 : 1);
+                    }
+                }
+                jindex_.push_back(jjnr_.size());
+            }
+
+            nlist_          = t_nblist();
+            nlist_.nri      = iinr_.size();
+            nlist_.iinr     = iinr_.data();
+            nlist_.jindex   = jindex_.data();
+            nlist_.jjnr     = jjnr_.data();
+            nlist_.shift    = shift_.data();
+            nlist_.gid      = gid_.data();
+            nlist_.excl_fep = exclFep_.data();
+        }
+
+        std::vector<RVec>   x_;
+        std::vector<real>   chargeA_;
+        std::vector<real>   chargeB_;
+        std::vector<int>    typeA_;
+        std::vector<int>    typeB_;
+        std::vector<real>   nbfp_;
+        std::vector<real>   ljPmeC6Grid_;
+        std::vector<int>    iinr_;
+        std::vector<int>    jindex_;
+        std::vector<int>    jjnr_;
+        std::vector<int>    shift_;
+        std::vector<int>    gid_;
+        std::vector<char>   exclFep_;
+        rvec                shiftVec_[1];
+        rvec                fshift_[1];
+        interaction_const_t ic_;
+        t_nblist            nlist_;
+        t_forcerec          fr_;
+        t_mdatoms           mdatoms_;
+};
+
+//! Relative tolerance of the SIMD kernel with respect to the plain-C kernel
+const double c_relativeTolerance = (GMX_DOUBLE ? 1e-10 : 1e-4);
+
+//! Tolerance for a quantity with the given magnitude
+test::FloatingPointTolerance toleranceForMagnitude(double magnitude)
+{
+    return test::relativeToleranceAsFloatingPoint(std::max(magnitude, 1.0), c_relativeTolerance);
+}
+
+//! Parameters: electrostatics type, VdW setup, soft-core index, lambda index
+typedef std::tuple<int, VdwSetup, int, int> FepKernelTestParameters;
+
+//! Test fixture for comparing the SIMD and plain-C free-energy kernels
+class FreeEnergyKernelTest : public ::testing::TestWithParam<FepKernelTestParameters>
+{
+};
+
+TEST_P(FreeEnergyKernelTest, SimdMatchesPlainC)
+{
+    const int            eeltype    = std::get<0>(GetParam());
+    const VdwSetup       vdwSetup   = std::get<1>(GetParam());
+    const SoftCore      &softCore   = c_softCores[std::get<2>(GetParam())];
+    const real           lambdaCoul = c_lambdas[std::get<3>(GetParam())][0];
+    const real           lambdaVdw  = c_lambdas[std::get<3>(GetParam())][1];
+
+    FepKernelTestSystem  system(eeltype, vdwSetup, softCore);
+
+    const KernelOutput   ref  = system.runKernel(false, lambdaCoul, lambdaVdw);
+    /* Without SIMD support this runs the plain-C fall-back of the dispatch */
+    const KernelOutput   simd = system.runKernel(true, lambdaCoul, lambdaVdw);
+
+    /* Without soft-core close pairs give large forces, so we compare
+     * all force components relative to the largest one.
+     */
+    real fMax = 0;
+    for (const RVec &f : ref.f)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            fMax = std::max(fMax, std::abs(f[d]));
+        }
+    }
+    const test::FloatingPointTolerance forceTolerance = toleranceForMagnitude(fMax);
+    for (int i = 0; i < c_numAtoms; i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            EXPECT_REAL_EQ_TOL(ref.f[i][d], simd.f[i][d], forceTolerance) << "atom " << i << " dim " << d;
+        }
+    }
+
+    EXPECT_REAL_EQ_TOL(ref.vCoul, simd.vCoul, toleranceForMagnitude(std::abs(ref.vCoul)));
+    EXPECT_REAL_EQ_TOL(ref.vVdw, simd.vVdw, toleranceForMagnitude(std::abs(ref.vVdw)));
+    EXPECT_REAL_EQ_TOL(ref.dvdlCoul, simd.dvdlCoul, toleranceForMagnitude(std::abs(ref.dvdlCoul)));
+    EXPECT_REAL_EQ_TOL(ref.dvdlVdw, simd.dvdlVdw, toleranceForMagnitude(std::abs(ref.dvdlVdw)));
+}
+
+INSTANTIATE_TEST_CASE_P(Interactions, FreeEnergyKernelTest,
+                            ::testing::Combine(::testing::Values(eelRF, eelPME),
+                                                   ::testing::Values(VdwSetup::LJPotentialShift,
+                                                                     VdwSetup::LJPotentialSwitch,
+                                                                     VdwSetup::LJPme),
+                                                   ::testing::Range(0, static_cast<int>(sizeof(c_softCores)/sizeof(c_softCores[0]))),
+                                                   ::testing::Range(0, static_cast<int>(sizeof(c_lambdas)/sizeof(c_lambdas[0])))));
+
+//! Parameters: electrostatics type, VdW setup, soft-core index
+typedef std::tuple<int, VdwSetup, int> FepForeignKernelTestParameters;
+
+//! Test fixture for comparing the single-pass foreign-lambda kernel with a loop over lambdas
+class FreeEnergyForeignKernelTest : public ::testing::TestWithParam<FepForeignKernelTestParameters>
+{
+};
+
+TEST_P(FreeEnergyForeignKernelTest, SinglePassMatchesPerLambdaLoop)
+{
+    const int            eeltype  = std::get<0>(GetParam());
+    const VdwSetup       vdwSetup = std::get<1>(GetParam());
+    const SoftCore      &softCore = c_softCores[std::get<2>(GetParam())];
+
+    FepKernelTestSystem  system(eeltype, vdwSetup, softCore);
+
+    if (!GMX_SIMD_HAVE_REAL)
+    {
+        /* mdrun then always uses the per-lambda loop */
+        EXPECT_FALSE(system.foreignKernelSupported());
+        std::cout << "Skipping the single-pass foreign-lambda kernel test: "
+                  << "it requires SIMD support, which this build does not have" << std::endl;
+        return;
+    }
+
+    /* As in do_nb_verlet_fep(), the first entry is the current lambda,
+     * followed by the foreign lambdas, including the end states and
+     * different Coulomb and VdW lambdas.
+     */
+    const std::vector<real> lambdaCoul = { 0.3, 0, 0.2, 0.5, 0.8, 1, 1 };
+    const std::vector<real> lambdaVdw  = { 0.7, 0, 0.2, 0.5, 1, 0.4, 1 };
+
+    const std::vector<real> ref        = system.runPerLambdaLoop(lambdaCoul, lambdaVdw);
+    const std::vector<real> singlePass = system.runForeignKernel(lambdaCoul, lambdaVdw);
+
+    ASSERT_EQ(ref.size(), singlePass.size());
+    for (size_t l = 0; l < ref.size(); l++)
+    {
+        EXPECT_REAL_EQ_TOL(ref[l], singlePass[l], toleranceForMagnitude(std::abs(ref[l]))) << "lambda index " << l;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Interactions, FreeEnergyForeignKernelTest,
+                            ::testing::Combine(::testing::Values(eelRF, eelPME),
+                                                   ::testing::Values(VdwSetup::LJPotentialShift,
+                                                                     VdwSetup::LJPotentialSwitch,
+                                                                     VdwSetup::LJPme),
+                                                   ::testing::Range(0, static_cast<int>(sizeof(c_softCores)/sizeof(c_softCores[0])))));
+
+}      // namespace
+}      // namespace gmx
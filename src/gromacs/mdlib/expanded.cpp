@@ -65,6 +65,8 @@
 #include "gromacs/mdtypes/state.h"
 #include "gromacs/random/threefry.h"
 #include "gromacs/random/uniformrealdistribution.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
 #include "gromacs/timing/wallcycle.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/gmxmpi.h"
@@ -91,85 +93,97 @@ void init_expanded_ensemble(gmx_bool bStateFromCP, t_inputrec *ir, df_history_t
     }
 }
 
-static void GenerateGibbsProbabilities(real *ene, double *p_k, double *pks, int minfep, int maxfep)
+/* Replaces x[i] by exp(x[i]) for 0 <= i < n and returns the sum */
+static double ExponentiateAndSum(double *x, int n)
 {
+    double sum = 0;
+    int    i   = 0;
 
-    int  i;
-    real maxene;
+#if GMX_SIMD_HAVE_DOUBLE && GMX_SIMD_HAVE_LOADU
+    gmx::SimdDouble sumS = gmx::setZero();
+    for (; i + GMX_SIMD_DOUBLE_WIDTH <= n; i += GMX_SIMD_DOUBLE_WIDTH)
+    {
+        gmx::SimdDouble expS = gmx::exp(gmx::loadU<gmx::SimdDouble>(x + i));
+        gmx::storeU(x + i, expS);
+        sumS = sumS + expS;
+    }
+    sum = gmx::reduce(sumS);
+#endif
+    for (; i < n; i++)
+    {
+        x[i] = std::exp(x[i]);
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+/* Computes the Gibbs probabilities p_k[i] = exp(ene[i])/sum_j exp(ene[j])
+ * for minfep <= i <= maxfep. The maximum exponent is subtracted
+ * (log-sum-exp), so the exponentials can not overflow and at least one
+ * of them is one. Returns the denominator in the shifted frame in *pks.
+ */
+static void GenerateGibbsProbabilities(const real *ene, double *p_k, double *pks, int minfep, int maxfep)
+{
+    int    i;
+    double maxene, invsum;
 
-    *pks   = 0.0;
     maxene = ene[minfep];
-    /* find the maximum value */
     for (i = minfep; i <= maxfep; i++)
     {
-        if (ene[i] > maxene)
-        {
-            maxene = ene[i];
-        }
+        maxene = std::max(maxene, static_cast<double>(ene[i]));
     }
-    /* find the denominator */
     for (i = minfep; i <= maxfep; i++)
     {
-        *pks += std::exp(ene[i]-maxene);
+        p_k[i] = ene[i] - maxene;
     }
-    /*numerators*/
+
+    *pks   = ExponentiateAndSum(p_k + minfep, maxfep - minfep + 1);
+    invsum = 1.0/(*pks);
     for (i = minfep; i <= maxfep; i++)
     {
-        p_k[i] = std::exp(ene[i]-maxene) / *pks;
+        p_k[i] *= invsum;
     }
 }
 
-static void GenerateWeightedGibbsProbabilities(real *ene, double *p_k, double *pks, int nlim, real *nvals, real delta)
+/* As GenerateGibbsProbabilities, but with the energies weighted by
+ * the histogram counts nvals over all nlim states
+ */
+static void GenerateWeightedGibbsProbabilities(const real *ene, double *p_k, double *pks, int nlim, const real *nvals, real delta)
 {
+    int    i;
+    double maxene, invsum;
 
-    int   i;
-    real  maxene;
-    real *nene;
-    *pks = 0.0;
-
-    snew(nene, nlim);
     for (i = 0; i < nlim; i++)
     {
         if (nvals[i] == 0)
         {
             /* add the delta, since we need to make sure it's greater than zero, and
                we need a non-arbitrary number? */
-            nene[i] = ene[i] + std::log(nvals[i]+delta);
+            p_k[i] = ene[i] + std::log(static_cast<double>(nvals[i] + delta));
         }
         else
         {
-            nene[i] = ene[i] + std::log(nvals[i]);
-        }
-    }
-
-    /* find the maximum value */
-    maxene = nene[0];
-    for (i = 0; i < nlim; i++)
-    {
-        if (nene[i] > maxene)
-        {
-            maxene = nene[i];
+            p_k[i] = ene[i] + std::log(static_cast<double>(nvals[i]));
         }
     }
 
-    /* subtract off the maximum, avoiding overflow */
+    maxene = p_k[0];
     for (i = 0; i < nlim; i++)
     {
-        nene[i] -= maxene;
+        maxene = std::max(maxene, p_k[i]);
     }
-
-    /* find the denominator */
     for (i = 0; i < nlim; i++)
     {
-        *pks += std::exp(nene[i]);
+        p_k[i] -= maxene;
     }
 
-    /*numerators*/
+    *pks   = ExponentiateAndSum(p_k, nlim);
+    invsum = 1.0/(*pks);
     for (i = 0; i < nlim; i++)
     {
-        p_k[i] = std::exp(nene[i]) / *pks;
+        p_k[i] *= invsum;
     }
-    sfree(nene);
 }
 
 static int FindMinimum(real *min_metric, int N)
@@ -700,16 +714,116 @@ static gmx_bool UpdateWeights(int nlim, t_expanded *expand, df_history_t *dfhist
     return FALSE;
 }
 
-static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, int fep_state, real *weighted_lamee, double *p_k,
-                           gmx_int64_t seed, gmx_int64_t step)
+/* Returns the range of states a Gibbs move from fep_state can go to */
+static void GetGibbsRange(const t_expanded *expand, int nlim, int fep_state, int *minfep, int *maxfep)
+{
+    if (expand->gibbsdeltalam < 0)
+    {
+        *minfep = 0;
+        *maxfep = nlim-1;
+    }
+    else
+    {
+        *minfep = std::max(fep_state - expand->gibbsdeltalam, 0);
+        *maxfep = std::min(fep_state + expand->gibbsdeltalam, nlim-1);
+    }
+}
+
+/* Computes the Gibbs probabilities p_k over minfep..maxfep, their running
+ * sum and 1 - p_k, which are needed for sampling new states. Generates
+ * a fatal error with the weights when the probabilities are not finite.
+ */
+static void GenerateGibbsSamplingData(const real *weighted_lamee, const df_history_t *dfhist,
+                                      double *p_k, double *cumulative, double *remainder,
+                                      int minfep, int maxfep)
+{
+    int    ifep;
+    double pks, sum;
+
+    GenerateGibbsProbabilities(weighted_lamee, p_k, &pks, minfep, maxfep);
+
+    if (!std::isfinite(pks))
+    {
+        int   loc    = 0;
+        int   nerror = 200+(maxfep-minfep+1)*60;
+        char *errorstr;
+        snew(errorstr, nerror);
+        /* Generate detailed info for failure */
+        loc += sprintf(errorstr, "Something wrong in choosing new lambda state with a Gibbs move -- probably underflow in weight determination.\nDenominator is: %3d%17.10e\n  i                dE        numerator          weights\n", 0, pks);
+        for (ifep = minfep; ifep <= maxfep; ifep++)
+        {
+            loc += sprintf(&errorstr[loc], "%3d %17.10e%17.10e%17.10e\n", ifep, weighted_lamee[ifep], p_k[ifep], dfhist->sum_weights[ifep]);
+        }
+        gmx_fatal(FARGS, errorstr);
+    }
+
+    sum = 0;
+    for (ifep = minfep; ifep <= maxfep; ifep++)
+    {
+        sum              += p_k[ifep];
+        cumulative[ifep]  = sum;
+        remainder[ifep]   = 1 - p_k[ifep];
+    }
+}
+
+/* Returns the first state in first..last for which the cumulative
+ * probability is at least r, or last when rounding puts r beyond the sum.
+ * This is a binary search, so drawing a state is O(log(nlim)).
+ */
+static int FindInCumulative(const double *cumulative, int first, int last, double r)
+{
+    return first + static_cast<int>(std::lower_bound(cumulative + first, cumulative + last, r) - (cumulative + first));
+}
+
+/* Adds the expected transitions of nmoves Gibbs moves from fep_state
+ * to the transition matrix. These only depend on the starting state,
+ * so they are added once per state instead of once per move.
+ */
+static void AccumulateGibbsTransitions(const t_expanded *expand, df_history_t *dfhist, int fep_state,
+                                       const double *p_k, const double *remainder,
+                                       int minfep, int maxfep, double nmoves)
+{
+    int    ifep;
+    double propose, accept, stay;
+    real  *Tij = dfhist->Tij[fep_state];
+
+    if (expand->elmcmove == elmcmoveGIBBS)
+    {
+        /* all proposals are accepted */
+        for (ifep = minfep; ifep <= maxfep; ifep++)
+        {
+            Tij[ifep] += nmoves*p_k[ifep];
+        }
+    }
+    else if (remainder[fep_state] != 0)
+    {
+        /* Metropolized Gibbs never proposes the current state, rejected
+           proposals stay there. When only the current state has any
+           probability, nothing is proposed at all. */
+        stay = 0;
+        for (ifep = minfep; ifep <= maxfep; ifep++)
+        {
+            propose = (ifep != fep_state) ? p_k[ifep]/remainder[fep_state] : 0;
+            /* acceptance probability is min{1,\frac{1 - p(old)}{1-p(new)} */
+            accept  = (remainder[ifep] != 0) ? std::min(remainder[fep_state]/remainder[ifep], 1.0) : 1.0;
+
+            Tij[ifep] += nmoves*propose*accept;
+            stay      += propose*(1.0 - accept);
+        }
+        Tij[fep_state] += nmoves*stay;
+    }
+}
+
+int ChooseNewLambda(int nlim, const t_expanded *expand, df_history_t *dfhist, int fep_state, const real *weighted_lamee, double *p_k,
+                    gmx_int64_t seed, gmx_int64_t step)
 {
     /* Choose new lambda value, and update transition matrix */
 
-    int                                  i, ifep, minfep, maxfep, lamnew, lamtrial, starting_fep_state;
+    int                                  i, ifep, minfep, maxfep, lamnew, lamtrial, starting_fep_state, pkState;
     real                                 r1, r2, de, trialprob, tprob = 0;
-    double                              *propose, *accept, *remainder;
-    double                               pks;
-    real                                 pnorm;
+    double                              *cumulative = nullptr, *remainder = nullptr, *nGibbsMoves = nullptr;
+    double                               r;
+    gmx_bool                             bGibbs, bFullRange;
     gmx::ThreeFry2x64<0>                 rng(seed, gmx::RandomDomain::ExpandedEnsemble); // We only draw once, so zero bits internal counter is fine
     gmx::UniformRealDistribution<real>   dist;
 
@@ -741,74 +855,43 @@ static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, i
         }
     }
 
-    snew(propose, nlim);
-    snew(accept, nlim);
-    snew(remainder, nlim);
+    bGibbs     = ((expand->elmcmove == elmcmoveGIBBS) || (expand->elmcmove == elmcmoveMETGIBBS));
+    /* Over the full range the Gibbs probabilities do not depend on the
+       current state, so they are only computed once for all repeats */
+    bFullRange = (expand->gibbsdeltalam < 0);
+    pkState    = -1;
+    if (bGibbs)
+    {
+        snew(cumulative, nlim);
+        snew(remainder, nlim);
+        snew(nGibbsMoves, nlim);
+    }
 
     for (i = 0; i < expand->lmc_repeats; i++)
     {
         rng.restart(step, i);
         dist.reset();
 
-        for (ifep = 0; ifep < nlim; ifep++)
-        {
-            propose[ifep] = 0;
-            accept[ifep]  = 0;
-        }
-
-        if ((expand->elmcmove == elmcmoveGIBBS) || (expand->elmcmove == elmcmoveMETGIBBS))
+        if (bGibbs)
         {
             /* use the Gibbs sampler, with restricted range */
-            if (expand->gibbsdeltalam < 0)
-            {
-                minfep      = 0;
-                maxfep      = nlim-1;
-            }
-            else
+            GetGibbsRange(expand, nlim, fep_state, &minfep, &maxfep);
+            if (pkState < 0 || (!bFullRange && pkState != fep_state))
             {
-                minfep = fep_state - expand->gibbsdeltalam;
-                maxfep = fep_state + expand->gibbsdeltalam;
-                if (minfep < 0)
-                {
-                    minfep = 0;
-                }
-                if (maxfep > nlim-1)
-                {
-                    maxfep = nlim-1;
-                }
+                GenerateGibbsSamplingData(weighted_lamee, dfhist, p_k, cumulative, remainder, minfep, maxfep);
+                pkState = fep_state;
             }
-
-            GenerateGibbsProbabilities(weighted_lamee, p_k, &pks, minfep, maxfep);
+            nGibbsMoves[fep_state] += 1;
 
             if (expand->elmcmove == elmcmoveGIBBS)
             {
-                for (ifep = minfep; ifep <= maxfep; ifep++)
-                {
-                    propose[ifep] = p_k[ifep];
-                    accept[ifep]  = 1.0;
-                }
                 /* Gibbs sampling */
-                r1 = dist(rng);
-                for (lamnew = minfep; lamnew <= maxfep; lamnew++)
-                {
-                    if (r1 <= p_k[lamnew])
-                    {
-                        break;
-                    }
-                    r1 -= p_k[lamnew];
-                }
+                r1     = dist(rng);
+                lamnew = FindInCumulative(cumulative, minfep, maxfep, r1);
             }
             else if (expand->elmcmove == elmcmoveMETGIBBS)
             {
-
                 /* Metropolized Gibbs sampling */
-                for (ifep = minfep; ifep <= maxfep; ifep++)
-                {
-                    remainder[ifep] = 1 - p_k[ifep];
-                }
-
-                /* find the proposal probabilities */
-
                 if (remainder[fep_state] == 0)
                 {
                     /* only the current state has any probability */
@@ -817,33 +900,19 @@ static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, i
                 }
                 else
                 {
-                    for (ifep = minfep; ifep <= maxfep; ifep++)
+                    /* select lamtrial according to p(lamtrial)/1-p(fep_state),
+                       i.e. from the running sum with fep_state left out */
+                    r1 = dist(rng);
+                    r  = r1*remainder[fep_state];
+                    if (fep_state == maxfep || (fep_state > minfep && r <= cumulative[fep_state-1]))
                     {
-                        if (ifep != fep_state)
-                        {
-                            propose[ifep] = p_k[ifep]/remainder[fep_state];
-                        }
-                        else
-                        {
-                            propose[ifep] = 0;
-                        }
+                        lamtrial = FindInCumulative(cumulative, minfep, fep_state-1, r);
                     }
-
-                    r1 = dist(rng);
-                    for (lamtrial = minfep; lamtrial <= maxfep; lamtrial++)
+                    else
                     {
-                        pnorm = p_k[lamtrial]/remainder[fep_state];
-                        if (lamtrial != fep_state)
-                        {
-                            if (r1 <= pnorm)
-                            {
-                                break;
-                            }
-                            r1 -= pnorm;
-                        }
+                        lamtrial = FindInCumulative(cumulative, fep_state+1, maxfep, r + p_k[fep_state]);
                     }
 
-                    /* we have now selected lamtrial according to p(lamtrial)/1-p(fep_state) */
                     tprob = 1.0;
                     /* trial probability is min{1,\frac{1 - p(old)}{1-p(new)} MRS 1/8/2008 */
                     trialprob = (remainder[fep_state])/(remainder[lamtrial]);
@@ -861,52 +930,6 @@ static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, i
                         lamnew = fep_state;
                     }
                 }
-
-                /* now figure out the acceptance probability for each */
-                for (ifep = minfep; ifep <= maxfep; ifep++)
-                {
-                    tprob = 1.0;
-                    if (remainder[ifep] != 0)
-                    {
-                        trialprob = (remainder[fep_state])/(remainder[ifep]);
-                    }
-                    else
-                    {
-                        trialprob = 1.0; /* this state is the only choice! */
-                    }
-                    if (trialprob < tprob)
-                    {
-                        tprob = trialprob;
-                    }
-                    /* probability for fep_state=0, but that's fine, it's never proposed! */
-                    accept[ifep] = tprob;
-                }
-            }
-
-            if (lamnew > maxfep)
-            {
-                /* it's possible some rounding is failing */
-                if (gmx_within_tol(remainder[fep_state], 0, 50*GMX_DOUBLE_EPS))
-                {
-                    /* numerical rounding error -- no state other than the original has weight */
-                    lamnew = fep_state;
-                }
-                else
-                {
-                    /* probably not a numerical issue */
-                    int   loc    = 0;
-                    int   nerror = 200+(maxfep-minfep+1)*60;
-                    char *errorstr;
-                    snew(errorstr, nerror);
-                    /* if its greater than maxfep, then something went wrong -- probably underflow in the calculation
-                       of sum weights. Generated detailed info for failure */
-                    loc += sprintf(errorstr, "Something wrong in choosing new lambda state with a Gibbs move -- probably underflow in weight determination.\nDenominator is: %3d%17.10e\n  i                dE        numerator          weights\n", 0, pks);
-                    for (ifep = minfep; ifep <= maxfep; ifep++)
-                    {
-                        loc += sprintf(&errorstr[loc], "%3d %17.10e%17.10e%17.10e\n", ifep, weighted_lamee[ifep], p_k[ifep], dfhist->sum_weights[ifep]);
-                    }
-                    gmx_fatal(FARGS, errorstr);
-                }
             }
         }
         else if ((expand->elmcmove == elmcmoveMETROPOLIS) || (expand->elmcmove == elmcmoveBARKER))
@@ -945,22 +968,18 @@ static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, i
                 {
                     tprob = trialprob;
                 }
-                propose[fep_state] = 0;
-                propose[lamtrial]  = 1.0; /* note that this overwrites the above line if fep_state = ntrial, which only occurs at the ends */
-                accept[fep_state]  = 1.0; /* doesn't actually matter, never proposed unless fep_state = ntrial, in which case it's 1.0 anyway */
-                accept[lamtrial]   = tprob;
-
             }
             else if (expand->elmcmove == elmcmoveBARKER)
             {
                 tprob = 1.0/(1.0+std::exp(-de));
-
-                propose[fep_state] = (1-tprob);
-                propose[lamtrial] += tprob; /* we add, to account for the fact that at the end, they might be the same point */
-                accept[fep_state]  = 1.0;
-                accept[lamtrial]   = 1.0;
             }
 
+            /* Only lamtrial is proposed, with both samplers the move goes
+               there with probability tprob. At the ends lamtrial can be
+               fep_state, in which case the two updates sum to one. */
+            dfhist->Tij[fep_state][lamtrial]  += tprob;
+            dfhist->Tij[fep_state][fep_state] += 1.0 - tprob;
+
             r2 = dist(rng);
             if (r2 < tprob)
             {
@@ -972,20 +991,31 @@ static int ChooseNewLambda(int nlim, t_expanded *expand, df_history_t *dfhist, i
             }
         }
 
+        fep_state = lamnew;
+    }
+
+    if (bGibbs)
+    {
         for (ifep = 0; ifep < nlim; ifep++)
         {
-            dfhist->Tij[fep_state][ifep]      += propose[ifep]*accept[ifep];
-            dfhist->Tij[fep_state][fep_state] += propose[ifep]*(1.0-accept[ifep]);
+            if (nGibbsMoves[ifep] > 0)
+            {
+                GetGibbsRange(expand, nlim, ifep, &minfep, &maxfep);
+                if (!bFullRange && pkState != ifep)
+                {
+                    GenerateGibbsSamplingData(weighted_lamee, dfhist, p_k, cumulative, remainder, minfep, maxfep);
+                    pkState = ifep;
+                }
+                AccumulateGibbsTransitions(expand, dfhist, ifep, p_k, remainder, minfep, maxfep, nGibbsMoves[ifep]);
+            }
         }
-        fep_state = lamnew;
+        sfree(cumulative);
+        sfree(remainder);
+        sfree(nGibbsMoves);
     }
 
     dfhist->Tij_empirical[starting_fep_state][lamnew] += 1.0;
 
-    sfree(propose);
-    sfree(accept);
-    sfree(remainder);
-
     return lamnew;
 }
 
@@ -59,6 +59,13 @@ int ExpandedEnsembleDynamics(FILE *log, t_inputrec *ir, gmx_enerdata_t *enerd,
                              gmx_int64_t step,
                              rvec *v, t_mdatoms *mdatoms);
 
+/* Chooses a new lambda state from fep_state with the expand->elmcmove
+ * moves and adds the transitions to dfhist->Tij and Tij_empirical.
+ * p_k is a work buffer of nlim elements. Only exposed for testing.
+ */
+int ChooseNewLambda(int nlim, const t_expanded *expand, df_history_t *dfhist, int fep_state, const real *weighted_lamee, double *p_k,
+                    gmx_int64_t seed, gmx_int64_t step);
+
 void PrintFreeEnergyInfoToFile(FILE *outfile, t_lambda *fep, t_expanded *expand, t_simtemp *simtemp, df_history_t *dfhist,
                                int fep_state, int frequency, gmx_int64_t step);
 
@@ -38,11 +38,15 @@
 
 #include "groupcoord.h"
 
+#include <algorithm>
+
 #include "gromacs/domdec/ga2la.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/mdtypes/commrec.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/utility/gmxmpi.h"
+#include "gromacs/utility/real.h"
 #include "gromacs/utility/smalloc.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -268,6 +272,75 @@ extern void communicate_group_positions(
 }
 
 
+/* Make the local positions of the group whole with the collective shifts
+ * from the last call to communicate_group_positions */
+extern void get_local_group_positions_whole(
+        const rvec      *x_loc,    /* Local positions on this node */
+        const int        nr_loc,   /* Local number of atoms in the group */
+        const int       *anrs_loc, /* Local atom numbers */
+        const int       *coll_ind, /* Collective index */
+        const ivec      *shifts,   /* Collective array of shifts */
+        matrix           box,      /* The box */
+        rvec            *x_whole)  /* OUT: The local positions made whole [0..nr_loc] */
+{
+    int  i, tx, ty, tz;
+
+
+    for (i = 0; i < nr_loc; i++)
+    {
+        copy_rvec(x_loc[anrs_loc[i]], x_whole[i]);
+
+        tx = shifts[coll_ind[i]][XX];
+        ty = shifts[coll_ind[i]][YY];
+        tz = shifts[coll_ind[i]][ZZ];
+
+        x_whole[i][XX] += tx*box[XX][XX]+ty*box[YY][XX]+tz*box[ZZ][XX];
+        x_whole[i][YY] += ty*box[YY][YY]+tz*box[ZZ][YY];
+        x_whole[i][ZZ] += tz*box[ZZ][ZZ];
+    }
+}
+
+
+/* Get the global range of the local positions projected onto vec */
+extern void get_projection_range_comm(
+        const t_commrec *cr,
+        rvec             x_loc[],  /* Local positions */
+        int              nr_loc,   /* Local number of atoms */
+        const rvec       vec,      /* The vector to project onto */
+        real            *proj_min, /* OUT: Smallest projection of all nodes */
+        real            *proj_max) /* OUT: Largest projection of all nodes */
+{
+    int  i;
+    real proj;
+    real buf[2];
+
+
+    /* The minimum is stored negated, so we need only a single max-reduction */
+    buf[0] = -GMX_REAL_MAX;
+    buf[1] = -GMX_REAL_MAX;
+    for (i = 0; i < nr_loc; i++)
+    {
+        proj   = iprod(x_loc[i], vec);
+        buf[0] = std::max(buf[0], -proj);
+        buf[1] = std::max(buf[1], proj);
+    }
+
+#if GMX_MPI
+    if (PAR(cr))
+    {
+        real buf_loc[2] = { buf[0], buf[1] };
+
+        MPI_Allreduce(buf_loc, buf, 2, GMX_MPI_REAL, MPI_MAX, cr->mpi_comm_mygroup);
+    }
+#else
+    GMX_UNUSED_VALUE(cr);
+#endif
+
+    *proj_min = -buf[0];
+    *proj_max =  buf[1];
+}
+
+
 /* Determine the (weighted) sum vector from positions x */
 extern double get_sum_of_positions(rvec x[], real weight[], const int nat, dvec dsumvec)
 {
@@ -133,6 +133,48 @@ extern void communicate_group_positions(const t_commrec *cr, rvec *xcoll, ivec *
                                         int *anrs_loc, int *coll_ind, rvec *xcoll_old,
                                         matrix box);
 
+/*! \brief Make the local positions of a group whole without communication.
+ *
+ * Copies the local positions of the group and applies the collective shifts
+ * that were determined by the last call to communicate_group_positions.
+ * Since the shifts only change after neighbor searching, between neighbor
+ * searching steps the result is identical to the corresponding entries of
+ * the assembled collective array. This allows computing quantities that
+ * are sums over the group's atoms from the local atoms only, followed by
+ * a single small reduction, instead of assembling all positions.
+ *
+ * \param[in]     x_loc        Pointer to the local atom positions this node has.
+ * \param[in]     nr_loc       Number of group atoms on the local node.
+ * \param[in]     anrs_loc     Array of the local atom indices.
+ * \param[in]     coll_ind     Position of each local atom in the collective array.
+ * \param[in]     shifts       Collective array of shifts, as maintained by
+ *                             communicate_group_positions.
+ * \param[in]     box          Simulation box matrix.
+ * \param[out]    x_whole      The local positions made whole [0..nr_loc].
+ */
+extern void get_local_group_positions_whole(const rvec *x_loc, const int nr_loc,
+                                            const int *anrs_loc, const int *coll_ind,
+                                            const ivec *shifts, matrix box,
+                                            rvec *x_whole);
+
+
+/*! \brief Calculates the global range of local positions projected onto a vector.
+ *
+ * Determines the smallest and the largest projection x_loc[i].vec of
+ * the positions of all nodes with a single reduction of two values.
+ * Nodes without local atoms do not contribute.
+ *
+ * \param[in]   cr           Pointer to MPI communication data.
+ * \param[in]   x_loc        Array of local positions [0..nr_loc].
+ * \param[in]   nr_loc       The number of positions on the local node.
+ * \param[in]   vec          The vector to project onto.
+ * \param[out]  proj_min     The smallest projection over all nodes.
+ * \param[out]  proj_max     The largest projection over all nodes.
+ */
+extern void get_projection_range_comm(const t_commrec *cr, rvec x_loc[], int nr_loc,
+                                      const rvec vec, real *proj_min, real *proj_max);
+
+
 /*! \brief Calculates the center of the positions x locally.
  *
  * Calculates the center of mass (if masses are given in the weight array) or
@@ -156,12 +156,14 @@ void compute_globals(FILE *fplog, gmx_global_stat *gstat, t_commrec *cr, t_input
                      tensor pres, rvec mu_tot, gmx::Constraints *constr,
                      gmx::SimulationSignaller *signalCoordinator,
                      matrix box, int *totalNumberOfBondedInteractions,
-                     gmx_bool *bSumEkinhOld, int flags)
+                     gmx_bool *bSumEkinhOld, int flags,
+                     const std::function<void()> &overlappingWork)
 {
     tensor   corr_vir, corr_pres;
     gmx_bool bEner, bPres, bTemp;
     gmx_bool bStopCM, bGStat,
              bReadEkin, bEkinAveVel, bScaleEkin, bConstrain;
+    gmx_bool bGlobalSumInFlight = FALSE;
     real     prescorr, enercorr, dvdlcorr, dvdl_ekin;
 
     /* translate CGLO flags to gmx_booleans */
@@ -223,18 +225,48 @@ void compute_globals(FILE *fplog, gmx_global_stat *gstat, t_commrec *cr, t_input
             if (PAR(cr))
             {
                 wallcycle_start(wcycle, ewcMoveE);
-                global_stat(gstat, cr, enerd, force_vir, shake_vir, mu_tot,
-                            ir, ekind, constr, bStopCM ? vcm : nullptr,
-                            signalBuffer.size(), signalBuffer.data(),
-                            totalNumberOfBondedInteractions,
-                            *bSumEkinhOld, flags);
+                global_stat_start(gstat, cr, enerd, force_vir, shake_vir, mu_tot,
+                                  ir, ekind, constr, bStopCM ? vcm : nullptr,
+                                  signalBuffer.size(), signalBuffer.data(),
+                                  totalNumberOfBondedInteractions,
+                                  *bSumEkinhOld, flags);
                 wallcycle_stop(wcycle, ewcMoveE);
+                bGlobalSumInFlight = TRUE;
+            }
+            else
+            {
+                signalCoordinator->finalizeSignals();
+                *bSumEkinhOld = FALSE;
             }
-            signalCoordinator->finalizeSignals();
-            *bSumEkinhOld = FALSE;
         }
     }
 
+    /* The work below does not depend on the sums, so we do it
+     * while the global summation is in progress.
+     */
+    if (overlappingWork)
+    {
+        overlappingWork();
+    }
+
+    /* ##########  Long range energy information ###### */
+
+    /* This only depends on the box and lambda */
+    if (bEner || bPres || bConstrain)
+    {
+        calc_dispcorr(ir, fr, box, state->lambda[efptVDW],
+                      corr_pres, corr_vir, &prescorr, &enercorr, &dvdlcorr);
+    }
+
+    if (bGlobalSumInFlight)
+    {
+        wallcycle_start(wcycle, ewcMoveE);
+        global_stat_finish(gstat, cr);
+        wallcycle_stop(wcycle, ewcMoveE);
+        signalCoordinator->finalizeSignals();
+        *bSumEkinhOld = FALSE;
+    }
+
     /* Do center of mass motion removal */
     if (bStopCM)
     {
@@ -274,14 +306,6 @@ void compute_globals(FILE *fplog, gmx_global_stat *gstat, t_commrec *cr, t_input
         enerd->term[F_EKIN] = trace(ekind->ekin);
     }
 
-    /* ##########  Long range energy information ###### */
-
-    if (bEner || bPres || bConstrain)
-    {
-        calc_dispcorr(ir, fr, box, state->lambda[efptVDW],
-                      corr_pres, corr_vir, &prescorr, &enercorr, &dvdlcorr);
-    }
-
     if (bEner)
     {
         enerd->term[F_DISPCORR]  = enercorr;
@@ -37,6 +37,8 @@
 #ifndef GMX_MDLIB_MD_SUPPORT_H
 #define GMX_MDLIB_MD_SUPPORT_H
 
+#include <functional>
+
 #include "gromacs/mdlib/vcm.h"
 #include "gromacs/timing/wallcycle.h"
 
@@ -126,7 +128,11 @@ void compute_globals(FILE *fplog, gmx_global_stat *gstat, t_commrec *cr, t_input
                      tensor pres, rvec mu_tot, gmx::Constraints *constr,
                      gmx::SimulationSignaller *signalCoordinator,
                      matrix box, int *totalNumberOfBondedInteractions,
-                     gmx_bool *bSumEkinhOld, int flags);
-/* Compute global variables during integration */
+                     gmx_bool *bSumEkinhOld, int flags,
+                     const std::function<void()> &overlappingWork = std::function<void()>());
+/* Compute global variables during integration.
+ * When set, overlappingWork is called while the global summation is
+ * in progress, so it should not use or modify any of the summed data.
+ */
 
 #endif
@@ -148,7 +148,8 @@ struct MdrunOptions
         ntompOptionIsSet(FALSE),
         imdOptions(),
         verbose(FALSE),
-        verboseStepPrintInterval(100)
+        verboseStepPrintInterval(100),
+        awhShareFullGrid(FALSE)
     {
     }
 
@@ -182,6 +183,8 @@ struct MdrunOptions
     gmx_bool            verbose;
     //! If verbose=true, print remaining runtime at this step interval
     int                 verboseStepPrintInterval;
+    //! Sum the data of all AWH points when sharing biases between simulations, only used as a reference for testing
+    gmx_bool            awhShareFullGrid;
 };
 
 //! \brief Allocate and initialize node-local state entries
@@ -139,6 +139,22 @@ void sum_bin(t_bin *b, const t_commrec *cr)
     gmx_sumd(b->maxreal, b->rbuf, cr);
 }
 
+void sum_bin_start(t_bin *b, const t_commrec *cr)
+{
+    int i;
+
+    for (i = b->nreal; (i < b->maxreal); i++)
+    {
+        b->rbuf[i] = 0;
+    }
+    gmx_sumd_start(b->maxreal, b->rbuf, cr, &b->sumRequest);
+}
+
+void sum_bin_wait(t_bin *b, const t_commrec *cr)
+{
+    gmx_sumd_wait(cr, &b->sumRequest);
+}
+
 void extract_binr(t_bin *b, int index, int nr, real r[])
 {
     int     i;
@@ -37,14 +37,16 @@
 #ifndef GMX_MDLIB_RBIN_H
 #define GMX_MDLIB_RBIN_H
 
+#include "gromacs/gmxlib/network.h"
 #include "gromacs/utility/real.h"
 
 struct t_commrec;
 
 typedef struct {
-    int     nreal;
-    int     maxreal;
-    double *rbuf;
+    int                nreal;
+    int                maxreal;
+    double            *rbuf;
+    gmx_sumd_request_t sumRequest;
 } t_bin;
 
 t_bin *mk_bin(void);
@@ -63,6 +65,14 @@ int add_bind(t_bin *b, int nr, double r[]);
 void sum_bin(t_bin *b, const t_commrec *cr);
 /* Globally sum the reals in the bin */
 
+void sum_bin_start(t_bin *b, const t_commrec *cr);
+/* Start globally summing the reals in the bin, the sum is only
+ * available after sum_bin_wait has been called.
+ */
+
+void sum_bin_wait(t_bin *b, const t_commrec *cr);
+/* Complete the global sum started by sum_bin_start */
+
 void extract_binr(t_bin *b, int index, int nr, real r[]);
 void extract_bind(t_bin *b, int index, int nr, double r[]);
 /* Extract values from the bin, starting from index (see add_bin) */
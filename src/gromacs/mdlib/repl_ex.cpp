@@ -113,17 +113,28 @@ typedef struct gmx_repl_ex
     real  *Vol;
     real **de;
 
+    /* data for exchanging the ensemble parameters instead of the states,
+       the ensembles are numbered as the replicas at the start of the run */
+    gmx_bool              bSwapParams; /* swap the parameters instead of the states */
+    const gmx_multisim_t *ms;          /* the multi-simulation, for summing the statistics */
+    int                   ens;         /* the ensemble this replica is in */
+    int                   repl_below;  /* the replica in ensemble ens-1, -1 if none */
+    int                   repl_above;  /* the replica in ensemble ens+1, -1 if none */
+    int                   ngtc;        /* the number of temperature coupling groups */
+    real                 *ref_t;       /* reference temperatures, ngtc per ensemble */
+    real                 *ref_p;       /* reference pressures, DIM*DIM per ensemble */
+
 } t_gmx_repl_ex;
 
 static gmx_bool repl_quantity(const gmx_multisim_t *ms,
-                              struct gmx_repl_ex *re, int ere, real q)
+                              struct gmx_repl_ex *re, int ere, int ens, real q)
 {
     real    *qall;
     gmx_bool bDiff;
     int      s;
 
     snew(qall, ms->nsim);
-    qall[re->repl] = q;
+    qall[ens] = q;
     gmx_sum_sim(ms->nsim, qall, ms);
 
     bDiff = FALSE;
@@ -150,11 +161,54 @@ static gmx_bool repl_quantity(const gmx_multisim_t *ms,
     return bDiff;
 }
 
+/* Determines which replicas are in the ensembles neighboring ens */
+static void init_ensemble_neighbors(const gmx_multisim_t *ms,
+                                    struct gmx_repl_ex *re, int ens)
+{
+    int *ensall, *count;
+    int  s;
+
+    snew(ensall, re->nrepl);
+    snew(count, re->nrepl);
+    ensall[re->repl] = ens;
+    gmx_sumi_sim(re->nrepl, ensall, ms);
+
+    re->ens        = ens;
+    re->repl_below = -1;
+    re->repl_above = -1;
+    for (s = 0; s < re->nrepl; s++)
+    {
+        if (ensall[s] < 0 || ensall[s] >= re->nrepl)
+        {
+            gmx_fatal(FARGS, "Replica %d is in ensemble %d, which does not exist", s, ensall[s]);
+        }
+        count[ensall[s]]++;
+        if (ensall[s] == ens - 1)
+        {
+            re->repl_below = s;
+        }
+        if (ensall[s] == ens + 1)
+        {
+            re->repl_above = s;
+        }
+    }
+    for (s = 0; s < re->nrepl; s++)
+    {
+        if (count[s] != 1)
+        {
+            gmx_fatal(FARGS, "%d replicas are in ensemble %d, the checkpoint files of the replicas do not match", count[s], s);
+        }
+    }
+    sfree(count);
+    sfree(ensall);
+}
+
 gmx_repl_ex_t
 init_replica_exchange(FILE                            *fplog,
                       const gmx_multisim_t            *ms,
                       int                              numAtomsInSystem,
                       const t_inputrec                *ir,
+                      const t_state                   *state,
                       const ReplicaExchangeParameters &replExParams)
 {
     real                pres;
@@ -189,6 +243,12 @@ init_replica_exchange(FILE                            *fplog,
     re->nrepl    = ms->nsim;
     snew(re->q, ereENDSINGLE);
 
+    re->bSwapParams = replExParams.swapParameters;
+    if (re->bSwapParams)
+    {
+        init_ensemble_neighbors(ms, re, state->replex_state);
+    }
+
     fprintf(fplog, "Repl  There are %d replicas:\n", re->nrepl);
 
     /* We only check that the number of atoms in the systms match.
@@ -219,10 +279,14 @@ init_replica_exchange(FILE                            *fplog,
     }
 
     re->type = -1;
-    bTemp    = repl_quantity(ms, re, ereTEMP, re->temp);
+    bTemp    = repl_quantity(ms, re, ereTEMP, re->repl, re->temp);
     if (ir->efep != efepNO)
     {
-        bLambda = repl_quantity(ms, re, ereLAMBDA, (real)ir->fepvals->init_fep_state);
+        /* When swapping parameters, the lambda state has been read
+         * from the checkpoint and belongs to the current ensemble.
+         */
+        bLambda = repl_quantity(ms, re, ereLAMBDA, re->bSwapParams ? re->ens : re->repl,
+                                (real)ir->fepvals->init_fep_state);
     }
     if (re->type == -1)  /* nothing was assigned */
     {
@@ -255,6 +319,28 @@ init_replica_exchange(FILE                            *fplog,
             gmx_fatal(FARGS, "delta_lambda is not zero");
         }
     }
+    if (re->bSwapParams)
+    {
+        if (replExParams.numExchanges > 0)
+        {
+            gmx_fatal(FARGS, "Exchanging the ensemble parameters is only supported with neighbor replica exchange, do not use -nex");
+        }
+        if (inputrecNvtTrotter(ir) || inputrecNptTrotter(ir) || inputrecNphTrotter(ir))
+        {
+            gmx_fatal(FARGS, "Exchanging the ensemble parameters is not supported with Trotter decomposition");
+        }
+        if (ir->bExpanded)
+        {
+            gmx_fatal(FARGS, "Exchanging the ensemble parameters is not supported with expanded ensemble");
+        }
+        for (i = 0; i < ir->opts.ngtc; i++)
+        {
+            if (ir->opts.annealing[i] != eannNO)
+            {
+                gmx_fatal(FARGS, "Exchanging the ensemble parameters is not supported with simulated annealing");
+            }
+        }
+    }
     if (re->bNPT)
     {
         snew(re->pres, re->nrepl);
@@ -436,6 +522,34 @@ init_replica_exchange(FILE                            *fplog,
         snew(re->de[i], re->nrepl);
     }
     re->nex = replExParams.numExchanges;
+
+    if (re->bSwapParams)
+    {
+        /* Collect the reference temperatures and pressures of all
+         * ensembles, these are set in a replica when it moves there.
+         */
+        re->ms   = ms;
+        re->ngtc = ir->opts.ngtc;
+        snew(re->ref_t, re->nrepl*re->ngtc);
+        snew(re->ref_p, re->nrepl*DIM*DIM);
+        for (i = 0; i < re->ngtc; i++)
+        {
+            re->ref_t[re->repl*re->ngtc + i] = ir->opts.ref_t[i];
+        }
+        for (i = 0; i < DIM; i++)
+        {
+            for (j = 0; j < DIM; j++)
+            {
+                re->ref_p[(re->repl*DIM + i)*DIM + j] = ir->ref_p[i][j];
+            }
+        }
+        gmx_sum_sim(re->nrepl*re->ngtc, re->ref_t, ms);
+        gmx_sum_sim(re->nrepl*DIM*DIM, re->ref_p, ms);
+
+        fprintf(fplog, "\nRepl  Exchanging the ensemble parameters instead of the states\n");
+        fprintf(fplog, "Repl  This replica starts in ensemble %d\n", re->ens);
+    }
+
     return re;
 }
 
@@ -504,6 +618,33 @@ static void exchange_doubles(const gmx_multisim_t gmx_unused *ms, int gmx_unused
     }
 }
 
+static void exchange_ints(const gmx_multisim_t gmx_unused *ms, int gmx_unused b, int *v, int n)
+{
+    int *buf;
+    int  i;
+
+    if (v)
+    {
+        snew(buf, n);
+#if GMX_MPI
+        {
+            MPI_Request mpi_req;
+
+            MPI_Isend(v, n*sizeof(int), MPI_BYTE, MSRANK(ms, b), 0,
+                      ms->mpi_comm_masters, &mpi_req);
+            MPI_Recv(buf, n*sizeof(int), MPI_BYTE, MSRANK(ms, b), 0,
+                     ms->mpi_comm_masters, MPI_STATUS_IGNORE);
+            MPI_Wait(&mpi_req, MPI_STATUS_IGNORE);
+        }
+#endif
+        for (i = 0; i < n; i++)
+        {
+            v[i] = buf[i];
+        }
+        sfree(buf);
+    }
+}
+
 static void exchange_rvecs(const gmx_multisim_t gmx_unused *ms, int gmx_unused b, rvec *v, int n)
 {
     rvec *buf;
@@ -585,6 +726,71 @@ static void scale_velocities(t_state *state, real fac)
     }
 }
 
+/* Sets the parameters of ensemble re->ens in ir and state_local and
+ * scales the velocities by vscale. The parameters are only known on
+ * the master rank and are broadcast to the other ranks.
+ */
+static void set_ensemble_parameters(const t_commrec *cr, const struct gmx_repl_ex *re,
+                                    real vscale, t_inputrec *ir, t_state *state_local)
+{
+    int   ngtc = ir->opts.ngtc;
+    int   nbuf = ngtc + DIM*DIM + 2;
+    real *buf;
+    int   i, j;
+
+    snew(buf, nbuf);
+    if (MASTER(cr))
+    {
+        for (i = 0; i < ngtc; i++)
+        {
+            buf[i] = re->ref_t[re->ens*ngtc + i];
+        }
+        for (i = 0; i < DIM*DIM; i++)
+        {
+            buf[ngtc + i] = re->ref_p[re->ens*DIM*DIM + i];
+        }
+        if (re->type == ereLAMBDA || re->type == ereTL)
+        {
+            buf[ngtc + DIM*DIM] = re->q[ereLAMBDA][re->ens];
+        }
+        else
+        {
+            buf[ngtc + DIM*DIM] = state_local->fep_state;
+        }
+        buf[ngtc + DIM*DIM + 1] = vscale;
+    }
+    if (DOMAINDECOMP(cr))
+    {
+        gmx_bcast(nbuf*sizeof(real), buf, cr);
+    }
+
+    for (i = 0; i < ngtc; i++)
+    {
+        ir->opts.ref_t[i] = buf[i];
+    }
+    for (i = 0; i < DIM; i++)
+    {
+        for (j = 0; j < DIM; j++)
+        {
+            ir->ref_p[i][j] = buf[ngtc + i*DIM + j];
+        }
+    }
+    state_local->fep_state = static_cast<int>(buf[ngtc + DIM*DIM]);
+    if (buf[ngtc + DIM*DIM + 1] != 1)
+    {
+        scale_velocities(state_local, buf[ngtc + DIM*DIM + 1]);
+    }
+    sfree(buf);
+}
+
+void set_replica_exchange_parameters(const t_commrec *cr,
+                                     struct gmx_repl_ex *re,
+                                     t_inputrec *ir,
+                                     t_state *state_local)
+{
+    set_ensemble_parameters(cr, re, 1, ir, state_local);
+}
+
 static void print_transition_matrix(FILE *fplog, int n, int **nmoves, int *nattempt)
 {
     int   i, j, ntot;
@@ -1298,10 +1504,226 @@ gmx_bool replica_exchange(FILE *fplog, const t_commrec *cr,
     return bThisReplicaExchanged;
 }
 
+/* Attempts an exchange of the ensemble of this replica with the
+ * replica in the neighboring ensemble of the current pairing and
+ * updates re->ens and the replicas in the neighboring ensembles.
+ * Only communicates with the replicas in the neighboring ensembles.
+ */
+static void
+test_for_parameter_exchange(FILE                 *fplog,
+                            const gmx_multisim_t *ms,
+                            struct gmx_repl_ex   *re,
+                            const gmx_enerdata_t *enerd,
+                            real                  vol,
+                            gmx_int64_t           step,
+                            real                  time)
+{
+    int                                  m, a = -1, b = -1, e, partner, outer;
+    int                                  ens_new, outer_new, partner_outer_new;
+    real                                 delta, prob = 0;
+    gmx_bool                             bEx = FALSE;
+    double                               buf[4];
+    gmx::ThreeFry2x64<0>                 rng(re->seed, gmx::RandomDomain::ReplicaExchange); // We only draw once per pair, so zero bits internal counter is fine
+    gmx::UniformRealDistribution<real>   uniformRealDist;
+
+    fprintf(fplog, "Replica exchange at step %" GMX_PRId64 " time %.5f\n", step, time);
+
+    /* As with state exchange, ensemble i-1 and i are paired when i%2 == m,
+     * only the lowest and highest ensemble can be without partner.
+     */
+    m = (step / re->nst) % 2;
+    if (re->ens > 0 && re->ens % 2 == m)
+    {
+        a       = re->ens - 1;
+        b       = re->ens;
+        partner = re->repl_below;
+        outer   = re->repl_above;
+    }
+    else if (re->ens + 1 < re->nrepl && (re->ens + 1) % 2 == m)
+    {
+        a       = re->ens;
+        b       = re->ens + 1;
+        partner = re->repl_above;
+        outer   = re->repl_below;
+    }
+    else
+    {
+        partner = -1;
+        outer   = (re->ens == 0 ? re->repl_above : re->repl_below);
+    }
+
+    ens_new = re->ens;
+    if (partner >= 0)
+    {
+        /* Exchange the potential energy, the volume and the energy
+         * differences with the ensembles of the pair. Both replicas
+         * fill the same elements of the arrays with the same values,
+         * so they compute the same delta and make the same decision.
+         */
+        for (e = 0; e < re->nrepl; e++)
+        {
+            re->beta[e] = 1.0/((re->type == ereTEMP || re->type == ereTL ? re->q[ereTEMP][e] : re->temp)*BOLTZ);
+        }
+        buf[0] = enerd->term[F_EPOT];
+        buf[1] = vol;
+        buf[2] = 0;
+        buf[3] = 0;
+        if (re->type == ereLAMBDA || re->type == ereTL)
+        {
+            buf[2] = enerd->enerpart_lambda[(int)re->q[ereLAMBDA][a]+1] - enerd->enerpart_lambda[0];
+            buf[3] = enerd->enerpart_lambda[(int)re->q[ereLAMBDA][b]+1] - enerd->enerpart_lambda[0];
+        }
+        re->Epot[re->ens]  = buf[0];
+        re->Vol[re->ens]   = buf[1];
+        re->de[a][re->ens] = buf[2];
+        re->de[b][re->ens] = buf[3];
+        exchange_doubles(ms, partner, buf, 4);
+        e                  = (re->ens == a ? b : a);
+        re->Epot[e]        = buf[0];
+        re->Vol[e]         = buf[1];
+        re->de[a][e]       = buf[2];
+        re->de[b][e]       = buf[3];
+
+        delta = calc_delta(fplog, TRUE, re, a, b, a, b);
+        if (delta <= 0)
+        {
+            prob = 1;
+            bEx  = TRUE;
+        }
+        else
+        {
+            if (delta > PROBABILITYCUTOFF)
+            {
+                prob = 0;
+            }
+            else
+            {
+                prob = exp(-delta);
+            }
+            /* Both replicas of the pair draw the same number */
+            rng.restart(step, a);
+            bEx = uniformRealDist(rng) < prob;
+        }
+        if (bEx)
+        {
+            ens_new = e;
+        }
+        /* Only the lower ensemble of the pair collects the statistics */
+        if (re->ens == a)
+        {
+            re->prob_sum[b] += prob;
+            if (bEx)
+            {
+                re->nexchange[b]++;
+            }
+        }
+        fprintf(fplog, "Repl  ensembles %d <-> %d  pr %4.2f%s\n", a, b, prob, bEx ? "  x" : "");
+    }
+
+    /* Tell the replica in the outer neighboring ensemble which replica
+     * is now in our old ensemble and receive which replica is now in its
+     * ensemble. Then pass that on to the partner, which needs it when
+     * it moves into our old ensemble.
+     */
+    outer_new = outer;
+    if (outer >= 0)
+    {
+        outer_new = (bEx ? partner : re->repl);
+        exchange_ints(ms, outer, &outer_new, 1);
+    }
+    partner_outer_new = outer_new;
+    if (partner >= 0)
+    {
+        exchange_ints(ms, partner, &partner_outer_new, 1);
+    }
+    if (partner < 0)
+    {
+        if (re->ens == 0)
+        {
+            re->repl_above = outer_new;
+        }
+        else
+        {
+            re->repl_below = outer_new;
+        }
+    }
+    else if (re->ens == a)
+    {
+        re->repl_below = (bEx ? partner : outer_new);
+        re->repl_above = (bEx ? partner_outer_new : partner);
+    }
+    else
+    {
+        re->repl_below = (bEx ? partner_outer_new : partner);
+        re->repl_above = (bEx ? partner : outer_new);
+    }
+
+    re->nmoves[re->ens][ens_new] += 1;
+    re->nmoves[ens_new][re->ens] += 1;
+    re->nattempt[m]++;
+    re->ens = ens_new;
+
+    /* This line, together with the step above, allows demultiplexing
+     * the output of the replicas into continuous ensembles.
+     */
+    fprintf(fplog, "Repl  ensemble %d\n\n", re->ens);
+    fflush(fplog);
+}
+
+gmx_bool replica_exchange_parameters(FILE *fplog, const t_commrec *cr,
+                                     const gmx_multisim_t *ms, struct gmx_repl_ex *re,
+                                     t_inputrec *ir,
+                                     t_state *state, const gmx_enerdata_t *enerd,
+                                     t_state *state_local, gmx_int64_t step, real time)
+{
+    int      ens_old;
+    real     vscale                = 1;
+    gmx_bool bThisReplicaExchanged = FALSE;
+
+    if (MASTER(cr))
+    {
+        ens_old = re->ens;
+        test_for_parameter_exchange(fplog, ms, re, enerd, det(state_local->box), step, time);
+        bThisReplicaExchanged = (re->ens != ens_old);
+        /* The configuration stays, so the velocities are scaled
+         * to the new temperature */
+        if (bThisReplicaExchanged && (re->type == ereTEMP || re->type == ereTL))
+        {
+            vscale = sqrt(re->q[ereTEMP][re->ens]/re->q[ereTEMP][ens_old]);
+        }
+        state->replex_state = re->ens;
+    }
+    if (DOMAINDECOMP(cr))
+    {
+#if GMX_MPI
+        MPI_Bcast(&bThisReplicaExchanged, sizeof(gmx_bool), MPI_BYTE, MASTERRANK(cr),
+                  cr->mpi_comm_mygroup);
+#endif
+    }
+
+    if (bThisReplicaExchanged)
+    {
+        set_ensemble_parameters(cr, re, vscale, ir, state_local);
+    }
+
+    return bThisReplicaExchanged;
+}
+
 void print_replica_exchange_statistics(FILE *fplog, struct gmx_repl_ex *re)
 {
     int  i;
 
+    if (re->bSwapParams)
+    {
+        /* Each replica only collected the statistics of its own moves */
+        gmx_sumi_sim(re->nrepl, re->nexchange, re->ms);
+        gmx_sum_sim(re->nrepl, re->prob_sum, re->ms);
+        for (i = 0; i < re->nrepl; i++)
+        {
+            gmx_sumi_sim(re->nrepl, re->nmoves[i], re->ms);
+        }
+    }
+
     fprintf(fplog, "\nReplica exchange statistics\n");
 
     if (re->nex == 0)
@@ -55,13 +55,15 @@ struct ReplicaExchangeParameters
     ReplicaExchangeParameters() :
         exchangeInterval(0),
         numExchanges(0),
-        randomSeed(-1)
+        randomSeed(-1),
+        swapParameters(FALSE)
     {
     };
 
-    int exchangeInterval; /* Interval in steps at which to attempt exchanges, 0 means no replica exchange */
-    int numExchanges;     /* The number of exchanges to attempt at an exchange step */
-    int randomSeed;       /* The random seed, -1 means generate a seed */
+    int      exchangeInterval; /* Interval in steps at which to attempt exchanges, 0 means no replica exchange */
+    int      numExchanges;     /* The number of exchanges to attempt at an exchange step */
+    int      randomSeed;       /* The random seed, -1 means generate a seed */
+    gmx_bool swapParameters;   /* Exchange the ensemble parameters instead of the states */
 };
 
 /* Abstract type for replica exchange */
@@ -72,8 +74,22 @@ init_replica_exchange(FILE                            *fplog,
                       const gmx_multisim_t            *ms,
                       int                              numAtomsInSystem,
                       const t_inputrec                *ir,
+                      const t_state                   *state,
                       const ReplicaExchangeParameters &replExParams);
-/* Should only be called on the master ranks */
+/* Should only be called on the master ranks.
+ * With parameter swapping, state->replex_state gives the ensemble
+ * this replica is in, which differs from the replica index
+ * when continuing from a checkpoint.
+ */
+
+void set_replica_exchange_parameters(const t_commrec *cr,
+                                     gmx_repl_ex_t re,
+                                     t_inputrec *ir,
+                                     t_state *state_local);
+/* With parameter swapping, sets the temperatures, the lambda state and
+ * the reference pressure of the ensemble this replica is currently in.
+ * Should be called on all ranks after init_replica_exchange.
+ */
 
 gmx_bool replica_exchange(FILE *fplog,
                           const t_commrec *cr,
@@ -90,6 +106,24 @@ gmx_bool replica_exchange(FILE *fplog,
  * in state and still needs to be redistributed over the ranks.
  */
 
+gmx_bool replica_exchange_parameters(FILE *fplog,
+                                     const t_commrec *cr,
+                                     const gmx_multisim_t *ms,
+                                     gmx_repl_ex_t re,
+                                     t_inputrec *ir,
+                                     t_state *state, const gmx_enerdata_t *enerd,
+                                     t_state *state_local,
+                                     gmx_int64_t step, real time);
+/* Attempts replica exchange by swapping the ensemble parameters of
+ * neighboring ensembles, should be called on all ranks.
+ * Returns TRUE if the ensemble of this replica has changed, in which
+ * case the reference temperatures and pressure in ir and the lambda
+ * state and velocities in state_local have been updated.
+ * The coordinates stay with the replica, so no state is collected
+ * or communicated. Each replica only communicates with the replicas
+ * in the neighboring ensembles, not with all replicas.
+ */
+
 void print_replica_exchange_statistics(FILE *fplog, gmx_repl_ex_t re);
 /* Should only be called on the master ranks */
 
@@ -47,6 +47,7 @@
 #include <cstdint>
 
 #include <array>
+#include <vector>
 
 #include "gromacs/awh/awh.h"
 #include "gromacs/domdec/dlbtiming.h"
@@ -645,32 +646,77 @@ static void do_nb_verlet_fep(nbnxn_pairlist_set_t *nbl_lists,
      */
     if (fepvals->n_lambda > 0 && (flags & GMX_FORCE_DHDL) && fepvals->sc_alpha != 0)
     {
-        kernel_data.flags          = (donb_flags & ~(GMX_NONBONDED_DO_FORCE | GMX_NONBONDED_DO_SHIFTFORCE)) | GMX_NONBONDED_DO_FOREIGNLAMBDA;
-        kernel_data.lambda         = lam_i;
-        kernel_data.energygrp_elec = enerd->foreign_grpp.ener[egCOULSR];
-        kernel_data.energygrp_vdw  = enerd->foreign_grpp.ener[egLJSR];
-        /* Note that we add to kernel_data.dvdl, but ignore the result */
-
-        for (i = 0; i < enerd->n_lambda; i++)
+        if (gmx_nb_free_energy_foreign_supported(fr))
         {
-            for (j = 0; j < efptNR; j++)
+            /* Compute the energies at all lambda values in one pass
+             * over the pair lists, instead of one pass per lambda.
+             */
+            std::vector<real> lambdaCoul(enerd->n_lambda);
+            std::vector<real> lambdaVdw(enerd->n_lambda);
+            for (i = 0; i < enerd->n_lambda; i++)
             {
-                lam_i[j] = (i == 0 ? lambda[j] : fepvals->all_lambda[j][i-1]);
+                lambdaCoul[i] = (i == 0 ? lambda[efptCOUL] : fepvals->all_lambda[efptCOUL][i-1]);
+                lambdaVdw[i]  = (i == 0 ? lambda[efptVDW]  : fepvals->all_lambda[efptVDW][i-1]);
             }
-            reset_foreign_enerdata(enerd);
+            /* Each thread accumulates into its own energy and flop buffers,
+             * which we reduce in thread order, so the result does not
+             * depend on the thread scheduling.
+             */
+            std::vector<real>   energies(nbl_lists->nnbl*enerd->n_lambda, 0);
+            std::vector<t_nrnb> nrnbThread(nbl_lists->nnbl);
 #pragma omp parallel for schedule(static) num_threads(nbl_lists->nnbl)
             for (th = 0; th < nbl_lists->nnbl; th++)
             {
                 try
                 {
-                    gmx_nb_free_energy_kernel(nbl_lists->nbl_fep[th],
-                                              x, f, fr, mdatoms, &kernel_data, nrnb);
+                    init_nrnb(&nrnbThread[th]);
+                    gmx_nb_free_energy_foreign_kernel(nbl_lists->nbl_fep[th],
+                                                      x, fr, mdatoms,
+                                                      enerd->n_lambda,
+                                                      lambdaCoul.data(), lambdaVdw.data(),
+                                                      energies.data() + th*enerd->n_lambda,
+                                                      &nrnbThread[th]);
                 }
                 GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
             }
+            for (th = 0; th < nbl_lists->nnbl; th++)
+            {
+                for (i = 0; i < enerd->n_lambda; i++)
+                {
+                    enerd->enerpart_lambda[i] += energies[th*enerd->n_lambda + i];
+                }
+                add_nrnb(nrnb, nrnb, &nrnbThread[th]);
+            }
+        }
+        else
+        {
+            kernel_data.flags          = (donb_flags & ~(GMX_NONBONDED_DO_FORCE | GMX_NONBONDED_DO_SHIFTFORCE)) | GMX_NONBONDED_DO_FOREIGNLAMBDA;
+            kernel_data.lambda         = lam_i;
+            kernel_data.energygrp_elec = enerd->foreign_grpp.ener[egCOULSR];
+            kernel_data.energygrp_vdw  = enerd->foreign_grpp.ener[egLJSR];
+            /* Note that we add to kernel_data.dvdl, but ignore the result */
 
-            sum_epot(&(enerd->foreign_grpp), enerd->foreign_term);
-            enerd->enerpart_lambda[i] += enerd->foreign_term[F_EPOT];
+            for (i = 0; i < enerd->n_lambda; i++)
+            {
+                for (j = 0; j < efptNR; j++)
+                {
+                    lam_i[j] = (i == 0 ? lambda[j] : fepvals->all_lambda[j][i-1]);
+                }
+                reset_foreign_enerdata(enerd);
+#pragma omp parallel for schedule(static) num_threads(nbl_lists->nnbl)
+                for (th = 0; th < nbl_lists->nnbl; th++)
+                {
+                    try
+                    {
+                        gmx_nb_free_energy_kernel(nbl_lists->nbl_fep[th],
+                                                  x, f, fr, mdatoms, &kernel_data, nrnb);
+                    }
+                    GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+                }
+
+                sum_epot(&(enerd->foreign_grpp), enerd->foreign_term);
+                enerd->enerpart_lambda[i] += enerd->foreign_term[F_EPOT];
+            }
         }
     }
 
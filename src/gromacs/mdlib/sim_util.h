@@ -98,6 +98,28 @@ void global_stat(gmx_global_stat_t gs,
                  gmx_bool bSumEkinhOld, int flags);
 /* All-reduce energy-like quantities over cr->mpi_comm_mysim */
 
+void global_stat_start(gmx_global_stat_t gs,
+                       const t_commrec *cr, gmx_enerdata_t *enerd,
+                       tensor fvir, tensor svir, rvec mu_tot,
+                       t_inputrec *inputrec,
+                       gmx_ekindata_t *ekind,
+                       gmx::Constraints *constr, t_vcm *vcm,
+                       int nsig, real *sig,
+                       int *totalNumberOfBondedInteractions,
+                       gmx_bool bSumEkinhOld, int flags);
+/* Packs the same quantities as global_stat and starts their reduction.
+ * With library MPI the ranks on a physical node are reduced first, after
+ * which the sum over the nodes is started as a non-blocking allreduce.
+ * Local work that does not touch any of the summed quantities can be
+ * done before calling global_stat_finish. The output arguments are only
+ * updated by global_stat_finish, they should not be modified before that.
+ */
+
+void global_stat_finish(gmx_global_stat_t gs, const t_commrec *cr);
+/* Completes the reduction started by global_stat_start and extracts
+ * the sums into the arguments passed to global_stat_start.
+ */
+
 int do_per_step(gmx_int64_t step, gmx_int64_t nstep);
 /* Return TRUE if io should be done */
 
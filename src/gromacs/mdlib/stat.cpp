@@ -59,13 +59,39 @@
 #include "gromacs/mdtypes/md_enums.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
+#include "gromacs/utility/gmxassert.h"
 #include "gromacs/utility/smalloc.h"
 
 typedef struct gmx_global_stat
 {
-    t_bin *rb;
-    int   *itc0;
-    int   *itc1;
+    t_bin          *rb;
+    int            *itc0;
+    int            *itc1;
+
+    /* The state below is set by global_stat_start and used by
+     * global_stat_finish to extract the sums after the reduction.
+     */
+    gmx_bool        bPending;
+    int             ie, ifv, isv, irmsd, imu;
+    int             idedl, idedlo, idvdll, idvdlnl, iepl, icm, imass, ica, inb;
+    int             isig, icj, ici, icx;
+    int             inn[egNR];
+    real            copyenerd[F_NRE];
+    int             nener;
+    real           *rmsd_data;
+    double          nb;
+    gmx_enerdata_t *enerd;
+    rvec           *fvir;
+    rvec           *svir;
+    real           *mu_tot;
+    t_inputrec     *inputrec;
+    gmx_ekindata_t *ekind;
+    t_vcm          *vcm;
+    int             nsig;
+    real           *sig;
+    int            *totalNumberOfBondedInteractions;
+    gmx_bool        bSumEkinhOld;
+    int             flags;
 } t_gmx_global_stat;
 
 gmx_global_stat_t global_stat_init(t_inputrec *ir)
@@ -135,31 +161,25 @@ static int filter_enerdterm(real *afrom, gmx_bool bToBuffer, real *ato,
     return to;
 }
 
-void global_stat(gmx_global_stat_t gs,
-                 const t_commrec *cr, gmx_enerdata_t *enerd,
-                 tensor fvir, tensor svir, rvec mu_tot,
-                 t_inputrec *inputrec,
-                 gmx_ekindata_t *ekind, gmx::Constraints *constr,
-                 t_vcm *vcm,
-                 int nsig, real *sig,
-                 int *totalNumberOfBondedInteractions,
-                 gmx_bool bSumEkinhOld, int flags)
+void global_stat_start(gmx_global_stat_t gs,
+                       const t_commrec *cr, gmx_enerdata_t *enerd,
+                       tensor fvir, tensor svir, rvec mu_tot,
+                       t_inputrec *inputrec,
+                       gmx_ekindata_t *ekind, gmx::Constraints *constr,
+                       t_vcm *vcm,
+                       int nsig, real *sig,
+                       int *totalNumberOfBondedInteractions,
+                       gmx_bool bSumEkinhOld, int flags)
 /* instead of current system, gmx_booleans for summing virial, kinetic energy, and other terms */
 {
     t_bin     *rb;
     int       *itc0, *itc1;
-    int        ie    = 0, ifv = 0, isv = 0, irmsd = 0, imu = 0;
-    int        idedl = 0, idedlo = 0, idvdll = 0, idvdlnl = 0, iepl = 0, icm = 0, imass = 0, ica = 0, inb = 0;
-    int        isig  = -1;
-    int        icj   = -1, ici = -1, icx = -1;
-    int        inn[egNR];
-    real       copyenerd[F_NRE];
-    int        nener, j;
-    real      *rmsd_data = nullptr;
-    double     nb;
+    int        j;
     gmx_bool   bVV, bTemp, bEner, bPres, bConstrVir, bEkinAveVel, bReadEkin;
     bool       checkNumberOfBondedInteractions = flags & CGLO_CHECK_NUMBER_OF_BONDED_INTERACTIONS;
 
+    GMX_RELEASE_ASSERT(!gs->bPending, "global_stat_start called with a summation in flight");
+
     bVV           = EI_VV(inputrec->eI);
     bTemp         = flags & CGLO_TEMPERATURE;
     bEner         = flags & CGLO_ENERGY;
@@ -172,6 +192,20 @@ void global_stat(gmx_global_stat_t gs,
     itc0 = gs->itc0;
     itc1 = gs->itc1;
 
+    /* Store everything we need to extract the sums in global_stat_finish */
+    gs->enerd                           = enerd;
+    gs->fvir                            = fvir;
+    gs->svir                            = svir;
+    gs->mu_tot                          = mu_tot;
+    gs->inputrec                        = inputrec;
+    gs->ekind                           = ekind;
+    gs->vcm                             = vcm;
+    gs->nsig                            = nsig;
+    gs->sig                             = sig;
+    gs->totalNumberOfBondedInteractions = totalNumberOfBondedInteractions;
+    gs->bSumEkinhOld                    = bSumEkinhOld;
+    gs->flags                           = flags;
+    gs->rmsd_data                       = nullptr;
 
     reset_bin(rb);
     /* This routine copies all the data to be summed to one big buffer
@@ -183,13 +217,13 @@ void global_stat(gmx_global_stat_t gs,
        communicated and summed when they need to be, to avoid repeating
        the sums and overcounting. */
 
-    nener = filter_enerdterm(enerd->term, TRUE, copyenerd, bTemp, bPres, bEner);
+    gs->nener = filter_enerdterm(enerd->term, TRUE, gs->copyenerd, bTemp, bPres, bEner);
 
     /* First, the data that needs to be communicated with velocity verlet every time
        This is just the constraint virial.*/
     if (bConstrVir)
     {
-        isv = add_binr(rb, DIM*DIM, svir[0]);
+        gs->isv = add_binr(rb, DIM*DIM, svir[0]);
     }
 
 /* We need the force virial and the kinetic energy for the first time through with velocity verlet */
@@ -213,86 +247,127 @@ void global_stat(gmx_global_stat_t gs,
                 }
             }
             /* these probably need to be put into one of these categories */
-            idedl = add_binr(rb, 1, &(ekind->dekindl));
+            gs->idedl = add_binr(rb, 1, &(ekind->dekindl));
             if (bSumEkinhOld)
             {
-                idedlo = add_binr(rb, 1, &(ekind->dekindl_old));
+                gs->idedlo = add_binr(rb, 1, &(ekind->dekindl_old));
             }
-            ica   = add_binr(rb, 1, &(ekind->cosacc.mvcos));
+            gs->ica   = add_binr(rb, 1, &(ekind->cosacc.mvcos));
         }
     }
 
     if (bPres)
     {
-        ifv = add_binr(rb, DIM*DIM, fvir[0]);
+        gs->ifv = add_binr(rb, DIM*DIM, fvir[0]);
     }
 
 
     if (bEner)
     {
-        ie  = add_binr(rb, nener, copyenerd);
+        gs->ie  = add_binr(rb, gs->nener, gs->copyenerd);
         if (constr)
         {
-            rmsd_data = gmx::constr_rmsd_data(constr);
-            if (rmsd_data)
+            gs->rmsd_data = gmx::constr_rmsd_data(constr);
+            if (gs->rmsd_data)
             {
-                irmsd = add_binr(rb, 2, rmsd_data);
+                gs->irmsd = add_binr(rb, 2, gs->rmsd_data);
             }
         }
         if (!inputrecNeedMutot(inputrec))
         {
-            imu = add_binr(rb, DIM, mu_tot);
+            gs->imu = add_binr(rb, DIM, mu_tot);
         }
 
         for (j = 0; (j < egNR); j++)
         {
-            inn[j] = add_binr(rb, enerd->grpp.nener, enerd->grpp.ener[j]);
+            gs->inn[j] = add_binr(rb, enerd->grpp.nener, enerd->grpp.ener[j]);
         }
         if (inputrec->efep != efepNO)
         {
-            idvdll  = add_bind(rb, efptNR, enerd->dvdl_lin);
-            idvdlnl = add_bind(rb, efptNR, enerd->dvdl_nonlin);
+            gs->idvdll  = add_bind(rb, efptNR, enerd->dvdl_lin);
+            gs->idvdlnl = add_bind(rb, efptNR, enerd->dvdl_nonlin);
             if (enerd->n_lambda > 0)
             {
-                iepl = add_bind(rb, enerd->n_lambda, enerd->enerpart_lambda);
+                gs->iepl = add_bind(rb, enerd->n_lambda, enerd->enerpart_lambda);
             }
         }
     }
 
     if (vcm)
     {
-        icm   = add_binr(rb, DIM*vcm->nr, vcm->group_p[0]);
-        imass = add_binr(rb, vcm->nr, vcm->group_mass);
+        gs->icm   = add_binr(rb, DIM*vcm->nr, vcm->group_p[0]);
+        gs->imass = add_binr(rb, vcm->nr, vcm->group_mass);
         if (vcm->mode == ecmANGULAR)
         {
-            icj   = add_binr(rb, DIM*vcm->nr, vcm->group_j[0]);
-            icx   = add_binr(rb, DIM*vcm->nr, vcm->group_x[0]);
-            ici   = add_binr(rb, DIM*DIM*vcm->nr, vcm->group_i[0][0]);
+            gs->icj   = add_binr(rb, DIM*vcm->nr, vcm->group_j[0]);
+            gs->icx   = add_binr(rb, DIM*vcm->nr, vcm->group_x[0]);
+            gs->ici   = add_binr(rb, DIM*DIM*vcm->nr, vcm->group_i[0][0]);
         }
     }
 
     if (checkNumberOfBondedInteractions)
     {
-        nb  = cr->dd->nbonded_local;
-        inb = add_bind(rb, 1, &nb);
+        gs->nb  = cr->dd->nbonded_local;
+        gs->inb = add_bind(rb, 1, &gs->nb);
     }
     if (nsig > 0)
     {
-        isig = add_binr(rb, nsig, sig);
+        gs->isig = add_binr(rb, nsig, sig);
     }
 
-    /* Global sum it all */
+    /* Global sum it all, this returns before the inter-node part
+     * of the reduction has completed, when MPI supports that.
+     */
     if (debug)
     {
         fprintf(debug, "Summing %d energies\n", rb->maxreal);
     }
-    sum_bin(rb, cr);
+    sum_bin_start(rb, cr);
+
+    gs->bPending = TRUE;
+}
+
+void global_stat_finish(gmx_global_stat_t gs, const t_commrec *cr)
+{
+    t_bin          *rb;
+    int            *itc0, *itc1;
+    int             j;
+    gmx_bool        bVV, bTemp, bEner, bPres, bConstrVir, bEkinAveVel, bReadEkin;
+    int             flags;
+    t_inputrec     *inputrec;
+    gmx_ekindata_t *ekind;
+    gmx_enerdata_t *enerd;
+    t_vcm          *vcm;
+
+    GMX_RELEASE_ASSERT(gs->bPending, "global_stat_finish called without global_stat_start");
+
+    flags    = gs->flags;
+    inputrec = gs->inputrec;
+    ekind    = gs->ekind;
+    enerd    = gs->enerd;
+    vcm      = gs->vcm;
+
+    bVV           = EI_VV(inputrec->eI);
+    bTemp         = flags & CGLO_TEMPERATURE;
+    bEner         = flags & CGLO_ENERGY;
+    bPres         = (flags & CGLO_PRESSURE);
+    bConstrVir    = (flags & CGLO_CONSTRAINT);
+    bEkinAveVel   = (inputrec->eI == eiVV || (inputrec->eI == eiVVAK && bPres));
+    bReadEkin     = (flags & CGLO_READEKIN);
+
+    rb   = gs->rb;
+    itc0 = gs->itc0;
+    itc1 = gs->itc1;
+
+    sum_bin_wait(rb, cr);
+
+    gs->bPending = FALSE;
 
     /* Extract all the data locally */
 
     if (bConstrVir)
     {
-        extract_binr(rb, isv, DIM*DIM, svir[0]);
+        extract_binr(rb, gs->isv, DIM*DIM, gs->svir[0]);
     }
 
     /* We need the force virial and the kinetic energy for the first time through with velocity verlet */
@@ -302,7 +377,7 @@ void global_stat(gmx_global_stat_t gs,
         {
             for (j = 0; (j < inputrec->opts.ngtc); j++)
             {
-                if (bSumEkinhOld)
+                if (gs->bSumEkinhOld)
                 {
                     extract_binr(rb, itc0[j], DIM*DIM, ekind->tcstat[j].ekinh_old[0]);
                 }
@@ -315,72 +390,88 @@ void global_stat(gmx_global_stat_t gs,
                     extract_binr(rb, itc1[j], DIM*DIM, ekind->tcstat[j].ekinh[0]);
                 }
             }
-            extract_binr(rb, idedl, 1, &(ekind->dekindl));
-            if (bSumEkinhOld)
+            extract_binr(rb, gs->idedl, 1, &(ekind->dekindl));
+            if (gs->bSumEkinhOld)
             {
-                extract_binr(rb, idedlo, 1, &(ekind->dekindl_old));
+                extract_binr(rb, gs->idedlo, 1, &(ekind->dekindl_old));
             }
-            extract_binr(rb, ica, 1, &(ekind->cosacc.mvcos));
+            extract_binr(rb, gs->ica, 1, &(ekind->cosacc.mvcos));
         }
     }
     if (bPres)
     {
-        extract_binr(rb, ifv, DIM*DIM, fvir[0]);
+        extract_binr(rb, gs->ifv, DIM*DIM, gs->fvir[0]);
     }
 
     if (bEner)
     {
-        extract_binr(rb, ie, nener, copyenerd);
-        if (rmsd_data)
+        extract_binr(rb, gs->ie, gs->nener, gs->copyenerd);
+        if (gs->rmsd_data)
         {
-            extract_binr(rb, irmsd, 2, rmsd_data);
+            extract_binr(rb, gs->irmsd, 2, gs->rmsd_data);
         }
         if (!inputrecNeedMutot(inputrec))
         {
-            extract_binr(rb, imu, DIM, mu_tot);
+            extract_binr(rb, gs->imu, DIM, gs->mu_tot);
         }
 
         for (j = 0; (j < egNR); j++)
         {
-            extract_binr(rb, inn[j], enerd->grpp.nener, enerd->grpp.ener[j]);
+            extract_binr(rb, gs->inn[j], enerd->grpp.nener, enerd->grpp.ener[j]);
         }
         if (inputrec->efep != efepNO)
         {
-            extract_bind(rb, idvdll, efptNR, enerd->dvdl_lin);
-            extract_bind(rb, idvdlnl, efptNR, enerd->dvdl_nonlin);
+            extract_bind(rb, gs->idvdll, efptNR, enerd->dvdl_lin);
+            extract_bind(rb, gs->idvdlnl, efptNR, enerd->dvdl_nonlin);
             if (enerd->n_lambda > 0)
             {
-                extract_bind(rb, iepl, enerd->n_lambda, enerd->enerpart_lambda);
+                extract_bind(rb, gs->iepl, enerd->n_lambda, enerd->enerpart_lambda);
             }
         }
 
-        filter_enerdterm(copyenerd, FALSE, enerd->term, bTemp, bPres, bEner);
+        filter_enerdterm(gs->copyenerd, FALSE, enerd->term, bTemp, bPres, bEner);
     }
 
     if (vcm)
     {
-        extract_binr(rb, icm, DIM*vcm->nr, vcm->group_p[0]);
-        extract_binr(rb, imass, vcm->nr, vcm->group_mass);
+        extract_binr(rb, gs->icm, DIM*vcm->nr, vcm->group_p[0]);
+        extract_binr(rb, gs->imass, vcm->nr, vcm->group_mass);
         if (vcm->mode == ecmANGULAR)
         {
-            extract_binr(rb, icj, DIM*vcm->nr, vcm->group_j[0]);
-            extract_binr(rb, icx, DIM*vcm->nr, vcm->group_x[0]);
-            extract_binr(rb, ici, DIM*DIM*vcm->nr, vcm->group_i[0][0]);
+            extract_binr(rb, gs->icj, DIM*vcm->nr, vcm->group_j[0]);
+            extract_binr(rb, gs->icx, DIM*vcm->nr, vcm->group_x[0]);
+            extract_binr(rb, gs->ici, DIM*DIM*vcm->nr, vcm->group_i[0][0]);
         }
     }
 
-    if (checkNumberOfBondedInteractions)
+    if (flags & CGLO_CHECK_NUMBER_OF_BONDED_INTERACTIONS)
     {
-        extract_bind(rb, inb, 1, &nb);
-        *totalNumberOfBondedInteractions = static_cast<int>(nb+0.5);
+        extract_bind(rb, gs->inb, 1, &gs->nb);
+        *gs->totalNumberOfBondedInteractions = static_cast<int>(gs->nb+0.5);
     }
 
-    if (nsig > 0)
+    if (gs->nsig > 0)
     {
-        extract_binr(rb, isig, nsig, sig);
+        extract_binr(rb, gs->isig, gs->nsig, gs->sig);
     }
 }
 
+void global_stat(gmx_global_stat_t gs,
+                 const t_commrec *cr, gmx_enerdata_t *enerd,
+                 tensor fvir, tensor svir, rvec mu_tot,
+                 t_inputrec *inputrec,
+                 gmx_ekindata_t *ekind, gmx::Constraints *constr,
+                 t_vcm *vcm,
+                 int nsig, real *sig,
+                 int *totalNumberOfBondedInteractions,
+                 gmx_bool bSumEkinhOld, int flags)
+{
+    global_stat_start(gs, cr, enerd, fvir, svir, mu_tot, inputrec, ekind, constr,
+                      vcm, nsig, sig, totalNumberOfBondedInteractions,
+                      bSumEkinhOld, flags);
+    global_stat_finish(gs, cr);
+}
+
 int do_per_step(gmx_int64_t step, gmx_int64_t nstep)
 {
     if (nstep != 0)
@@ -0,0 +1,331 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2018, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the expanded-ensemble lambda moves.
+ *
+ * ChooseNewLambda is compared with the linear-scan implementation it
+ * replaced, which is kept here as a reference. Both are driven with
+ * the same random weights and seeds, so they should choose the same
+ * states and accumulate the same transition matrices, up to the
+ * summation order.
+ *
+ * \ingroup module_mdlib
+ */
+#include "gmxpre.h"
+
+#include "gromacs/mdlib/expanded.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/math/utilities.h"
+#include "gromacs/mdtypes/df_history.h"
+#include "gromacs/mdtypes/inputrec.h"
+#include "gromacs/mdtypes/md_enums.h"
+#include "gromacs/mdtypes/state.h"
+#include "gromacs/random/threefry.h"
+#include "gromacs/random/uniformrealdistribution.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+namespace
+{
+
+//! Gibbs probabilities as computed before the log-sum-exp rewrite
+void referenceGibbsProbabilities(const real *ene, double *p_k, int minfep, int maxfep)
+{
+    real   maxene = ene[minfep];
+    double pks    = 0;
+
+    for (int i = minfep; i <= maxfep; i++)
+    {
+        maxene = std::max(maxene, ene[i]);
+    }
+    for (int i = minfep; i <= maxfep; i++)
+    {
+        pks += std::exp(ene[i] - maxene);
+    }
+    for (int i = minfep; i <= maxfep; i++)
+    {
+        p_k[i] = std::exp(ene[i] - maxene)/pks;
+    }
+}
+
+/*! \brief The lambda move implementation before the rewrite of ChooseNewLambda
+ *
+ * States are drawn by a linear scan over the probabilities and the
+ * proposal and acceptance probabilities of all states are added to
+ * the transition matrix for every move. The marching start and the
+ * error dump are left out, the tests do not use them.
+ */
+int referenceChooseNewLambda(int nlim, const t_expanded *expand, df_history_t *dfhist, int fep_state,
+                             const real *weighted_lamee, gmx_int64_t seed, gmx_int64_t step)
+{
+    ThreeFry2x64<0>               rng(seed, RandomDomain::ExpandedEnsemble);
+    UniformRealDistribution<real> dist;
+    std::vector<double>           p_k(nlim), propose(nlim), accept(nlim), remainder(nlim);
+    int                           starting_fep_state = fep_state;
+    int                           lamnew             = fep_state;
+    int                           lamtrial, minfep, maxfep;
+    real                          r1, r2, tprob = 0;
+
+    for (int i = 0; i < expand->lmc_repeats; i++)
+    {
+        rng.restart(step, i);
+        dist.reset();
+
+        std::fill(propose.begin(), propose.end(), 0);
+        std::fill(accept.begin(), accept.end(), 0);
+
+        if (expand->elmcmove == elmcmoveGIBBS || expand->elmcmove == elmcmoveMETGIBBS)
+        {
+            if (expand->gibbsdeltalam < 0)
+            {
+                minfep = 0;
+                maxfep = nlim - 1;
+            }
+            else
+            {
+                minfep = std::max(fep_state - expand->gibbsdeltalam, 0);
+                maxfep = std::min(fep_state + expand->gibbsdeltalam, nlim - 1);
+            }
+
+            referenceGibbsProbabilities(weighted_lamee, p_k.data(), minfep, maxfep);
+
+            if (expand->elmcmove == elmcmoveGIBBS)
+            {
+                for (int ifep = minfep; ifep <= maxfep; ifep++)
+                {
+                    propose[ifep] = p_k[ifep];
+                    accept[ifep]  = 1.0;
+                }
+                r1 = dist(rng);
+                for (lamnew = minfep; lamnew <= maxfep; lamnew++)
+                {
+                    if (r1 <= p_k[lamnew])
+                    {
+                        break;
+                    }
+                    r1 -= p_k[lamnew];
+                }
+            }
+            else
+            {
+                for (int ifep = minfep; ifep <= maxfep; ifep++)
+                {
+                    remainder[ifep] = 1 - p_k[ifep];
+                }
+
+                if (remainder[fep_state] == 0)
+                {
+                    lamnew = fep_state;
+                }
+                else
+                {
+                    for (int ifep = minfep; ifep <= maxfep; ifep++)
+                    {
+                        propose[ifep] = (ifep != fep_state) ? p_k[ifep]/remainder[fep_state] : 0;
+                    }
+
+                    r1 = dist(rng);
+                    for (lamtrial = minfep; lamtrial <= maxfep; lamtrial++)
+                    {
+                        real pnorm = p_k[lamtrial]/remainder[fep_state];
+                        if (lamtrial != fep_state)
+                        {
+                            if (r1 <= pnorm)
+                            {
+                                break;
+                            }
+                            r1 -= pnorm;
+                        }
+                    }
+                    /* The old code had no protection against rounding here */
+                    EXPECT_LE(lamtrial, maxfep) << "reference scan ran past the last state";
+                    lamtrial = std::min(lamtrial, maxfep);
+
+                    tprob = std::min(remainder[fep_state]/remainder[lamtrial], 1.0);
+                    r2    = dist(rng);
+                    lamnew = (r2 < tprob) ? lamtrial : fep_state;
+                }
+
+                for (int ifep = minfep; ifep <= maxfep; ifep++)
+                {
+                    accept[ifep] = (remainder[ifep] != 0) ? std::min(remainder[fep_state]/remainder[ifep], 1.0) : 1.0;
+                }
+            }
+
+            if (lamnew > maxfep)
+            {
+                /* The rounding correction of the old code */
+                EXPECT_TRUE(gmx_within_tol(remainder[fep_state], 0, 50*GMX_DOUBLE_EPS)) << "reference Gibbs scan ran past the last state";
+                lamnew = fep_state;
+            }
+        }
+        else
+        {
+            r1 = dist(rng);
+            if (r1 < 0.5)
+            {
+                lamtrial = (fep_state == 0) ? fep_state : fep_state - 1;
+            }
+            else
+            {
+                lamtrial = (fep_state == nlim - 1) ? fep_state : fep_state + 1;
+            }
+
+            real de = weighted_lamee[lamtrial] - weighted_lamee[fep_state];
+            if (expand->elmcmove == elmcmoveMETROPOLIS)
+            {
+                tprob              = std::min(static_cast<real>(std::exp(de)), static_cast<real>(1.0));
+                propose[fep_state] = 0;
+                propose[lamtrial]  = 1.0;
+                accept[fep_state]  = 1.0;
+                accept[lamtrial]   = tprob;
+            }
+            else
+            {
+                tprob              = 1.0/(1.0 + std::exp(-de));
+                propose[fep_state] = (1 - tprob);
+                propose[lamtrial] += tprob;
+                accept[fep_state]  = 1.0;
+                accept[lamtrial]   = 1.0;
+            }
+
+            r2     = dist(rng);
+            lamnew = (r2 < tprob) ? lamtrial : fep_state;
+        }
+
+        for (int ifep = 0; ifep < nlim; ifep++)
+        {
+            dfhist->Tij[fep_state][ifep]      += propose[ifep]*accept[ifep];
+            dfhist->Tij[fep_state][fep_state] += propose[ifep]*(1.0 - accept[ifep]);
+        }
+        fep_state = lamnew;
+    }
+
+    dfhist->Tij_empirical[starting_fep_state][lamnew] += 1.0;
+
+    return lamnew;
+}
+
+//! Number of lambda states
+const int         c_numStates = 40;
+//! Number of lambda moves, with new weights for each move
+const int         c_numSteps  = 200;
+//! The seed for the lambda moves
+const gmx_int64_t c_seed      = 1234567;
+
+//! Parameters: move type, Gibbs range (-1 is all states), lmc-repeats
+typedef std::tuple<int, int, int> ExpandedMoveTestParameters;
+
+//! Test fixture for comparing ChooseNewLambda with the reference implementation
+class ExpandedMoveTest : public ::testing::TestWithParam<ExpandedMoveTestParameters>
+{
+};
+
+TEST_P(ExpandedMoveTest, MatchesLinearScanReference)
+{
+    t_expanded expand = {};
+    expand.elmcmove      = std::get<0>(GetParam());
+    expand.gibbsdeltalam = std::get<1>(GetParam());
+    expand.lmc_repeats   = std::get<2>(GetParam());
+    expand.elamstats     = elamstatsMETROPOLIS;
+
+    df_history_t dfhist, dfhistRef;
+    init_df_history(&dfhist, c_numStates);
+    init_df_history(&dfhistRef, c_numStates);
+
+    /* Reduced free-energy differences of a few kT, so many states
+     * get a significant probability.
+     */
+    ThreeFry2x64<64>              rng(987654, RandomDomain::Other);
+    UniformRealDistribution<real> dist;
+    std::vector<real>             weighted_lamee(c_numStates);
+    std::vector<double>           p_k(c_numStates);
+    int                           state    = c_numStates/2;
+    int                           stateRef = state;
+
+    for (int step = 0; step < c_numSteps; step++)
+    {
+        for (real &w : weighted_lamee)
+        {
+            w = 8*dist(rng) - 4;
+        }
+        state    = ChooseNewLambda(c_numStates, &expand, &dfhist, state, weighted_lamee.data(), p_k.data(), c_seed, step);
+        stateRef = referenceChooseNewLambda(c_numStates, &expand, &dfhistRef, stateRef, weighted_lamee.data(), c_seed, step);
+        ASSERT_EQ(stateRef, state) << "at step " << step;
+    }
+
+    for (int i = 0; i < c_numStates; i++)
+    {
+        /* The row sums are the number of moves from state i. The
+         * contributions are summed in a different order, so we use
+         * a tolerance relative to the row sum.
+         */
+        double rowSum = 0;
+        for (int j = 0; j < c_numStates; j++)
+        {
+            rowSum += dfhistRef.Tij[i][j];
+        }
+        const test::FloatingPointTolerance tolerance =
+            test::relativeToleranceAsFloatingPoint(std::max(rowSum, 1.0), GMX_DOUBLE ? 1e-10 : 1e-5);
+        for (int j = 0; j < c_numStates; j++)
+        {
+            EXPECT_REAL_EQ_TOL(dfhistRef.Tij[i][j], dfhist.Tij[i][j], tolerance) << "Tij[" << i << "][" << j << "]";
+            EXPECT_EQ(dfhistRef.Tij_empirical[i][j], dfhist.Tij_empirical[i][j]) << "Tij_empirical[" << i << "][" << j << "]";
+        }
+    }
+
+    done_df_history(&dfhist);
+    done_df_history(&dfhistRef);
+}
+
+INSTANTIATE_TEST_CASE_P(MoveTypes, ExpandedMoveTest,
+                            ::testing::Combine(::testing::Values(elmcmoveMETROPOLIS, elmcmoveBARKER,
+                                                                 elmcmoveGIBBS, elmcmoveMETGIBBS),
+                                                   ::testing::Values(-1, 3),
+                                                   ::testing::Values(1, 10)));
+
+} // namespace
+} // namespace gmx
@@ -51,6 +51,7 @@
 #include <cmath>
 
 #include <algorithm>
+#include <functional>
 #include <memory>
 
 #include "thread_mpi/threads.h"
@@ -301,7 +302,7 @@ void gmx::Integrator::do_md()
     gmx_groups_t     *groups;
     gmx_ekindata_t   *ekind;
     gmx_shellfc_t    *shellfc;
-    gmx_bool          bSumEkinhOld, bDoReplEx, bExchanged, bNeedRepartition;
+    gmx_bool          bSumEkinhOld, bDoReplEx, bExchanged, bExchangedParameters, bNeedRepartition;
     gmx_bool          bResetCountersHalfMaxH = FALSE;
     gmx_bool          bTemp, bPres, bTrotter;
     real              dvdl_constr;
@@ -572,7 +573,8 @@ void gmx::Integrator::do_md()
     /* Initialize AWH and restore state from history in checkpoint if needed. */
     if (ir->bDoAwh)
     {
-        ir->awh = new gmx::Awh(fplog, *ir, cr, ms, *ir->awhParams, opt2fn("-awh", nfile, fnm), ir->pull_work);
+        ir->awh = new gmx::Awh(fplog, *ir, cr, ms, *ir->awhParams, opt2fn("-awh", nfile, fnm), ir->pull_work,
+                           mdrunOptions.awhShareFullGrid);
 
         if (startingFromCheckpoint)
         {
@@ -590,7 +592,14 @@ void gmx::Integrator::do_md()
     if (useReplicaExchange && MASTER(cr))
     {
         repl_ex = init_replica_exchange(fplog, ms, top_global->natoms, ir,
-                                        replExParams);
+                                        state_global, replExParams);
+    }
+    if (useReplicaExchange && replExParams.swapParameters)
+    {
+        /* When continuing, this replica can be in another ensemble than
+         * the one of its run input file */
+        set_replica_exchange_parameters(cr, repl_ex, ir, state);
+        update_temperature_constants(upd, ir);
     }
     /* PME tuning is only supported in the Verlet scheme, with PME for
      * Coulomb. It is not supported with only LJ PME, or for
@@ -862,13 +871,14 @@ void gmx::Integrator::do_md()
     /* Loop over MD steps or if rerunMD to end of input trajectory,
      * or, if max_hours>0, until max_hours is reached.
      */
-    real max_hours   = mdrunOptions.maximumHoursToRun;
-    bFirstStep       = TRUE;
+    real max_hours       = mdrunOptions.maximumHoursToRun;
+    bFirstStep           = TRUE;
     /* Skip the first Nose-Hoover integration when we get the state from tpx */
-    bInitStep        = !startingFromCheckpoint || EI_VV(ir->eI);
-    bSumEkinhOld     = FALSE;
-    bExchanged       = FALSE;
-    bNeedRepartition = FALSE;
+    bInitStep            = !startingFromCheckpoint || EI_VV(ir->eI);
+    bSumEkinhOld         = FALSE;
+    bExchanged           = FALSE;
+    bExchangedParameters = FALSE;
+    bNeedRepartition     = FALSE;
 
     bool simulationsShareState = false;
     int  nstSignalComm         = nstglobalcomm;
@@ -1085,7 +1095,7 @@ void gmx::Integrator::do_md()
             update_mdatoms(mdatoms, state->lambda[efptMASS]);
         }
 
-        if ((bRerunMD && rerun_fr.bV) || bExchanged)
+        if ((bRerunMD && rerun_fr.bV) || bExchanged || bExchangedParameters)
         {
 
             /* We need the kinetic energy at minus the half step for determining
@@ -1312,7 +1322,7 @@ void gmx::Integrator::do_md()
                         enerd->term[F_EKIN] = trace(ekind->ekin);
                     }
                 }
-                else if (bExchanged)
+                else if (bExchanged || bExchangedParameters)
                 {
                     wallcycle_stop(wcycle, ewcUPDATE);
                     /* We need the kinetic energy at minus the half step for determining
@@ -1619,7 +1629,12 @@ void gmx::Integrator::do_md()
             unshift_self(graph, state->box, as_rvec_array(state->x.data()));
         }
 
-        if (vsite != nullptr)
+        /* Virtual sites have no mass, so their construction does not
+         * affect the kinetic energy, the COM motion or the virial.
+         * When we compute globals below, it is done while the global
+         * summation is in progress.
+         */
+        auto constructVirtualSites = [&]()
         {
             wallcycle_start(wcycle, ewcVSITECONSTR);
             if (graph != nullptr)
@@ -1635,7 +1650,7 @@ void gmx::Integrator::do_md()
                 unshift_self(graph, state->box, as_rvec_array(state->x.data()));
             }
             wallcycle_stop(wcycle, ewcVSITECONSTR);
-        }
+        };
 
         /* ############## IF NOT VV, Calculate globals HERE  ############ */
         /* With Leap-Frog we can skip compute_globals at
@@ -1647,7 +1662,14 @@ void gmx::Integrator::do_md()
             // and when algorithms require it.
             bool doInterSimSignal = (simulationsShareState && do_per_step(step, nstSignalComm));
 
-            if (bGStat || (!EI_VV(ir->eI) && do_per_step(step+1, nstglobalcomm)) || doInterSimSignal)
+            bool doComputeGlobals = (bGStat || (!EI_VV(ir->eI) && do_per_step(step+1, nstglobalcomm)) || doInterSimSignal);
+
+            if (vsite != nullptr && !doComputeGlobals)
+            {
+                constructVirtualSites();
+            }
+
+            if (doComputeGlobals)
             {
                 // Since we're already communicating at this step, we
                 // can propagate intra-simulation signals. Note that
@@ -1670,7 +1692,8 @@ void gmx::Integrator::do_md()
                                 | (!EI_VV(ir->eI) ? CGLO_TEMPERATURE : 0)
                                 | (!EI_VV(ir->eI) || bRerunMD ? CGLO_PRESSURE : 0)
                                 | CGLO_CONSTRAINT
-                                | (shouldCheckNumberOfBondedInteractions ? CGLO_CHECK_NUMBER_OF_BONDED_INTERACTIONS : 0)
+                                | (shouldCheckNumberOfBondedInteractions ? CGLO_CHECK_NUMBER_OF_BONDED_INTERACTIONS : 0),
+                                vsite != nullptr ? constructVirtualSites : std::function<void()>()
                                 );
                 checkNumberOfBondedInteractions(fplog, cr, totalNumberOfBondedInteractions,
                                                 top_global, top, state,
@@ -1814,8 +1837,24 @@ void gmx::Integrator::do_md()
         }
 
         /* Replica exchange */
-        bExchanged = FALSE;
-        if (bDoReplEx)
+        bExchanged           = FALSE;
+        bExchangedParameters = FALSE;
+        if (bDoReplEx && replExParams.swapParameters)
+        {
+            bExchangedParameters = replica_exchange_parameters(fplog, cr, ms, repl_ex, ir,
+                                                               state_global, enerd,
+                                                               state, step, t);
+            if (bExchangedParameters)
+            {
+                update_temperature_constants(upd, ir);
+                if (ir->etc == etcNOSEHOOVER)
+                {
+                    /* The Nose-Hoover masses depend on the reference temperatures */
+                    init_npt_masses(ir, state, &MassQ, FALSE);
+                }
+            }
+        }
+        else if (bDoReplEx)
         {
             bExchanged = replica_exchange(fplog, cr, ms, repl_ex,
                                           state_global, enerd,
@@ -51,6 +51,7 @@
 #include <ctime>
 
 #include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "gromacs/commandline/filenm.h"
@@ -387,6 +388,11 @@ static void init_em(FILE *fplog, const char *title,
     {
         *top = dd_init_local_top(top_global);
 
+        if (MASTER(cr))
+        {
+            /* Allocate the per-atom arrays requested by the minimizer, e.g. cg_p */
+            state_change_natoms(state_global, state_global->natoms);
+        }
         dd_init_local_state(cr->dd, state_global, &ems->s);
 
         /* Distribute the charge groups over the nodes from the master node */
@@ -712,6 +718,143 @@ static void em_dd_partition_system(FILE *fplog, int step, const t_commrec *cr,
     dd_store_state(cr->dd, &ems->s);
 }
 
+//! Returns the dot product of the first \p natoms elements of \p a and \p b, accumulated in double
+static double em_dot(int natoms, const rvec *a, const rvec *b)
+{
+    double sum = 0;
+
+    // cppcheck-suppress unreadVariable
+    int    nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+: sum)
+    for (int i = 0; i < natoms; i++)
+    {
+        // Trivial OpenMP block that does not throw
+        sum += a[i][XX]*b[i][XX];
+        sum += a[i][YY]*b[i][YY];
+        sum += a[i][ZZ]*b[i][ZZ];
+    }
+
+    return sum;
+}
+
+//! Adds \p alpha times \p x to \p y for the first \p natoms elements
+static void em_axpy(int natoms, real alpha, const rvec *x, rvec *y)
+{
+    // cppcheck-suppress unreadVariable
+    int nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int i = 0; i < natoms; i++)
+    {
+        // Trivial OpenMP block that does not throw
+        for (int m = 0; m < DIM; m++)
+        {
+            y[i][m] += alpha*x[i][m];
+        }
+    }
+}
+
+//! Sets the first \p natoms elements of \p y to \p alpha times \p x
+static void em_scale(int natoms, real alpha, const rvec *x, rvec *y)
+{
+    // cppcheck-suppress unreadVariable
+    int nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int i = 0; i < natoms; i++)
+    {
+        // Trivial OpenMP block that does not throw
+        svmul(alpha, x[i], y[i]);
+    }
+}
+
+//! Sets the frozen dimensions of the home atom vector \p v to zero
+static void em_clear_frozen(const t_grpopts *opts, const t_mdatoms *md, rvec *v)
+{
+    if (md->cFREEZE == nullptr && opts->nFreeze[0][XX] == 0 &&
+        opts->nFreeze[0][YY] == 0 && opts->nFreeze[0][ZZ] == 0)
+    {
+        return;
+    }
+
+    // cppcheck-suppress unreadVariable
+    int nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (int i = 0; i < md->homenr; i++)
+    {
+        // Trivial OpenMP block that does not throw
+        int gf = (md->cFREEZE ? md->cFREEZE[i] : 0);
+        for (int m = 0; m < DIM; m++)
+        {
+            if (opts->nFreeze[gf][m])
+            {
+                v[i][m] = 0;
+            }
+        }
+    }
+}
+
+/*! \brief Returns the sum over the first \p natoms atoms of the squared size of \p p relative to \p x
+ *
+ * This determines the smallest step along the search direction \p p
+ * that still changes the coordinates \p x within machine precision.
+ */
+static double em_minstep_sum(int natoms, const rvec *x, const rvec *p)
+{
+    double minstep = 0;
+
+    // cppcheck-suppress unreadVariable
+    int    nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+: minstep)
+    for (int i = 0; i < natoms; i++)
+    {
+        // Trivial OpenMP block that does not throw
+        for (int m = 0; m < DIM; m++)
+        {
+            double tmp = fabs(x[i][m]);
+            if (tmp < 1.0)
+            {
+                tmp = 1.0;
+            }
+            tmp      = p[i][m]/tmp;
+            minstep += tmp*tmp;
+        }
+    }
+
+    return minstep;
+}
+
+/*! \brief Gives the trial state \p ems2, generated from \p ems1, the minimizer memory of \p ems1
+ *
+ * With domain decomposition \p ems2 can be repartitioned before its
+ * forces are compared with those of \p ems1. So then \p ems2 gets the
+ * force of \p ems1 in em_vecs[0] and a copy of the other vectors in
+ * em_vecs, which DD moves along with the atoms. Without DD the atom
+ * order never changes and the memory can stay where it is.
+ */
+static void em_pass_memory(const t_commrec *cr, const t_mdatoms *md,
+                           const em_state_t *ems1, em_state_t *ems2)
+{
+    if (!DOMAINDECOMP(cr))
+    {
+        return;
+    }
+
+    const t_state *s1 = &ems1->s;
+    t_state       *s2 = &ems2->s;
+
+    if (s2->em_vecs.size() != s1->em_vecs.size())
+    {
+        s2->em_vecs.resize(s1->em_vecs.size());
+        state_change_natoms(s2, s2->natoms);
+    }
+
+    for (size_t v = 0; v < s1->em_vecs.size(); v++)
+    {
+        const rvec *src = as_rvec_array(v == 0 ? ems1->f.data() : s1->em_vecs[v].data());
+        rvec       *dst = as_rvec_array(s2->em_vecs[v].data());
+        em_scale(md->homenr, 1, src, dst);
+    }
+}
+
 namespace
 {
 
@@ -910,87 +1053,8 @@ EnergyEvaluator::run(em_state_t *ems, rvec mu_tot,
 
 } // namespace
 
-//! Parallel utility summing energies and forces
-static double reorder_partsum(const t_commrec *cr, t_grpopts *opts, t_mdatoms *mdatoms,
-                              gmx_mtop_t *top_global,
-                              em_state_t *s_min, em_state_t *s_b)
-{
-    t_block       *cgs_gl;
-    int            ncg, *cg_gl, *index, c, cg, i, a0, a1, a, gf, m;
-    double         partsum;
-    unsigned char *grpnrFREEZE;
-
-    if (debug)
-    {
-        fprintf(debug, "Doing reorder_partsum\n");
-    }
-
-    const rvec *fm = as_rvec_array(s_min->f.data());
-    const rvec *fb = as_rvec_array(s_b->f.data());
-
-    cgs_gl = dd_charge_groups_global(cr->dd);
-    index  = cgs_gl->index;
-
-    /* Collect fm in a global vector fmg.
-     * This conflicts with the spirit of domain decomposition,
-     * but to fully optimize this a much more complicated algorithm is required.
-     */
-    rvec *fmg;
-    snew(fmg, top_global->natoms);
-
-    ncg   = s_min->s.cg_gl.size();
-    cg_gl = s_min->s.cg_gl.data();
-    i     = 0;
-    for (c = 0; c < ncg; c++)
-    {
-        cg = cg_gl[c];
-        a0 = index[cg];
-        a1 = index[cg+1];
-        for (a = a0; a < a1; a++)
-        {
-            copy_rvec(fm[i], fmg[a]);
-            i++;
-        }
-    }
-    gmx_sum(top_global->natoms*3, fmg[0], cr);
-
-    /* Now we will determine the part of the sum for the cgs in state s_b */
-    ncg         = s_b->s.cg_gl.size();
-    cg_gl       = s_b->s.cg_gl.data();
-    partsum     = 0;
-    i           = 0;
-    gf          = 0;
-    grpnrFREEZE = top_global->groups.grpnr[egcFREEZE];
-    for (c = 0; c < ncg; c++)
-    {
-        cg = cg_gl[c];
-        a0 = index[cg];
-        a1 = index[cg+1];
-        for (a = a0; a < a1; a++)
-        {
-            if (mdatoms->cFREEZE && grpnrFREEZE)
-            {
-                gf = grpnrFREEZE[i];
-            }
-            for (m = 0; m < DIM; m++)
-            {
-                if (!opts->nFreeze[gf][m])
-                {
-                    partsum += (fb[i][m] - fmg[a][m])*fb[i][m];
-                }
-            }
-            i++;
-        }
-    }
-
-    sfree(fmg);
-
-    return partsum;
-}
-
 //! Print some stuff, like beta, whatever that means.
 static real pr_beta(const t_commrec *cr, t_grpopts *opts, t_mdatoms *mdatoms,
-                    gmx_mtop_t *top_global,
                     em_state_t *s_min, em_state_t *s_b)
 {
     double sum;
@@ -998,39 +1062,28 @@ static real pr_beta(const t_commrec *cr, t_grpopts *opts, t_mdatoms *mdatoms,
     /* This is just the classical Polak-Ribiere calculation of beta;
      * it looks a bit complicated since we take freeze groups into account,
      * and might have to sum it in parallel runs.
+     * With DD the atom order of s_min can differ from that of s_b,
+     * but s_b carries a copy of the force of s_min, see em_pass_memory().
      */
+    const rvec *fm = as_rvec_array(DOMAINDECOMP(cr) ? s_b->s.em_vecs[0].data() : s_min->f.data());
+    const rvec *fb = as_rvec_array(s_b->f.data());
+    sum            = 0;
 
-    if (!DOMAINDECOMP(cr) ||
-        (s_min->s.ddp_count == cr->dd->ddp_count &&
-         s_b->s.ddp_count   == cr->dd->ddp_count))
+    // cppcheck-suppress unreadVariable
+    int nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+: sum)
+    for (int i = 0; i < mdatoms->homenr; i++)
     {
-        const rvec *fm  = as_rvec_array(s_min->f.data());
-        const rvec *fb  = as_rvec_array(s_b->f.data());
-        sum             = 0;
-        int         gf  = 0;
-        /* This part of code can be incorrect with DD,
-         * since the atom ordering in s_b and s_min might differ.
-         */
-        for (int i = 0; i < mdatoms->homenr; i++)
+        // Trivial OpenMP block that does not throw
+        int gf = (mdatoms->cFREEZE ? mdatoms->cFREEZE[i] : 0);
+        for (int m = 0; m < DIM; m++)
         {
-            if (mdatoms->cFREEZE)
+            if (!opts->nFreeze[gf][m])
             {
-                gf = mdatoms->cFREEZE[i];
-            }
-            for (int m = 0; m < DIM; m++)
-            {
-                if (!opts->nFreeze[gf][m])
-                {
-                    sum += (fb[i][m] - fm[i][m])*fb[i][m];
-                }
+                sum += (fb[i][m] - fm[i][m])*fb[i][m];
             }
         }
     }
-    else
-    {
-        /* We need to reorder cgs while summing */
-        sum = reorder_partsum(cr, opts, mdatoms, top_global, s_min, s_b);
-    }
     if (PAR(cr))
     {
         gmx_sumd(1, &sum, cr);
@@ -1063,13 +1116,16 @@ Integrator::do_cg()
     tensor            vir, pres;
     int               number_steps, neval = 0, nstcg = inputrec->nstcgsteep;
     gmx_mdoutf_t      outf;
-    int               m, step, nminstep;
+    int               step, nminstep;
     auto              mdatoms = mdAtoms->mdatoms();
 
     step = 0;
 
     // Ensure the extra per-atom state array gets allocated
-    state_global->flags |= (1<<estCGP);
+    if (MASTER(cr))
+    {
+        state_global->flags |= (1<<estCGP);
+    }
 
     /* Create 4 states on the stack and extract pointers that we will swap */
     em_state_t  s0 {}, s1 {}, s2 {}, s3 {};
@@ -1085,6 +1141,13 @@ Integrator::do_cg()
             vsite, constr, nullptr,
             nfile, fnm, &outf, &mdebin, wcycle);
 
+    if (DOMAINDECOMP(cr))
+    {
+        /* Trial states need the force of s_min for computing beta */
+        s_min->s.em_vecs.resize(1);
+        state_change_natoms(&s_min->s, s_min->s.natoms);
+    }
+
     /* Print to log file */
     print_em_start(fplog, cr, walltime_accounting, wcycle, CG);
 
@@ -1156,28 +1219,35 @@ Integrator::do_cg()
          * simply the negative gradient.
          */
 
+        if (DOMAINDECOMP(cr) && s_min->s.ddp_count < cr->dd->ddp_count)
+        {
+            em_dd_partition_system(fplog, step, cr, top_global, inputrec,
+                                   s_min, top, mdAtoms, fr, vsite, constr,
+                                   nrnb, wcycle);
+        }
+
         /* Calculate the new direction in p, and the gradient in this direction, gpa */
         rvec       *pm  = as_rvec_array(s_min->s.cg_p.data());
         const rvec *sfm = as_rvec_array(s_min->f.data());
         double      gpa = 0;
-        int         gf  = 0;
+        // cppcheck-suppress unreadVariable
+        int         nthreads gmx_unused = gmx_omp_nthreads_get(emntUpdate);
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+: gpa)
         for (int i = 0; i < mdatoms->homenr; i++)
         {
-            if (mdatoms->cFREEZE)
+            // Trivial OpenMP block that does not throw
+            int gf = (mdatoms->cFREEZE ? mdatoms->cFREEZE[i] : 0);
+            for (int d = 0; d < DIM; d++)
             {
-                gf = mdatoms->cFREEZE[i];
-            }
-            for (m = 0; m < DIM; m++)
-            {
-                if (!inputrec->opts.nFreeze[gf][m])
+                if (!inputrec->opts.nFreeze[gf][d])
                 {
-                    pm[i][m] = sfm[i][m] + beta*pm[i][m];
-                    gpa     -= pm[i][m]*sfm[i][m];
+                    pm[i][d] = sfm[i][d] + beta*pm[i][d];
+                    gpa     -= pm[i][d]*sfm[i][d];
                     /* f is negative gradient, thus the sign */
                 }
                 else
                 {
-                    pm[i][m] = 0;
+                    pm[i][d] = 0;
                 }
             }
         }
@@ -1213,27 +1283,14 @@ Integrator::do_cg()
         /* Calculate minimum allowed stepsize, before the average (norm)
          * relative change in coordinate is smaller than precision
          */
-        minstep = 0;
-        for (int i = 0; i < mdatoms->homenr; i++)
-        {
-            for (m = 0; m < DIM; m++)
-            {
-                tmp = fabs(s_min->s.x[i][m]);
-                if (tmp < 1.0)
-                {
-                    tmp = 1.0;
-                }
-                tmp      = pm[i][m]/tmp;
-                minstep += tmp*tmp;
-            }
-        }
+        minstep = em_minstep_sum(mdatoms->homenr, as_rvec_array(s_min->s.x.data()), pm);
         /* Add up from all CPUs */
         if (PAR(cr))
         {
             gmx_sumd(1, &minstep, cr);
         }
 
-        minstep = GMX_REAL_EPS/sqrt(minstep/(3*state_global->natoms));
+        minstep = GMX_REAL_EPS/sqrt(minstep/(3*top_global->natoms));
 
         if (stepsize < minstep)
         {
@@ -1270,32 +1327,18 @@ Integrator::do_cg()
         a         = 0.0;
         c         = a + stepsize; /* reference position along line is zero */
 
-        if (DOMAINDECOMP(cr) && s_min->s.ddp_count < cr->dd->ddp_count)
-        {
-            em_dd_partition_system(fplog, step, cr, top_global, inputrec,
-                                   s_min, top, mdAtoms, fr, vsite, constr,
-                                   nrnb, wcycle);
-        }
-
         /* Take a trial step (new coords in s_c) */
         do_em_step(cr, ms, inputrec, mdatoms, fr->bMolPBC, s_min, c, &s_min->s.cg_p, s_c,
                    constr, top, nrnb, wcycle, -1);
+        em_pass_memory(cr, mdatoms, s_min, s_c);
 
         neval++;
         /* Calculate energy for the trial step */
         energyEvaluator.run(s_c, mu_tot, vir, pres, -1, FALSE);
 
         /* Calc derivative along line */
-        const rvec *pc  = as_rvec_array(s_c->s.cg_p.data());
-        const rvec *sfc = as_rvec_array(s_c->f.data());
-        double      gpc = 0;
-        for (int i = 0; i < mdatoms->homenr; i++)
-        {
-            for (m = 0; m < DIM; m++)
-            {
-                gpc -= pc[i][m]*sfc[i][m]; /* f is negative gradient, thus the sign */
-            }
-        }
+        /* f is negative gradient, thus the sign */
+        double gpc = -em_dot(mdatoms->homenr, as_rvec_array(s_c->s.cg_p.data()), as_rvec_array(s_c->f.data()));
         /* Sum the gradient along the line across CPUs */
         if (PAR(cr))
         {
@@ -1385,6 +1428,7 @@ Integrator::do_cg()
                 /* Take a trial step to this new point - new coords in s_b */
                 do_em_step(cr, ms, inputrec, mdatoms, fr->bMolPBC, s_min, b, &s_min->s.cg_p, s_b,
                            constr, top, nrnb, wcycle, -1);
+                em_pass_memory(cr, mdatoms, s_min, s_b);
 
                 neval++;
                 /* Calculate energy for the trial step */
@@ -1393,16 +1437,7 @@ Integrator::do_cg()
                 /* p does not change within a step, but since the domain decomposition
                  * might change, we have to use cg_p of s_b here.
                  */
-                const rvec *pb  = as_rvec_array(s_b->s.cg_p.data());
-                const rvec *sfb = as_rvec_array(s_b->f.data());
-                gpb             = 0;
-                for (int i = 0; i < mdatoms->homenr; i++)
-                {
-                    for (m = 0; m < DIM; m++)
-                    {
-                        gpb -= pb[i][m]*sfb[i][m]; /* f is negative gradient, thus the sign */
-                    }
-                }
+                gpb = -em_dot(mdatoms->homenr, as_rvec_array(s_b->s.cg_p.data()), as_rvec_array(s_b->f.data()));
                 /* Sum the gradient along the line across CPUs */
                 if (PAR(cr))
                 {
@@ -1498,6 +1533,14 @@ Integrator::do_cg()
             gpb = gpc;
         }
 
+        if (DOMAINDECOMP(cr) && s_b->s.ddp_count != cr->dd->ddp_count)
+        {
+            /* The best state is not the last one we evaluated, reload it */
+            em_dd_partition_system(fplog, step, cr, top_global, inputrec,
+                                   s_b, top, mdAtoms, fr, vsite, constr,
+                                   nrnb, wcycle);
+        }
+
         /* new search direction */
         /* beta = 0 means forget all memory and restart with steepest descents. */
         if (nstcg && ((step % nstcg) == 0))
@@ -1513,7 +1556,7 @@ Integrator::do_cg()
             /* Polak-Ribiere update.
              * Change to fnorm2/fnorm2_old for Fletcher-Reeves
              */
-            beta = pr_beta(cr, &inputrec->opts, mdatoms, top_global, s_min, s_b);
+            beta = pr_beta(cr, &inputrec->opts, mdatoms, s_min, s_b);
         }
         /* Limit beta to prevent oscillations */
         if (fabs(beta) > 5.0)
@@ -1558,7 +1601,10 @@ Integrator::do_cg()
         }
 
         /* Send energies and positions to the IMD client if bIMD is TRUE. */
-        if (do_IMD(inputrec->bIMD, step, cr, TRUE, state_global->box, as_rvec_array(state_global->x.data()), inputrec, 0, wcycle) && MASTER(cr))
+        if (do_IMD(inputrec->bIMD, step, cr, TRUE, state_global->box,
+                   MASTER(cr) ? as_rvec_array(state_global->x.data()) : nullptr,
+                   inputrec, 0, wcycle) &&
+            MASTER(cr))
         {
             IMD_send_positions(inputrec->imd);
         }
@@ -1650,82 +1696,75 @@ void
 Integrator::do_lbfgs()
 {
     static const char *LBFGS = "Low-Memory BFGS Minimizer";
-    em_state_t         ems;
     gmx_localtop_t    *top;
     gmx_enerdata_t    *enerd;
     gmx_global_stat_t  gstat;
     t_graph           *graph;
     int                ncorr, nmaxcorr, point, cp, neval, nminstep;
     double             stepsize, step_taken, gpa, gpb, gpc, tmp, minstep;
-    real              *rho, *alpha, *p, *s, **dx, **dg;
-    real               a, b, c, maxdelta, delta;
+    real              *rho, *alpha;
+    real               a, b, c, maxdelta, smax;
     real               diag, Epot0;
     real               dgdx, dgdg, sq, yr, beta;
     t_mdebin          *mdebin;
     gmx_bool           converged;
     rvec               mu_tot;
-    gmx_bool           do_log, do_ene, do_x, do_f, foundlower, *frozen;
+    gmx_bool           do_log, do_ene, do_x, do_f, foundlower;
     tensor             vir, pres;
-    int                start, end, number_steps;
+    int                number_steps;
     gmx_mdoutf_t       outf;
-    int                i, k, m, n, gf, step;
+    int                k, step;
     int                mdof_flags;
     auto               mdatoms = mdAtoms->mdatoms();
 
-    if (PAR(cr))
-    {
-        gmx_fatal(FARGS, "Cannot do parallel L-BFGS Minimization - yet.\n");
-    }
-
     if (nullptr != constr)
     {
         gmx_fatal(FARGS, "The combination of constraints and L-BFGS minimization is not implemented. Either do not use constraints, or use another minimizer (e.g. steepest descent).");
     }
 
-    n        = 3*state_global->natoms;
     nmaxcorr = inputrec->nbfgscorr;
 
-    snew(frozen, n);
-
-    snew(p, n);
     snew(rho, nmaxcorr);
     snew(alpha, nmaxcorr);
 
-    snew(dx, nmaxcorr);
-    for (i = 0; i < nmaxcorr; i++)
-    {
-        snew(dx[i], n);
-    }
+    step  = 0;
+    neval = 0;
 
-    snew(dg, nmaxcorr);
-    for (i = 0; i < nmaxcorr; i++)
+    // Ensure the search direction, stored in cg_p, gets allocated
+    if (MASTER(cr))
     {
-        snew(dg[i], n);
+        state_global->flags |= (1<<estCGP);
     }
 
-    step  = 0;
-    neval = 0;
+    /* Create 4 states on the stack and extract pointers that we will swap */
+    em_state_t  s0 {}, s1 {}, s2 {}, s3 {};
+    em_state_t *s_min = &s0;
+    em_state_t *s_a   = &s1;
+    em_state_t *s_b   = &s2;
+    em_state_t *s_c   = &s3;
 
-    /* Init em */
+    /* Init em and store the local state in s_min */
     init_em(fplog, LBFGS, cr, ms, outputProvider, inputrec, mdrunOptions,
-            state_global, top_global, &ems, &top,
+            state_global, top_global, s_min, &top,
             nrnb, mu_tot, fr, &enerd, &graph, mdAtoms, &gstat,
             vsite, constr, nullptr,
             nfile, fnm, &outf, &mdebin, wcycle);
 
-    start = 0;
-    end   = mdatoms->homenr;
-
-    /* We need 4 working states */
-    em_state_t  s0 {}, s1 {}, s2 {}, s3 {};
-    em_state_t *sa   = &s0;
-    em_state_t *sb   = &s1;
-    em_state_t *sc   = &s2;
-    em_state_t *last = &s3;
-    /* Initialize by copying the state from ems (we could skip x and f here) */
-    *sa              = ems;
-    *sb              = ems;
-    *sc              = ems;
+    /* The memory is stored in the extra per-atom vectors of the state,
+     * so it moves along with the atoms with domain decomposition:
+     * em_vecs[0] is used by em_pass_memory() for the previous force,
+     * followed by nmaxcorr position and nmaxcorr gradient differences.
+     */
+    s_min->s.em_vecs.resize(1 + 2*nmaxcorr);
+    state_change_natoms(&s_min->s, s_min->s.natoms);
+    auto dx = [&s_min](int k)
+        {
+            return as_rvec_array(s_min->s.em_vecs[1 + k].data());
+        };
+    auto dg = [&s_min, nmaxcorr](int k)
+        {
+            return as_rvec_array(s_min->s.em_vecs[1 + nmaxcorr + k].data());
+        };
 
     /* Print to log file */
     print_em_start(fplog, cr, walltime_accounting, wcycle, LBFGS);
@@ -1735,19 +1774,6 @@ Integrator::do_lbfgs()
     /* Max number of steps */
     number_steps = inputrec->nsteps;
 
-    /* Create a 3*natoms index to tell whether each degree of freedom is frozen */
-    gf = 0;
-    for (i = start; i < end; i++)
-    {
-        if (mdatoms->cFREEZE)
-        {
-            gf = mdatoms->cFREEZE[i];
-        }
-        for (m = 0; m < DIM; m++)
-        {
-            frozen[3*i+m] = inputrec->opts.nFreeze[gf][m];
-        }
-    }
     if (MASTER(cr))
     {
         sp_header(stderr, LBFGS, inputrec->em_tol, number_steps);
@@ -1757,13 +1783,6 @@ Integrator::do_lbfgs()
         sp_header(fplog, LBFGS, inputrec->em_tol, number_steps);
     }
 
-    if (vsite)
-    {
-        construct_vsites(vsite, as_rvec_array(state_global->x.data()), 1, nullptr,
-                         top->idef.iparams, top->idef.il,
-                         fr->ePBC, fr->bMolPBC, cr, state_global->box);
-    }
-
     /* Call the force routine and some auxiliary (neighboursearching etc.) */
     /* do_force always puts the charge groups in the box and shifts again
      * We do not unshift, so molecules are always whole
@@ -1776,7 +1795,7 @@ Integrator::do_lbfgs()
         vsite, constr, fcd, graph,
         mdAtoms, fr, enerd
     };
-    energyEvaluator.run(&ems, mu_tot, vir, pres, -1, TRUE);
+    energyEvaluator.run(s_min, mu_tot, vir, pres, -1, TRUE);
 
     if (MASTER(cr))
     {
@@ -1800,13 +1819,13 @@ Integrator::do_lbfgs()
     {
         double sqrtNumAtoms = sqrt(static_cast<double>(state_global->natoms));
         fprintf(stderr, "Using %d BFGS correction steps.\n\n", nmaxcorr);
-        fprintf(stderr, "   F-max             = %12.5e on atom %d\n", ems.fmax, ems.a_fmax + 1);
-        fprintf(stderr, "   F-Norm            = %12.5e\n", ems.fnorm/sqrtNumAtoms);
+        fprintf(stderr, "   F-max             = %12.5e on atom %d\n", s_min->fmax, s_min->a_fmax + 1);
+        fprintf(stderr, "   F-Norm            = %12.5e\n", s_min->fnorm/sqrtNumAtoms);
         fprintf(stderr, "\n");
         /* and copy to the log file too... */
         fprintf(fplog, "Using %d BFGS correction steps.\n\n", nmaxcorr);
-        fprintf(fplog, "   F-max             = %12.5e on atom %d\n", ems.fmax, ems.a_fmax + 1);
-        fprintf(fplog, "   F-Norm            = %12.5e\n", ems.fnorm/sqrtNumAtoms);
+        fprintf(fplog, "   F-max             = %12.5e on atom %d\n", s_min->fmax, s_min->a_fmax + 1);
+        fprintf(fplog, "   F-Norm            = %12.5e\n", s_min->fnorm/sqrtNumAtoms);
         fprintf(fplog, "\n");
     }
 
@@ -1814,24 +1833,14 @@ Integrator::do_lbfgs()
     point = 0;
 
     // Set initial search direction to the force (-gradient), or 0 for frozen particles.
-    real *fInit = static_cast<real *>(as_rvec_array(ems.f.data())[0]);
-    for (i = 0; i < n; i++)
-    {
-        if (!frozen[i])
-        {
-            dx[point][i] = fInit[i]; /* Initial search direction */
-        }
-        else
-        {
-            dx[point][i] = 0;
-        }
-    }
+    em_scale(mdatoms->homenr, 1, as_rvec_array(s_min->f.data()), as_rvec_array(s_min->s.cg_p.data()));
+    em_clear_frozen(&inputrec->opts, mdatoms, as_rvec_array(s_min->s.cg_p.data()));
 
     // Stepsize will be modified during the search, and actually it is not critical
     // (the main efficiency in the algorithm comes from changing directions), but
     // we still need an initial value, so estimate it as the inverse of the norm
     // so we take small steps where the potential fluctuates a lot.
-    stepsize  = 1.0/ems.fnorm;
+    stepsize  = 1.0/s_min->fnorm;
 
     /* Start the loop over BFGS steps.
      * Each successful step is counted, and we continue until
@@ -1866,36 +1875,47 @@ Integrator::do_lbfgs()
         }
 
         mdoutf_write_to_trajectory_files(fplog, cr, outf, mdof_flags,
-                                         top_global, step, (real)step, &ems.s, state_global, observablesHistory, ems.f);
+                                         top_global, step, (real)step, &s_min->s, state_global, observablesHistory, s_min->f);
 
-        /* Do the linesearching in the direction dx[point][0..(n-1)] */
+        /* Do the linesearching in the direction s = cg_p of s_min */
+        const rvec *s  = as_rvec_array(s_min->s.cg_p.data());
+        const rvec *xx = as_rvec_array(s_min->s.x.data());
+        const rvec *ff = as_rvec_array(s_min->f.data());
 
-        /* make s a pointer to current search direction - point=0 first time we get here */
-        s = dx[point];
-
-        real *xx = static_cast<real *>(as_rvec_array(ems.s.x.data())[0]);
-        real *ff = static_cast<real *>(as_rvec_array(ems.f.data())[0]);
-
-        // calculate line gradient in position A
-        for (gpa = 0, i = 0; i < n; i++)
-        {
-            gpa -= s[i]*ff[i];
-        }
+        // calculate line gradient in position A, f is negative gradient, thus the sign
+        gpa     = -em_dot(mdatoms->homenr, s, ff);
 
         /* Calculate minimum allowed stepsize along the line, before the average (norm)
          * relative change in coordinate is smaller than precision
          */
-        for (minstep = 0, i = 0; i < n; i++)
+        minstep = em_minstep_sum(mdatoms->homenr, xx, s);
+
+        /* The largest displacement of any coordinate along the line
+         * is proportional to the largest component of the search direction.
+         */
+        smax = 0;
+        for (int i = 0; i < mdatoms->homenr; i++)
         {
-            tmp = fabs(xx[i]);
-            if (tmp < 1.0)
+            for (int m = 0; m < DIM; m++)
             {
-                tmp = 1.0;
+                smax = std::max(smax, s[i][m]);
             }
-            tmp      = s[i]/tmp;
-            minstep += tmp*tmp;
         }
-        minstep = GMX_REAL_EPS/sqrt(minstep/n);
+
+        /* Sum the line gradient and minimum step, and find the global maximum */
+        if (PAR(cr))
+        {
+            double sum[2] = { gpa, minstep };
+            gmx_sumd(2, sum, cr);
+            gpa     = sum[0];
+            minstep = sum[1];
+#if GMX_MPI
+            real smaxLocal = smax;
+            MPI_Allreduce(&smaxLocal, &smax, 1, GMX_MPI_REAL, MPI_MAX, cr->mpi_comm_mygroup);
+#endif
+        }
+
+        minstep = GMX_REAL_EPS/sqrt(minstep/(3*top_global->natoms));
 
         if (stepsize < minstep)
         {
@@ -1903,13 +1923,8 @@ Integrator::do_lbfgs()
             break;
         }
 
-        // Before taking any steps along the line, store the old position
-        *last       = ems;
-        real *lastx = static_cast<real *>(as_rvec_array(last->s.x.data())[0]);
-        real *lastf = static_cast<real *>(as_rvec_array(last->f.data())[0]);
-        Epot0       = ems.epot;
-
-        *sa         = ems;
+        // Before taking any steps along the line, store the old energy
+        Epot0       = s_min->epot;
 
         /* Take a step downhill.
          * In theory, we should find the actual minimum of the function in this
@@ -1934,10 +1949,15 @@ Integrator::do_lbfgs()
          * Due to the finite numerical accuracy, it turns out that it is a good idea
          * to accept a SMALL increase in energy, if the derivative is still downhill.
          * This leads to lower final energies in the tests I've done. / Erik
+         *
+         * The states along the line are generated from s_min, whose energy
+         * and forces are reused as point A. The forces of the accepted point
+         * are reused as the starting point of the next line search.
          */
 
         // State "A" is the first position along the line.
         // reference position along line is initially zero
+        s_a->epot  = s_min->epot;
         a          = 0.0;
 
         // Check stepsize first. We do not allow displacements
@@ -1950,15 +1970,7 @@ Integrator::do_lbfgs()
 
             // Calculate what the largest change in any individual coordinate
             // would be (translation along line * gradient along line)
-            maxdelta = 0;
-            for (i = 0; i < n; i++)
-            {
-                delta = c*s[i];
-                if (delta > maxdelta)
-                {
-                    maxdelta = delta;
-                }
-            }
+            maxdelta = c*smax;
             // If any displacement is larger than the stepsize limit, reduce the step
             if (maxdelta > inputrec->em_stepsize)
             {
@@ -1967,23 +1979,17 @@ Integrator::do_lbfgs()
         }
         while (maxdelta > inputrec->em_stepsize);
 
-        // Take a trial step and move the coordinate array xc[] to position C
-        real *xc = static_cast<real *>(as_rvec_array(sc->s.x.data())[0]);
-        for (i = 0; i < n; i++)
-        {
-            xc[i] = lastx[i] + c*s[i];
-        }
+        // Take a trial step and move the coordinates to position C
+        do_em_step(cr, ms, inputrec, mdatoms, fr->bMolPBC, s_min, c, &s_min->s.cg_p, s_c,
+                   constr, top, nrnb, wcycle, -1);
+        em_pass_memory(cr, mdatoms, s_min, s_c);
 
         neval++;
         // Calculate energy for the trial step in position C
-        energyEvaluator.run(sc, mu_tot, vir, pres, step, FALSE);
+        energyEvaluator.run(s_c, mu_tot, vir, pres, step, FALSE);
 
-        // Calc line gradient in position C
-        real *fc = static_cast<real *>(as_rvec_array(sc->f.data())[0]);
-        for (gpc = 0, i = 0; i < n; i++)
-        {
-            gpc -= s[i]*fc[i]; /* f is negative gradient, thus the sign */
-        }
+        // Calc line gradient in position C, using cg_p of s_c since DD might have changed
+        gpc = -em_dot(mdatoms->homenr, as_rvec_array(s_c->s.cg_p.data()), as_rvec_array(s_c->f.data()));
         /* Sum the gradient along the line across CPUs */
         if (PAR(cr))
         {
@@ -1993,11 +1999,11 @@ Integrator::do_lbfgs()
         // This is the max amount of increase in energy we tolerate.
         // By allowing VERY small changes (close to numerical precision) we
         // frequently find even better (lower) final energies.
-        tmp = sqrt(GMX_REAL_EPS)*fabs(sa->epot);
+        tmp = sqrt(GMX_REAL_EPS)*fabs(s_a->epot);
 
         // Accept the step if the energy is lower in the new position C (compared to A),
         // or if it is not significantly higher and the line derivative is still negative.
-        if (sc->epot < sa->epot || (gpc < 0 && sc->epot < (sa->epot + tmp)))
+        if (s_c->epot < s_a->epot || (gpc < 0 && s_c->epot < (s_a->epot + tmp)))
         {
             // Great, we found a better energy. We no longer try to alter the
             // stepsize, but simply accept this new better position. The we select a new
@@ -2054,25 +2060,26 @@ Integrator::do_lbfgs()
                     b = 0.5*(a+c);
                 }
 
-                // Take a trial step to point B
-                real *xb = static_cast<real *>(as_rvec_array(sb->s.x.data())[0]);
-                for (i = 0; i < n; i++)
+                if (DOMAINDECOMP(cr) && s_min->s.ddp_count != cr->dd->ddp_count)
                 {
-                    xb[i] = lastx[i] + b*s[i];
+                    /* Reload the old state */
+                    em_dd_partition_system(fplog, -1, cr, top_global, inputrec,
+                                           s_min, top, mdAtoms, fr, vsite, constr,
+                                           nrnb, wcycle);
                 }
 
+                // Take a trial step to point B
+                do_em_step(cr, ms, inputrec, mdatoms, fr->bMolPBC, s_min, b, &s_min->s.cg_p, s_b,
+                           constr, top, nrnb, wcycle, -1);
+                em_pass_memory(cr, mdatoms, s_min, s_b);
+
                 neval++;
                 // Calculate energy for the trial step in point B
-                energyEvaluator.run(sb, mu_tot, vir, pres, step, FALSE);
-                fnorm = sb->fnorm;
+                energyEvaluator.run(s_b, mu_tot, vir, pres, step, FALSE);
+                fnorm = s_b->fnorm;
 
                 // Calculate gradient in point B
-                real *fb = static_cast<real *>(as_rvec_array(sb->f.data())[0]);
-                for (gpb = 0, i = 0; i < n; i++)
-                {
-                    gpb -= s[i]*fb[i]; /* f is negative gradient, thus the sign */
-
-                }
+                gpb = -em_dot(mdatoms->homenr, as_rvec_array(s_b->s.cg_p.data()), as_rvec_array(s_b->f.data()));
                 /* Sum the gradient along the line across CPUs */
                 if (PAR(cr))
                 {
@@ -2086,14 +2093,14 @@ Integrator::do_lbfgs()
                     /* Replace c endpoint with b */
                     c   = b;
                     /* swap states b and c */
-                    swap_em_state(&sb, &sc);
+                    swap_em_state(&s_b, &s_c);
                 }
                 else
                 {
                     /* Replace a endpoint with b */
                     a   = b;
                     /* swap states a and b */
-                    swap_em_state(&sa, &sb);
+                    swap_em_state(&s_a, &s_b);
                 }
 
                 /*
@@ -2103,9 +2110,13 @@ Integrator::do_lbfgs()
                  */
                 nminstep++;
             }
-            while ((sb->epot > sa->epot || sb->epot > sc->epot) && (nminstep < 20));
+            while ((s_b->epot > s_a->epot || s_b->epot > s_c->epot) && (nminstep < 20));
 
-            if (fabs(sb->epot - Epot0) < GMX_REAL_EPS || nminstep >= 20)
+            /* With a == 0, A is still the starting point and choosing it
+             * would not move us, so that also counts as not finding a lower energy.
+             */
+            if (fabs(s_b->epot - Epot0) < GMX_REAL_EPS || nminstep >= 20 ||
+                (a == 0 && s_c->epot >= s_a->epot))
             {
                 /* OK. We couldn't find a significantly lower energy.
                  * If ncorr==0 this was steepest descent, and then we give up.
@@ -2121,29 +2132,32 @@ Integrator::do_lbfgs()
                 {
                     /* Reset memory */
                     ncorr = 0;
-                    /* Search in gradient direction */
-                    for (i = 0; i < n; i++)
+                    if (DOMAINDECOMP(cr) && s_min->s.ddp_count != cr->dd->ddp_count)
                     {
-                        dx[point][i] = ff[i];
+                        em_dd_partition_system(fplog, step, cr, top_global, inputrec,
+                                               s_min, top, mdAtoms, fr, vsite, constr,
+                                               nrnb, wcycle);
                     }
+                    /* Search in gradient direction */
+                    em_scale(mdatoms->homenr, 1, as_rvec_array(s_min->f.data()), as_rvec_array(s_min->s.cg_p.data()));
+                    em_clear_frozen(&inputrec->opts, mdatoms, as_rvec_array(s_min->s.cg_p.data()));
                     /* Reset stepsize */
                     stepsize = 1.0/fnorm;
                     continue;
                 }
             }
 
-            /* Select min energy state of A & C, put the best in xx/ff/Epot
+            /* Select min energy state of A & C, put the best in C
              */
-            if (sc->epot < sa->epot)
+            if (s_c->epot < s_a->epot)
             {
                 /* Use state C */
-                ems        = *sc;
                 step_taken = c;
             }
             else
             {
                 /* Use state A */
-                ems        = *sa;
+                swap_em_state(&s_a, &s_c);
                 step_taken = a;
             }
 
@@ -2152,10 +2166,33 @@ Integrator::do_lbfgs()
         {
             /* found lower */
             /* Use state C */
-            ems        = *sc;
             step_taken = c;
         }
 
+        if (DOMAINDECOMP(cr) && s_c->s.ddp_count != cr->dd->ddp_count)
+        {
+            /* The new state is not the last one we evaluated, reload it */
+            em_dd_partition_system(fplog, step, cr, top_global, inputrec,
+                                   s_c, top, mdAtoms, fr, vsite, constr,
+                                   nrnb, wcycle);
+        }
+
+        /* Make the new state the current one. Without DD the memory stays
+         * in place, so we move it to the new state. With DD, the new state
+         * has a copy of the memory and of the previous force in its own order.
+         */
+        const rvec *lastf;
+        if (DOMAINDECOMP(cr))
+        {
+            lastf = as_rvec_array(s_c->s.em_vecs[0].data());
+        }
+        else
+        {
+            std::swap(s_min->s.em_vecs, s_c->s.em_vecs);
+            lastf = as_rvec_array(s_min->f.data());
+        }
+        swap_em_state(&s_min, &s_c);
+
         /* Update the memory information, and calculate a new
          * approximation of the inverse hessian
          */
@@ -2166,19 +2203,23 @@ Integrator::do_lbfgs()
             ncorr++;
         }
 
-        for (i = 0; i < n; i++)
-        {
-            dg[point][i]  = lastf[i]-ff[i];
-            dx[point][i] *= step_taken;
-        }
+        rvec *p = as_rvec_array(s_min->s.cg_p.data());
+        ff      = as_rvec_array(s_min->f.data());
 
-        dgdg = 0;
-        dgdx = 0;
-        for (i = 0; i < n; i++)
+        // The position difference is the step taken along the search direction
+        em_scale(mdatoms->homenr, step_taken, p, dx(point));
+        em_scale(mdatoms->homenr, 1, lastf, dg(point));
+        em_axpy(mdatoms->homenr, -1, ff, dg(point));
+
+        double dsum[2];
+        dsum[0] = em_dot(mdatoms->homenr, dg(point), dg(point));
+        dsum[1] = em_dot(mdatoms->homenr, dg(point), dx(point));
+        if (PAR(cr))
         {
-            dgdg += dg[point][i]*dg[point][i];
-            dgdx += dg[point][i]*dx[point][i];
+            gmx_sumd(2, dsum, cr);
         }
+        dgdg = dsum[0];
+        dgdx = dsum[1];
 
         diag = dgdx/dgdg;
 
@@ -2190,11 +2231,8 @@ Integrator::do_lbfgs()
             point = 0;
         }
 
-        /* Update */
-        for (i = 0; i < n; i++)
-        {
-            p[i] = ff[i];
-        }
+        /* Update, the new search direction is computed in place in p */
+        em_scale(mdatoms->homenr, 1, ff, p);
 
         cp = point;
 
@@ -2207,41 +2245,34 @@ Integrator::do_lbfgs()
                 cp = ncorr-1;
             }
 
-            sq = 0;
-            for (i = 0; i < n; i++)
+            double sqSum = em_dot(mdatoms->homenr, dx(cp), p);
+            if (PAR(cr))
             {
-                sq += dx[cp][i]*p[i];
+                gmx_sumd(1, &sqSum, cr);
             }
+            sq = sqSum;
 
             alpha[cp] = rho[cp]*sq;
 
-            for (i = 0; i < n; i++)
-            {
-                p[i] -= alpha[cp]*dg[cp][i];
-            }
+            em_axpy(mdatoms->homenr, -alpha[cp], dg(cp), p);
         }
 
-        for (i = 0; i < n; i++)
-        {
-            p[i] *= diag;
-        }
+        em_scale(mdatoms->homenr, diag, p, p);
 
         /* And then go forward again */
         for (k = 0; k < ncorr; k++)
         {
-            yr = 0;
-            for (i = 0; i < n; i++)
+            double yrSum = em_dot(mdatoms->homenr, p, dg(cp));
+            if (PAR(cr))
             {
-                yr += p[i]*dg[cp][i];
+                gmx_sumd(1, &yrSum, cr);
             }
+            yr = yrSum;
 
             beta = rho[cp]*yr;
             beta = alpha[cp]-beta;
 
-            for (i = 0; i < n; i++)
-            {
-                p[i] += beta*dx[cp][i];
-            }
+            em_axpy(mdatoms->homenr, beta, dx(cp), p);
 
             cp++;
             if (cp >= ncorr)
@@ -2250,17 +2281,7 @@ Integrator::do_lbfgs()
             }
         }
 
-        for (i = 0; i < n; i++)
-        {
-            if (!frozen[i])
-            {
-                dx[point][i] = p[i];
-            }
-            else
-            {
-                dx[point][i] = 0;
-            }
-        }
+        em_clear_frozen(&inputrec->opts, mdatoms, p);
 
         /* Print it if necessary */
         if (MASTER(cr))
@@ -2269,7 +2290,7 @@ Integrator::do_lbfgs()
             {
                 double sqrtNumAtoms = sqrt(static_cast<double>(state_global->natoms));
                 fprintf(stderr, "\rStep %d, Epot=%12.6e, Fnorm=%9.3e, Fmax=%9.3e (atom %d)\n",
-                        step, ems.epot, ems.fnorm/sqrtNumAtoms, ems.fmax, ems.a_fmax + 1);
+                        step, s_min->epot, s_min->fnorm/sqrtNumAtoms, s_min->fmax, s_min->a_fmax + 1);
                 fflush(stderr);
             }
             /* Store the new (lower) energies */
@@ -2288,18 +2309,21 @@ Integrator::do_lbfgs()
         }
 
         /* Send x and E to IMD client, if bIMD is TRUE. */
-        if (do_IMD(inputrec->bIMD, step, cr, TRUE, state_global->box, as_rvec_array(state_global->x.data()), inputrec, 0, wcycle) && MASTER(cr))
+        if (do_IMD(inputrec->bIMD, step, cr, TRUE, state_global->box,
+                   MASTER(cr) ? as_rvec_array(state_global->x.data()) : nullptr,
+                   inputrec, 0, wcycle) &&
+            MASTER(cr))
         {
             IMD_send_positions(inputrec->imd);
         }
 
         // Reset stepsize in we are doing more iterations
-        stepsize = 1.0/ems.fnorm;
+        stepsize = 1.0/s_min->fnorm;
 
         /* Stop when the maximum force lies below tolerance.
          * If we have reached machine precision, converged is already set to true.
          */
-        converged = converged || (ems.fmax < inputrec->em_tol);
+        converged = converged || (s_min->fmax < inputrec->em_tol);
 
     }   /* End of the loop */
 
@@ -2311,7 +2335,7 @@ Integrator::do_lbfgs()
         step--; /* we never took that last step in this case */
 
     }
-    if (ems.fmax > inputrec->em_tol)
+    if (s_min->fmax > inputrec->em_tol)
     {
         if (MASTER(cr))
         {
@@ -2349,18 +2373,18 @@ Integrator::do_lbfgs()
      * above (which we did if do_x or do_f was true).
      */
     do_x = !do_per_step(step, inputrec->nstxout);
-    do_f = !do_per_step(step, inputrec->nstfout);
+    do_f = (inputrec->nstfout > 0 && !do_per_step(step, inputrec->nstfout));
     write_em_traj(fplog, cr, outf, do_x, do_f, ftp2fn(efSTO, nfile, fnm),
                   top_global, inputrec, step,
-                  &ems, state_global, observablesHistory);
+                  s_min, state_global, observablesHistory);
 
     if (MASTER(cr))
     {
         double sqrtNumAtoms = sqrt(static_cast<double>(state_global->natoms));
         print_converged(stderr, LBFGS, inputrec->em_tol, step, converged,
-                        number_steps, &ems, sqrtNumAtoms);
+                        number_steps, s_min, sqrtNumAtoms);
         print_converged(fplog, LBFGS, inputrec->em_tol, step, converged,
-                        number_steps, &ems, sqrtNumAtoms);
+                        number_steps, s_min, sqrtNumAtoms);
 
         fprintf(fplog, "\nPerformed %d energy evaluations in total.\n", neval);
     }
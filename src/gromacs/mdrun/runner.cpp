@@ -549,7 +549,7 @@ int Mdrunner::mdrunner()
          * This is done later for normal MPI and also once more with tMPI
          * for all tMPI ranks.
          */
-        check_and_update_hw_opt_2(&hw_opt, inputrec->cutoff_scheme);
+        check_and_update_hw_opt_2(&hw_opt, inputrec->cutoff_scheme, inputrec->eI);
 
         bool useGpuForNonbonded = false;
         bool useGpuForPme       = false;
@@ -659,6 +659,14 @@ int Mdrunner::mdrunner()
     {
         /* now make sure the state is initialized and propagated */
         set_state_entries(globalState.get(), inputrec);
+
+        if (replExParams.exchangeInterval > 0 && replExParams.swapParameters)
+        {
+            /* The ensemble of a replica changes during the run and
+             * is stored in the checkpoint, it starts as the replica index */
+            globalState->flags       |= (1<<estREPLEX_STATE);
+            globalState->replex_state = ms->sim;
+        }
     }
 
     /* NM and TPI parallelize over force/energy calculations, not atoms,
@@ -895,7 +903,7 @@ int Mdrunner::mdrunner()
 #endif
 
     /* Check and update hw_opt for the cut-off scheme */
-    check_and_update_hw_opt_2(&hw_opt, inputrec->cutoff_scheme);
+    check_and_update_hw_opt_2(&hw_opt, inputrec->cutoff_scheme, inputrec->eI);
 
     /* Check and update the number of OpenMP threads requested */
     checkAndUpdateRequestedNumOpenmpThreads(&hw_opt, *hwinfo, cr, ms, physicalNodeComm.size_,
@@ -907,7 +915,7 @@ int Mdrunner::mdrunner()
                           hw_opt.nthreads_omp,
                           hw_opt.nthreads_omp_pme,
                           !thisRankHasDuty(cr, DUTY_PP),
-                          inputrec->cutoff_scheme == ecutsVERLET);
+                          inputrec->cutoff_scheme == ecutsVERLET || EI_TPI(inputrec->eI));
 
 #ifndef NDEBUG
     if (EI_TPI(inputrec->eI) &&
@@ -1369,6 +1377,10 @@ int Mdrunner::mdrunner()
     free_gpu(pmeDeviceInfo);
     done_forcerec(fr, mtop.molblock.size(), mtop.groups.grps[egcENER].nr);
     sfree(fcd);
+    if (DOMAINDECOMP(cr))
+    {
+        done_domdec(cr->dd);
+    }
 
     if (doMembed)
     {
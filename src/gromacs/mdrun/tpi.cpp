@@ -49,6 +49,7 @@
 #include <ctime>
 
 #include <algorithm>
+#include <vector>
 
 #include "gromacs/commandline/filenm.h"
 #include "gromacs/domdec/domdec.h"
@@ -60,15 +61,18 @@
 #include "gromacs/gmxlib/conformation-utilities.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/gmxlib/nrnb.h"
+#include "gromacs/math/functions.h"
 #include "gromacs/math/units.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/mdlib/constr.h"
 #include "gromacs/mdlib/force.h"
 #include "gromacs/mdlib/force_flags.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdlib/mdatoms.h"
 #include "gromacs/mdlib/mdebin.h"
 #include "gromacs/mdlib/mdrun.h"
 #include "gromacs/mdlib/ns.h"
+#include "gromacs/mdlib/rf_util.h"
 #include "gromacs/mdlib/sim_util.h"
 #include "gromacs/mdlib/tgroup.h"
 #include "gromacs/mdlib/update.h"
@@ -81,13 +85,19 @@
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/random/threefry.h"
 #include "gromacs/random/uniformrealdistribution.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
+#include "gromacs/simd/vector_operations.h"
 #include "gromacs/timing/wallcycle.h"
 #include "gromacs/timing/walltime_accounting.h"
 #include "gromacs/topology/mtop_util.h"
 #include "gromacs/trajectory/trajectoryframe.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 #include "integrator.h"
@@ -124,6 +134,620 @@ static void realloc_bins(double **bin, int *nbin, int nbin_new)
     }
 }
 
+//! Maximum number of insertions for which the batched energies are stored at once
+static const int c_tpiBatchMaxSteps = 4096;
+
+#if GMX_SIMD_HAVE_REAL
+//! The atom list is padded to the SIMD width
+static const int c_tpiListPadding = GMX_SIMD_REAL_WIDTH;
+#else
+//! The atom list is padded to the SIMD width
+static const int c_tpiListPadding = 1;
+#endif
+
+//! Coordinate offset of padding entries in the batched atom list, far away from any inserted atom
+static const real c_tpiFarAway = 1000;
+
+/*! \brief Cell grid with the charge-group centers of the fixed system
+ *
+ * The cells are at least rlist in size, so the charge groups within
+ * rlist of a point are found in the 3x3x3 cells around it.
+ */
+struct TpiGrid
+{
+    rvec             corner;      //!< Lower corner of the grid
+    ivec             numCells;    //!< The number of cells along each dimension
+    rvec             invCellSize; //!< The inverse cell size along each dimension
+    std::vector<int> cellStart;   //!< The start index in cellCg for each cell, size #cells+1
+    std::vector<int> cellCg;      //!< The charge groups sorted on cell
+    std::vector<int> cgCell;      //!< Buffer with the cell index for each charge group
+};
+
+/*! \brief List of the atoms of the fixed system around an insertion center
+ *
+ * The coordinates are relative to the insertion center and
+ * the atoms are grouped by energy group. Each group is padded
+ * to the SIMD width with far away entries without interactions.
+ * The interaction parameters with atom i of the inserted molecule
+ * are stored at offset i*numAtoms.
+ */
+struct TpiAtomList
+{
+    std::vector<int>                                cg;         //!< Charge groups within rlist
+    std::vector<gmx::RVec>                          shift;      //!< Periodic shift of each charge group
+    std::vector<int>                                atom;       //!< Atom index, -1 for padding
+    std::vector<int>                                atomCg;     //!< Index in cg for each atom, -1 for padding
+    std::vector<real, gmx::AlignedAllocator<real> > x;          //!< x-coordinates
+    std::vector<real, gmx::AlignedAllocator<real> > y;          //!< y-coordinates
+    std::vector<real, gmx::AlignedAllocator<real> > z;          //!< z-coordinates
+    std::vector<real, gmx::AlignedAllocator<real> > qq;         //!< epsfac*q_i*q_j
+    std::vector<real, gmx::AlignedAllocator<real> > c6;         //!< C6/6
+    std::vector<real, gmx::AlignedAllocator<real> > c12;        //!< C12/12
+    std::vector<int>                                groupStart; //!< Start of each energy group, size #groups+1
+    int                                             numAtoms;   //!< The number of entries, including padding
+};
+
+//! Per-thread buffers for batched TPI
+struct TpiThreadData
+{
+    TpiAtomList                         list;   //!< The atom list for the current insertion center
+    std::vector<gmx::RVec>              xMol;   //!< Buffer for the rotated molecule
+    std::vector<real>                   vLJ;    //!< LJ energy per energy group
+    std::vector<real>                   vCoul;  //!< Coulomb energy per energy group
+};
+
+/*! \brief Returns whether the insertion energies can be computed with the batched kernel
+ *
+ * This covers the analytical Lennard-Jones and plain or reaction-field
+ * Coulomb group-scheme kernels without modifiers, for a molecule without
+ * non-excluded intramolecular pairs. All other setups, as well as
+ * free-energy perturbation, QM/MM, energy-group exclusions and
+ * configuration dumps, use do_force for every insertion.
+ */
+static gmx_bool tpiUseBatchedKernel(const t_inputrec *ir, const t_forcerec *fr,
+                                    const t_blocka *excls, int a_tp0, int a_tp1,
+                                    int gid_tp, int ngid, gmx_bool bCharge,
+                                    const char *dump_pdb)
+{
+    if (ir->efep != efepNO || ir->bQMMM || dump_pdb != nullptr)
+    {
+        return FALSE;
+    }
+    if (fr->nbkernel_vdw_interaction != GMX_NBKERNEL_VDW_LENNARDJONES ||
+        fr->nbkernel_vdw_modifier != eintmodNONE)
+    {
+        return FALSE;
+    }
+    /* Without charges on the molecule the electrostatics do not contribute */
+    if (bCharge &&
+        !((fr->nbkernel_elec_interaction == GMX_NBKERNEL_ELEC_COULOMB ||
+           fr->nbkernel_elec_interaction == GMX_NBKERNEL_ELEC_REACTIONFIELD) &&
+          fr->nbkernel_elec_modifier == eintmodNONE))
+    {
+        return FALSE;
+    }
+    for (int g = 0; g < ngid; g++)
+    {
+        if (fr->egp_flags[gid_tp*ngid + g] & EGP_EXCL)
+        {
+            return FALSE;
+        }
+    }
+    /* All atom pairs within the molecule should be excluded */
+    for (int i = a_tp0; i < a_tp1; i++)
+    {
+        int numExcl = 0;
+        for (int j = excls->index[i]; j < excls->index[i + 1]; j++)
+        {
+            if (excls->a[j] >= a_tp0 && excls->a[j] < a_tp1)
+            {
+                numExcl++;
+            }
+        }
+        if (numExcl != a_tp1 - a_tp0)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//! Puts the charge-group centers \p cgcm on the cell grid
+static void tpiPutOnGrid(TpiGrid *grid, int numCg, const rvec *cgcm, real rlist)
+{
+    rvec upper;
+    int  d, numCellsTot;
+
+    if (numCg == 0)
+    {
+        clear_rvec(grid->corner);
+        for (d = 0; d < DIM; d++)
+        {
+            grid->numCells[d]    = 1;
+            grid->invCellSize[d] = 1/rlist;
+        }
+        grid->cellStart.assign(2, 0);
+        grid->cellCg.clear();
+        return;
+    }
+
+    copy_rvec(cgcm[0], grid->corner);
+    copy_rvec(cgcm[0], upper);
+    for (int cg = 1; cg < numCg; cg++)
+    {
+        for (d = 0; d < DIM; d++)
+        {
+            grid->corner[d] = std::min(grid->corner[d], cgcm[cg][d]);
+            upper[d]        = std::max(upper[d], cgcm[cg][d]);
+        }
+    }
+    numCellsTot = 1;
+    for (d = 0; d < DIM; d++)
+    {
+        real size             = std::max(upper[d] - grid->corner[d], rlist);
+        grid->numCells[d]     = std::max(static_cast<int>(size/rlist), 1);
+        /* Make sure the cells are not smaller than rlist due to rounding */
+        grid->invCellSize[d]  = grid->numCells[d]/(size*(1 + 2*GMX_REAL_EPS));
+        numCellsTot          *= grid->numCells[d];
+    }
+
+    grid->cellStart.assign(numCellsTot + 1, 0);
+    grid->cgCell.resize(numCg);
+    for (int cg = 0; cg < numCg; cg++)
+    {
+        ivec ci;
+        for (d = 0; d < DIM; d++)
+        {
+            ci[d] = std::min(static_cast<int>((cgcm[cg][d] - grid->corner[d])*grid->invCellSize[d]),
+                             grid->numCells[d] - 1);
+        }
+        grid->cgCell[cg] = (ci[XX]*grid->numCells[YY] + ci[YY])*grid->numCells[ZZ] + ci[ZZ];
+        grid->cellStart[grid->cgCell[cg] + 1]++;
+    }
+    for (int c = 0; c < numCellsTot; c++)
+    {
+        grid->cellStart[c + 1] += grid->cellStart[c];
+    }
+    grid->cellCg.resize(numCg);
+    for (int cg = 0; cg < numCg; cg++)
+    {
+        grid->cellCg[grid->cellStart[grid->cgCell[cg]]++] = cg;
+    }
+    /* Restore the starts, which were shifted by one cell during the fill */
+    for (int c = numCellsTot; c > 0; c--)
+    {
+        grid->cellStart[c] = grid->cellStart[c - 1];
+    }
+    grid->cellStart[0] = 0;
+}
+
+/*! \brief Makes the list of atoms in charge groups with centers within rlist of \p x_init
+ *
+ * As the group-scheme search, this includes every periodic image
+ * of a charge group for which the center is within rlist.
+ */
+static void tpiMakeAtomList(TpiAtomList *list, const TpiGrid *grid,
+                            const t_block *cgs, const int *cginfo, int ngid,
+                            int numTpAtoms, const int *tpType, const real *tpCharge,
+                            const t_mdatoms *md, const t_forcerec *fr,
+                            const rvec *x, const rvec *cgcm, const matrix box,
+                            const rvec x_init, real rlist)
+{
+    const real rs2 = rlist*rlist;
+    ivec       shp = { 1, 1, 1 };
+    int        n;
+
+    /* A strongly skewed box needs two shifts along x, as in ns_grid */
+    if (box[XX][XX] - std::abs(box[YY][XX]) - std::abs(box[ZZ][XX]) < rlist)
+    {
+        shp[XX] = 2;
+    }
+
+    list->cg.clear();
+    list->shift.clear();
+    for (int tz = -shp[ZZ]; tz <= shp[ZZ]; tz++)
+    {
+        for (int ty = -shp[YY]; ty <= shp[YY]; ty++)
+        {
+            for (int tx = -shp[XX]; tx <= shp[XX]; tx++)
+            {
+                rvec shift, xi;
+                ivec c0, c1;
+                bool bInRange = true;
+
+                for (int d = 0; d < DIM; d++)
+                {
+                    shift[d] = tx*box[XX][d] + ty*box[YY][d] + tz*box[ZZ][d];
+                    xi[d]    = x_init[d] + shift[d];
+                    real l   = (xi[d] - rlist - grid->corner[d])*grid->invCellSize[d];
+                    real u   = (xi[d] + rlist - grid->corner[d])*grid->invCellSize[d];
+                    if (u < 0 || l >= grid->numCells[d])
+                    {
+                        bInRange = false;
+                    }
+                    c0[d] = std::max(static_cast<int>(l), 0);
+                    c1[d] = std::min(static_cast<int>(u), grid->numCells[d] - 1);
+                }
+                if (!bInRange)
+                {
+                    continue;
+                }
+                for (int cx = c0[XX]; cx <= c1[XX]; cx++)
+                {
+                    for (int cy = c0[YY]; cy <= c1[YY]; cy++)
+                    {
+                        for (int cz = c0[ZZ]; cz <= c1[ZZ]; cz++)
+                        {
+                            int c = (cx*grid->numCells[YY] + cy)*grid->numCells[ZZ] + cz;
+                            for (int i = grid->cellStart[c]; i < grid->cellStart[c + 1]; i++)
+                            {
+                                int cg = grid->cellCg[i];
+                                if (distance2(xi, cgcm[cg]) < rs2)
+                                {
+                                    list->cg.push_back(cg);
+                                    list->shift.push_back(shift);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* Store the atoms grouped by energy group, relative to x_init
+     * and shifted into the image of the test particle.
+     */
+    list->atom.clear();
+    list->atomCg.clear();
+    list->groupStart.resize(ngid + 1);
+    list->groupStart[0] = 0;
+    for (int g = 0; g < ngid; g++)
+    {
+        for (size_t k = 0; k < list->cg.size(); k++)
+        {
+            int cg = list->cg[k];
+            if (GET_CGINFO_GID(cginfo[cg]) == g)
+            {
+                for (int a = cgs->index[cg]; a < cgs->index[cg + 1]; a++)
+                {
+                    list->atom.push_back(a);
+                    list->atomCg.push_back(k);
+                }
+            }
+        }
+        while (list->atom.size() % c_tpiListPadding != 0)
+        {
+            list->atom.push_back(-1);
+            list->atomCg.push_back(-1);
+        }
+        list->groupStart[g + 1] = list->atom.size();
+    }
+    n              = list->atom.size();
+    list->numAtoms = n;
+
+    list->x.resize(n);
+    list->y.resize(n);
+    list->z.resize(n);
+    list->qq.resize(numTpAtoms*n);
+    list->c6.resize(numTpAtoms*n);
+    list->c12.resize(numTpAtoms*n);
+    for (int j = 0; j < n; j++)
+    {
+        int aj = list->atom[j];
+        if (aj >= 0)
+        {
+            const gmx::RVec &shift = list->shift[list->atomCg[j]];
+
+            list->x[j] = x[aj][XX] - shift[XX] - x_init[XX];
+            list->y[j] = x[aj][YY] - shift[YY] - x_init[YY];
+            list->z[j] = x[aj][ZZ] - shift[ZZ] - x_init[ZZ];
+            for (int i = 0; i < numTpAtoms; i++)
+            {
+                list->qq[i*n + j]  = fr->ic->epsfac*tpCharge[i]*md->chargeA[aj];
+                list->c6[i*n + j]  = C6(fr->nbfp, fr->ntype, tpType[i], md->typeA[aj])/6;
+                list->c12[i*n + j] = C12(fr->nbfp, fr->ntype, tpType[i], md->typeA[aj])/12;
+            }
+        }
+        else
+        {
+            list->x[j] = c_tpiFarAway;
+            list->y[j] = c_tpiFarAway;
+            list->z[j] = c_tpiFarAway;
+            for (int i = 0; i < numTpAtoms; i++)
+            {
+                list->qq[i*n + j]  = 0;
+                list->c6[i*n + j]  = 0;
+                list->c12[i*n + j] = 0;
+            }
+        }
+    }
+}
+
+/*! \brief Computes the LJ and Coulomb energies per energy group of the inserted molecule
+ *
+ * \param[in]  list       The atom list around the insertion center
+ * \param[in]  numTpAtoms The number of atoms in the inserted molecule
+ * \param[in]  xTp        The molecule coordinates relative to the insertion center
+ * \param[in]  bCharge    Whether the molecule has charges
+ * \param[in]  krf        The reaction-field constant, 0 for plain Coulomb
+ * \param[in]  crf        The reaction-field shift, 0 for plain Coulomb
+ * \param[in]  ngid       The number of energy groups
+ * \param[out] vLJ        The LJ energy per energy group
+ * \param[out] vCoul      The Coulomb energy per energy group
+ */
+static void tpiCalcEnergies(const TpiAtomList *list, int numTpAtoms, const gmx::RVec *xTp,
+                            gmx_bool bCharge, real krf, real crf, int ngid,
+                            real *vLJ, real *vCoul)
+{
+    const int   n    = list->numAtoms;
+    const real *x    = list->x.data();
+    const real *y    = list->y.data();
+    const real *z    = list->z.data();
+
+    for (int g = 0; g < ngid; g++)
+    {
+        vLJ[g]   = 0;
+        vCoul[g] = 0;
+    }
+
+    for (int i = 0; i < numTpAtoms; i++)
+    {
+        const real *qq  = list->qq.data() + i*n;
+        const real *c6  = list->c6.data() + i*n;
+        const real *c12 = list->c12.data() + i*n;
+
+        for (int g = 0; g < ngid; g++)
+        {
+            const int j0 = list->groupStart[g];
+            const int j1 = list->groupStart[g + 1];
+#if GMX_SIMD_HAVE_REAL
+            const gmx::SimdReal ix(xTp[i][XX]);
+            const gmx::SimdReal iy(xTp[i][YY]);
+            const gmx::SimdReal iz(xTp[i][ZZ]);
+            const gmx::SimdReal krfS(krf);
+            const gmx::SimdReal crfS(crf);
+            gmx::SimdReal       vLJS   = gmx::setZero();
+            gmx::SimdReal       vCoulS = gmx::setZero();
+
+            for (int j = j0; j < j1; j += GMX_SIMD_REAL_WIDTH)
+            {
+                gmx::SimdReal dx     = ix - gmx::load<gmx::SimdReal>(x + j);
+                gmx::SimdReal dy     = iy - gmx::load<gmx::SimdReal>(y + j);
+                gmx::SimdReal dz     = iz - gmx::load<gmx::SimdReal>(z + j);
+                gmx::SimdReal rsq    = gmx::norm2(dx, dy, dz);
+                gmx::SimdReal rinv   = gmx::invsqrt(rsq);
+                gmx::SimdReal rinvsq = rinv*rinv;
+                gmx::SimdReal rinv6  = rinvsq*rinvsq*rinvsq;
+
+                vLJS = gmx::fma(rinv6, gmx::fms(gmx::load<gmx::SimdReal>(c12 + j), rinv6,
+                                                gmx::load<gmx::SimdReal>(c6 + j)), vLJS);
+                if (bCharge)
+                {
+                    vCoulS = gmx::fma(gmx::load<gmx::SimdReal>(qq + j),
+                                      gmx::fma(krfS, rsq, rinv) - crfS, vCoulS);
+                }
+            }
+            vLJ[g]   += gmx::reduce(vLJS);
+            vCoul[g] += gmx::reduce(vCoulS);
+#else
+            for (int j = j0; j < j1; j++)
+            {
+                real dx     = xTp[i][XX] - x[j];
+                real dy     = xTp[i][YY] - y[j];
+                real dz     = xTp[i][ZZ] - z[j];
+                real rsq    = dx*dx + dy*dy + dz*dz;
+                real rinv   = gmx::invsqrt(rsq);
+                real rinvsq = rinv*rinv;
+                real rinv6  = rinvsq*rinvsq*rinvsq;
+
+                vLJ[g] += rinv6*(c12[j]*rinv6 - c6[j]);
+                if (bCharge)
+                {
+                    vCoul[g] += qq[j]*(rinv + krf*rsq - crf);
+                }
+            }
+#endif
+        }
+    }
+}
+
+/*! \brief Draws the location and orientation of the insertion at one step
+ *
+ * With bNS a new insertion center x_init is drawn for random insertion
+ * in the whole volume. Insertions are placed within drmax of x_init,
+ * except with nstlist=1 without cavity, where x_tp=x_init.
+ * The random engine should be restarted for each step.
+ */
+static void tpiDrawInsertion(gmx::ThreeFry2x64<16> *rng, gmx::UniformRealDistribution<real> *dist,
+                             gmx_bool bCavity, gmx_bool bNS, int nstlist, real drmax,
+                             const matrix box, rvec x_init, rvec x_tp,
+                             gmx_bool bRotate, real angle[DIM])
+{
+    rvec dx;
+    int  d;
+
+    if (!bCavity && bNS)
+    {
+        /* Generate a random position in the box */
+        for (d = 0; d < DIM; d++)
+        {
+            x_init[d] = (*dist)(*rng)*box[d][d];
+        }
+    }
+
+    if (!bCavity && nstlist == 1)
+    {
+        copy_rvec(x_init, x_tp);
+    }
+    else
+    {
+        /* Generate coordinates within |dx|=drmax of x_init */
+        do
+        {
+            for (d = 0; d < DIM; d++)
+            {
+                dx[d] = (2*(*dist)(*rng) - 1)*drmax;
+            }
+        }
+        while (norm2(dx) > drmax*drmax);
+        rvec_add(x_init, dx, x_tp);
+    }
+
+    if (bRotate)
+    {
+        /* Rotate the molecule randomly */
+        for (d = 0; d < DIM; d++)
+        {
+            angle[d] = 2*M_PI*(*dist)(*rng);
+        }
+    }
+}
+
+//! Frame and system data needed for computing the TPI energies in batches
+struct TpiBatchSetup
+{
+    const t_block     *cgs;          //!< The charge groups, the last is the molecule to insert
+    const int         *cginfo;       //!< Charge-group info with the energy groups
+    int                ngid;         //!< The number of energy groups
+    int                numTpAtoms;   //!< The number of atoms to insert
+    const rvec        *x_mol;        //!< Coordinates of the molecule to insert
+    const int         *tpType;       //!< Atom types of the molecule to insert
+    const real        *tpCharge;     //!< Charges of the molecule to insert
+    const t_mdatoms   *md;           //!< The atom data
+    const t_forcerec  *fr;           //!< The force record
+    gmx_int64_t        seed;         //!< The random seed
+    gmx_bool           bCavity;      //!< Whether we insert in a cavity
+    int                nstlist;      //!< The number of insertions per insertion center
+    real               drmax;        //!< The maximum distance from the insertion center
+    real               rlist;        //!< The pair-list cut-off
+    gmx_bool           bCharge;      //!< Whether the molecule has charges
+    real               krf;          //!< Reaction-field constant, 0 for plain Coulomb
+    real               crf;          //!< Reaction-field shift, 0 for plain Coulomb
+    gmx_bool           bDispCorr;    //!< Whether there is a dispersion correction
+    gmx_bool           bRFExcl;      //!< Whether there is a reaction-field exclusion correction
+    int                nener;        //!< The number of energy terms per insertion
+    /* Per frame */
+    const rvec        *x;            //!< The coordinates, with charge groups in the box
+    const rvec        *cgcm;         //!< The charge-group centers
+    matrix             box;          //!< The box
+    TpiGrid            grid;         //!< Cell grid with the charge groups
+    rvec               x_cavity;     //!< The cavity center
+    TpiAtomList        cavityList;   //!< Atom list around the cavity center
+    real               enerDispCorr; //!< The dispersion correction energy
+    real               enerRFExcl;   //!< The reaction-field exclusion correction
+};
+
+/*! \brief Computes the TPI energy terms for a batch of insertion blocks
+ *
+ * Computes the energies of all insertions in blocks firstBlock,
+ * firstBlock+blockStride, ..., for numBlocks blocks of stepBlockSize
+ * steps. The blocks are distributed over the OpenMP threads.
+ * The nener energy terms of the k-th insertion, in the order of the
+ * TPI output, are stored at ener[k*nener] and the location in xTp[k].
+ */
+static void tpiComputeBatch(const TpiBatchSetup *setup, std::vector<TpiThreadData> *threadData,
+                            gmx_int64_t frame_step, gmx_int64_t firstBlock, int numBlocks,
+                            int blockStride, gmx_int64_t stepBlockSize, gmx_int64_t nsteps,
+                            real *ener, rvec *xTp)
+{
+    const int numThreads = threadData->size();
+
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+    for (int b = 0; b < numBlocks; b++)
+    {
+        try
+        {
+            TpiThreadData                      &td    = (*threadData)[gmx_omp_get_thread_num()];
+            const gmx_int64_t                   step0 = (firstBlock + b*blockStride)*stepBlockSize;
+            const gmx_int64_t                   step1 = std::min(step0 + stepBlockSize, nsteps);
+            const int                           ngid  = setup->ngid;
+            const TpiAtomList                  *list  = setup->bCavity ? &setup->cavityList : &td.list;
+            gmx::ThreeFry2x64<16>               rng(setup->seed, gmx::RandomDomain::TestParticleInsertion);
+            gmx::UniformRealDistribution<real>  dist;
+            rvec                                x_init, x_tp, dx;
+            real                                angle[DIM];
+
+            copy_rvec(setup->x_cavity, x_init);
+            td.xMol.resize(setup->numTpAtoms);
+            td.vLJ.resize(ngid);
+            td.vCoul.resize(ngid);
+
+            for (gmx_int64_t step = step0; step < step1; step++)
+            {
+                /* The same random numbers as with do_force for each step */
+                rng.restart(frame_step, step);
+                dist.reset();
+
+                gmx_bool bNS = (!setup->bCavity && step % setup->nstlist == 0);
+                tpiDrawInsertion(&rng, &dist, setup->bCavity, bNS,
+                                 setup->nstlist, setup->drmax, setup->box,
+                                 x_init, x_tp, setup->numTpAtoms > 1, angle);
+                if (bNS)
+                {
+                    tpiMakeAtomList(&td.list, &setup->grid, setup->cgs, setup->cginfo, ngid,
+                                    setup->numTpAtoms, setup->tpType, setup->tpCharge,
+                                    setup->md, setup->fr, setup->x, setup->cgcm, setup->box,
+                                    x_init, setup->rlist);
+                }
+
+                /* Put the molecule at x_tp, relative to x_init */
+                rvec_sub(x_tp, x_init, dx);
+                if (setup->numTpAtoms == 1)
+                {
+                    copy_rvec(dx, td.xMol[0]);
+                }
+                else
+                {
+                    for (int i = 0; i < setup->numTpAtoms; i++)
+                    {
+                        copy_rvec(setup->x_mol[i], td.xMol[i]);
+                    }
+                    rotate_conf(setup->numTpAtoms, as_rvec_array(td.xMol.data()), nullptr,
+                                angle[XX], angle[YY], angle[ZZ]);
+                    for (int i = 0; i < setup->numTpAtoms; i++)
+                    {
+                        rvec_inc(td.xMol[i], dx);
+                    }
+                }
+
+                tpiCalcEnergies(list, setup->numTpAtoms, td.xMol.data(),
+                                setup->bCharge, setup->krf, setup->crf, ngid,
+                                td.vLJ.data(), td.vCoul.data());
+
+                const int k    = b*stepBlockSize + (step - step0);
+                real     *e    = ener + k*setup->nener;
+                real      epot = setup->enerDispCorr + setup->enerRFExcl;
+                int       t    = 1;
+                for (int g = 0; g < ngid; g++)
+                {
+                    e[t++] = td.vLJ[g];
+                    epot  += td.vLJ[g] + td.vCoul[g];
+                }
+                if (setup->bDispCorr)
+                {
+                    e[t++] = setup->enerDispCorr;
+                }
+                if (setup->bCharge)
+                {
+                    for (int g = 0; g < ngid; g++)
+                    {
+                        e[t++] = td.vCoul[g];
+                    }
+                    if (setup->bRFExcl)
+                    {
+                        e[t++] = setup->enerRFExcl;
+                    }
+                }
+                e[0] = epot;
+                copy_rvec(x_tp, xTp[k]);
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR;
+    }
+}
+
 namespace gmx
 {
 
@@ -136,13 +760,15 @@ Integrator::do_tpi()
     PaddedRVecVector f {};
     real             lambda, t, temp, beta, drmax, epot;
     double           embU, sum_embU, *sum_UgembU, V, V_all, VembU_all;
+    real            *stepEner;
     t_trxstatus     *status;
     t_trxframe       rerun_fr;
-    gmx_bool         bDispCorr, bCharge, bRFExcl, bNotLastFrame, bStateChanged, bNS;
+    gmx_bool         bDispCorr, bCharge, bRFExcl, bNotLastFrame, bStateChanged, bNS, bBatched;
     tensor           force_vir, shake_vir, vir, pres;
     int              cg_tp, a_tp0, a_tp1, ngid, gid_tp, nener, e;
     rvec            *x_mol;
-    rvec             mu_tot, x_init, dx, x_tp;
+    rvec             mu_tot, x_init, x_tp;
+    real             angle[DIM];
     int              nnodes, frame;
     gmx_int64_t      frame_step_prev, frame_step;
     gmx_int64_t      nsteps, stepblocksize = 0, step;
@@ -361,6 +987,8 @@ Integrator::do_tpi()
         }
     }
     snew(sum_UgembU, nener);
+    /* The energy terms of a single insertion, in the same order */
+    snew(stepEner, nener);
 
     /* Copy the random seed set by the user */
     seed = inputrec->ld_seed;
@@ -462,6 +1090,71 @@ Integrator::do_tpi()
             gmx_fatal(FARGS, "Unknown integrator %s", ei_names[inputrec->eI]);
     }
 
+    /* With simple non-bonded interactions we compute the insertion
+     * energies directly, in batches of insertions over OpenMP threads,
+     * instead of calling do_force for every insertion.
+     */
+    bBatched = tpiUseBatchedKernel(inputrec, fr, &top->excls, a_tp0, a_tp1,
+                                   gid_tp, ngid, bCharge, dump_pdb);
+    TpiBatchSetup              batch;
+    std::vector<TpiThreadData> batchThreadData;
+    std::vector<int>           tpType;
+    std::vector<real>          tpCharge;
+    std::vector<real>          batchEner;
+    std::vector<gmx::RVec>     batchXTp;
+    int                        batchMaxBlocks  = 0;
+    gmx_int64_t                batchFirstBlock = 0, batchEndStep = 0;
+    if (bBatched)
+    {
+        for (i = a_tp0; i < a_tp1; i++)
+        {
+            tpType.push_back(mdatoms->typeA[i]);
+            tpCharge.push_back(mdatoms->chargeA[i]);
+        }
+        batch.cgs          = &top->cgs;
+        batch.cginfo       = fr->cginfo;
+        batch.ngid         = ngid;
+        batch.numTpAtoms   = a_tp1 - a_tp0;
+        batch.x_mol        = x_mol;
+        batch.tpType       = tpType.data();
+        batch.tpCharge     = tpCharge.data();
+        batch.md           = mdatoms;
+        batch.fr           = fr;
+        batch.seed         = seed;
+        batch.bCavity      = bCavity;
+        batch.nstlist      = inputrec->nstlist;
+        batch.drmax        = drmax;
+        batch.rlist        = inputrec->rlist;
+        batch.bCharge      = bCharge;
+        batch.bDispCorr    = bDispCorr;
+        batch.bRFExcl      = bRFExcl;
+        batch.nener        = nener;
+        batch.x            = as_rvec_array(state_global->x.data());
+        batch.cgcm         = fr->cg_cm;
+        if (fr->nbkernel_elec_interaction == GMX_NBKERNEL_ELEC_REACTIONFIELD)
+        {
+            batch.krf      = fr->ic->k_rf;
+            batch.crf      = fr->ic->c_rf;
+        }
+        else
+        {
+            batch.krf      = 0;
+            batch.crf      = 0;
+        }
+
+        int numThreads = gmx_omp_nthreads_get(emntDefault);
+        batchThreadData.resize(numThreads);
+        batchMaxBlocks = std::max(c_tpiBatchMaxSteps/static_cast<int>(stepblocksize), 1);
+        batchEner.resize(batchMaxBlocks*stepblocksize*nener);
+        batchXTp.resize(batchMaxBlocks*stepblocksize);
+
+        if (fplog)
+        {
+            fprintf(fplog, "\nWill compute the insertion energies directly using %d OpenMP thread%s\n",
+                    numThreads, numThreads > 1 ? "s" : "");
+        }
+    }
+
     while (bNotLastFrame)
     {
         frame_step      = rerun_fr.step;
@@ -498,162 +1191,231 @@ Integrator::do_tpi()
         bStateChanged = TRUE;
         bNS           = TRUE;
 
-        step = cr->nodeid*stepblocksize;
-        while (step < nsteps)
+        if (bCavity)
         {
-            /* Restart random engine using the frame and insertion step
-             * as counters.
-             * Note that we need to draw several random values per iteration,
-             * but by using the internal subcounter functionality of ThreeFry2x64
-             * we can draw 131072 unique 64-bit values before exhausting
-             * the stream. This is a huge margin, and if something still goes
-             * wrong you will get an exception when the stream is exhausted.
+            /* Random insertion around a cavity location
+             * given by the last coordinate of the trajectory.
              */
-            rng.restart(frame_step, step);
-            dist.reset();  // erase any memory in the distribution
-
-            if (!bCavity)
+            if (nat_cavity == 1)
             {
-                /* Random insertion in the whole volume */
-                bNS = (step % inputrec->nstlist == 0);
-                if (bNS)
+                /* Copy the location of the cavity */
+                copy_rvec(rerun_fr.x[rerun_fr.natoms-1], x_init);
+            }
+            else
+            {
+                /* Determine the center of mass of the last molecule */
+                clear_rvec(x_init);
+                mass_tot = 0;
+                for (i = 0; i < nat_cavity; i++)
                 {
-                    /* Generate a random position in the box */
                     for (d = 0; d < DIM; d++)
                     {
-                        x_init[d] = dist(rng)*state_global->box[d][d];
+                        x_init[d] +=
+                            mass_cavity[i]*rerun_fr.x[rerun_fr.natoms-nat_cavity+i][d];
                     }
+                    mass_tot += mass_cavity[i];
+                }
+                for (d = 0; d < DIM; d++)
+                {
+                    x_init[d] /= mass_tot;
+                }
+            }
+        }
+
+        if (bBatched)
+        {
+            wallcycle_start(wcycle, ewcFORCE);
+
+            /* Put the fixed system on a grid for searching around insertions */
+            put_charge_groups_in_box(fplog, 0, cg_tp, fr->ePBC, state_global->box,
+                                     &top->cgs, as_rvec_array(state_global->x.data()), fr->cg_cm);
+            tpiPutOnGrid(&batch.grid, cg_tp, fr->cg_cm, inputrec->rlist);
+            copy_mat(state_global->box, batch.box);
+
+            /* The dispersion correction is the same for all insertions */
+            batch.enerDispCorr = 0;
+            if (bDispCorr)
+            {
+                calc_dispcorr(inputrec, fr, state_global->box,
+                              lambda, pres, vir, &prescorr, &enercorr, &dvdlcorr);
+                batch.enerDispCorr = enercorr;
+            }
+
+            /* The RF exclusion correction only depends on the internal
+             * coordinates of the molecule, so we compute it once.
+             */
+            batch.enerRFExcl = 0;
+            if (bRFExcl)
+            {
+                t_pbc pbc;
+                real  dvdl_rf_excl = 0;
+
+                for (i = a_tp0; i < a_tp1; i++)
+                {
+                    copy_rvec(x_mol[i-a_tp0], state_global->x[i]);
                 }
+                set_pbc(&pbc, fr->ePBC, state_global->box);
+                batch.enerRFExcl =
+                    RF_excl_correction(fr, nullptr, mdatoms, &top->excls, FALSE,
+                                       as_rvec_array(state_global->x.data()), as_rvec_array(f.data()),
+                                       fr->fshift, &pbc, lambda, &dvdl_rf_excl);
+            }
+
+            if (bCavity)
+            {
+                copy_rvec(x_init, batch.x_cavity);
+                tpiMakeAtomList(&batch.cavityList, &batch.grid, batch.cgs, batch.cginfo, ngid,
+                                batch.numTpAtoms, batch.tpType, batch.tpCharge,
+                                mdatoms, fr, batch.x, batch.cgcm, batch.box,
+                                x_init, inputrec->rlist);
+            }
+            batchEndStep = 0;
 
-                if (inputrec->nstlist == 1)
+            wallcycle_stop(wcycle, ewcFORCE);
+        }
+
+        step = cr->nodeid*stepblocksize;
+        while (step < nsteps)
+        {
+            if (bBatched)
+            {
+                if (step >= batchEndStep)
                 {
-                    copy_rvec(x_init, x_tp);
+                    /* Compute the energies for the next blocks of steps
+                     * assigned to this rank.
+                     */
+                    gmx_int64_t numBlocksTot = (nsteps + stepblocksize - 1)/stepblocksize;
+                    batchFirstBlock          = step/stepblocksize;
+                    int         numBlocks    = std::min(static_cast<gmx_int64_t>(batchMaxBlocks),
+                                                        (numBlocksTot - batchFirstBlock + nnodes - 1)/nnodes);
+
+                    wallcycle_start(wcycle, ewcFORCE);
+                    tpiComputeBatch(&batch, &batchThreadData, frame_step,
+                                    batchFirstBlock, numBlocks, nnodes, stepblocksize, nsteps,
+                                    batchEner.data(), as_rvec_array(batchXTp.data()));
+                    wallcycle_stop(wcycle, ewcFORCE);
+
+                    batchEndStep = (batchFirstBlock + (numBlocks - 1)*nnodes + 1)*stepblocksize;
                 }
-                else
+
+                gmx_int64_t k = ((step/stepblocksize - batchFirstBlock)/nnodes)*stepblocksize + step % stepblocksize;
+                for (e = 0; e < nener; e++)
                 {
-                    /* Generate coordinates within |dx|=drmax of x_init */
-                    do
-                    {
-                        for (d = 0; d < DIM; d++)
-                        {
-                            dx[d] = (2*dist(rng) - 1)*drmax;
-                        }
-                    }
-                    while (norm2(dx) > drmax*drmax);
-                    rvec_add(x_init, dx, x_tp);
+                    stepEner[e] = batchEner[k*nener + e];
                 }
+                copy_rvec(batchXTp[k], x_tp);
             }
             else
             {
-                /* Random insertion around a cavity location
-                 * given by the last coordinate of the trajectory.
+                /* Restart random engine using the frame and insertion step
+                 * as counters.
+                 * Note that we need to draw several random values per iteration,
+                 * but by using the internal subcounter functionality of ThreeFry2x64
+                 * we can draw 131072 unique 64-bit values before exhausting
+                 * the stream. This is a huge margin, and if something still goes
+                 * wrong you will get an exception when the stream is exhausted.
                  */
-                if (step == 0)
+                rng.restart(frame_step, step);
+                dist.reset();  // erase any memory in the distribution
+
+                if (!bCavity)
                 {
-                    if (nat_cavity == 1)
+                    bNS = (step % inputrec->nstlist == 0);
+                }
+                tpiDrawInsertion(&rng, &dist, bCavity, bNS, inputrec->nstlist, drmax,
+                                 state_global->box, x_init, x_tp, a_tp1 - a_tp0 > 1, angle);
+
+                if (a_tp1 - a_tp0 == 1)
+                {
+                    /* Insert a single atom, just copy the insertion location */
+                    copy_rvec(x_tp, state_global->x[a_tp0]);
+                }
+                else
+                {
+                    /* Copy the coordinates from the top file */
+                    for (i = a_tp0; i < a_tp1; i++)
                     {
-                        /* Copy the location of the cavity */
-                        copy_rvec(rerun_fr.x[rerun_fr.natoms-1], x_init);
+                        copy_rvec(x_mol[i-a_tp0], state_global->x[i]);
                     }
-                    else
+                    rotate_conf(a_tp1-a_tp0, as_rvec_array(state_global->x.data())+a_tp0, nullptr,
+                                angle[XX], angle[YY], angle[ZZ]);
+                    /* Shift to the insertion location */
+                    for (i = a_tp0; i < a_tp1; i++)
                     {
-                        /* Determine the center of mass of the last molecule */
-                        clear_rvec(x_init);
-                        mass_tot = 0;
-                        for (i = 0; i < nat_cavity; i++)
-                        {
-                            for (d = 0; d < DIM; d++)
-                            {
-                                x_init[d] +=
-                                    mass_cavity[i]*rerun_fr.x[rerun_fr.natoms-nat_cavity+i][d];
-                            }
-                            mass_tot += mass_cavity[i];
-                        }
-                        for (d = 0; d < DIM; d++)
-                        {
-                            x_init[d] /= mass_tot;
-                        }
+                        rvec_inc(state_global->x[i], x_tp);
                     }
                 }
-                /* Generate coordinates within |dx|=drmax of x_init */
-                do
+
+                /* Clear some matrix variables  */
+                clear_mat(force_vir);
+                clear_mat(shake_vir);
+                clear_mat(vir);
+                clear_mat(pres);
+
+                /* Set the charge group center of mass of the test particle */
+                copy_rvec(x_init, fr->cg_cm[top->cgs.nr-1]);
+
+                /* Calc energy (no forces) on new positions.
+                 * Since we only need the intermolecular energy
+                 * and the RF exclusion terms of the inserted molecule occur
+                 * within a single charge group we can pass NULL for the graph.
+                 * This also avoids shifts that would move charge groups
+                 * out of the box. */
+                /* Make do_force do a single node force calculation */
+                cr->nnodes = 1;
+                do_force(fplog, cr, ms, inputrec,
+                         step, nrnb, wcycle, top, &top_global->groups,
+                         state_global->box, state_global->x, &state_global->hist,
+                         f, force_vir, mdatoms, enerd, fcd,
+                         state_global->lambda,
+                         nullptr, fr, nullptr, mu_tot, t, nullptr,
+                         GMX_FORCE_NONBONDED | GMX_FORCE_ENERGY |
+                         (bNS ? GMX_FORCE_DYNAMICBOX | GMX_FORCE_NS : 0) |
+                         (bStateChanged ? GMX_FORCE_STATECHANGED : 0),
+                         DdOpenBalanceRegionBeforeForceComputation::no,
+                         DdCloseBalanceRegionAfterForceComputation::no);
+                cr->nnodes    = nnodes;
+                bStateChanged = FALSE;
+                bNS           = FALSE;
+
+                /* Calculate long range corrections to pressure and energy */
+                calc_dispcorr(inputrec, fr, state_global->box,
+                              lambda, pres, vir, &prescorr, &enercorr, &dvdlcorr);
+                /* figure out how to rearrange the next 4 lines MRS 8/4/2009 */
+                enerd->term[F_DISPCORR]  = enercorr;
+                enerd->term[F_EPOT]     += enercorr;
+                enerd->term[F_PRES]     += prescorr;
+                enerd->term[F_DVDL_VDW] += dvdlcorr;
+
+                /* Collect the energy contributions of the test molecule */
+                e             = 0;
+                stepEner[e++] = enerd->term[F_EPOT];
+                for (i = 0; i < ngid; i++)
                 {
-                    for (d = 0; d < DIM; d++)
-                    {
-                        dx[d] = (2*dist(rng) - 1)*drmax;
-                    }
+                    stepEner[e++] = enerd->grpp.ener[fr->bBHAM ? egBHAMSR : egLJSR][GID(i, gid_tp, ngid)];
                 }
-                while (norm2(dx) > drmax*drmax);
-                rvec_add(x_init, dx, x_tp);
-            }
-
-            if (a_tp1 - a_tp0 == 1)
-            {
-                /* Insert a single atom, just copy the insertion location */
-                copy_rvec(x_tp, state_global->x[a_tp0]);
-            }
-            else
-            {
-                /* Copy the coordinates from the top file */
-                for (i = a_tp0; i < a_tp1; i++)
+                if (bDispCorr)
                 {
-                    copy_rvec(x_mol[i-a_tp0], state_global->x[i]);
+                    stepEner[e++] = enerd->term[F_DISPCORR];
                 }
-                /* Rotate the molecule randomly */
-                real angleX = 2*M_PI*dist(rng);
-                real angleY = 2*M_PI*dist(rng);
-                real angleZ = 2*M_PI*dist(rng);
-                rotate_conf(a_tp1-a_tp0, as_rvec_array(state_global->x.data())+a_tp0, nullptr,
-                            angleX, angleY, angleZ);
-                /* Shift to the insertion location */
-                for (i = a_tp0; i < a_tp1; i++)
+                if (bCharge)
                 {
-                    rvec_inc(state_global->x[i], x_tp);
+                    for (i = 0; i < ngid; i++)
+                    {
+                        stepEner[e++] = enerd->grpp.ener[egCOULSR][GID(i, gid_tp, ngid)];
+                    }
+                    if (bRFExcl)
+                    {
+                        stepEner[e++] = enerd->term[F_RF_EXCL];
+                    }
+                    if (EEL_FULL(fr->ic->eeltype))
+                    {
+                        stepEner[e++] = enerd->term[F_COUL_RECIP];
+                    }
                 }
             }
 
-            /* Clear some matrix variables  */
-            clear_mat(force_vir);
-            clear_mat(shake_vir);
-            clear_mat(vir);
-            clear_mat(pres);
-
-            /* Set the charge group center of mass of the test particle */
-            copy_rvec(x_init, fr->cg_cm[top->cgs.nr-1]);
-
-            /* Calc energy (no forces) on new positions.
-             * Since we only need the intermolecular energy
-             * and the RF exclusion terms of the inserted molecule occur
-             * within a single charge group we can pass NULL for the graph.
-             * This also avoids shifts that would move charge groups
-             * out of the box. */
-            /* Make do_force do a single node force calculation */
-            cr->nnodes = 1;
-            do_force(fplog, cr, ms, inputrec,
-                     step, nrnb, wcycle, top, &top_global->groups,
-                     state_global->box, state_global->x, &state_global->hist,
-                     f, force_vir, mdatoms, enerd, fcd,
-                     state_global->lambda,
-                     nullptr, fr, nullptr, mu_tot, t, nullptr,
-                     GMX_FORCE_NONBONDED | GMX_FORCE_ENERGY |
-                     (bNS ? GMX_FORCE_DYNAMICBOX | GMX_FORCE_NS : 0) |
-                     (bStateChanged ? GMX_FORCE_STATECHANGED : 0),
-                     DdOpenBalanceRegionBeforeForceComputation::no,
-                     DdCloseBalanceRegionAfterForceComputation::no);
-            cr->nnodes    = nnodes;
-            bStateChanged = FALSE;
-            bNS           = FALSE;
-
-            /* Calculate long range corrections to pressure and energy */
-            calc_dispcorr(inputrec, fr, state_global->box,
-                          lambda, pres, vir, &prescorr, &enercorr, &dvdlcorr);
-            /* figure out how to rearrange the next 4 lines MRS 8/4/2009 */
-            enerd->term[F_DISPCORR]  = enercorr;
-            enerd->term[F_EPOT]     += enercorr;
-            enerd->term[F_PRES]     += prescorr;
-            enerd->term[F_DVDL_VDW] += dvdlcorr;
-
-            epot               = enerd->term[F_EPOT];
+            epot               = stepEner[0];
             bEnergyOutOfBounds = FALSE;
 
             /* If the compiler doesn't optimize this check away
@@ -688,42 +1450,9 @@ Integrator::do_tpi()
                 embU      = exp(static_cast<double>(-beta*epot));
                 sum_embU += embU;
                 /* Determine the weighted energy contributions of each energy group */
-                e                = 0;
-                sum_UgembU[e++] += epot*embU;
-                if (fr->bBHAM)
-                {
-                    for (i = 0; i < ngid; i++)
-                    {
-                        sum_UgembU[e++] +=
-                            enerd->grpp.ener[egBHAMSR][GID(i, gid_tp, ngid)]*embU;
-                    }
-                }
-                else
-                {
-                    for (i = 0; i < ngid; i++)
-                    {
-                        sum_UgembU[e++] +=
-                            enerd->grpp.ener[egLJSR][GID(i, gid_tp, ngid)]*embU;
-                    }
-                }
-                if (bDispCorr)
-                {
-                    sum_UgembU[e++] += enerd->term[F_DISPCORR]*embU;
-                }
-                if (bCharge)
+                for (e = 0; e < nener; e++)
                 {
-                    for (i = 0; i < ngid; i++)
-                    {
-                        sum_UgembU[e++] += enerd->grpp.ener[egCOULSR][GID(i, gid_tp, ngid)] * embU;
-                    }
-                    if (bRFExcl)
-                    {
-                        sum_UgembU[e++] += enerd->term[F_RF_EXCL]*embU;
-                    }
-                    if (EEL_FULL(fr->ic->eeltype))
-                    {
-                        sum_UgembU[e++] += enerd->term[F_COUL_RECIP]*embU;
-                    }
+                    sum_UgembU[e] += stepEner[e]*embU;
                 }
             }
 
@@ -855,6 +1584,7 @@ Integrator::do_tpi()
     sfree(bin);
 
     sfree(sum_UgembU);
+    sfree(stepEner);
 
     walltime_accounting_set_nsteps_done(walltime_accounting, frame*inputrec->nsteps);
 }
@@ -119,6 +119,10 @@ void state_change_natoms(t_state *state, int natoms)
     {
         state->cg_p.resize(paddedSize);
     }
+    for (auto &vec : state->em_vecs)
+    {
+        vec.resize(paddedSize);
+    }
 }
 
 void init_dfhist_state(t_state *state, int dfhistNumLambda)
@@ -230,6 +234,7 @@ t_state::t_state() : natoms(0),
                      nhchainlength(0),
                      flags(0),
                      fep_state(0),
+                     replex_state(0),
                      lambda(),
                      nosehoover_xi(),
                      nosehoover_vxi(),
@@ -242,6 +247,7 @@ t_state::t_state() : natoms(0),
                      x(),
                      v(),
                      cg_p(),
+                     em_vecs(),
                      ekinstate(),
                      hist(),
                      dfhist(nullptr),
@@ -94,7 +94,7 @@ enum {
     estORIRE_INITF, estORIRE_DTAV,
     estSVIR_PREV, estNH_VXI, estVETA, estVOL0, estNHPRES_XI, estNHPRES_VXI, estFVIR_PREV,
     estFEPSTATE, estMC_RNG_NOTSUPPORTED, estMC_RNGI_NOTSUPPORTED,
-    estBAROS_INT,
+    estBAROS_INT, estREPLEX_STATE,
     estNR
 };
 
@@ -197,6 +197,7 @@ class t_state
         int                        nhchainlength;  //!< The NH-chain length for temperature coupling
         int                        flags;          //!< Set of bit-flags telling which entries are present, see enum at the top of the file
         int                        fep_state;      //!< indicates which of the alchemical states we are in
+        int                        replex_state;   //!< indicates which replica exchange ensemble we are in, only used when swapping parameters
         std::array<real, efptNR>   lambda;         //!< Free-energy lambda vector
         matrix                     box;            //!< Matrix of box vectors
         matrix                     box_rel;        //!< Relative box vectors to preserve box shape
@@ -215,6 +216,7 @@ class t_state
         gmx::HostVector<gmx::RVec> x;              //!< The coordinates (natoms)
         PaddedRVecVector           v;              //!< The velocities (natoms)
         PaddedRVecVector           cg_p;           //!< p vector for conjugate gradient minimization
+        std::vector<PaddedRVecVector> em_vecs;     //!< Extra per-atom vectors of the minimizers, moved along with the atoms with domain decomposition
 
         ekinstate_t                ekinstate;      //!< The state of the kinetic energy
 
@@ -2474,7 +2474,14 @@ init_pull(FILE *fplog, const pull_params_t *pull_params, const t_inputrec *ir,
 
     /* The gmx_omp_nthreads module might not be initialized here, so max(1,) */
     pull->nthreads = std::max(1, gmx_omp_nthreads_get(emntDefault));
-    snew(pull->sum_com, pull->nthreads);
+    if (pull->nthreads > 1)
+    {
+        snew(pull->sum_com_thread, (pull->nthreads - 1)*3*pull->ngroup);
+    }
+    else
+    {
+        pull->sum_com_thread = nullptr;
+    }
 
     comm = &pull->comm;
 
@@ -2617,6 +2624,7 @@ static void destroy_pull(struct pull_t *pull)
     sfree(pull->comm.rbuf);
     sfree(pull->comm.dbuf);
     sfree(pull->comm.dbuf_cyl);
+    sfree(pull->sum_com_thread);
 
     delete pull;
 }
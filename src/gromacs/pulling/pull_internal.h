@@ -59,7 +59,9 @@
 
 /*! \cond INTERNAL */
 
-/*! \brief Determines up to what local atom count a pull group gets processed single-threaded.
+/*! \brief Determines up to what local atom count pull groups get processed single-threaded.
+ *
+ * For the COM calculation this is the local atom count summed over all groups.
  *
  * We set this limit to 1 with debug to catch bugs.
  * On Haswell with GCC 5 the cross-over point is around 400 atoms,
@@ -162,12 +164,6 @@ struct pull_sum_com_t {
     double sum_ssm;   /* Sum of sin(x)*sin(x)*mass   */
     double sum_cmp;   /* Sum of cos(xp)*sin(xp)*mass */
     double sum_smp;   /* Sum of sin(xp)*sin(xp)*mass */
-
-    /* Dummy data to ensure adjacent elements in an array are separated
-     * by a cache line size, max 128 bytes.
-     * TODO: Replace this by some automated mechanism.
-     */
-    int    dummy[32];
 };
 
 typedef struct {
@@ -215,7 +211,7 @@ struct pull_t
     gmx_bool           bSetPBCatoms; /* Do we need to set x_pbc for the groups? */
 
     int                nthreads;     /* Number of threads used by the pull code */
-    pull_sum_com_t    *sum_com;      /* Work array for summing for COM, 1 entry per thread */
+    dvec              *sum_com_thread; /* Work array for COM sums of threads > 0, 3*ngroup per thread */
 
     pull_comm_t        comm;         /* Communication parameters, communicator and buffers */
 
@@ -173,6 +173,8 @@ typedef struct gmx_enfrotgrp
     rvec  *xr_loc;          /* Local reference coords, correctly rotated      */
     rvec  *x_loc_pbc;       /* Local current coords, correct PBC image        */
     real  *m_loc;           /* Masses of the current local atoms              */
+    rvec  *xref_loc;        /* Flexible distributed only: local reference
+                               coords (not rotated)                           */
 
     /* Flexible rotation only */
     int    nslabs_alloc;              /* For this many slabs memory is allocated        */
@@ -202,6 +204,11 @@ typedef struct gmx_enfrotgrp
                                          this is precalculated for optimization reasons */
     t_gmx_slabdata *slab_data;        /* Holds atom positions and gaussian weights
                                          of atoms belonging to a slab                   */
+    gmx_bool        bDistributed;     /* Compute the slab sums from the local atoms
+                                         and reduce them, instead of assembling xc
+                                         at every step                                  */
+    gmx_bool        bAssembled;       /* Has xc been assembled at this step?            */
+    double         *slab_buf;         /* Buffer for reducing the slab sums              */
 
     /* For potential fits with varying angle: */
     t_gmx_potfit *PotAngleFit;  /* Used for fit type 'potential'              */
@@ -594,7 +601,7 @@ static inline real gaussian_weight(rvec curr_x, t_rotgrp *rotg, int n)
 
 /* Returns the weight in a single slab, also calculates the Gaussian- and mass-
  * weighted sum of positions for that slab */
-static real get_slab_weight(int j, t_rotgrp *rotg, rvec xc[], real mc[], rvec *x_weighted_sum)
+static real get_slab_weight(int j, t_rotgrp *rotg, rvec xc[], real mc[], int nat, rvec *x_weighted_sum)
 {
     rvec            curr_x;           /* The position of an atom                      */
     rvec            curr_x_weighted;  /* The gaussian-weighted position               */
@@ -606,8 +613,8 @@ static real get_slab_weight(int j, t_rotgrp *rotg, rvec xc[], real mc[], rvec *x
 
     clear_rvec(*x_weighted_sum);
 
-    /* Loop over all atoms in the rotation group */
-    for (i = 0; i < rotg->nat; i++)
+    /* Loop over all (local) atoms in the rotation group */
+    for (i = 0; i < nat; i++)
     {
         copy_rvec(xc[i], curr_x);
         gaussian = gaussian_weight(curr_x, rotg, j);
@@ -622,18 +629,21 @@ static real get_slab_weight(int j, t_rotgrp *rotg, rvec xc[], real mc[], rvec *x
 
 
 static void get_slab_centers(
-        t_rotgrp  *rotg,       /* The rotation group information               */
-        rvec      *xc,         /* The rotation group positions; will
-                                  typically be enfrotgrp->xc, but at first call
-                                  it is enfrotgrp->xc_ref                      */
-        real      *mc,         /* The masses of the rotation group atoms       */
-        int        g,          /* The number of the rotation group             */
-        real       time,       /* Used for output only                         */
-        FILE      *out_slabs,  /* For outputting center per slab information   */
-        gmx_bool   bOutStep,   /* Is this an output step?                      */
-        gmx_bool   bReference) /* If this routine is called from
-                                  init_rot_group we need to store
-                                  the reference slab centers                   */
+        t_rotgrp        *rotg,       /* The rotation group information               */
+        rvec            *xc,         /* The rotation group positions; will
+                                        typically be enfrotgrp->xc, but at first call
+                                        it is enfrotgrp->xc_ref                      */
+        real            *mc,         /* The masses of the rotation group atoms       */
+        int              nat,        /* The number of positions in xc                */
+        const t_commrec *cr,         /* When not NULL, xc contains only the local
+                                        positions and the sums are reduced over cr   */
+        int              g,          /* The number of the rotation group             */
+        real             time,       /* Used for output only                         */
+        FILE            *out_slabs,  /* For outputting center per slab information   */
+        gmx_bool         bOutStep,   /* Is this an output step?                      */
+        gmx_bool         bReference) /* If this routine is called from
+                                        init_rot_group we need to store
+                                        the reference slab centers                   */
 {
     /* Slab index */
     int             j, islab;
@@ -646,7 +656,34 @@ static void get_slab_centers(
     for (j = erg->slab_first; j <= erg->slab_last; j++)
     {
         islab                    = j - erg->slab_first;
-        erg->slab_weights[islab] = get_slab_weight(j, rotg, xc, mc, &erg->slab_center[islab]);
+        erg->slab_weights[islab] = get_slab_weight(j, rotg, xc, mc, nat, &erg->slab_center[islab]);
+    }
+
+    /* Add the contributions of the local atoms of all nodes */
+    if (cr != nullptr && PAR(cr))
+    {
+        int nslabs = erg->slab_last - erg->slab_first + 1;
+
+        for (islab = 0; islab < nslabs; islab++)
+        {
+            erg->slab_buf[4*islab    ] = erg->slab_center[islab][XX];
+            erg->slab_buf[4*islab + 1] = erg->slab_center[islab][YY];
+            erg->slab_buf[4*islab + 2] = erg->slab_center[islab][ZZ];
+            erg->slab_buf[4*islab + 3] = erg->slab_weights[islab];
+        }
+        gmx_sumd(4*nslabs, erg->slab_buf, cr);
+        for (islab = 0; islab < nslabs; islab++)
+        {
+            erg->slab_center[islab][XX] = erg->slab_buf[4*islab    ];
+            erg->slab_center[islab][YY] = erg->slab_buf[4*islab + 1];
+            erg->slab_center[islab][ZZ] = erg->slab_buf[4*islab + 2];
+            erg->slab_weights[islab]    = erg->slab_buf[4*islab + 3];
+        }
+    }
+
+    for (j = erg->slab_first; j <= erg->slab_last; j++)
+    {
+        islab = j - erg->slab_first;
 
         /* We can do the calculations ONLY if there is weight in the slab! */
         if (erg->slab_weights[islab] > WEIGHT_MIN)
@@ -1711,7 +1748,7 @@ static int get_single_atom_gaussians(
 }
 
 
-static void flex2_precalc_inner_sum(t_rotgrp *rotg)
+static void flex2_precalc_inner_sum(t_rotgrp *rotg, const t_commrec *cr)
 {
     int             i, n, islab;
     rvec            xi;       /* positions in the i-sum                        */
@@ -1726,12 +1763,30 @@ static void flex2_precalc_inner_sum(t_rotgrp *rotg)
     rvec            s_in, tmpvec, tmpvec2;
     real            mi, wi;  /* Mass-weighting of the positions                 */
     real            N_M;     /* N/M                                             */
+    rvec           *x, *xref;   /* Positions and reference positions to sum over */
+    real           *m;          /* ... and their masses                          */
+    int             i0, i1;     /* Range of atoms to sum over                    */
     gmx_enfrotgrp_t erg;     /* Pointer to enforced rotation group data */
 
 
     erg = rotg->enfrotgrp;
     N_M = rotg->nat * erg->invmass;
 
+    /* Without the assembled positions we sum over the local atoms and
+     * reduce the inner sums over the nodes afterwards */
+    if (erg->bAssembled)
+    {
+        x    = erg->xc;
+        m    = erg->mc_sorted; /* need the sorted mass here */
+        xref = erg->xc_ref_sorted;
+    }
+    else
+    {
+        x    = erg->x_loc_pbc;
+        m    = erg->m_loc;
+        xref = erg->xref_loc;
+    }
+
     /* Loop over all slabs that contain something */
     for (n = erg->slab_first; n <= erg->slab_last; n++)
     {
@@ -1748,18 +1803,34 @@ static void flex2_precalc_inner_sum(t_rotgrp *rotg)
          * to calculate from firstatom to lastatom only. All other contributions will
          * be very small. */
         clear_rvec(innersumvec);
-        for (i = erg->firstatom[islab]; i <= erg->lastatom[islab]; i++)
+        if (erg->bAssembled)
+        {
+            i0 = erg->firstatom[islab];
+            i1 = erg->lastatom[islab];
+        }
+        else
+        {
+            i0 = 0;
+            i1 = erg->nat_loc - 1;
+        }
+        for (i = i0; i <= i1; i++)
         {
             /* Coordinate xi of this atom */
-            copy_rvec(erg->xc[i], xi);
+            copy_rvec(x[i], xi);
+
+            /* The local atoms are not sorted, so check the range of this slab here */
+            if (!erg->bAssembled && std::abs(calc_beta(xi, rotg, n)) > erg->max_beta)
+            {
+                continue;
+            }
 
             /* The i-weights */
             gaussian_xi = gaussian_weight(xi, rotg, n);
-            mi          = erg->mc_sorted[i]; /* need the sorted mass here */
+            mi          = m[i];
             wi          = N_M*mi;
 
             /* Calculate rin */
-            copy_rvec(erg->xc_ref_sorted[i], yi0); /* Reference position yi0   */
+            copy_rvec(xref[i], yi0);               /* Reference position yi0   */
             rvec_sub(yi0, ycn, tmpvec2);           /* tmpvec2 = yi0 - ycn      */
             mvmul(erg->rotmat, tmpvec2, rin);      /* rin = Omega.(yi0 - ycn)  */
 
@@ -1790,10 +1861,15 @@ static void flex2_precalc_inner_sum(t_rotgrp *rotg)
         /* Save it to be used in do_flex2_lowlevel */
         copy_rvec(innersumvec, erg->slab_innersumvec[islab]);
     } /* END of loop over slabs */
+
+    if (!erg->bAssembled && PAR(cr))
+    {
+        gmx_sum(3*(erg->slab_last - erg->slab_first + 1), erg->slab_innersumvec[0], cr);
+    }
 }
 
 
-static void flex_precalc_inner_sum(t_rotgrp *rotg)
+static void flex_precalc_inner_sum(t_rotgrp *rotg, const t_commrec *cr)
 {
     int             i, n, islab;
     rvec            xi;       /* position                                      */
@@ -1806,12 +1882,30 @@ static void flex_precalc_inner_sum(t_rotgrp *rotg)
     real            mi, wi;      /* Mass-weighting of the positions               */
     real            N_M;         /* N/M                                           */
 
+    rvec           *x, *xref;   /* Positions and reference positions to sum over */
+    real           *m;          /* ... and their masses                          */
+    int             i0, i1;     /* Range of atoms to sum over                    */
     gmx_enfrotgrp_t erg;         /* Pointer to enforced rotation group data */
 
 
     erg = rotg->enfrotgrp;
     N_M = rotg->nat * erg->invmass;
 
+    /* Without the assembled positions we sum over the local atoms and
+     * reduce the inner sums over the nodes afterwards */
+    if (erg->bAssembled)
+    {
+        x    = erg->xc;
+        m    = erg->mc_sorted; /* need the sorted mass here */
+        xref = erg->xc_ref_sorted;
+    }
+    else
+    {
+        x    = erg->x_loc_pbc;
+        m    = erg->m_loc;
+        xref = erg->xref_loc;
+    }
+
     /* Loop over all slabs that contain something */
     for (n = erg->slab_first; n <= erg->slab_last; n++)
     {
@@ -1827,18 +1921,34 @@ static void flex_precalc_inner_sum(t_rotgrp *rotg)
          * to calculate from firstatom to lastatom only. All other contributions will
          * be very small. */
         clear_rvec(innersumvec);
-        for (i = erg->firstatom[islab]; i <= erg->lastatom[islab]; i++)
+        if (erg->bAssembled)
+        {
+            i0 = erg->firstatom[islab];
+            i1 = erg->lastatom[islab];
+        }
+        else
+        {
+            i0 = 0;
+            i1 = erg->nat_loc - 1;
+        }
+        for (i = i0; i <= i1; i++)
         {
             /* Coordinate xi of this atom */
-            copy_rvec(erg->xc[i], xi);
+            copy_rvec(x[i], xi);
+
+            /* The local atoms are not sorted, so check the range of this slab here */
+            if (!erg->bAssembled && std::abs(calc_beta(xi, rotg, n)) > erg->max_beta)
+            {
+                continue;
+            }
 
             /* The i-weights */
             gaussian_xi = gaussian_weight(xi, rotg, n);
-            mi          = erg->mc_sorted[i]; /* need the sorted mass here */
+            mi          = m[i];
             wi          = N_M*mi;
 
             /* Calculate rin and qin */
-            rvec_sub(erg->xc_ref_sorted[i], ycn, tmpvec); /* tmpvec = yi0-ycn */
+            rvec_sub(xref[i], ycn, tmpvec);               /* tmpvec = yi0-ycn */
             mvmul(erg->rotmat, tmpvec, rin);              /* rin = Omega.(yi0 - ycn)  */
             cprod(rotg->vec, rin, tmpvec);                /* tmpvec = v x Omega*(yi0-ycn) */
 
@@ -1858,16 +1968,22 @@ static void flex_precalc_inner_sum(t_rotgrp *rotg)
           /* Save it to be used in do_flex_lowlevel */
         copy_rvec(innersumvec, erg->slab_innersumvec[islab]);
     }
+
+    if (!erg->bAssembled && PAR(cr))
+    {
+        gmx_sum(3*(erg->slab_last - erg->slab_first + 1), erg->slab_innersumvec[0], cr);
+    }
 }
 
 
 static real do_flex2_lowlevel(
-        t_rotgrp  *rotg,
-        real       sigma,   /* The Gaussian width sigma */
-        rvec       x[],
-        gmx_bool   bOutstepRot,
-        gmx_bool   bOutstepSlab,
-        matrix     box)
+        t_rotgrp        *rotg,
+        const t_commrec *cr,
+        real             sigma,   /* The Gaussian width sigma */
+        rvec             x[],
+        gmx_bool         bOutstepRot,
+        gmx_bool         bOutstepSlab,
+        matrix           box)
 {
     int             count, ic, ii, j, m, n, islab, iigrp, ifit;
     rvec            xj;          /* position in the i-sum                         */
@@ -1905,7 +2021,7 @@ static real do_flex2_lowlevel(
 
     /* Pre-calculate the inner sums, so that we do not have to calculate
      * them again for every atom */
-    flex2_precalc_inner_sum(rotg);
+    flex2_precalc_inner_sum(rotg, cr);
 
     bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == rotg->eFittype);
 
@@ -2110,12 +2226,13 @@ static real do_flex2_lowlevel(
 
 
 static real do_flex_lowlevel(
-        t_rotgrp *rotg,
-        real      sigma,     /* The Gaussian width sigma                      */
-        rvec      x[],
-        gmx_bool  bOutstepRot,
-        gmx_bool  bOutstepSlab,
-        matrix    box)
+        t_rotgrp        *rotg,
+        const t_commrec *cr,
+        real             sigma,     /* The Gaussian width sigma                      */
+        rvec             x[],
+        gmx_bool         bOutstepRot,
+        gmx_bool         bOutstepSlab,
+        matrix           box)
 {
     int             count, ic, ifit, ii, j, m, n, islab, iigrp;
     rvec            xj, yj0;                /* current and reference position                */
@@ -2145,7 +2262,7 @@ static real do_flex_lowlevel(
 
     /* Pre-calculate the inner sums, so that we do not have to calculate
      * them again for every atom */
-    flex_precalc_inner_sum(rotg);
+    flex_precalc_inner_sum(rotg, cr);
 
     bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == rotg->eFittype);
 
@@ -2468,31 +2585,31 @@ static void get_firstlast_atom_per_slab(t_rotgrp *rotg)
 static inline int get_first_slab(
         t_rotgrp *rotg,      /* The rotation group (inputrec data) */
         real      max_beta,  /* The max_beta value, instead of min_gaussian */
-        rvec      firstatom) /* First atom after sorting along the rotation vector v */
+        real      firstproj) /* Projection of the first atom along the rotation vector v */
 {
     /* Find the first slab for the first atom */
-    return static_cast<int>(ceil(static_cast<double>((iprod(firstatom, rotg->vec) - max_beta)/rotg->slab_dist)));
+    return static_cast<int>(ceil(static_cast<double>((firstproj - max_beta)/rotg->slab_dist)));
 }
 
 
 static inline int get_last_slab(
         t_rotgrp *rotg,     /* The rotation group (inputrec data) */
         real      max_beta, /* The max_beta value, instead of min_gaussian */
-        rvec      lastatom) /* Last atom along v */
+        real      lastproj) /* Projection of the last atom along v */
 {
     /* Find the last slab for the last atom */
-    return static_cast<int>(floor(static_cast<double>((iprod(lastatom, rotg->vec) + max_beta)/rotg->slab_dist)));
+    return static_cast<int>(floor(static_cast<double>((lastproj + max_beta)/rotg->slab_dist)));
 }
 
 
 static void get_firstlast_slab_check(
         t_rotgrp        *rotg,      /* The rotation group (inputrec data) */
         t_gmx_enfrotgrp *erg,       /* The rotation group (data only accessible in this file) */
-        rvec             firstatom, /* First atom after sorting along the rotation vector v */
-        rvec             lastatom)  /* Last atom along v */
+        real             firstproj, /* Projection of the first atom along the rotation vector v */
+        real             lastproj)  /* Projection of the last atom along v */
 {
-    erg->slab_first = get_first_slab(rotg, erg->max_beta, firstatom);
-    erg->slab_last  = get_last_slab(rotg, erg->max_beta, lastatom);
+    erg->slab_first = get_first_slab(rotg, erg->max_beta, firstproj);
+    erg->slab_last  = get_last_slab(rotg, erg->max_beta, lastproj);
 
     /* Calculate the slab buffer size, which changes when slab_first changes */
     erg->slab_buffer = erg->slab_first - erg->slab_first_ref;
@@ -2515,18 +2632,20 @@ static void get_firstlast_slab_check(
 
 /* Enforced rotation with a flexible axis */
 static void do_flexible(
-        gmx_bool        bMaster,
-        gmx_enfrot_t    enfrot,       /* Other rotation data                        */
-        t_rotgrp       *rotg,         /* The rotation group                         */
-        int             g,            /* Group number                               */
-        rvec            x[],          /* The local positions                        */
-        matrix          box,
-        double          t,            /* Time in picoseconds                        */
-        gmx_bool        bOutstepRot,  /* Output to main rotation output file        */
-        gmx_bool        bOutstepSlab) /* Output per-slab data                       */
+        const t_commrec *cr,
+        gmx_enfrot_t     enfrot,       /* Other rotation data                        */
+        t_rotgrp        *rotg,         /* The rotation group                         */
+        int              g,            /* Group number                               */
+        rvec             x[],          /* The local positions                        */
+        matrix           box,
+        double           t,            /* Time in picoseconds                        */
+        gmx_bool         bOutstepRot,  /* Output to main rotation output file        */
+        gmx_bool         bOutstepSlab) /* Output per-slab data                       */
 {
     int             l, nslabs;
     real            sigma;    /* The Gaussian width sigma */
+    real            projMin;  /* Range of the positions along the rotation vector */
+    real            projMax;
     gmx_enfrotgrp_t erg;      /* Pointer to enforced rotation group data */
 
 
@@ -2535,20 +2654,32 @@ static void do_flexible(
     /* Define the sigma value */
     sigma = 0.7*rotg->slab_dist;
 
-    /* Sort the collective coordinates erg->xc along the rotation vector. This is
-     * an optimization for the inner loop. */
-    sort_collective_coordinates(rotg, enfrot->data);
+    if (erg->bAssembled)
+    {
+        /* Sort the collective coordinates erg->xc along the rotation vector. This is
+         * an optimization for the inner loop. */
+        sort_collective_coordinates(rotg, enfrot->data);
+
+        /* Determine the first relevant slab for the first atom and the last
+         * relevant slab for the last atom */
+        get_firstlast_slab_check(rotg, erg, iprod(erg->xc[0], rotg->vec), iprod(erg->xc[rotg->nat-1], rotg->vec));
 
-    /* Determine the first relevant slab for the first atom and the last
-     * relevant slab for the last atom */
-    get_firstlast_slab_check(rotg, erg, erg->xc[0], erg->xc[rotg->nat-1]);
+        /* Determine for each slab depending on the min_gaussian cutoff criterium,
+         * a first and a last atom index inbetween stuff needs to be calculated */
+        get_firstlast_atom_per_slab(rotg);
 
-    /* Determine for each slab depending on the min_gaussian cutoff criterium,
-     * a first and a last atom index inbetween stuff needs to be calculated */
-    get_firstlast_atom_per_slab(rotg);
+        /* Determine the gaussian-weighted center of positions for all slabs */
+        get_slab_centers(rotg, erg->xc, erg->mc_sorted, rotg->nat, nullptr, g, t, enfrot->out_slabs, bOutstepSlab, FALSE);
+    }
+    else
+    {
+        /* The slab range follows from the extreme atoms along the rotation vector */
+        get_projection_range_comm(cr, erg->x_loc_pbc, erg->nat_loc, rotg->vec, &projMin, &projMax);
+        get_firstlast_slab_check(rotg, erg, projMin, projMax);
 
-    /* Determine the gaussian-weighted center of positions for all slabs */
-    get_slab_centers(rotg, erg->xc, erg->mc_sorted, g, t, enfrot->out_slabs, bOutstepSlab, FALSE);
+        /* Sum the slab centers over the local atoms of all nodes */
+        get_slab_centers(rotg, erg->x_loc_pbc, erg->m_loc, erg->nat_loc, cr, g, t, enfrot->out_slabs, bOutstepSlab, FALSE);
+    }
 
     /* Clear the torque per slab from last time step: */
     nslabs = erg->slab_last - erg->slab_first + 1;
@@ -2560,11 +2691,11 @@ static void do_flexible(
     /* Call the rotational forces kernel */
     if (rotg->eType == erotgFLEX || rotg->eType == erotgFLEXT)
     {
-        erg->V = do_flex_lowlevel(rotg, sigma, x, bOutstepRot, bOutstepSlab, box);
+        erg->V = do_flex_lowlevel(rotg, cr, sigma, x, bOutstepRot, bOutstepSlab, box);
     }
     else if (rotg->eType == erotgFLEX2 || rotg->eType == erotgFLEX2T)
     {
-        erg->V = do_flex2_lowlevel(rotg, sigma, x, bOutstepRot, bOutstepSlab, box);
+        erg->V = do_flex2_lowlevel(rotg, cr, sigma, x, bOutstepRot, bOutstepSlab, box);
     }
     else
     {
@@ -2573,7 +2704,7 @@ static void do_flexible(
 
     /* Determine angle by RMSD fit to the reference - Let's hope this */
     /* only happens once in a while, since this is not parallelized! */
-    if (bMaster && (erotgFitPOT != rotg->eFittype) )
+    if (MASTER(cr) && (erotgFitPOT != rotg->eFittype) )
     {
         if (bOutstepRot)
         {
@@ -3309,6 +3440,7 @@ static void allocate_slabs(
     snew(erg->xc_sortind, rotg->nat);
     snew(erg->firstatom, nslabs);
     snew(erg->lastatom, nslabs);
+    snew(erg->slab_buf, 4*nslabs);
 }
 
 
@@ -3324,15 +3456,15 @@ static void get_firstlast_slab_ref(t_rotgrp *rotg, real mc[], int ref_firstindex
 
 
     erg        = rotg->enfrotgrp;
-    first      = get_first_slab(rotg, erg->max_beta, rotg->x_ref[ref_firstindex]);
-    last       = get_last_slab( rotg, erg->max_beta, rotg->x_ref[ref_lastindex ]);
+    first      = get_first_slab(rotg, erg->max_beta, iprod(rotg->x_ref[ref_firstindex], rotg->vec));
+    last       = get_last_slab( rotg, erg->max_beta, iprod(rotg->x_ref[ref_lastindex ], rotg->vec));
 
-    while (get_slab_weight(first, rotg, rotg->x_ref, mc, &dummy) > WEIGHT_MIN)
+    while (get_slab_weight(first, rotg, rotg->x_ref, mc, rotg->nat, &dummy) > WEIGHT_MIN)
     {
         first--;
     }
     erg->slab_first_ref = first+1;
-    while (get_slab_weight(last, rotg, rotg->x_ref, mc, &dummy) > WEIGHT_MIN)
+    while (get_slab_weight(last, rotg, rotg->x_ref, mc, rotg->nat, &dummy) > WEIGHT_MIN)
     {
         last++;
     }
@@ -3427,6 +3559,19 @@ static void init_rot_group(FILE *fplog, const t_commrec *cr, int g, t_rotgrp *ro
         snew(erg->x_loc_pbc, rotg->nat);
     }
 
+    /* With more than one node, the flexible types can avoid assembling the
+     * positions at each step by reducing the sums over the slabs instead */
+    erg->bDistributed = bFlex && PAR(cr) && (getenv("GMX_ENFROT_ASSEMBLE") == nullptr);
+    if (erg->bDistributed)
+    {
+        snew(erg->x_loc_pbc, rotg->nat);
+        snew(erg->xref_loc, rotg->nat);
+        if (nullptr != fplog)
+        {
+            fprintf(fplog, "%s group %d computes the slab sums from the local atoms.\n", RotStr, g);
+        }
+    }
+
     snew(erg->f_rot_loc, rotg->nat);
     snew(erg->xc_ref_ind, rotg->nat);
 
@@ -3467,7 +3612,7 @@ static void init_rot_group(FILE *fplog, const t_commrec *cr, int g, t_rotgrp *ro
     {
         snew(erg->mc_sorted, rotg->nat);
     }
-    if (!bColl)
+    if (!bColl || erg->bDistributed)
     {
         snew(erg->m_loc, rotg->nat);
     }
@@ -3584,7 +3729,7 @@ static void init_rot_group(FILE *fplog, const t_commrec *cr, int g, t_rotgrp *ro
         /* Flexible rotation: determine the reference centers for the rest of the simulation */
         erg->slab_first = erg->slab_first_ref;
         erg->slab_last  = erg->slab_last_ref;
-        get_slab_centers(rotg, rotg->x_ref, erg->mc, g, -1, out_slabs, bOutputCenters, TRUE);
+        get_slab_centers(rotg, rotg->x_ref, erg->mc, rotg->nat, nullptr, g, -1, out_slabs, bOutputCenters, TRUE);
 
         /* Length of each x_rotref vector from center (needed if fit routine NORM is chosen): */
         if (rotg->eFittype == erotgFitNORM)
@@ -3936,7 +4081,14 @@ extern void do_rotation(
         erg->degangle = rotg->rate * t;
         calc_rotmat(rotg->vec, erg->degangle, erg->rotmat);
 
-        if (bColl)
+        /* The flexible types only need the positions of all atoms to update
+         * the shifts after neighbor searching and for fitting the angle
+         * on the master, otherwise they reduce the slab sums */
+        erg->bAssembled = bColl &&
+            (!erg->bDistributed || bNS ||
+             ((outstep_rot || outstep_slab) && erotgFitPOT != rotg->eFittype));
+
+        if (erg->bAssembled)
         {
             /* Transfer the rotation group's positions such that every node has
              * all of them. Every node contributes its local positions x and stores
@@ -3944,6 +4096,19 @@ extern void do_rotation(
             communicate_group_positions(cr, erg->xc, erg->xc_shifts, erg->xc_eshifts, bNS,
                                         x, rotg->nat, erg->nat_loc, erg->ind_loc, erg->xc_ref_ind, erg->xc_old, box);
         }
+        else if (bColl)
+        {
+            /* Make the local positions whole with the shifts from the last
+             * assembly step, these only change after neighbor searching */
+            get_local_group_positions_whole(x, erg->nat_loc, erg->ind_loc, erg->xc_ref_ind,
+                                            erg->xc_shifts, box, erg->x_loc_pbc);
+            for (i = 0; i < erg->nat_loc; i++)
+            {
+                ii            = erg->xc_ref_ind[i];
+                erg->m_loc[i] = erg->mc[ii];
+                copy_rvec(rotg->x_ref[ii], erg->xref_loc[i]);
+            }
+        }
         else
         {
             /* Fill the local masses array;
@@ -4037,16 +4202,25 @@ extern void do_rotation(
                 /* Subtract the center of the rotation group from the collective positions array
                  * Also store the center in erg->xc_center since it needs to be subtracted
                  * in the low level routines from the local coordinates as well */
-                get_center(erg->xc, erg->mc, rotg->nat, erg->xc_center);
-                svmul(-1.0, erg->xc_center, transvec);
-                translate_x(erg->xc, rotg->nat, transvec);
-                do_flexible(MASTER(cr), er, rotg, g, x, box, t, outstep_rot, outstep_slab);
+                if (erg->bAssembled)
+                {
+                    get_center(erg->xc, erg->mc, rotg->nat, erg->xc_center);
+                    svmul(-1.0, erg->xc_center, transvec);
+                    translate_x(erg->xc, rotg->nat, transvec);
+                }
+                else
+                {
+                    get_center_comm(cr, erg->x_loc_pbc, erg->m_loc, erg->nat_loc, rotg->nat, erg->xc_center);
+                    svmul(-1.0, erg->xc_center, transvec);
+                    translate_x(erg->x_loc_pbc, erg->nat_loc, transvec);
+                }
+                do_flexible(cr, er, rotg, g, x, box, t, outstep_rot, outstep_slab);
                 break;
             case erotgFLEX:
             case erotgFLEX2:
                 /* Do NOT subtract the center of mass in the low level routines! */
                 clear_rvec(erg->xc_center);
-                do_flexible(MASTER(cr), er, rotg, g, x, box, t, outstep_rot, outstep_slab);
+                do_flexible(cr, er, rotg, g, x, box, t, outstep_rot, outstep_slab);
                 break;
             default:
                 gmx_fatal(FARGS, "No such rotation potential.");
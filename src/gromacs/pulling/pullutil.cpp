@@ -41,6 +41,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include "gromacs/domdec/domdec_struct.h"
 #include "gromacs/domdec/ga2la.h"
 #include "gromacs/fileio/confio.h"
@@ -183,6 +185,130 @@ static void pull_set_pbcatoms(const t_commrec *cr, struct pull_t *pull,
     }
 }
 
+/* Determines the local atoms and sums of the dynamic reference group
+ * of cylinder pull coordinate pcrd, the sums are stored in dbuf_cyl.
+ */
+static void make_cyl_refgrp(const pull_t      *pull,
+                            pull_coord_work_t *pcrd,
+                            pull_group_work_t *pdyna,
+                            const t_mdatoms   *md,
+                            const t_pbc       *pbc,
+                            double             t,
+                            const rvec        *x,
+                            double            *dbuf_cyl)
+{
+    const pull_group_work_t *pref, *pgrp;
+    rvec                     g_x, dx, dir;
+    double                   inv_cyl_r2;
+    double                   sum_a, wmass, wwmass;
+    dvec                     radf_fac0, radf_fac1;
+    int                      m;
+
+    inv_cyl_r2 = 1.0/gmx::square(pull->params.cylinder_r);
+
+    /* pref will be the same group for all pull coordinates */
+    pref  = &pull->group[pcrd->params.group[0]];
+    pgrp  = &pull->group[pcrd->params.group[1]];
+    copy_dvec_to_rvec(pcrd->spatialData.vec, dir);
+    pdyna->nat_loc = 0;
+
+    sum_a  = 0;
+    wmass  = 0;
+    wwmass = 0;
+    clear_dvec(radf_fac0);
+    clear_dvec(radf_fac1);
+
+    /* We calculate distances with respect to the reference location
+     * of this cylinder group (g_x), which we already have now since
+     * we reduced the other group COM over the ranks. This resolves
+     * any PBC issues and we don't need to use a PBC-atom here.
+     */
+    if (pcrd->params.rate != 0)
+    {
+        /* With rate=0, value_ref is set initially */
+        pcrd->value_ref = pcrd->params.init + pcrd->params.rate*t;
+    }
+    for (m = 0; m < DIM; m++)
+    {
+        g_x[m] = pgrp->x[m] - pcrd->spatialData.vec[m]*pcrd->value_ref;
+    }
+
+    /* Loop over the local atoms in the main ref group, these have been
+     * set up at the last domain decomposition, so no lookup is needed.
+     */
+    for (int i = 0; i < pref->nat_loc; i++)
+    {
+        int    ii = pref->ind_loc[i];
+        double dr2, dr2_rel, inp;
+        dvec   dr;
+
+        pbc_dx_aiuc(pbc, x[ii], g_x, dx);
+        inp = iprod(dir, dx);
+        dr2 = 0;
+        for (m = 0; m < DIM; m++)
+        {
+            /* Determine the radial components */
+            dr[m] = dx[m] - inp*dir[m];
+            dr2  += dr[m]*dr[m];
+        }
+        dr2_rel = dr2*inv_cyl_r2;
+
+        if (dr2_rel < 1)
+        {
+            double mass, weight, dweight_r;
+            dvec   mdw;
+
+            /* add to index, to sum of COM, to weight array */
+            if (pdyna->nat_loc >= pdyna->nalloc_loc)
+            {
+                pdyna->nalloc_loc = over_alloc_large(pdyna->nat_loc+1);
+                srenew(pdyna->ind_loc,    pdyna->nalloc_loc);
+                srenew(pdyna->weight_loc, pdyna->nalloc_loc);
+                srenew(pdyna->mdw,        pdyna->nalloc_loc);
+                srenew(pdyna->dv,         pdyna->nalloc_loc);
+            }
+            pdyna->ind_loc[pdyna->nat_loc] = ii;
+
+            mass      = md->massT[ii];
+            /* The radial weight function is 1-2x^2+x^4,
+             * where x=r/cylinder_r. Since this function depends
+             * on the radial component, we also get radial forces
+             * on both groups.
+             */
+            weight    = 1 + (-2 + dr2_rel)*dr2_rel;
+            dweight_r = (-4 + 4*dr2_rel)*inv_cyl_r2;
+            pdyna->weight_loc[pdyna->nat_loc] = weight;
+            sum_a    += mass*weight*inp;
+            wmass    += mass*weight;
+            wwmass   += mass*weight*weight;
+            dsvmul(mass*dweight_r, dr, mdw);
+            copy_dvec(mdw, pdyna->mdw[pdyna->nat_loc]);
+            /* Currently we only have the axial component of the
+             * distance (inp) up to an unkown offset. We add this
+             * offset after the reduction needs to determine the
+             * COM of the cylinder group.
+             */
+            pdyna->dv[pdyna->nat_loc] = inp;
+            for (m = 0; m < DIM; m++)
+            {
+                radf_fac0[m] += mdw[m];
+                radf_fac1[m] += mdw[m]*inp;
+            }
+            pdyna->nat_loc++;
+        }
+    }
+
+    dbuf_cyl[0] = wmass;
+    dbuf_cyl[1] = wwmass;
+    dbuf_cyl[2] = sum_a;
+    dbuf_cyl[3] = radf_fac0[XX];
+    dbuf_cyl[4] = radf_fac0[YY];
+    dbuf_cyl[5] = radf_fac0[ZZ];
+    dbuf_cyl[6] = radf_fac1[XX];
+    dbuf_cyl[7] = radf_fac1[YY];
+    dbuf_cyl[8] = radf_fac1[ZZ];
+}
+
 static void make_cyl_refgrps(const t_commrec *cr,
                              pull_t          *pull,
                              const t_mdatoms *md,
@@ -191,12 +317,11 @@ static void make_cyl_refgrps(const t_commrec *cr,
                              const rvec      *x)
 {
     /* The size and stride per coord for the reduction buffer */
-    const int       stride = 9;
-    int             i, ii, m, start, end;
-    rvec            g_x, dx, dir;
-    double          inv_cyl_r2;
+    const int       stride    = 9;
+    const int       numCoords = pull->coord.size();
+    int             m;
+    rvec            g_x;
     pull_comm_t    *comm;
-    gmx_ga2la_t    *ga2la = nullptr;
 
     comm = &pull->comm;
 
@@ -205,139 +330,27 @@ static void make_cyl_refgrps(const t_commrec *cr,
         snew(comm->dbuf_cyl, pull->coord.size()*stride);
     }
 
-    if (cr && DOMAINDECOMP(cr))
+    /* The cylinder groups of different coordinates are independent,
+     * so we can make them in parallel. Coordinates with other geometries
+     * contribute zero sums to the reduction buffer.
+     */
+#pragma omp parallel for num_threads(pull->nthreads) schedule(dynamic)
+    for (int c = 0; c < numCoords; c++)
     {
-        ga2la = cr->dd->ga2la;
-    }
-
-    start = 0;
-    end   = md->homenr;
-
-    inv_cyl_r2 = 1.0/gmx::square(pull->params.cylinder_r);
-
-    /* loop over all groups to make a reference group for each*/
-    for (size_t c = 0; c < pull->coord.size(); c++)
-    {
-        pull_coord_work_t *pcrd;
-        double             sum_a, wmass, wwmass;
-        dvec               radf_fac0, radf_fac1;
-
-        pcrd   = &pull->coord[c];
-
-        sum_a  = 0;
-        wmass  = 0;
-        wwmass = 0;
-        clear_dvec(radf_fac0);
-        clear_dvec(radf_fac1);
+        pull_coord_work_t *pcrd = &pull->coord[c];
 
         if (pcrd->params.eGeom == epullgCYL)
         {
-            pull_group_work_t *pref, *pgrp, *pdyna;
-
-            /* pref will be the same group for all pull coordinates */
-            pref  = &pull->group[pcrd->params.group[0]];
-            pgrp  = &pull->group[pcrd->params.group[1]];
-            pdyna = &pull->dyna[c];
-            copy_dvec_to_rvec(pcrd->spatialData.vec, dir);
-            pdyna->nat_loc = 0;
-
-            /* We calculate distances with respect to the reference location
-             * of this cylinder group (g_x), which we already have now since
-             * we reduced the other group COM over the ranks. This resolves
-             * any PBC issues and we don't need to use a PBC-atom here.
-             */
-            if (pcrd->params.rate != 0)
-            {
-                /* With rate=0, value_ref is set initially */
-                pcrd->value_ref = pcrd->params.init + pcrd->params.rate*t;
-            }
-            for (m = 0; m < DIM; m++)
+            make_cyl_refgrp(pull, pcrd, &pull->dyna[c], md, pbc, t, x,
+                            comm->dbuf_cyl + c*stride);
+        }
+        else
+        {
+            for (int i = 0; i < stride; i++)
             {
-                g_x[m] = pgrp->x[m] - pcrd->spatialData.vec[m]*pcrd->value_ref;
-            }
-
-            /* loop over all atoms in the main ref group */
-            for (i = 0; i < pref->params.nat; i++)
-            {
-                ii = pref->params.ind[i];
-                if (ga2la)
-                {
-                    if (!ga2la_get_home(ga2la, pref->params.ind[i], &ii))
-                    {
-                        ii = -1;
-                    }
-                }
-                if (ii >= start && ii < end)
-                {
-                    double dr2, dr2_rel, inp;
-                    dvec   dr;
-
-                    pbc_dx_aiuc(pbc, x[ii], g_x, dx);
-                    inp = iprod(dir, dx);
-                    dr2 = 0;
-                    for (m = 0; m < DIM; m++)
-                    {
-                        /* Determine the radial components */
-                        dr[m] = dx[m] - inp*dir[m];
-                        dr2  += dr[m]*dr[m];
-                    }
-                    dr2_rel = dr2*inv_cyl_r2;
-
-                    if (dr2_rel < 1)
-                    {
-                        double mass, weight, dweight_r;
-                        dvec   mdw;
-
-                        /* add to index, to sum of COM, to weight array */
-                        if (pdyna->nat_loc >= pdyna->nalloc_loc)
-                        {
-                            pdyna->nalloc_loc = over_alloc_large(pdyna->nat_loc+1);
-                            srenew(pdyna->ind_loc,    pdyna->nalloc_loc);
-                            srenew(pdyna->weight_loc, pdyna->nalloc_loc);
-                            srenew(pdyna->mdw,        pdyna->nalloc_loc);
-                            srenew(pdyna->dv,         pdyna->nalloc_loc);
-                        }
-                        pdyna->ind_loc[pdyna->nat_loc] = ii;
-
-                        mass      = md->massT[ii];
-                        /* The radial weight function is 1-2x^2+x^4,
-                         * where x=r/cylinder_r. Since this function depends
-                         * on the radial component, we also get radial forces
-                         * on both groups.
-                         */
-                        weight    = 1 + (-2 + dr2_rel)*dr2_rel;
-                        dweight_r = (-4 + 4*dr2_rel)*inv_cyl_r2;
-                        pdyna->weight_loc[pdyna->nat_loc] = weight;
-                        sum_a    += mass*weight*inp;
-                        wmass    += mass*weight;
-                        wwmass   += mass*weight*weight;
-                        dsvmul(mass*dweight_r, dr, mdw);
-                        copy_dvec(mdw, pdyna->mdw[pdyna->nat_loc]);
-                        /* Currently we only have the axial component of the
-                         * distance (inp) up to an unkown offset. We add this
-                         * offset after the reduction needs to determine the
-                         * COM of the cylinder group.
-                         */
-                        pdyna->dv[pdyna->nat_loc] = inp;
-                        for (m = 0; m < DIM; m++)
-                        {
-                            radf_fac0[m] += mdw[m];
-                            radf_fac1[m] += mdw[m]*inp;
-                        }
-                        pdyna->nat_loc++;
-                    }
-                }
+                comm->dbuf_cyl[c*stride + i] = 0;
             }
         }
-        comm->dbuf_cyl[c*stride+0] = wmass;
-        comm->dbuf_cyl[c*stride+1] = wwmass;
-        comm->dbuf_cyl[c*stride+2] = sum_a;
-        comm->dbuf_cyl[c*stride+3] = radf_fac0[XX];
-        comm->dbuf_cyl[c*stride+4] = radf_fac0[YY];
-        comm->dbuf_cyl[c*stride+5] = radf_fac0[ZZ];
-        comm->dbuf_cyl[c*stride+6] = radf_fac1[XX];
-        comm->dbuf_cyl[c*stride+7] = radf_fac1[YY];
-        comm->dbuf_cyl[c*stride+8] = radf_fac1[ZZ];
     }
 
     if (cr != nullptr && PAR(cr))
@@ -540,6 +553,85 @@ static void sum_com_part_cosweight(const pull_group_work_t *pgrp,
     sum_com->sum_smp = sum_smp;
 }
 
+/* Sums the local COM contributions of atoms ind_start to ind_end of
+ * group pgrp into the three elements of dbuf, in the layout of the buffer
+ * for the global COM reduction.
+ */
+static void sum_com_group_range(const pull_t *pull,
+                                const pull_group_work_t *pgrp,
+                                int ind_start, int ind_end,
+                                const rvec *x, const rvec *xp,
+                                const real *mass,
+                                const t_pbc *pbc,
+                                const rvec x_pbc,
+                                real twopi_box,
+                                dvec *dbuf)
+{
+    pull_sum_com_t sum_com;
+
+    if (pgrp->epgrppbc != epgrppbcCOS)
+    {
+        /* sum_com_part only sets sum_wmxp with xp != nullptr */
+        clear_dvec(sum_com.sum_wmxp);
+
+        /* If we have a single-atom group the mass is irrelevant, so
+         * we can remove the mass factor to avoid division by zero.
+         * Note that with constraint pulling the mass does matter, but
+         * in that case a check group mass != 0 has been done before.
+         */
+        if (pgrp->params.nat == 1 &&
+            pgrp->nat_loc == 1 &&
+            mass[pgrp->ind_loc[0]] == 0)
+        {
+            GMX_ASSERT(xp == NULL, "We should not have groups with zero mass with constraints, i.e. xp!=NULL");
+
+            /* Copy the single atom coordinate */
+            for (int d = 0; d < DIM; d++)
+            {
+                sum_com.sum_wmx[d] = x[pgrp->ind_loc[0]][d];
+            }
+            /* Set all mass factors to 1 to get the correct COM */
+            sum_com.sum_wm  = 1;
+            sum_com.sum_wwm = 1;
+        }
+        else
+        {
+            sum_com_part(pgrp, ind_start, ind_end,
+                         x, xp, mass,
+                         pbc, x_pbc,
+                         &sum_com);
+        }
+        if (pgrp->weight_loc == nullptr)
+        {
+            sum_com.sum_wwm = sum_com.sum_wm;
+        }
+
+        copy_dvec(sum_com.sum_wmx,  dbuf[0]);
+        copy_dvec(sum_com.sum_wmxp, dbuf[1]);
+        dbuf[2][0] = sum_com.sum_wm;
+        dbuf[2][1] = sum_com.sum_wwm;
+        dbuf[2][2] = 0;
+    }
+    else
+    {
+        /* Cosine weighting geometry */
+        sum_com_part_cosweight(pgrp, ind_start, ind_end,
+                               pull->cosdim, twopi_box,
+                               x, xp, mass,
+                               &sum_com);
+
+        dbuf[0][0] = sum_com.sum_cm;
+        dbuf[0][1] = sum_com.sum_sm;
+        dbuf[0][2] = 0;
+        dbuf[1][0] = sum_com.sum_ccm;
+        dbuf[1][1] = sum_com.sum_csm;
+        dbuf[1][2] = sum_com.sum_ssm;
+        dbuf[2][0] = sum_com.sum_cmp;
+        dbuf[2][1] = sum_com.sum_smp;
+        dbuf[2][2] = 0;
+    }
+}
+
 /* calculates center of mass of selection index from all coordinates x */
 void pull_calc_coms(const t_commrec *cr,
                     pull_t *pull,
@@ -596,133 +688,88 @@ void pull_calc_coms(const t_commrec *cr,
         twopi_box = 2.0*M_PI/pbc->box[pull->cosdim][pull->cosdim];
     }
 
+    /* We compute the local sums of all groups in a single pass over
+     * the concatenated local atom lists of the groups, divided evenly
+     * over the threads. This gives good load balance for any mix of
+     * group sizes, also with many small groups.
+     */
+    int numAtoms = 0;
     for (g = 0; g < pull->ngroup; g++)
     {
-        pull_group_work_t *pgrp;
-
-        pgrp = &pull->group[g];
-
-        if (pgrp->bCalcCOM)
+        if (pull->group[g].bCalcCOM)
         {
-            if (pgrp->epgrppbc != epgrppbcCOS)
-            {
-                rvec   x_pbc = { 0, 0, 0 };
-
-                if (pgrp->epgrppbc == epgrppbcREFAT)
-                {
-                    /* Set the pbc atom */
-                    copy_rvec(comm->rbuf[g], x_pbc);
-                }
+            numAtoms += pull->group[g].nat_loc;
+        }
+    }
 
-                /* The final sums should end up in sum_com[0] */
-                pull_sum_com_t *sum_com = &pull->sum_com[0];
+    /* Cosine weighting uses a slab of the system, thus we always have many
+     * atoms in the pull groups. Therefore, always use threads then.
+     */
+    int numThreads = pull->nthreads;
+    if (pull->cosdim < 0 && numAtoms <= c_pullMaxNumLocalAtomsSingleThreaded)
+    {
+        numThreads = 1;
+    }
 
-                /* If we have a single-atom group the mass is irrelevant, so
-                 * we can remove the mass factor to avoid division by zero.
-                 * Note that with constraint pulling the mass does matter, but
-                 * in that case a check group mass != 0 has been done before.
-                 */
-                if (pgrp->params.nat == 1 &&
-                    pgrp->nat_loc == 1 &&
-                    md->massT[pgrp->ind_loc[0]] == 0)
-                {
-                    GMX_ASSERT(xp == NULL, "We should not have groups with zero mass with constraints, i.e. xp!=NULL");
+    const int numElements = 3*pull->ngroup;
 
-                    /* Copy the single atom coordinate */
-                    for (int d = 0; d < DIM; d++)
-                    {
-                        sum_com->sum_wmx[d] = x[pgrp->ind_loc[0]][d];
-                    }
-                    /* Set all mass factors to 1 to get the correct COM */
-                    sum_com->sum_wm  = 1;
-                    sum_com->sum_wwm = 1;
-                }
-                else if (pgrp->nat_loc <= c_pullMaxNumLocalAtomsSingleThreaded)
-                {
-                    sum_com_part(pgrp, 0, pgrp->nat_loc,
-                                 x, xp, md->massT,
-                                 pbc, x_pbc,
-                                 sum_com);
-                }
-                else
-                {
-#pragma omp parallel for num_threads(pull->nthreads) schedule(static)
-                    for (int t = 0; t < pull->nthreads; t++)
-                    {
-                        int ind_start = (pgrp->nat_loc*(t + 0))/pull->nthreads;
-                        int ind_end   = (pgrp->nat_loc*(t + 1))/pull->nthreads;
-                        sum_com_part(pgrp, ind_start, ind_end,
-                                     x, xp, md->massT,
-                                     pbc, x_pbc,
-                                     &pull->sum_com[t]);
-                    }
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int th = 0; th < numThreads; th++)
+    {
+        /* Thread 0 sums directly into the communication buffer */
+        dvec *dbuf      = (th == 0 ? comm->dbuf : pull->sum_com_thread + (th - 1)*numElements);
+        int   atomStart = (numAtoms*(th + 0))/numThreads;
+        int   atomEnd   = (numAtoms*(th + 1))/numThreads;
+        int   offset    = 0;
 
-                    /* Reduce the thread contributions to sum_com[0] */
-                    for (int t = 1; t < pull->nthreads; t++)
-                    {
-                        sum_com->sum_wm  += pull->sum_com[t].sum_wm;
-                        sum_com->sum_wwm += pull->sum_com[t].sum_wwm;
-                        dvec_inc(sum_com->sum_wmx, pull->sum_com[t].sum_wmx);
-                        dvec_inc(sum_com->sum_wmxp, pull->sum_com[t].sum_wmxp);
-                    }
-                }
+        for (int g = 0; g < pull->ngroup; g++)
+        {
+            const pull_group_work_t *pgrp = &pull->group[g];
 
-                if (pgrp->weight_loc == nullptr)
-                {
-                    sum_com->sum_wwm = sum_com->sum_wm;
-                }
+            clear_dvec(dbuf[g*3    ]);
+            clear_dvec(dbuf[g*3 + 1]);
+            clear_dvec(dbuf[g*3 + 2]);
 
-                /* Copy local sums to a buffer for global summing */
-                copy_dvec(sum_com->sum_wmx,  comm->dbuf[g*3]);
-                copy_dvec(sum_com->sum_wmxp, comm->dbuf[g*3 + 1]);
-                comm->dbuf[g*3 + 2][0] = sum_com->sum_wm;
-                comm->dbuf[g*3 + 2][1] = sum_com->sum_wwm;
-                comm->dbuf[g*3 + 2][2] = 0;
+            if (!pgrp->bCalcCOM)
+            {
+                continue;
             }
-            else
+
+            int ind_start = std::max(atomStart - offset, 0);
+            int ind_end   = std::min(atomEnd - offset, pgrp->nat_loc);
+            if (ind_start < ind_end)
             {
-                /* Cosine weighting geometry.
-                 * This uses a slab of the system, thus we always have many
-                 * atoms in the pull groups. Therefore, always use threads.
-                 */
-#pragma omp parallel for num_threads(pull->nthreads) schedule(static)
-                for (int t = 0; t < pull->nthreads; t++)
-                {
-                    int ind_start = (pgrp->nat_loc*(t + 0))/pull->nthreads;
-                    int ind_end   = (pgrp->nat_loc*(t + 1))/pull->nthreads;
-                    sum_com_part_cosweight(pgrp, ind_start, ind_end,
-                                           pull->cosdim, twopi_box,
-                                           x, xp, md->massT,
-                                           &pull->sum_com[t]);
-                }
+                rvec x_pbc = { 0, 0, 0 };
 
-                /* Reduce the thread contributions to sum_com[0] */
-                pull_sum_com_t *sum_com = &pull->sum_com[0];
-                for (int t = 1; t < pull->nthreads; t++)
+                if (pgrp->epgrppbc == epgrppbcREFAT)
                 {
-                    sum_com->sum_cm  += pull->sum_com[t].sum_cm;
-                    sum_com->sum_sm  += pull->sum_com[t].sum_sm;
-                    sum_com->sum_ccm += pull->sum_com[t].sum_ccm;
-                    sum_com->sum_csm += pull->sum_com[t].sum_csm;
-                    sum_com->sum_ssm += pull->sum_com[t].sum_ssm;
-                    sum_com->sum_cmp += pull->sum_com[t].sum_cmp;
-                    sum_com->sum_smp += pull->sum_com[t].sum_smp;
+                    /* Set the pbc atom */
+                    copy_rvec(comm->rbuf[g], x_pbc);
                 }
 
-                /* Copy local sums to a buffer for global summing */
-                comm->dbuf[g*3    ][0] = sum_com->sum_cm;
-                comm->dbuf[g*3    ][1] = sum_com->sum_sm;
-                comm->dbuf[g*3    ][2] = 0;
-                comm->dbuf[g*3 + 1][0] = sum_com->sum_ccm;
-                comm->dbuf[g*3 + 1][1] = sum_com->sum_csm;
-                comm->dbuf[g*3 + 1][2] = sum_com->sum_ssm;
-                comm->dbuf[g*3 + 2][0] = sum_com->sum_cmp;
-                comm->dbuf[g*3 + 2][1] = sum_com->sum_smp;
-                comm->dbuf[g*3 + 2][2] = 0;
+                sum_com_group_range(pull, pgrp, ind_start, ind_end,
+                                    x, xp, md->massT,
+                                    pbc, x_pbc, twopi_box,
+                                    dbuf + g*3);
+            }
+            offset += pgrp->nat_loc;
+        }
+    }
+
+    if (numThreads > 1)
+    {
+        /* Reduce the thread contributions to the communication buffer */
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+        for (int i = 0; i < numElements; i++)
+        {
+            for (int th = 1; th < numThreads; th++)
+            {
+                dvec_inc(comm->dbuf[i], pull->sum_com_thread[(th - 1)*numElements + i]);
             }
         }
     }
 
+    /* A single reduction over the ranks for the sums of all groups */
     pullAllReduce(cr, comm, pull->ngroup*3*DIM, comm->dbuf[0]);
 
     for (g = 0; g < pull->ngroup; g++)
@@ -378,7 +378,6 @@ int get_nthreads_mpi(const gmx_hw_info_t    *hwinfo,
         // had to define a function that returns such requirements,
         // and a description string.
         SingleRankChecker checker;
-        checker.applyConstraint(inputrec->eI == eiLBFGS, "L-BFGS minimization");
         checker.applyConstraint(inputrec->coulombtype == eelEWALD, "Plain Ewald electrostatics");
         checker.applyConstraint(doMembed, "Membrane embedding");
         bool useOrientationRestraints = (gmx_mtop_ftype_count(mtop, F_ORIRES) > 0);
@@ -424,7 +423,7 @@ int get_nthreads_mpi(const gmx_hw_info_t    *hwinfo,
      * the group scheme, or is a rerun with energy groups. */
     ngpu = (nonbondedOnGpu ? static_cast<int>(gpuIdsToUse.size()) : 0);
 
-    if (inputrec->cutoff_scheme == ecutsGROUP)
+    if (inputrec->cutoff_scheme == ecutsGROUP && !EI_TPI(inputrec->eI))
     {
         /* We checked this before, but it doesn't hurt to do it once more */
         GMX_RELEASE_ASSERT(hw_opt->nthreads_omp == 1, "The group scheme only supports one OpenMP thread per rank");
@@ -779,10 +778,18 @@ void check_and_update_hw_opt_1(gmx_hw_opt_t    *hw_opt,
 }
 
 void check_and_update_hw_opt_2(gmx_hw_opt_t *hw_opt,
-                               int           cutoff_scheme)
+                               int           cutoff_scheme,
+                               int           integrator)
 {
     if (cutoff_scheme == ecutsGROUP)
     {
+        /* TPI computes insertion energies over OpenMP threads,
+         * but we only use them when requested explicitly.
+         */
+        if (EI_TPI(integrator) && hw_opt->nthreads_omp > 1)
+        {
+            return;
+        }
         /* We only have OpenMP support for PME only nodes */
         if (hw_opt->nthreads_omp > 1)
         {
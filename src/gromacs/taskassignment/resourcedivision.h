@@ -102,9 +102,10 @@ void check_and_update_hw_opt_1(gmx_hw_opt_t    *hw_opt,
                                const t_commrec *cr,
                                int              nPmeRanks);
 
-/*! \brief Checks we can do when we know the cut-off scheme */
+/*! \brief Checks we can do when we know the cut-off scheme and integrator */
 void check_and_update_hw_opt_2(gmx_hw_opt_t *hw_opt,
-                               int           cutoff_scheme);
+                               int           cutoff_scheme,
+                               int           integrator);
 
 /*! \brief Check, and if necessary update, the number of OpenMP threads requested
  *
@@ -349,6 +349,8 @@ int Mdrunner::mainFunction(int argc, char *argv[])
           "Number of random exchanges to carry out each exchange interval (N^3 is one suggestion).  -nex zero or not specified gives neighbor replica exchange." },
         { "-reseed",  FALSE, etINT, {&replExParams.randomSeed},
           "Seed for replica exchange, -1 is generate a seed" },
+        { "-exparams", FALSE, etBOOL, {&replExParams.swapParameters},
+          "Exchange the ensemble parameters between replicas instead of the coordinates and velocities, the ensemble of each replica is written to the log file" },
         { "-imdport",    FALSE, etINT, {&imdOptions.port},
           "HIDDENIMD listening port" },
         { "-imdwait",  FALSE, etBOOL, {&imdOptions.wait},
@@ -359,6 +361,8 @@ int Mdrunner::mainFunction(int argc, char *argv[])
           "HIDDENAllow pulling in the simulation from IMD client" },
         { "-rerunvsite", FALSE, etBOOL, {&mdrunOptions.rerunConstructVsites},
           "HIDDENRecalculate virtual site coordinates with [TT]-rerun[tt]" },
+        { "-awhsharefullgrid", FALSE, etBOOL, {&mdrunOptions.awhShareFullGrid},
+          "HIDDENWith AWH bias sharing, sum the data of all points instead of only the sampled ones, for testing" },
         { "-confout", FALSE, etBOOL, {&mdrunOptions.writeConfout},
           "HIDDENWrite the last configuration with [TT]-c[tt] and force checkpointing at the last step" },
         { "-stepout", FALSE, etINT, {&mdrunOptions.verboseStepPrintInterval},
@@ -443,6 +447,11 @@ int Mdrunner::mainFunction(int argc, char *argv[])
         gmx_fatal(FARGS, "Replica exchange number of exchanges needs to be positive");
     }
 
+    if (replExParams.swapParameters && replExParams.exchangeInterval == 0)
+    {
+        gmx_fatal(FARGS, "Exchanging the ensemble parameters (-exparams) requires replica exchange (-replex)");
+    }
+
     ms = init_multisystem(MPI_COMM_WORLD, multidir);
 
     /* Prepare the intra-simulation communication */
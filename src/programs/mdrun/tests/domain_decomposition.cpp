@@ -42,12 +42,20 @@
  */
 #include "gmxpre.h"
 
+#include "config.h"
+
+#include <cmath>
+#include <cstdlib>
+
 #include <string>
 
 #include <gtest/gtest.h>
 
 #include "testutils/cmdlinetest.h"
+#include "testutils/mpitest.h"
+#include "testutils/testasserts.h"
 
+#include "energyreader.h"
 #include "moduletest.h"
 
 namespace
@@ -74,4 +82,110 @@ TEST_F(DomainDecompositionSpecialCasesTest, AnEmptyDomainWorks)
     ASSERT_EQ(0, runner_.callMdrun());
 }
 
+//! Returns the potential energy of the last frame in the energy file \p edrFileName
+real lastPotentialEnergy(const std::string &edrFileName)
+{
+    auto energyReader = gmx::test::openEnergyFileToReadFields(edrFileName, {"Potential"});
+    real potential    = 0;
+    int  numFrames    = 0;
+    while (energyReader->readNextFrame())
+    {
+        potential = energyReader->frame().at("Potential");
+        numFrames++;
+    }
+    EXPECT_GT(numFrames, 0) << "no energy frames in " << edrFileName;
+
+    return potential;
+}
+
+/*! \brief Ensures that L-BFGS minimization, which keeps per-atom memory vectors in the state, works with domain decomposition
+ *
+ * With thread-MPI, the final potential energy is compared with
+ * a minimization of the same input on one rank. With library MPI
+ * all test ranks take part in the run, so only the decomposed run
+ * is checked.
+ */
+TEST_F(DomainDecompositionSpecialCasesTest, LbfgsMinimizationWorks)
+{
+    runner_.useStringAsMdpFile("integrator = l-bfgs\n"
+                               "nsteps = 10\n"
+                               "cutoff-scheme = group\n"
+                               "coulombtype = reaction-field\n"
+                               "vdwtype = shift\n"
+                               "rvdw-switch = 0.7\n"
+                               "rvdw = 0.9\n"
+                               "rcoulomb = 0.9\n"
+                               "rlist = 0.9\n");
+    runner_.useTopGroAndNdxFromDatabase("argon5832");
+    ASSERT_EQ(0, runner_.callGrompp());
+
+    ASSERT_EQ(0, runner_.callMdrun());
+
+#if GMX_THREAD_MPI
+    if (gmx::test::getNumberOfTestMpiRanks() > 1)
+    {
+        const real ddPotential = lastPotentialEnergy(runner_.edrFileName_);
+
+        runner_.edrFileName_ = fileManager_.getTemporaryFilePath("serial.edr");
+        ::gmx::test::CommandLine caller;
+        caller.addOption("-ntmpi", 1);
+        ASSERT_EQ(0, runner_.callMdrun(caller));
+        const real serialPotential = lastPotentialEnergy(runner_.edrFileName_);
+
+        /* The force summation order differs with DD, which slightly
+         * changes the L-BFGS steps, so we can not expect exact agreement.
+         */
+        EXPECT_REAL_EQ_TOL(serialPotential, ddPotential, gmx::test::relativeToleranceAsFloatingPoint(std::abs(serialPotential), 1e-5));
+    }
+#endif
+}
+
+//! Ensures that incremental updates of the local bonded interactions match a full assignment
+TEST_F(DomainDecompositionSpecialCasesTest, IncrementalLocalTopologyMatchesFullAssignment)
+{
+    /* With GMX_DD_DEBUG set, domain decomposition compares every
+     * incremental update of the local bonded interactions with
+     * a full assignment and exits with a fatal error on mismatch.
+     * The system has position restraints and bonded interactions
+     * crossing the domain boundaries. With two domains along z,
+     * the cells are large enough that no distance checks are needed,
+     * which is required for the incremental update.
+     */
+    if (gmx::test::getNumberOfTestMpiRanks() != 2)
+    {
+        return;
+    }
+#if GMX_NATIVE_WINDOWS
+    _putenv_s("GMX_DD_DEBUG", "1");
+#else
+    setenv("GMX_DD_DEBUG", "1", 1);
+#endif
+    runner_.useStringAsMdpFile("dt = 0.002\n"
+                               "nsteps = 40\n"
+                               "nstlist = 10\n"
+                               "define = -DPOSRES\n"
+                               "tcoupl = v-rescale\n"
+                               "tc-grps = System\n"
+                               "tau-t = 0.1\n"
+                               "ref-t = 300\n"
+                               "gen-vel = yes\n"
+                               "constraints = h-bonds\n"
+                               "cutoff-scheme = Verlet\n");
+    runner_.useTopGroAndNdxFromDatabase("OctaneSandwich");
+    ASSERT_EQ(0, runner_.callGrompp());
+
+    ::gmx::test::CommandLine caller;
+    caller.append("-dd");
+    caller.append("1");
+    caller.append("1");
+    caller.append("2");
+    int returnValue = runner_.callMdrun(caller);
+#if GMX_NATIVE_WINDOWS
+    _putenv_s("GMX_DD_DEBUG", "");
+#else
+    unsetenv("GMX_DD_DEBUG");
+#endif
+    ASSERT_EQ(0, returnValue);
+}
+
 } // namespace
@@ -238,7 +238,10 @@ SimulationRunner::callMdrun(const CommandLine &callerRef)
     }
 
 #if GMX_THREAD_MPI
-    caller.addOption("-ntmpi", getNumberOfTestMpiRanks());
+    if (!caller.contains("-ntmpi"))
+    {
+        caller.addOption("-ntmpi", getNumberOfTestMpiRanks());
+    }
 #endif
 
 #if GMX_OPENMP
@@ -44,8 +44,22 @@
 
 #include "config.h"
 
+#include <cmath>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <gtest/gtest.h>
 
+#include "gromacs/fileio/enxio.h"
+#include "gromacs/fileio/xdr_datatype.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/stringutil.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/testasserts.h"
+
 #include "multisimtest.h"
 
 namespace gmx
@@ -107,6 +121,167 @@ INSTANTIATE_TEST_CASE_P(DISABLED_InNvt, MultiSimTest,
                             ::testing::Values("pcoupl = no"));
 #endif
 
+//! Convenience typedef
+typedef MultiSimTest MultiSimAwhSharingTest;
+
+/* This test ensures mdrun can run multi-simulations that share an AWH
+ * bias. The shared update exchanges the histograms of the points sampled
+ * by any simulation, so all simulations need to do the same number of
+ * updates, which we get with a sample and update at every step.
+ */
+TEST_P(MultiSimAwhSharingTest, ExitsNormally)
+{
+    if (size_ <= 1)
+    {
+        /* Can't test multi-sim without multiple ranks. */
+        return;
+    }
+    SimulationRunner runner(&fileManager_);
+    runner.useTopGroAndNdxFromDatabase("spc2");
+
+    const char *awhParams = GetParam();
+    organizeMdpFile(&runner, awhParams, 20);
+    /* Call grompp on every rank - the standard callGrompp() only runs
+       grompp on rank 0. */
+    EXPECT_EQ(0, runner.callGromppOnThisRank());
+
+    ASSERT_EQ(0, runner.callMdrun(*mdrunCaller_));
+}
+
+namespace
+{
+
+/*! \brief Returns the AWH data of the last frame with AWH output in an energy file
+ *
+ * This contains all AWH output, including the PMF, the target
+ * distribution and the weight and visit histograms.
+ */
+std::vector<float> readLastAwhData(const std::string &edrFileName)
+{
+    ener_file_t        energyFile = open_enx(edrFileName.c_str(), "r");
+    int                numTerms;
+    gmx_enxnm_t       *termNames = nullptr;
+    t_enxframe         frame;
+    std::vector<float> awhData;
+
+    do_enxnms(energyFile, &numTerms, &termNames);
+    free_enxnms(numTerms, termNames);
+    init_enxframe(&frame);
+    while (do_enx(energyFile, &frame))
+    {
+        const t_enxblock *block = find_block_id_enxframe(&frame, enxAWH, nullptr);
+        if (block != nullptr)
+        {
+            awhData.clear();
+            for (int s = 0; s < block->nsub; s++)
+            {
+                GMX_RELEASE_ASSERT(block->sub[s].type == xdr_datatype_float, "AWH output should be stored in float");
+                awhData.insert(awhData.end(), block->sub[s].fval, block->sub[s].fval + block->sub[s].nr);
+            }
+        }
+    }
+    free_enxframe(&frame);
+    close_enx(energyFile);
+
+    return awhData;
+}
+
+}   // namespace
+
+/* This test checks that summing only the points sampled by any of the
+ * simulations gives the same AWH output as summing the whole grid,
+ * which the hidden mdrun option -awhsharefullgrid selects. The two only differ in
+ * rounding of the PMF of points that were not sampled.
+ */
+TEST_P(MultiSimAwhSharingTest, SharingSampledPointsMatchesSharingFullGrid)
+{
+    if (size_ <= 1)
+    {
+        /* Can't test multi-sim without multiple ranks. */
+        return;
+    }
+    SimulationRunner runner(&fileManager_);
+    runner.useTopGroAndNdxFromDatabase("spc2");
+
+    /* Start every other simulation with the second molecule shifted,
+     * so the simulations sample different, partially overlapping,
+     * parts of the AWH grid.
+     */
+    const real shift = 0.3*(rank_ % 2);
+    runner.groFileName_ = fileManager_.getTemporaryFilePath("start.gro");
+    TextWriter::writeFileFromString(runner.groFileName_,
+                                    formatString("Two SPC water molecules\n"
+                                                 "    6\n"
+                                                 "    1SOL     OW    1   0.569   1.275   1.165\n"
+                                                 "    1SOL    HW1    2   0.476   1.268   1.128\n"
+                                                 "    1SOL    HW2    3   0.580   1.364   1.209\n"
+                                                 "    2SOL     OW    4%8.3f   1.511   0.703\n"
+                                                 "    2SOL    HW1    5%8.3f   1.495   0.784\n"
+                                                 "    2SOL    HW2    6%8.3f   1.521   0.623\n"
+                                                 "   3.01000   3.01000   3.01000\n",
+                                                 1.555 + shift, 1.498 + shift, 1.496 + shift));
+
+    const char *awhParams = GetParam();
+    organizeMdpFile(&runner, awhParams, 20);
+    /* Call grompp on every rank - the standard callGrompp() only runs
+       grompp on rank 0. */
+    EXPECT_EQ(0, runner.callGromppOnThisRank());
+
+    ASSERT_EQ(0, runner.callMdrun(*mdrunCaller_));
+    std::vector<float> awhDataSampledPoints = readLastAwhData(runner.edrFileName_);
+
+    runner.edrFileName_ = fileManager_.getTemporaryFilePath("fullgrid.edr");
+    CommandLine fullGridCaller(*mdrunCaller_);
+    fullGridCaller.append("-awhsharefullgrid");
+    ASSERT_EQ(0, runner.callMdrun(fullGridCaller));
+    std::vector<float> awhDataFullGrid = readLastAwhData(runner.edrFileName_);
+
+    ASSERT_FALSE(awhDataFullGrid.empty()) << "The energy file should contain AWH output";
+    ASSERT_EQ(awhDataFullGrid.size(), awhDataSampledPoints.size());
+    for (size_t i = 0; i < awhDataFullGrid.size(); i++)
+    {
+        const FloatingPointTolerance tolerance =
+            relativeToleranceAsFloatingPoint(std::max(std::abs(awhDataFullGrid[i]), 1.0f), 1e-5);
+        EXPECT_FLOAT_EQ_TOL(awhDataFullGrid[i], awhDataSampledPoints[i], tolerance) << "AWH output element " << i;
+    }
+}
+
+//! AWH bias on the distance between the two water molecules, shared over the simulations
+const char *g_awhSharingMdp =
+    "nstenergy = 10\n"
+    "pull = yes\n"
+    "pull-ngroups = 2\n"
+    "pull-ncoords = 1\n"
+    "pull-group1-name = FirstWaterMolecule\n"
+    "pull-group2-name = SecondWaterMolecule\n"
+    "pull-coord1-groups = 1 2\n"
+    "pull-coord1-type = external-potential\n"
+    "pull-coord1-potential-provider = awh\n"
+    "pull-coord1-geometry = distance\n"
+    "awh = yes\n"
+    "awh-nstsample = 1\n"
+    "awh-nsamples-update = 1\n"
+    "awh-nstout = 10\n"
+    "awh-share-multisim = yes\n"
+    "awh-nbias = 1\n"
+    "awh1-share-group = 1\n"
+    "awh1-error-init = 5\n"
+    "awh1-ndim = 1\n"
+    "awh1-dim1-coord-index = 1\n"
+    "awh1-dim1-start = 0.8\n"
+    "awh1-dim1-end = 1.5\n"
+    "awh1-dim1-force-constant = 1000\n"
+    "awh1-dim1-diffusion = 0.1\n";
+
+#if GMX_LIB_MPI
+INSTANTIATE_TEST_CASE_P(InNvt, MultiSimAwhSharingTest,
+                            ::testing::Values(g_awhSharingMdp));
+#else
+// Test needs real MPI to run
+INSTANTIATE_TEST_CASE_P(DISABLED_InNvt, MultiSimAwhSharingTest,
+                            ::testing::Values(g_awhSharingMdp));
+#endif
+
 //! Convenience typedef
 typedef MultiSimTest MultiSimTerminationTest;
 
@@ -86,5 +86,30 @@ TEST_F(ReplicaExchangeTerminationTest, WritesCheckpointAfterMaxhTerminationAndTh
     runMaxhTest();
 }
 
+//! Convenience typedef
+typedef MultiSimTest ReplicaExchangeParameterSwapTest;
+
+TEST_P(ReplicaExchangeParameterSwapTest, ExitsNormally)
+{
+    mdrunCaller_->addOption("-replex", 1);
+    mdrunCaller_->addOption("-exparams");
+    runExitsNormallyTest();
+}
+
+#if GMX_LIB_MPI
+INSTANTIATE_TEST_CASE_P(WithDifferentControlVariables, ReplicaExchangeParameterSwapTest,
+                            ::testing::Values("pcoupl = no", "pcoupl = Berendsen"));
+#else
+INSTANTIATE_TEST_CASE_P(DISABLED_WithDifferentControlVariables, ReplicaExchangeParameterSwapTest,
+                            ::testing::Values("pcoupl = no", "pcoupl = Berendsen"));
+#endif
+
+TEST_F(ReplicaExchangeTerminationTest, WithParameterSwapWritesCheckpointAfterMaxhTerminationAndThenRestarts)
+{
+    mdrunCaller_->addOption("-replex", 1);
+    mdrunCaller_->addOption("-exparams");
+    runMaxhTest();
+}
+
 } // namespace
 } // namespace